@@ -0,0 +1,167 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef EVQ_H
+#define EVQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * \file
+ * Single-producer / single-consumer queue of timed port writes.
+ *
+ * The producer (e.g., the VGM decoder running in the foreground) only ever
+ * writes \c tail, and the consumer (e.g., the timer interrupt handler) only
+ * ever writes \c head. Neither side needs to disable interrupts or take a
+ * lock.
+ *
+ * \c head and \c tail are free-running 16-bit counters. They are masked to
+ * index the ring, and their difference is the number of queued events. This
+ * works as long as \c EVQ_SIZE is a power of two that is at most 32768.
+ *
+ * On the 8088, a 16-bit store to memory is a single instruction. Even though
+ * the 8-bit bus splits it into two bus cycles, an interrupt can never observe
+ * a half-written index. On a multiprocessor host, the index updates need
+ * acquire / release ordering so that the event data is visible before the
+ * index that publishes it.
+ */
+
+#ifndef EVQ_SIZE
+#define EVQ_SIZE 256u
+#endif
+
+#if (EVQ_SIZE & (EVQ_SIZE - 1)) != 0 || EVQ_SIZE > 32768u
+#error "EVQ_SIZE must be a power of two that is at most 32768."
+#endif
+
+#if defined(__GNUC__)
+#define EVQ_LOAD_ACQUIRE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define EVQ_STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+/* Single CPU. Since the indices and the events are all volatile, the
+ * compiler cannot reorder the accesses.
+ */
+#define EVQ_LOAD_ACQUIRE(x) (x)
+#define EVQ_STORE_RELEASE(x, v) ((x) = (v))
+#endif
+
+struct evq_event {
+    /** Time to wait after this write, in units chosen by the user. */
+    uint16_t delay;
+
+    /** I/O port to write. Zero means the event is only a delay. */
+    uint16_t port;
+
+    uint8_t value;
+};
+
+struct evq {
+    /** Index of the next event to consume. Only written by the consumer. */
+    volatile uint16_t head;
+
+    /** Index of the next free slot. Only written by the producer. */
+    volatile uint16_t tail;
+
+    /** Most events ever queued. Only written by the producer. */
+    uint16_t high_water;
+
+    /**
+     * Fewest events ever queued when the consumer took an event. Only
+     * written by the consumer. A value near zero means the producer is
+     * barely keeping up.
+     */
+    uint16_t low_water;
+
+    volatile struct evq_event events[EVQ_SIZE];
+};
+
+static inline void
+evq_init(struct evq *q)
+{
+    q->head = 0;
+    q->tail = 0;
+    q->high_water = 0;
+    q->low_water = EVQ_SIZE;
+}
+
+/**
+ * Number of events in the queue.
+ *
+ * From the producer, the result is a lower bound. From the consumer, the
+ * result is an upper bound on the free space.
+ */
+static inline uint16_t
+evq_count(const struct evq *q)
+{
+    return (uint16_t)(q->tail - q->head);
+}
+
+/**
+ * Add an event to the queue.
+ *
+ * May only be called by the producer.
+ *
+ * \return
+ * False if the queue is full.
+ */
+static inline bool
+evq_push(struct evq *q, uint16_t delay, uint16_t port, uint8_t value)
+{
+    const uint16_t tail = q->tail;
+    const uint16_t count = (uint16_t)(tail - EVQ_LOAD_ACQUIRE(q->head));
+
+    if (count >= EVQ_SIZE)
+        return false;
+
+    volatile struct evq_event *const e = &q->events[tail & (EVQ_SIZE - 1)];
+
+    e->delay = delay;
+    e->port = port;
+    e->value = value;
+
+    EVQ_STORE_RELEASE(q->tail, (uint16_t)(tail + 1));
+
+    if (count + 1 > q->high_water)
+        q->high_water = count + 1;
+
+    return true;
+}
+
+/**
+ * Get the oldest event in the queue without removing it.
+ *
+ * May only be called by the consumer.
+ *
+ * \return
+ * NULL if the queue is empty.
+ */
+static inline volatile struct evq_event *
+evq_peek(struct evq *q)
+{
+    const uint16_t head = q->head;
+    const uint16_t count = (uint16_t)(EVQ_LOAD_ACQUIRE(q->tail) - head);
+
+    if (count == 0)
+        return NULL;
+
+    if (count < q->low_water)
+        q->low_water = count;
+
+    return &q->events[head & (EVQ_SIZE - 1)];
+}
+
+/**
+ * Remove the event previously returned by \c evq_peek.
+ *
+ * May only be called by the consumer.
+ */
+static inline void
+evq_pop(struct evq *q)
+{
+    EVQ_STORE_RELEASE(q->head, (uint16_t)(q->head + 1));
+}
+
+#endif /* ifndef EVQ_H */
@@ -0,0 +1,1472 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "emu86.h"
+
+/* Decoded ModR/M byte. For a memory operand, seg:off is the address. */
+struct modrm {
+    uint8_t mod;
+    uint8_t reg;
+    uint8_t rm;
+    uint16_t seg;
+    uint16_t off;
+};
+
+/* State of the instruction being run. */
+struct insn {
+    /* Segment override, or -1 for none. */
+    int seg;
+
+    /* 0xf2 or 0xf3 for a repeat prefix, or zero. */
+    uint8_t rep;
+};
+
+static const uint8_t parity[256] = {
+#define P2(n) n, n ^ 1, n ^ 1, n
+#define P4(n) P2(n), P2(n ^ 1), P2(n ^ 1), P2(n)
+#define P6(n) P4(n), P4(n ^ 1), P4(n ^ 1), P4(n)
+    P6(1), P6(0), P6(0), P6(1)
+#undef P6
+#undef P4
+#undef P2
+};
+
+void
+emu86_reset(struct emu86 *cpu)
+{
+    memset(cpu->regs, 0, sizeof(cpu->regs));
+    memset(cpu->sregs, 0, sizeof(cpu->sregs));
+    memset(cpu->op_count, 0, sizeof(cpu->op_count));
+    memset(cpu->op_cycles, 0, sizeof(cpu->op_cycles));
+
+    cpu->sregs[CS] = 0xffff;
+    cpu->ip = 0;
+
+    /* Bits 12 through 15 always read as set on an 8086. Code that tells an
+     * 8086 from a 286 depends on it.
+     */
+    cpu->flags = 0xf002;
+    cpu->cycles = 0;
+    cpu->instructions = 0;
+    cpu->status = EMU86_RUNNING;
+}
+
+void
+emu86_stop(struct emu86 *cpu)
+{
+    if (cpu->status == EMU86_RUNNING)
+        cpu->status = EMU86_STOPPED;
+}
+
+static uint8_t
+fetch8(struct emu86 *cpu)
+{
+    return emu86_read8(cpu, cpu->sregs[CS], cpu->ip++);
+}
+
+static uint16_t
+fetch16(struct emu86 *cpu)
+{
+    const uint16_t v = emu86_read16(cpu, cpu->sregs[CS], cpu->ip);
+
+    cpu->ip += 2;
+    return v;
+}
+
+/* Memory accesses made by an instruction. A word costs an extra bus cycle
+ * on an 8088.
+ */
+static uint8_t
+mem_read8(struct emu86 *cpu, uint16_t seg, uint16_t off)
+{
+    return emu86_read8(cpu, seg, off);
+}
+
+static uint16_t
+mem_read16(struct emu86 *cpu, uint16_t seg, uint16_t off)
+{
+    if (cpu->bus8)
+        cpu->cycles += 4;
+
+    return emu86_read16(cpu, seg, off);
+}
+
+static void
+mem_write8(struct emu86 *cpu, uint16_t seg, uint16_t off, uint8_t value)
+{
+    emu86_write8(cpu, seg, off, value);
+}
+
+static void
+mem_write16(struct emu86 *cpu, uint16_t seg, uint16_t off, uint16_t value)
+{
+    if (cpu->bus8)
+        cpu->cycles += 4;
+
+    emu86_write16(cpu, seg, off, value);
+}
+
+static void
+push(struct emu86 *cpu, uint16_t value)
+{
+    cpu->regs[SP] -= 2;
+    mem_write16(cpu, cpu->sregs[SS], cpu->regs[SP], value);
+}
+
+static uint16_t
+pop(struct emu86 *cpu)
+{
+    const uint16_t v = mem_read16(cpu, cpu->sregs[SS], cpu->regs[SP]);
+
+    cpu->regs[SP] += 2;
+    return v;
+}
+
+static uint8_t
+get_reg8(const struct emu86 *cpu, unsigned r)
+{
+    return r < 4 ? cpu->regs[r] & 0xff : cpu->regs[r - 4] >> 8;
+}
+
+static void
+set_reg8(struct emu86 *cpu, unsigned r, uint8_t value)
+{
+    if (r < 4)
+        cpu->regs[r] = (cpu->regs[r] & 0xff00) | value;
+    else
+        cpu->regs[r - 4] = (cpu->regs[r - 4] & 0x00ff) | (value << 8);
+}
+
+static void
+set_flag(struct emu86 *cpu, uint16_t flag, bool set)
+{
+    if (set)
+        cpu->flags |= flag;
+    else
+        cpu->flags &= ~flag;
+}
+
+static bool
+flag(const struct emu86 *cpu, uint16_t flag)
+{
+    return (cpu->flags & flag) != 0;
+}
+
+/**
+ * Decode a ModR/M byte and charge the effective address time.
+ */
+static void
+decode_modrm(struct emu86 *cpu, const struct insn *in, struct modrm *m)
+{
+    /* Clocks to calculate each effective address, for mod 0 and for mod 1
+     * or 2. The direct address (mod 0, r/m 6) takes 6.
+     */
+    static const uint8_t ea_clocks[2][8] = {
+        { 7, 8, 8, 7, 5, 5, 6, 5 },
+        { 11, 12, 12, 11, 9, 9, 9, 9 },
+    };
+    const uint8_t b = fetch8(cpu);
+    uint16_t off;
+    int seg = DS;
+
+    m->mod = b >> 6;
+    m->reg = (b >> 3) & 7;
+    m->rm = b & 7;
+
+    if (m->mod == 3)
+        return;
+
+    switch (m->rm) {
+    case 0: off = cpu->regs[BX] + cpu->regs[SI]; break;
+    case 1: off = cpu->regs[BX] + cpu->regs[DI]; break;
+    case 2: off = cpu->regs[BP] + cpu->regs[SI]; seg = SS; break;
+    case 3: off = cpu->regs[BP] + cpu->regs[DI]; seg = SS; break;
+    case 4: off = cpu->regs[SI]; break;
+    case 5: off = cpu->regs[DI]; break;
+    case 6: off = cpu->regs[BP]; seg = SS; break;
+    default: off = cpu->regs[BX]; break;
+    }
+
+    if (m->mod == 0 && m->rm == 6) {
+        off = fetch16(cpu);
+        seg = DS;
+    } else if (m->mod == 1) {
+        off += (int8_t) fetch8(cpu);
+    } else if (m->mod == 2) {
+        off += fetch16(cpu);
+    }
+
+    cpu->cycles += ea_clocks[m->mod != 0][m->rm];
+
+    m->seg = cpu->sregs[in->seg >= 0 ? in->seg : seg];
+    m->off = off;
+}
+
+static uint8_t
+get_rm8(struct emu86 *cpu, const struct modrm *m)
+{
+    return m->mod == 3
+        ? get_reg8(cpu, m->rm) : mem_read8(cpu, m->seg, m->off);
+}
+
+static uint16_t
+get_rm16(struct emu86 *cpu, const struct modrm *m)
+{
+    return m->mod == 3
+        ? cpu->regs[m->rm] : mem_read16(cpu, m->seg, m->off);
+}
+
+static void
+set_rm8(struct emu86 *cpu, const struct modrm *m, uint8_t value)
+{
+    if (m->mod == 3)
+        set_reg8(cpu, m->rm, value);
+    else
+        mem_write8(cpu, m->seg, m->off, value);
+}
+
+static void
+set_rm16(struct emu86 *cpu, const struct modrm *m, uint16_t value)
+{
+    if (m->mod == 3)
+        cpu->regs[m->rm] = value;
+    else
+        mem_write16(cpu, m->seg, m->off, value);
+}
+
+/**
+ * Set SF, ZF, and PF from a result.
+ *
+ * \param w True for a word result.
+ */
+static void
+set_szp(struct emu86 *cpu, uint16_t r, bool w)
+{
+    const uint16_t sign = w ? 0x8000 : 0x80;
+
+    if (!w)
+        r &= 0xff;
+
+    set_flag(cpu, EMU86_SF, (r & sign) != 0);
+    set_flag(cpu, EMU86_ZF, r == 0);
+    set_flag(cpu, EMU86_PF, parity[r & 0xff]);
+}
+
+enum alu_op { ALU_ADD, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR,
+              ALU_CMP };
+
+/**
+ * Perform one of the eight arithmetic operations selected by bits 3 through
+ * 5 of the opcode, and set the flags.
+ *
+ * \return
+ * The result. For \c ALU_CMP the caller must not store it.
+ */
+static uint16_t
+alu(struct emu86 *cpu, enum alu_op op, uint16_t a, uint16_t b, bool w)
+{
+    const uint32_t mask = w ? 0xffff : 0xff;
+    const uint32_t sign = w ? 0x8000 : 0x80;
+    uint32_t r;
+
+    switch (op) {
+    case ALU_ADD:
+    case ALU_ADC: {
+        const uint32_t c = op == ALU_ADC && flag(cpu, EMU86_CF);
+
+        r = (uint32_t) a + b + c;
+        set_flag(cpu, EMU86_CF, r > mask);
+        set_flag(cpu, EMU86_OF, ((a ^ r) & (b ^ r) & sign) != 0);
+        set_flag(cpu, EMU86_AF, ((a ^ b ^ r) & 0x10) != 0);
+        break;
+    }
+
+    case ALU_SUB:
+    case ALU_SBB:
+    case ALU_CMP: {
+        const uint32_t c = op == ALU_SBB && flag(cpu, EMU86_CF);
+
+        r = ((uint32_t) a - b - c) & 0x1ffff;
+        set_flag(cpu, EMU86_CF, (uint32_t) a < (uint32_t) b + c);
+        set_flag(cpu, EMU86_OF, ((a ^ b) & (a ^ r) & sign) != 0);
+        set_flag(cpu, EMU86_AF, ((a ^ b ^ r) & 0x10) != 0);
+        break;
+    }
+
+    case ALU_OR:  r = a | b; goto logic;
+    case ALU_AND: r = a & b; goto logic;
+    default:      r = a ^ b;
+    logic:
+        set_flag(cpu, EMU86_CF, false);
+        set_flag(cpu, EMU86_OF, false);
+        set_flag(cpu, EMU86_AF, false);
+        break;
+    }
+
+    r &= mask;
+    set_szp(cpu, r, w);
+    return r;
+}
+
+static uint16_t
+inc_dec(struct emu86 *cpu, uint16_t a, bool dec, bool w)
+{
+    /* INC and DEC leave CF alone. */
+    const bool cf = flag(cpu, EMU86_CF);
+    const uint16_t r = alu(cpu, dec ? ALU_SUB : ALU_ADD, a, 1, w);
+
+    set_flag(cpu, EMU86_CF, cf);
+    return r;
+}
+
+/**
+ * One of the rotates or shifts selected by the reg field of opcodes d0
+ * through d3.
+ */
+static uint16_t
+shift(struct emu86 *cpu, unsigned op, uint16_t a, unsigned count, bool w)
+{
+    const uint16_t sign = w ? 0x8000 : 0x80;
+    const uint16_t mask = w ? 0xffff : 0xff;
+    uint32_t r = a;
+
+    if (count == 0)
+        return a;
+
+    for (unsigned i = 0; i < count; i++) {
+        bool cf;
+
+        switch (op) {
+        case 0:                 /* ROL */
+            cf = (r & sign) != 0;
+            r = ((r << 1) | cf) & mask;
+            break;
+        case 1:                 /* ROR */
+            cf = (r & 1) != 0;
+            r = (r >> 1) | (cf ? sign : 0);
+            break;
+        case 2:                 /* RCL */
+            cf = (r & sign) != 0;
+            r = ((r << 1) | flag(cpu, EMU86_CF)) & mask;
+            break;
+        case 3:                 /* RCR */
+            cf = (r & 1) != 0;
+            r = (r >> 1) | (flag(cpu, EMU86_CF) ? sign : 0);
+            break;
+        case 4:                 /* SHL */
+        case 6:                 /* Undocumented alias of SHL. */
+            cf = (r & sign) != 0;
+            r = (r << 1) & mask;
+            break;
+        case 5:                 /* SHR */
+            cf = (r & 1) != 0;
+            r >>= 1;
+            break;
+        default:                /* SAR */
+            cf = (r & 1) != 0;
+            r = (r >> 1) | (r & sign);
+            break;
+        }
+
+        set_flag(cpu, EMU86_CF, cf);
+    }
+
+    /* OF is only defined for a count of one. This is what the 8086 leaves
+     * in it for larger counts, too.
+     */
+    switch (op) {
+    case 0:
+    case 2:
+    case 4:
+    case 6:
+        set_flag(cpu, EMU86_OF,
+                 ((r & sign) != 0) != flag(cpu, EMU86_CF));
+        break;
+    case 1:
+    case 3:
+        set_flag(cpu, EMU86_OF, ((r ^ (r << 1)) & sign) != 0);
+        break;
+    case 5:
+        set_flag(cpu, EMU86_OF, count == 1 && (a & sign) != 0);
+        break;
+    default:
+        set_flag(cpu, EMU86_OF, false);
+        break;
+    }
+
+    if (op >= 4)
+        set_szp(cpu, r, w);
+
+    return r;
+}
+
+static void
+interrupt(struct emu86 *cpu, uint8_t n)
+{
+    push(cpu, cpu->flags);
+    set_flag(cpu, EMU86_IF, false);
+    set_flag(cpu, EMU86_TF, false);
+    push(cpu, cpu->sregs[CS]);
+    push(cpu, cpu->ip);
+
+    cpu->ip = mem_read16(cpu, 0, n * 4);
+    cpu->sregs[CS] = mem_read16(cpu, 0, n * 4 + 2);
+}
+
+static bool
+condition(const struct emu86 *cpu, unsigned cc)
+{
+    bool r;
+
+    switch (cc >> 1) {
+    case 0: r = flag(cpu, EMU86_OF); break;
+    case 1: r = flag(cpu, EMU86_CF); break;
+    case 2: r = flag(cpu, EMU86_ZF); break;
+    case 3: r = flag(cpu, EMU86_CF) || flag(cpu, EMU86_ZF); break;
+    case 4: r = flag(cpu, EMU86_SF); break;
+    case 5: r = flag(cpu, EMU86_PF); break;
+    case 6: r = flag(cpu, EMU86_SF) != flag(cpu, EMU86_OF); break;
+    default:
+        r = flag(cpu, EMU86_ZF) ||
+            flag(cpu, EMU86_SF) != flag(cpu, EMU86_OF);
+        break;
+    }
+
+    return (cc & 1) != 0 ? !r : r;
+}
+
+static uint8_t
+port_in8(struct emu86 *cpu, uint16_t port)
+{
+    return cpu->io.in != NULL ? cpu->io.in(cpu->io.ctx, port) : 0xff;
+}
+
+static void
+port_out8(struct emu86 *cpu, uint16_t port, uint8_t value)
+{
+    if (cpu->io.out != NULL)
+        cpu->io.out(cpu->io.ctx, port, value);
+}
+
+/**
+ * Run one iteration of a string instruction.
+ *
+ * \return
+ * For CMPS and SCAS, the state of ZF afterward. True otherwise.
+ */
+static bool
+string_op(struct emu86 *cpu, const struct insn *in, uint8_t op)
+{
+    const bool w = (op & 1) != 0;
+    const int16_t delta = (flag(cpu, EMU86_DF) ? -1 : 1) * (w ? 2 : 1);
+    const uint16_t src = cpu->sregs[in->seg >= 0 ? in->seg : DS];
+    const uint16_t es = cpu->sregs[ES];
+    uint16_t a;
+    uint16_t b;
+
+    switch (op & ~1) {
+    case 0xa4:                  /* MOVS */
+        if (w) {
+            mem_write16(cpu, es, cpu->regs[DI],
+                        mem_read16(cpu, src, cpu->regs[SI]));
+        } else {
+            mem_write8(cpu, es, cpu->regs[DI],
+                       mem_read8(cpu, src, cpu->regs[SI]));
+        }
+
+        cpu->regs[SI] += delta;
+        cpu->regs[DI] += delta;
+        return true;
+
+    case 0xa6:                  /* CMPS */
+        a = w ? mem_read16(cpu, src, cpu->regs[SI])
+            : mem_read8(cpu, src, cpu->regs[SI]);
+        b = w ? mem_read16(cpu, es, cpu->regs[DI])
+            : mem_read8(cpu, es, cpu->regs[DI]);
+        alu(cpu, ALU_CMP, a, b, w);
+        cpu->regs[SI] += delta;
+        cpu->regs[DI] += delta;
+        return flag(cpu, EMU86_ZF);
+
+    case 0xaa:                  /* STOS */
+        if (w)
+            mem_write16(cpu, es, cpu->regs[DI], cpu->regs[AX]);
+        else
+            mem_write8(cpu, es, cpu->regs[DI], cpu->regs[AX] & 0xff);
+
+        cpu->regs[DI] += delta;
+        return true;
+
+    case 0xac:                  /* LODS */
+        if (w)
+            cpu->regs[AX] = mem_read16(cpu, src, cpu->regs[SI]);
+        else
+            set_reg8(cpu, 0, mem_read8(cpu, src, cpu->regs[SI]));
+
+        cpu->regs[SI] += delta;
+        return true;
+
+    default:                    /* SCAS */
+        b = w ? mem_read16(cpu, es, cpu->regs[DI])
+            : mem_read8(cpu, es, cpu->regs[DI]);
+        alu(cpu, ALU_CMP, w ? cpu->regs[AX] : cpu->regs[AX] & 0xff, b, w);
+        cpu->regs[DI] += delta;
+        return flag(cpu, EMU86_ZF);
+    }
+}
+
+static void
+string_insn(struct emu86 *cpu, const struct insn *in, uint8_t op)
+{
+    /* Clocks for one iteration without and with a repeat prefix, indexed
+     * by (op - 0xa4) / 2. Repeated instructions also take 9 clocks to
+     * start. Index 2 is TEST, which is not a string instruction.
+     */
+    static const uint8_t once[6] = { 18, 22, 0, 11, 12, 15 };
+    static const uint8_t repeated[6] = { 17, 22, 0, 10, 13, 15 };
+    const unsigned i = ((op & ~1) - 0xa4) / 2;
+    const bool compare = i == 1 || i == 5;
+
+    if (in->rep == 0) {
+        cpu->cycles += once[i];
+        string_op(cpu, in, op);
+        return;
+    }
+
+    cpu->cycles += 9;
+    while (cpu->regs[CX] != 0) {
+        cpu->cycles += repeated[i];
+
+        const bool zf = string_op(cpu, in, op);
+
+        cpu->regs[CX]--;
+
+        if (compare && zf != (in->rep == 0xf3))
+            break;
+    }
+}
+
+static void
+bad_opcode(struct emu86 *cpu)
+{
+    cpu->status = EMU86_BAD_OPCODE;
+}
+
+static void
+mul_div(struct emu86 *cpu, const struct modrm *m, bool w)
+{
+    const uint16_t src = w ? get_rm16(cpu, m) : get_rm8(cpu, m);
+
+    switch (m->reg) {
+    case 0:
+    case 1:                     /* TEST (1 is an undocumented alias.) */
+        cpu->cycles += m->mod == 3 ? 5 : 11;
+        alu(cpu, ALU_AND, src, w ? fetch16(cpu) : fetch8(cpu), w);
+        return;
+
+    case 2:                     /* NOT */
+        cpu->cycles += m->mod == 3 ? 3 : 16;
+        if (w)
+            set_rm16(cpu, m, ~src);
+        else
+            set_rm8(cpu, m, ~src);
+        return;
+
+    case 3:                     /* NEG */
+        cpu->cycles += m->mod == 3 ? 3 : 16;
+        if (w)
+            set_rm16(cpu, m, alu(cpu, ALU_SUB, 0, src, true));
+        else
+            set_rm8(cpu, m, alu(cpu, ALU_SUB, 0, src, false));
+        return;
+
+    case 4:                     /* MUL */
+        if (w) {
+            const uint32_t r = (uint32_t) cpu->regs[AX] * src;
+
+            cpu->cycles += m->mod == 3 ? 124 : 130;
+            cpu->regs[AX] = r & 0xffff;
+            cpu->regs[DX] = r >> 16;
+            set_flag(cpu, EMU86_CF, cpu->regs[DX] != 0);
+        } else {
+            cpu->cycles += m->mod == 3 ? 73 : 79;
+            cpu->regs[AX] = (cpu->regs[AX] & 0xff) * src;
+            set_flag(cpu, EMU86_CF, (cpu->regs[AX] >> 8) != 0);
+        }
+
+        set_flag(cpu, EMU86_OF, flag(cpu, EMU86_CF));
+        return;
+
+    case 5:                     /* IMUL */
+        if (w) {
+            const int32_t r = (int32_t)(int16_t) cpu->regs[AX] *
+                (int16_t) src;
+
+            cpu->cycles += m->mod == 3 ? 141 : 147;
+            cpu->regs[AX] = (uint32_t) r & 0xffff;
+            cpu->regs[DX] = (uint32_t) r >> 16;
+            set_flag(cpu, EMU86_CF, r != (int16_t) r);
+        } else {
+            const int16_t r = (int8_t)(cpu->regs[AX] & 0xff) * (int8_t) src;
+
+            cpu->cycles += m->mod == 3 ? 89 : 95;
+            cpu->regs[AX] = (uint16_t) r;
+            set_flag(cpu, EMU86_CF, r != (int8_t) r);
+        }
+
+        set_flag(cpu, EMU86_OF, flag(cpu, EMU86_CF));
+        return;
+
+    case 6:                     /* DIV */
+        if (w) {
+            const uint32_t a = cpu->regs[AX] | ((uint32_t) cpu->regs[DX] << 16);
+
+            cpu->cycles += m->mod == 3 ? 153 : 159;
+            if (src == 0 || a / src > 0xffff)
+                break;
+
+            cpu->regs[AX] = a / src;
+            cpu->regs[DX] = a % src;
+        } else {
+            const uint16_t a = cpu->regs[AX];
+
+            cpu->cycles += m->mod == 3 ? 85 : 91;
+            if (src == 0 || a / src > 0xff)
+                break;
+
+            cpu->regs[AX] = (a / src) | ((a % src) << 8);
+        }
+        return;
+
+    default:                    /* IDIV */
+        if (w) {
+            const int32_t a = (int32_t)(cpu->regs[AX] |
+                                        ((uint32_t) cpu->regs[DX] << 16));
+            const int32_t d = (int16_t) src;
+
+            cpu->cycles += m->mod == 3 ? 174 : 180;
+            if (d == 0 || (a == INT32_MIN && d == -1))
+                break;
+
+            const int32_t q = a / d;
+
+            if (q > 0x7fff || q < -0x7fff)
+                break;
+
+            cpu->regs[AX] = (uint16_t) q;
+            cpu->regs[DX] = (uint16_t)(a % d);
+        } else {
+            const int16_t a = (int16_t) cpu->regs[AX];
+            const int16_t d = (int8_t) src;
+
+            cpu->cycles += m->mod == 3 ? 106 : 112;
+            if (d == 0)
+                break;
+
+            const int16_t q = a / d;
+
+            if (q > 0x7f || q < -0x7f)
+                break;
+
+            cpu->regs[AX] = (uint8_t) q | ((uint8_t)(a % d) << 8);
+        }
+        return;
+    }
+
+    /* Divide error. The 8086 pushes the address of the next instruction. */
+    cpu->cycles += 51;
+    interrupt(cpu, 0);
+}
+
+static void
+bcd_adjust(struct emu86 *cpu, uint8_t op)
+{
+    uint8_t al = cpu->regs[AX] & 0xff;
+    const bool af = flag(cpu, EMU86_AF) || (al & 0x0f) > 9;
+
+    switch (op) {
+    case 0x27:                  /* DAA */
+    case 0x2f: {                /* DAS */
+        const bool cf = flag(cpu, EMU86_CF) || al > 0x99;
+        const int sign = op == 0x27 ? 1 : -1;
+
+        cpu->cycles += 4;
+        if (af)
+            al += sign * 0x06;
+        if (cf)
+            al += sign * 0x60;
+
+        set_reg8(cpu, 0, al);
+        set_flag(cpu, EMU86_AF, af);
+        set_flag(cpu, EMU86_CF, cf);
+        set_szp(cpu, al, false);
+        break;
+    }
+
+    default: {                  /* AAA and AAS */
+        /* The 8086 adjusts AL and AH separately, so a carry out of AL
+         * does not reach AH.
+         */
+        cpu->cycles += 8;
+        if (af) {
+            const int sign = op == 0x37 ? 1 : -1;
+
+            set_reg8(cpu, 0, al + sign * 6);
+            set_reg8(cpu, 4, (cpu->regs[AX] >> 8) + sign);
+        }
+
+        set_reg8(cpu, 0, cpu->regs[AX] & 0x0f);
+        set_flag(cpu, EMU86_AF, af);
+        set_flag(cpu, EMU86_CF, af);
+        break;
+    }
+    }
+}
+
+/**
+ * Opcodes fe and ff, whose reg field selects the operation.
+ */
+static void
+group_ff(struct emu86 *cpu, const struct insn *in, bool w)
+{
+    struct modrm m;
+
+    decode_modrm(cpu, in, &m);
+
+    if (!w && m.reg >= 2) {
+        bad_opcode(cpu);
+        return;
+    }
+
+    switch (m.reg) {
+    case 0:                     /* INC */
+    case 1: {                   /* DEC */
+        cpu->cycles += m.mod == 3 ? 3 : 15;
+        if (w)
+            set_rm16(cpu, &m, inc_dec(cpu, get_rm16(cpu, &m), m.reg, true));
+        else
+            set_rm8(cpu, &m, inc_dec(cpu, get_rm8(cpu, &m), m.reg, false));
+        break;
+    }
+
+    case 2: {                   /* CALL near */
+        const uint16_t target = get_rm16(cpu, &m);
+
+        cpu->cycles += m.mod == 3 ? 16 : 21;
+        push(cpu, cpu->ip);
+        cpu->ip = target;
+        break;
+    }
+
+    case 3: {                   /* CALL far */
+        if (m.mod == 3) {
+            bad_opcode(cpu);
+            return;
+        }
+
+        const uint16_t ip = mem_read16(cpu, m.seg, m.off);
+        const uint16_t cs = mem_read16(cpu, m.seg, m.off + 2);
+
+        cpu->cycles += 37;
+        push(cpu, cpu->sregs[CS]);
+        push(cpu, cpu->ip);
+        cpu->sregs[CS] = cs;
+        cpu->ip = ip;
+        break;
+    }
+
+    case 4:                     /* JMP near */
+        cpu->cycles += m.mod == 3 ? 11 : 18;
+        cpu->ip = get_rm16(cpu, &m);
+        break;
+
+    case 5:                     /* JMP far */
+        if (m.mod == 3) {
+            bad_opcode(cpu);
+            return;
+        }
+
+        cpu->cycles += 24;
+        cpu->ip = mem_read16(cpu, m.seg, m.off);
+        cpu->sregs[CS] = mem_read16(cpu, m.seg, m.off + 2);
+        break;
+
+    default:                    /* PUSH (7 is an undocumented alias.) */
+        cpu->cycles += m.mod == 3 ? 11 : 16;
+
+        /* PUSH SP pushes the new value of SP on an 8086. */
+        if (m.mod == 3 && m.rm == SP) {
+            cpu->regs[SP] -= 2;
+            mem_write16(cpu, cpu->sregs[SS], cpu->regs[SP], cpu->regs[SP]);
+        } else {
+            push(cpu, get_rm16(cpu, &m));
+        }
+        break;
+    }
+}
+
+static void
+execute(struct emu86 *cpu, struct insn *in, uint8_t op)
+{
+    struct modrm m;
+    const bool w = (op & 1) != 0;
+
+    /* The eight arithmetic operations share one layout in 00 through 3f. */
+    if (op < 0x40 && (op & 7) < 6) {
+        const enum alu_op a = (op >> 3) & 7;
+        uint16_t r;
+
+        switch (op & 7) {
+        case 0:
+        case 1:                 /* r/m, reg */
+            decode_modrm(cpu, in, &m);
+            if (w)
+                r = alu(cpu, a, get_rm16(cpu, &m), cpu->regs[m.reg], true);
+            else
+                r = alu(cpu, a, get_rm8(cpu, &m), get_reg8(cpu, m.reg), false);
+
+            if (m.mod == 3) {
+                cpu->cycles += 3;
+            } else {
+                cpu->cycles += a == ALU_CMP ? 9 : 16;
+            }
+
+            if (a != ALU_CMP) {
+                if (w)
+                    set_rm16(cpu, &m, r);
+                else
+                    set_rm8(cpu, &m, r);
+            }
+            return;
+
+        case 2:
+        case 3:                 /* reg, r/m */
+            decode_modrm(cpu, in, &m);
+            cpu->cycles += m.mod == 3 ? 3 : 9;
+            if (w) {
+                r = alu(cpu, a, cpu->regs[m.reg], get_rm16(cpu, &m), true);
+                if (a != ALU_CMP)
+                    cpu->regs[m.reg] = r;
+            } else {
+                r = alu(cpu, a, get_reg8(cpu, m.reg), get_rm8(cpu, &m), false);
+                if (a != ALU_CMP)
+                    set_reg8(cpu, m.reg, r);
+            }
+            return;
+
+        case 4:                 /* AL, imm8 */
+            cpu->cycles += 4;
+            r = alu(cpu, a, cpu->regs[AX] & 0xff, fetch8(cpu), false);
+            if (a != ALU_CMP)
+                set_reg8(cpu, 0, r);
+            return;
+
+        default:                /* AX, imm16 */
+            cpu->cycles += 4;
+            r = alu(cpu, a, cpu->regs[AX], fetch16(cpu), true);
+            if (a != ALU_CMP)
+                cpu->regs[AX] = r;
+            return;
+        }
+    }
+
+    switch (op) {
+    case 0x06: case 0x0e: case 0x16: case 0x1e:     /* PUSH sreg */
+        cpu->cycles += 10;
+        push(cpu, cpu->sregs[op >> 3]);
+        return;
+
+    case 0x07: case 0x17: case 0x1f:                /* POP sreg */
+        cpu->cycles += 8;
+        cpu->sregs[op >> 3] = pop(cpu);
+        return;
+
+    case 0x0f: {                /* Trap to the host. */
+        const uint8_t n = fetch8(cpu);
+
+        if (cpu->io.trap == NULL) {
+            bad_opcode(cpu);
+            return;
+        }
+
+        cpu->io.trap(cpu->io.ctx, cpu, n);
+        return;
+    }
+
+    case 0x27: case 0x2f: case 0x37: case 0x3f:
+        bcd_adjust(cpu, op);
+        return;
+
+    case 0x40: case 0x41: case 0x42: case 0x43:
+    case 0x44: case 0x45: case 0x46: case 0x47:     /* INC reg */
+    case 0x48: case 0x49: case 0x4a: case 0x4b:
+    case 0x4c: case 0x4d: case 0x4e: case 0x4f:     /* DEC reg */
+        cpu->cycles += 2;
+        cpu->regs[op & 7] = inc_dec(cpu, cpu->regs[op & 7], op >= 0x48,
+                                    true);
+        return;
+
+    case 0x50: case 0x51: case 0x52: case 0x53:
+    case 0x54: case 0x55: case 0x56: case 0x57:     /* PUSH reg */
+        cpu->cycles += 11;
+        if (op == 0x54) {
+            cpu->regs[SP] -= 2;
+            mem_write16(cpu, cpu->sregs[SS], cpu->regs[SP], cpu->regs[SP]);
+        } else {
+            push(cpu, cpu->regs[op & 7]);
+        }
+        return;
+
+    case 0x58: case 0x59: case 0x5a: case 0x5b:
+    case 0x5c: case 0x5d: case 0x5e: case 0x5f:     /* POP reg */
+        cpu->cycles += 8;
+        cpu->regs[op & 7] = pop(cpu);
+        return;
+
+    case 0x70: case 0x71: case 0x72: case 0x73:
+    case 0x74: case 0x75: case 0x76: case 0x77:
+    case 0x78: case 0x79: case 0x7a: case 0x7b:
+    case 0x7c: case 0x7d: case 0x7e: case 0x7f: {   /* Jcc */
+        const int8_t d = fetch8(cpu);
+
+        if (condition(cpu, op & 15)) {
+            cpu->cycles += 16;
+            cpu->ip += d;
+        } else {
+            cpu->cycles += 4;
+        }
+        return;
+    }
+
+    case 0x80: case 0x81: case 0x82: case 0x83: {   /* ALU r/m, imm */
+        decode_modrm(cpu, in, &m);
+
+        const uint16_t a = w ? get_rm16(cpu, &m) : get_rm8(cpu, &m);
+        uint16_t b;
+
+        if (op == 0x81)
+            b = fetch16(cpu);
+        else if (op == 0x83)
+            b = (int8_t) fetch8(cpu);
+        else
+            b = fetch8(cpu);
+
+        const uint16_t r = alu(cpu, m.reg, a, b, w);
+
+        if (m.mod == 3)
+            cpu->cycles += 4;
+        else
+            cpu->cycles += m.reg == ALU_CMP ? 10 : 17;
+
+        if (m.reg != ALU_CMP) {
+            if (w)
+                set_rm16(cpu, &m, r);
+            else
+                set_rm8(cpu, &m, r);
+        }
+        return;
+    }
+
+    case 0x84: case 0x85:       /* TEST r/m, reg */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 3 : 9;
+        if (w)
+            alu(cpu, ALU_AND, get_rm16(cpu, &m), cpu->regs[m.reg], true);
+        else
+            alu(cpu, ALU_AND, get_rm8(cpu, &m), get_reg8(cpu, m.reg), false);
+        return;
+
+    case 0x86: case 0x87:       /* XCHG r/m, reg */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 4 : 17;
+        if (w) {
+            const uint16_t t = get_rm16(cpu, &m);
+
+            set_rm16(cpu, &m, cpu->regs[m.reg]);
+            cpu->regs[m.reg] = t;
+        } else {
+            const uint8_t t = get_rm8(cpu, &m);
+
+            set_rm8(cpu, &m, get_reg8(cpu, m.reg));
+            set_reg8(cpu, m.reg, t);
+        }
+        return;
+
+    case 0x88: case 0x89:       /* MOV r/m, reg */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 2 : 9;
+        if (w)
+            set_rm16(cpu, &m, cpu->regs[m.reg]);
+        else
+            set_rm8(cpu, &m, get_reg8(cpu, m.reg));
+        return;
+
+    case 0x8a: case 0x8b:       /* MOV reg, r/m */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 2 : 8;
+        if (w)
+            cpu->regs[m.reg] = get_rm16(cpu, &m);
+        else
+            set_reg8(cpu, m.reg, get_rm8(cpu, &m));
+        return;
+
+    case 0x8c:                  /* MOV r/m, sreg */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 2 : 9;
+        set_rm16(cpu, &m, cpu->sregs[m.reg & 3]);
+        return;
+
+    case 0x8d:                  /* LEA */
+        decode_modrm(cpu, in, &m);
+        if (m.mod == 3) {
+            bad_opcode(cpu);
+            return;
+        }
+
+        cpu->cycles += 2;
+        cpu->regs[m.reg] = m.off;
+        return;
+
+    case 0x8e:                  /* MOV sreg, r/m */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 2 : 8;
+        cpu->sregs[m.reg & 3] = get_rm16(cpu, &m);
+        return;
+
+    case 0x8f:                  /* POP r/m */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 8 : 17;
+        set_rm16(cpu, &m, pop(cpu));
+        return;
+
+    case 0x90:                  /* NOP */
+        cpu->cycles += 3;
+        return;
+
+    case 0x91: case 0x92: case 0x93:
+    case 0x94: case 0x95: case 0x96: case 0x97: {   /* XCHG AX, reg */
+        const uint16_t t = cpu->regs[AX];
+
+        cpu->cycles += 3;
+        cpu->regs[AX] = cpu->regs[op & 7];
+        cpu->regs[op & 7] = t;
+        return;
+    }
+
+    case 0x98:                  /* CBW */
+        cpu->cycles += 2;
+        cpu->regs[AX] = (uint16_t)(int8_t)(cpu->regs[AX] & 0xff);
+        return;
+
+    case 0x99:                  /* CWD */
+        cpu->cycles += 5;
+        cpu->regs[DX] = (cpu->regs[AX] & 0x8000) != 0 ? 0xffff : 0;
+        return;
+
+    case 0x9a: {                /* CALL far imm */
+        const uint16_t ip = fetch16(cpu);
+        const uint16_t cs = fetch16(cpu);
+
+        cpu->cycles += 28;
+        push(cpu, cpu->sregs[CS]);
+        push(cpu, cpu->ip);
+        cpu->sregs[CS] = cs;
+        cpu->ip = ip;
+        return;
+    }
+
+    case 0x9b:                  /* WAIT. There is no 8087. */
+        cpu->cycles += 4;
+        return;
+
+    case 0x9c:                  /* PUSHF */
+        cpu->cycles += 10;
+        push(cpu, cpu->flags);
+        return;
+
+    case 0x9d:                  /* POPF */
+        cpu->cycles += 8;
+        cpu->flags = (pop(cpu) & 0x0fd5) | 0xf002;
+        return;
+
+    case 0x9e:                  /* SAHF */
+        cpu->cycles += 4;
+        cpu->flags = (cpu->flags & 0xff00) |
+            ((cpu->regs[AX] >> 8) & 0xd5) | 0x02;
+        return;
+
+    case 0x9f:                  /* LAHF */
+        cpu->cycles += 4;
+        set_reg8(cpu, 4, cpu->flags & 0xff);
+        return;
+
+    case 0xa0: case 0xa1: {     /* MOV acc, [addr] */
+        const uint16_t seg = cpu->sregs[in->seg >= 0 ? in->seg : DS];
+        const uint16_t off = fetch16(cpu);
+
+        cpu->cycles += 10;
+        if (w)
+            cpu->regs[AX] = mem_read16(cpu, seg, off);
+        else
+            set_reg8(cpu, 0, mem_read8(cpu, seg, off));
+        return;
+    }
+
+    case 0xa2: case 0xa3: {     /* MOV [addr], acc */
+        const uint16_t seg = cpu->sregs[in->seg >= 0 ? in->seg : DS];
+        const uint16_t off = fetch16(cpu);
+
+        cpu->cycles += 10;
+        if (w)
+            mem_write16(cpu, seg, off, cpu->regs[AX]);
+        else
+            mem_write8(cpu, seg, off, cpu->regs[AX] & 0xff);
+        return;
+    }
+
+    case 0xa4: case 0xa5: case 0xa6: case 0xa7:
+    case 0xaa: case 0xab: case 0xac: case 0xad:
+    case 0xae: case 0xaf:
+        string_insn(cpu, in, op);
+        return;
+
+    case 0xa8:                  /* TEST AL, imm */
+        cpu->cycles += 4;
+        alu(cpu, ALU_AND, cpu->regs[AX] & 0xff, fetch8(cpu), false);
+        return;
+
+    case 0xa9:                  /* TEST AX, imm */
+        cpu->cycles += 4;
+        alu(cpu, ALU_AND, cpu->regs[AX], fetch16(cpu), true);
+        return;
+
+    case 0xb0: case 0xb1: case 0xb2: case 0xb3:
+    case 0xb4: case 0xb5: case 0xb6: case 0xb7:     /* MOV reg8, imm */
+        cpu->cycles += 4;
+        set_reg8(cpu, op & 7, fetch8(cpu));
+        return;
+
+    case 0xb8: case 0xb9: case 0xba: case 0xbb:
+    case 0xbc: case 0xbd: case 0xbe: case 0xbf:     /* MOV reg16, imm */
+        cpu->cycles += 4;
+        cpu->regs[op & 7] = fetch16(cpu);
+        return;
+
+    case 0xc2: case 0xca: {     /* RET imm */
+        const uint16_t n = fetch16(cpu);
+
+        cpu->ip = pop(cpu);
+        if (op == 0xca) {
+            cpu->cycles += 17;
+            cpu->sregs[CS] = pop(cpu);
+        } else {
+            cpu->cycles += 12;
+        }
+
+        cpu->regs[SP] += n;
+        return;
+    }
+
+    case 0xc3:                  /* RET */
+        cpu->cycles += 8;
+        cpu->ip = pop(cpu);
+        return;
+
+    case 0xcb:                  /* RETF */
+        cpu->cycles += 18;
+        cpu->ip = pop(cpu);
+        cpu->sregs[CS] = pop(cpu);
+        return;
+
+    case 0xc4: case 0xc5:       /* LES, LDS */
+        decode_modrm(cpu, in, &m);
+        if (m.mod == 3) {
+            bad_opcode(cpu);
+            return;
+        }
+
+        cpu->cycles += 16;
+        cpu->regs[m.reg] = mem_read16(cpu, m.seg, m.off);
+        cpu->sregs[op == 0xc4 ? ES : DS] = mem_read16(cpu, m.seg, m.off + 2);
+        return;
+
+    case 0xc6: case 0xc7:       /* MOV r/m, imm */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 4 : 10;
+        if (w)
+            set_rm16(cpu, &m, fetch16(cpu));
+        else
+            set_rm8(cpu, &m, fetch8(cpu));
+        return;
+
+    case 0xcc:                  /* INT 3 */
+        cpu->cycles += 52;
+        interrupt(cpu, 3);
+        return;
+
+    case 0xcd:                  /* INT imm */
+        cpu->cycles += 51;
+        interrupt(cpu, fetch8(cpu));
+        return;
+
+    case 0xce:                  /* INTO */
+        if (flag(cpu, EMU86_OF)) {
+            cpu->cycles += 53;
+            interrupt(cpu, 4);
+        } else {
+            cpu->cycles += 4;
+        }
+        return;
+
+    case 0xcf:                  /* IRET */
+        cpu->cycles += 24;
+        cpu->ip = pop(cpu);
+        cpu->sregs[CS] = pop(cpu);
+        cpu->flags = (pop(cpu) & 0x0fd5) | 0xf002;
+        return;
+
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3: {   /* Shifts */
+        const unsigned count = op >= 0xd2 ? cpu->regs[CX] & 0xff : 1;
+
+        decode_modrm(cpu, in, &m);
+        if (op >= 0xd2)
+            cpu->cycles += (m.mod == 3 ? 8 : 20) + 4 * count;
+        else
+            cpu->cycles += m.mod == 3 ? 2 : 15;
+
+        if (w)
+            set_rm16(cpu, &m, shift(cpu, m.reg, get_rm16(cpu, &m), count,
+                                    true));
+        else
+            set_rm8(cpu, &m, shift(cpu, m.reg, get_rm8(cpu, &m), count,
+                                   false));
+        return;
+    }
+
+    case 0xd4: {                /* AAM */
+        const uint8_t base = fetch8(cpu);
+        const uint8_t al = cpu->regs[AX] & 0xff;
+
+        cpu->cycles += 83;
+        if (base == 0) {
+            cpu->cycles += 51;
+            interrupt(cpu, 0);
+            return;
+        }
+
+        cpu->regs[AX] = ((al / base) << 8) | (al % base);
+        set_szp(cpu, al % base, false);
+        return;
+    }
+
+    case 0xd5: {                /* AAD */
+        const uint8_t base = fetch8(cpu);
+        const uint8_t al = (cpu->regs[AX] & 0xff) +
+            (cpu->regs[AX] >> 8) * base;
+
+        cpu->cycles += 60;
+        cpu->regs[AX] = al;
+        set_szp(cpu, al, false);
+        return;
+    }
+
+    case 0xd6:                  /* SALC (undocumented) */
+        cpu->cycles += 4;
+        set_reg8(cpu, 0, flag(cpu, EMU86_CF) ? 0xff : 0x00);
+        return;
+
+    case 0xd7: {                /* XLAT */
+        const uint16_t seg = cpu->sregs[in->seg >= 0 ? in->seg : DS];
+
+        cpu->cycles += 11;
+        set_reg8(cpu, 0, mem_read8(cpu, seg, cpu->regs[BX] +
+                                   (cpu->regs[AX] & 0xff)));
+        return;
+    }
+
+    case 0xd8: case 0xd9: case 0xda: case 0xdb:
+    case 0xdc: case 0xdd: case 0xde: case 0xdf:     /* ESC. No 8087. */
+        decode_modrm(cpu, in, &m);
+        cpu->cycles += m.mod == 3 ? 2 : 8;
+        return;
+
+    case 0xe0: case 0xe1: case 0xe2: {              /* LOOPNZ, LOOPZ, LOOP */
+        static const uint8_t taken[3] = { 19, 18, 17 };
+        static const uint8_t not_taken[3] = { 5, 6, 5 };
+        const int8_t d = fetch8(cpu);
+        const unsigned i = op - 0xe0;
+        bool jump = --cpu->regs[CX] != 0;
+
+        if (i == 0)
+            jump = jump && !flag(cpu, EMU86_ZF);
+        else if (i == 1)
+            jump = jump && flag(cpu, EMU86_ZF);
+
+        if (jump) {
+            cpu->cycles += taken[i];
+            cpu->ip += d;
+        } else {
+            cpu->cycles += not_taken[i];
+        }
+        return;
+    }
+
+    case 0xe3: {                /* JCXZ */
+        const int8_t d = fetch8(cpu);
+
+        if (cpu->regs[CX] == 0) {
+            cpu->cycles += 18;
+            cpu->ip += d;
+        } else {
+            cpu->cycles += 6;
+        }
+        return;
+    }
+
+    case 0xe4: case 0xe5: case 0xec: case 0xed: {   /* IN */
+        const uint16_t port = op < 0xe8 ? fetch8(cpu) : cpu->regs[DX];
+
+        cpu->cycles += op < 0xe8 ? 10 : 8;
+        if (w) {
+            cpu->cycles += cpu->bus8 ? 4 : 0;
+            cpu->regs[AX] = port_in8(cpu, port) |
+                ((uint16_t) port_in8(cpu, port + 1) << 8);
+        } else {
+            set_reg8(cpu, 0, port_in8(cpu, port));
+        }
+        return;
+    }
+
+    case 0xe6: case 0xe7: case 0xee: case 0xef: {   /* OUT */
+        const uint16_t port = op < 0xe8 ? fetch8(cpu) : cpu->regs[DX];
+
+        cpu->cycles += op < 0xe8 ? 10 : 8;
+        port_out8(cpu, port, cpu->regs[AX] & 0xff);
+        if (w) {
+            cpu->cycles += cpu->bus8 ? 4 : 0;
+            port_out8(cpu, port + 1, cpu->regs[AX] >> 8);
+        }
+        return;
+    }
+
+    case 0xe8: {                /* CALL near */
+        const uint16_t d = fetch16(cpu);
+
+        cpu->cycles += 19;
+        push(cpu, cpu->ip);
+        cpu->ip += d;
+        return;
+    }
+
+    case 0xe9:                  /* JMP near */
+        cpu->cycles += 15;
+        cpu->ip += fetch16(cpu);
+        return;
+
+    case 0xea: {                /* JMP far */
+        const uint16_t ip = fetch16(cpu);
+
+        cpu->cycles += 15;
+        cpu->sregs[CS] = fetch16(cpu);
+        cpu->ip = ip;
+        return;
+    }
+
+    case 0xeb:                  /* JMP short */
+        cpu->cycles += 15;
+        cpu->ip += (int8_t) fetch8(cpu);
+        return;
+
+    case 0xf4:                  /* HLT. Nothing can interrupt it here. */
+        cpu->cycles += 2;
+        cpu->status = EMU86_HALTED;
+        return;
+
+    case 0xf5:                  /* CMC */
+        cpu->cycles += 2;
+        cpu->flags ^= EMU86_CF;
+        return;
+
+    case 0xf6: case 0xf7:
+        decode_modrm(cpu, in, &m);
+        mul_div(cpu, &m, w);
+        return;
+
+    case 0xf8: case 0xf9:       /* CLC, STC */
+        cpu->cycles += 2;
+        set_flag(cpu, EMU86_CF, op & 1);
+        return;
+
+    case 0xfa: case 0xfb:       /* CLI, STI */
+        cpu->cycles += 2;
+        set_flag(cpu, EMU86_IF, op & 1);
+        return;
+
+    case 0xfc: case 0xfd:       /* CLD, STD */
+        cpu->cycles += 2;
+        set_flag(cpu, EMU86_DF, op & 1);
+        return;
+
+    case 0xfe: case 0xff:
+        group_ff(cpu, in, w);
+        return;
+
+    default:
+        /* 60 through 6f, c0, c1, c8, and c9 are 80186 instructions. On
+         * an 8086, some of them are aliases of other instructions, but
+         * compiled 8086 code never uses them.
+         */
+        bad_opcode(cpu);
+        return;
+    }
+}
+
+bool
+emu86_step(struct emu86 *cpu)
+{
+    if (cpu->status != EMU86_RUNNING)
+        return false;
+
+    const uint64_t start = cpu->cycles;
+    const uint16_t cs = cpu->sregs[CS];
+    const uint16_t ip = cpu->ip;
+    struct insn in = { .seg = -1, .rep = 0 };
+    uint8_t op;
+
+    for (;;) {
+        op = fetch8(cpu);
+
+        if (op == 0x26 || op == 0x2e || op == 0x36 || op == 0x3e)
+            in.seg = (op >> 3) & 3;
+        else if (op == 0xf2 || op == 0xf3)
+            in.rep = op;
+        else if (op != 0xf0 && op != 0xf1)
+            break;
+
+        cpu->cycles += 2;
+    }
+
+    execute(cpu, &in, op);
+
+    if (cpu->status == EMU86_BAD_OPCODE) {
+        cpu->fault_cs = cs;
+        cpu->fault_ip = ip;
+        cpu->sregs[CS] = cs;
+        cpu->ip = ip;
+        return false;
+    }
+
+    cpu->instructions++;
+    cpu->op_count[op]++;
+    cpu->op_cycles[op] += cpu->cycles - start;
+
+    if (cpu->status == EMU86_HALTED) {
+        cpu->fault_cs = cs;
+        cpu->fault_ip = ip;
+    }
+
+    return cpu->status == EMU86_RUNNING;
+}
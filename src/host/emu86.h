@@ -0,0 +1,148 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef EMU86_H
+#define EMU86_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * \file
+ * Cycle-counting 8086 / 8088 interpreter.
+ *
+ * Every instruction of the 8086 is interpreted. Instructions added by the
+ * 80186 and later stop the interpreter with \c EMU86_BAD_OPCODE, since the
+ * player is built for the 8088.
+ *
+ * Cycle counts are the documented 8086 clocks for each instruction and
+ * addressing mode. With \c bus8 set, as on an 8088, every word transferred
+ * to or from memory costs 4 more clocks. Neither the prefetch queue nor DRAM
+ * refresh is modeled, so counts for code that is limited by instruction
+ * fetch are low. They are repeatable, though, and they move in the same
+ * direction as the real ones when the code changes.
+ *
+ * The two byte sequence 0f nn, which is POP CS on an 8086 and never appears
+ * in compiled code, calls the \c trap callback with nn. The machine uses it
+ * to run BIOS and DOS services on the host.
+ */
+
+enum emu86_reg { AX, CX, DX, BX, SP, BP, SI, DI };
+enum emu86_sreg { ES, CS, SS, DS };
+
+#define EMU86_CF 0x0001
+#define EMU86_PF 0x0004
+#define EMU86_AF 0x0010
+#define EMU86_ZF 0x0040
+#define EMU86_SF 0x0080
+#define EMU86_TF 0x0100
+#define EMU86_IF 0x0200
+#define EMU86_DF 0x0400
+#define EMU86_OF 0x0800
+
+/* Size of the address space, and the extra bytes after it that let a word
+ * access at the last address read past the end without a check.
+ */
+#define EMU86_MEM_SIZE 0x100000u
+#define EMU86_MEM_SLACK 0x10u
+
+enum emu86_status {
+    EMU86_RUNNING,
+    EMU86_HALTED,
+    EMU86_BAD_OPCODE,
+
+    /** Stopped by a callback through \c emu86_stop. */
+    EMU86_STOPPED,
+};
+
+struct emu86;
+
+struct emu86_io {
+    void *ctx;
+    uint8_t (*in)(void *ctx, uint16_t port);
+    void (*out)(void *ctx, uint16_t port, uint8_t value);
+    void (*trap)(void *ctx, struct emu86 *cpu, uint8_t n);
+};
+
+struct emu86 {
+    uint16_t regs[8];
+    uint16_t sregs[4];
+    uint16_t ip;
+    uint16_t flags;
+
+    /** \c EMU86_MEM_SIZE + \c EMU86_MEM_SLACK bytes. */
+    uint8_t *mem;
+
+    /** Add 4 clocks for each word memory transfer, as on an 8088. */
+    bool bus8;
+
+    uint64_t cycles;
+    uint64_t instructions;
+
+    /** Instructions and clocks by first opcode byte, after prefixes. */
+    uint64_t op_count[256];
+    uint64_t op_cycles[256];
+
+    enum emu86_status status;
+
+    /** Address of the instruction that stopped the interpreter. */
+    uint16_t fault_cs;
+    uint16_t fault_ip;
+
+    struct emu86_io io;
+};
+
+/**
+ * Set the registers to their state after reset. Memory is not touched.
+ */
+void emu86_reset(struct emu86 *cpu);
+
+/**
+ * Run one instruction, including its prefixes. A string instruction with a
+ * repeat prefix runs to completion.
+ *
+ * \return
+ * False if the interpreter has stopped. See \c status.
+ */
+bool emu86_step(struct emu86 *cpu);
+
+/**
+ * Stop the interpreter after the current instruction.
+ */
+void emu86_stop(struct emu86 *cpu);
+
+static inline uint32_t
+emu86_linear(uint16_t seg, uint16_t off)
+{
+    return (((uint32_t) seg << 4) + off) & (EMU86_MEM_SIZE - 1);
+}
+
+static inline uint8_t
+emu86_read8(const struct emu86 *cpu, uint16_t seg, uint16_t off)
+{
+    return cpu->mem[emu86_linear(seg, off)];
+}
+
+static inline uint16_t
+emu86_read16(const struct emu86 *cpu, uint16_t seg, uint16_t off)
+{
+    return emu86_read8(cpu, seg, off) |
+        ((uint16_t) emu86_read8(cpu, seg, off + 1) << 8);
+}
+
+static inline void
+emu86_write8(struct emu86 *cpu, uint16_t seg, uint16_t off, uint8_t value)
+{
+    cpu->mem[emu86_linear(seg, off)] = value;
+}
+
+static inline void
+emu86_write16(struct emu86 *cpu, uint16_t seg, uint16_t off, uint16_t value)
+{
+    emu86_write8(cpu, seg, off, value & 0xff);
+    emu86_write8(cpu, seg, off + 1, value >> 8);
+}
+
+#endif /* ifndef EMU86_H */
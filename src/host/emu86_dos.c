@@ -0,0 +1,1072 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emu86_dos.h"
+
+/* Segment of the interrupt stubs. The stub of vector n is at STUB_OFFSET +
+ * 3 * n.
+ */
+#define STUB_SEG 0xf000
+#define STUB_OFFSET 0x0100
+
+#define BDA_SEG 0x0040
+#define BDA_TICKS 0x006c
+
+#define ENV_SEG 0x0fe0
+#define ENV_PARAS 0x0020
+#define PSP_SEG (ENV_SEG + ENV_PARAS)
+#define MEM_TOP 0xa000
+
+/* Handles 0 through 4 are the standard devices. */
+#define FILE_DEVICE -2
+#define FIRST_FILE 5
+
+/* DOS error codes. */
+#define DOS_BAD_FUNCTION 0x01
+#define DOS_NOT_FOUND 0x02
+#define DOS_TOO_MANY_FILES 0x04
+#define DOS_ACCESS_DENIED 0x05
+#define DOS_BAD_HANDLE 0x06
+#define DOS_NO_MEMORY 0x08
+#define DOS_BAD_BLOCK 0x09
+#define DOS_NO_MORE_FILES 0x12
+
+/* Low and high bytes of AX. */
+#define AL(m) ((m)->cpu.regs[AX] & 0xff)
+#define AH(m) ((m)->cpu.regs[AX] >> 8)
+
+struct mz_header {
+    uint16_t magic;
+    uint16_t last_page_bytes;
+    uint16_t pages;
+    uint16_t relocations;
+    uint16_t header_paras;
+    uint16_t min_alloc;
+    uint16_t max_alloc;
+    uint16_t ss;
+    uint16_t sp;
+    uint16_t checksum;
+    uint16_t ip;
+    uint16_t cs;
+    uint16_t relocation_offset;
+};
+
+static uint16_t
+le16(const uint8_t *p)
+{
+    return p[0] | ((uint16_t) p[1] << 8);
+}
+
+static void
+set_al(struct emu86_dos *m, uint8_t value)
+{
+    m->cpu.regs[AX] = (m->cpu.regs[AX] & 0xff00) | value;
+}
+
+/**
+ * Set a flag in the FLAGS image pushed by the INT that called a service.
+ * IRET at the end of the stub loads it.
+ */
+static void
+set_return_flag(struct emu86_dos *m, uint16_t flag, bool set)
+{
+    struct emu86 *const cpu = &m->cpu;
+    const uint16_t off = cpu->regs[SP] + 4;
+    uint16_t flags = emu86_read16(cpu, cpu->sregs[SS], off);
+
+    if (set)
+        flags |= flag;
+    else
+        flags &= ~flag;
+
+    emu86_write16(cpu, cpu->sregs[SS], off, flags);
+}
+
+static void
+dos_ok(struct emu86_dos *m)
+{
+    set_return_flag(m, EMU86_CF, false);
+}
+
+static void
+dos_fail(struct emu86_dos *m, uint16_t error)
+{
+    m->cpu.regs[AX] = error;
+    set_return_flag(m, EMU86_CF, true);
+}
+
+static void
+print(struct emu86_dos *m, const char *s, size_t n)
+{
+    if (m->output_size + n + 1 > m->output_cap) {
+        size_t cap = m->output_cap != 0 ? m->output_cap : 4096;
+
+        while (m->output_size + n + 1 > cap)
+            cap *= 2;
+
+        char *const p = realloc(m->output, cap);
+        if (p == NULL)
+            return;
+
+        m->output = p;
+        m->output_cap = cap;
+    }
+
+    memcpy(m->output + m->output_size, s, n);
+    m->output_size += n;
+    m->output[m->output_size] = '\0';
+
+    if (m->echo) {
+        fwrite(s, 1, n, stdout);
+        fflush(stdout);
+    }
+}
+
+static void
+print_char(struct emu86_dos *m, uint8_t c)
+{
+    const char s = c;
+
+    print(m, &s, 1);
+}
+
+static uint32_t
+bios_ticks(const struct emu86_dos *m)
+{
+    return emu86_dos_pit_clocks(m, m->cpu.cycles) >> 16;
+}
+
+static void
+update_ticks(struct emu86_dos *m)
+{
+    const uint32_t ticks = bios_ticks(m);
+
+    emu86_write16(&m->cpu, BDA_SEG, BDA_TICKS, ticks & 0xffff);
+    emu86_write16(&m->cpu, BDA_SEG, BDA_TICKS + 2, ticks >> 16);
+
+    /* The next tick is at the first CPU clock where the PIT clock reaches
+     * (ticks + 1) << 16.
+     */
+    const uint64_t pit = ((uint64_t) ticks + 1) << 16;
+
+    m->next_tick = (pit * 12 + m->osc_div - 1) / m->osc_div;
+}
+
+static uint16_t
+pit_count(const struct emu86_dos *m)
+{
+    const uint32_t reload = m->pit.reload != 0 ? m->pit.reload : 0x10000;
+    const uint64_t t = emu86_dos_pit_clocks(m, m->cpu.cycles);
+
+    /* Channel 0 is treated as having been loaded at time zero with every
+     * reload value, so that it stays in step with the BIOS tick count.
+     */
+    return (uint16_t)(reload - t % reload);
+}
+
+static void
+record(struct emu86_dos *m, uint16_t port, uint8_t value, bool is_write)
+{
+    if (m->port_count == m->port_cap) {
+        const size_t cap = m->port_cap != 0 ? m->port_cap * 2 : 4096;
+        struct emu86_port_access *const p =
+            realloc(m->ports, cap * sizeof(*p));
+
+        if (p == NULL)
+            return;
+
+        m->ports = p;
+        m->port_cap = cap;
+    }
+
+    struct emu86_port_access *const a = &m->ports[m->port_count++];
+
+    a->cycles = m->cpu.cycles;
+    a->port = port;
+    a->value = value;
+    a->is_write = is_write;
+}
+
+static uint8_t
+port_in(void *ctx, uint16_t port)
+{
+    struct emu86_dos *const m = ctx;
+    uint8_t value;
+
+    switch (port) {
+    case 0x40: {
+        const uint16_t count = m->pit.latched ? m->pit.latch : pit_count(m);
+
+        value = m->pit.read_high ? count >> 8 : count & 0xff;
+        if (m->pit.read_high)
+            m->pit.latched = false;
+
+        m->pit.read_high = !m->pit.read_high;
+        break;
+    }
+
+    case 0x20:
+        /* No interrupt is ever pending or in service. */
+        value = 0x00;
+        break;
+
+    case 0x21:
+        value = m->pic_mask;
+        break;
+
+    case 0x61:
+        value = m->port_b;
+        break;
+
+    default:
+        value = 0xff;
+        break;
+    }
+
+    record(m, port, value, false);
+    return value;
+}
+
+static void
+port_out(void *ctx, uint16_t port, uint8_t value)
+{
+    struct emu86_dos *const m = ctx;
+
+    record(m, port, value, true);
+
+    switch (port) {
+    case 0x40:
+        if (!m->pit.have_low) {
+            m->pit.low = value;
+            m->pit.have_low = true;
+        } else {
+            m->pit.reload = m->pit.low | (value << 8);
+            m->pit.have_low = false;
+        }
+        break;
+
+    case 0x43:
+        /* Only channel 0 is modeled. Access mode 0 latches the count, and
+         * any other mode starts a new reload value.
+         */
+        if ((value & 0xc0) != 0)
+            break;
+
+        if ((value & 0x30) == 0) {
+            m->pit.latch = pit_count(m);
+            m->pit.latched = true;
+        } else {
+            m->pit.have_low = false;
+        }
+
+        m->pit.read_high = false;
+        break;
+
+    case 0x21:
+        m->pic_mask = value;
+        break;
+
+    case 0x61:
+        m->port_b = value;
+        break;
+    }
+}
+
+/**
+ * Read a path from memory and turn it into a host path.
+ *
+ * The drive letter and any leading backslash are dropped, so every path is
+ * relative to the host's current directory.
+ */
+static void
+host_path(struct emu86_dos *m, uint16_t seg, uint16_t off, char *path,
+          size_t size)
+{
+    size_t n = 0;
+    char c;
+
+    if (emu86_read8(&m->cpu, seg, off + 1) == ':')
+        off += 2;
+
+    while (emu86_read8(&m->cpu, seg, off) == '\\' ||
+           emu86_read8(&m->cpu, seg, off) == '/')
+        off++;
+
+    while ((c = emu86_read8(&m->cpu, seg, off++)) != '\0' && n + 1 < size)
+        path[n++] = c == '\\' ? '/' : c;
+
+    path[n] = '\0';
+}
+
+static int
+open_host(const char *path, int flags)
+{
+    int fd = open(path, flags, 0644);
+
+    /* DOS names are not case sensitive, and programs usually spell them
+     * in capitals. Try the name in lower case, too.
+     */
+    if (fd < 0 && errno == ENOENT) {
+        char lower[128];
+        size_t i;
+
+        for (i = 0; path[i] != '\0' && i + 1 < sizeof(lower); i++)
+            lower[i] = tolower((unsigned char) path[i]);
+
+        lower[i] = '\0';
+        fd = open(lower, flags, 0644);
+    }
+
+    return fd;
+}
+
+static void
+dos_open(struct emu86_dos *m, bool create)
+{
+    struct emu86 *const cpu = &m->cpu;
+    char path[128];
+    unsigned h;
+
+    for (h = FIRST_FILE; h < EMU86_DOS_MAX_FILES; h++) {
+        if (m->files[h] == -1)
+            break;
+    }
+
+    if (h == EMU86_DOS_MAX_FILES) {
+        dos_fail(m, DOS_TOO_MANY_FILES);
+        return;
+    }
+
+    host_path(m, cpu->sregs[DS], cpu->regs[DX], path, sizeof(path));
+
+    static const int modes[3] = { O_RDONLY, O_WRONLY, O_RDWR };
+    const int flags = create
+        ? O_RDWR | O_CREAT | O_TRUNC : modes[(AL(m) & 3) < 3 ? AL(m) & 3 : 0];
+    const int fd = open_host(path, flags);
+
+    if (fd < 0) {
+        dos_fail(m, errno == ENOENT ? DOS_NOT_FOUND : DOS_ACCESS_DENIED);
+        return;
+    }
+
+    m->files[h] = fd;
+    cpu->regs[AX] = h;
+    dos_ok(m);
+}
+
+/**
+ * Get the host descriptor of a DOS handle.
+ *
+ * \return
+ * The descriptor, \c FILE_DEVICE for one of the standard devices, or -1 if
+ * the handle is not open.
+ */
+static int
+handle_fd(const struct emu86_dos *m, uint16_t h)
+{
+    return h < EMU86_DOS_MAX_FILES ? m->files[h] : -1;
+}
+
+static void
+dos_read(struct emu86_dos *m)
+{
+    struct emu86 *const cpu = &m->cpu;
+    const int fd = handle_fd(m, cpu->regs[BX]);
+    const uint32_t dst = emu86_linear(cpu->sregs[DS], cpu->regs[DX]);
+    uint16_t n = cpu->regs[CX];
+
+    if (fd == -1) {
+        dos_fail(m, DOS_BAD_HANDLE);
+        return;
+    }
+
+    /* There is never any console input. */
+    if (fd == FILE_DEVICE) {
+        cpu->regs[AX] = 0;
+        dos_ok(m);
+        return;
+    }
+
+    if (dst + n > EMU86_MEM_SIZE)
+        n = EMU86_MEM_SIZE - dst;
+
+    const ssize_t got = read(fd, &cpu->mem[dst], n);
+    if (got < 0) {
+        dos_fail(m, DOS_ACCESS_DENIED);
+        return;
+    }
+
+    cpu->regs[AX] = got;
+    dos_ok(m);
+}
+
+static void
+dos_write(struct emu86_dos *m)
+{
+    struct emu86 *const cpu = &m->cpu;
+    const uint16_t h = cpu->regs[BX];
+    const int fd = handle_fd(m, h);
+    const uint32_t src = emu86_linear(cpu->sregs[DS], cpu->regs[DX]);
+    uint16_t n = cpu->regs[CX];
+
+    if (fd == -1) {
+        dos_fail(m, DOS_BAD_HANDLE);
+        return;
+    }
+
+    if (src + n > EMU86_MEM_SIZE)
+        n = EMU86_MEM_SIZE - src;
+
+    if (fd == FILE_DEVICE) {
+        if (h == 1 || h == 2)
+            print(m, (const char *) &cpu->mem[src], n);
+
+        cpu->regs[AX] = n;
+        dos_ok(m);
+        return;
+    }
+
+    /* A write of zero bytes truncates the file at the current position. */
+    if (n == 0) {
+        const off_t pos = lseek(fd, 0, SEEK_CUR);
+
+        if (pos < 0 || ftruncate(fd, pos) != 0) {
+            dos_fail(m, DOS_ACCESS_DENIED);
+            return;
+        }
+
+        cpu->regs[AX] = 0;
+        dos_ok(m);
+        return;
+    }
+
+    const ssize_t put = write(fd, &cpu->mem[src], n);
+    if (put < 0) {
+        dos_fail(m, DOS_ACCESS_DENIED);
+        return;
+    }
+
+    cpu->regs[AX] = put;
+    dos_ok(m);
+}
+
+static void
+dos_seek(struct emu86_dos *m)
+{
+    struct emu86 *const cpu = &m->cpu;
+    const int fd = handle_fd(m, cpu->regs[BX]);
+    static const int whence[3] = { SEEK_SET, SEEK_CUR, SEEK_END };
+
+    if (fd == -1 || AL(m) > 2) {
+        dos_fail(m, fd == -1 ? DOS_BAD_HANDLE : DOS_BAD_FUNCTION);
+        return;
+    }
+
+    if (fd == FILE_DEVICE) {
+        cpu->regs[AX] = 0;
+        cpu->regs[DX] = 0;
+        dos_ok(m);
+        return;
+    }
+
+    /* The offset is signed for SEEK_CUR and SEEK_END. */
+    const int32_t off = (int32_t)(cpu->regs[DX] |
+                                  ((uint32_t) cpu->regs[CX] << 16));
+    const off_t pos = lseek(fd, AL(m) == 0 ? (off_t)(uint32_t) off : off,
+                            whence[AL(m)]);
+
+    if (pos < 0) {
+        dos_fail(m, DOS_ACCESS_DENIED);
+        return;
+    }
+
+    cpu->regs[AX] = pos & 0xffff;
+    cpu->regs[DX] = (pos >> 16) & 0xffff;
+    dos_ok(m);
+}
+
+static void
+dos_ioctl(struct emu86_dos *m)
+{
+    struct emu86 *const cpu = &m->cpu;
+    const int fd = handle_fd(m, cpu->regs[BX]);
+
+    if (AL(m) > 1) {
+        dos_fail(m, DOS_BAD_FUNCTION);
+        return;
+    }
+
+    if (fd == -1) {
+        dos_fail(m, DOS_BAD_HANDLE);
+        return;
+    }
+
+    /* A character device that is the console, or a file on drive C:. */
+    if (AL(m) == 0)
+        cpu->regs[DX] = fd == FILE_DEVICE ? 0x80d3 : 0x0002;
+
+    dos_ok(m);
+}
+
+/**
+ * Find the largest free run of paragraphs.
+ *
+ * \param seg Start of the run.
+ *
+ * \return
+ * Size of the run.
+ */
+static uint16_t
+largest_free(const struct emu86_dos *m, uint16_t *seg)
+{
+    uint16_t best = 0;
+    uint16_t start = PSP_SEG;
+
+    *seg = 0;
+
+    for (unsigned i = 0; i <= m->block_count; i++) {
+        const uint16_t end = i < m->block_count ? m->blocks[i].seg : MEM_TOP;
+
+        if (end > start && end - start > best) {
+            best = end - start;
+            *seg = start;
+        }
+
+        if (i < m->block_count)
+            start = m->blocks[i].seg + m->blocks[i].paras;
+    }
+
+    return best;
+}
+
+static int
+find_block(const struct emu86_dos *m, uint16_t seg)
+{
+    for (unsigned i = 0; i < m->block_count; i++) {
+        if (m->blocks[i].seg == seg)
+            return i;
+    }
+
+    return -1;
+}
+
+static void
+dos_alloc(struct emu86_dos *m)
+{
+    struct emu86 *const cpu = &m->cpu;
+    const uint16_t paras = cpu->regs[BX];
+    uint16_t start = PSP_SEG;
+    unsigned i;
+
+    /* First fit, as DOS does by default. */
+    for (i = 0; i <= m->block_count; i++) {
+        const uint16_t end = i < m->block_count ? m->blocks[i].seg : MEM_TOP;
+
+        if (end >= start && end - start >= paras)
+            break;
+
+        if (i < m->block_count)
+            start = m->blocks[i].seg + m->blocks[i].paras;
+    }
+
+    if (i > m->block_count || m->block_count == EMU86_DOS_MAX_BLOCKS ||
+        paras == 0) {
+        uint16_t seg;
+
+        cpu->regs[BX] = largest_free(m, &seg);
+        dos_fail(m, DOS_NO_MEMORY);
+        return;
+    }
+
+    memmove(&m->blocks[i + 1], &m->blocks[i],
+            (m->block_count - i) * sizeof(m->blocks[0]));
+    m->blocks[i].seg = start;
+    m->blocks[i].paras = paras;
+    m->block_count++;
+
+    cpu->regs[AX] = start;
+    dos_ok(m);
+}
+
+static void
+dos_free(struct emu86_dos *m)
+{
+    const int i = find_block(m, m->cpu.sregs[ES]);
+
+    if (i < 0) {
+        dos_fail(m, DOS_BAD_BLOCK);
+        return;
+    }
+
+    memmove(&m->blocks[i], &m->blocks[i + 1],
+            (m->block_count - i - 1) * sizeof(m->blocks[0]));
+    m->block_count--;
+    dos_ok(m);
+}
+
+static void
+dos_resize(struct emu86_dos *m)
+{
+    struct emu86 *const cpu = &m->cpu;
+    const int i = find_block(m, cpu->sregs[ES]);
+
+    if (i < 0) {
+        dos_fail(m, DOS_BAD_BLOCK);
+        return;
+    }
+
+    const uint16_t end = (unsigned) i + 1 < m->block_count
+        ? m->blocks[i + 1].seg : MEM_TOP;
+    const uint16_t room = end - m->blocks[i].seg;
+
+    if (cpu->regs[BX] > room) {
+        cpu->regs[BX] = room;
+        dos_fail(m, DOS_NO_MEMORY);
+        return;
+    }
+
+    m->blocks[i].paras = cpu->regs[BX];
+    dos_ok(m);
+}
+
+static void
+dos_exit(struct emu86_dos *m, int code)
+{
+    m->exit_code = code;
+    m->exited = true;
+    emu86_stop(&m->cpu);
+}
+
+static void
+int_21(struct emu86_dos *m)
+{
+    struct emu86 *const cpu = &m->cpu;
+
+    switch (AH(m)) {
+    case 0x00:                  /* Terminate */
+        dos_exit(m, 0);
+        break;
+
+    case 0x01:                  /* Read character with echo */
+    case 0x07:                  /* Direct character input */
+    case 0x08:                  /* Character input */
+        /* Nobody is at the keyboard. Esc stops whatever is waiting. */
+        set_al(m, 0x1b);
+        break;
+
+    case 0x02:                  /* Display character */
+        print_char(m, cpu->regs[DX] & 0xff);
+        break;
+
+    case 0x06:                  /* Direct console I/O */
+        if ((cpu->regs[DX] & 0xff) == 0xff) {
+            set_al(m, 0);
+            set_return_flag(m, EMU86_ZF, true);
+        } else {
+            print_char(m, cpu->regs[DX] & 0xff);
+        }
+        break;
+
+    case 0x09: {                /* Display string */
+        uint16_t off = cpu->regs[DX];
+        uint8_t c;
+
+        while ((c = emu86_read8(cpu, cpu->sregs[DS], off++)) != '$')
+            print_char(m, c);
+        break;
+    }
+
+    case 0x0b:                  /* Check input status */
+        set_al(m, 0x00);
+        break;
+
+    case 0x0e:                  /* Select drive */
+        set_al(m, 26);
+        break;
+
+    case 0x19:                  /* Get current drive */
+        set_al(m, 2);
+        break;
+
+    case 0x1a:                  /* Set DTA */
+    case 0x33:                  /* Get or set Ctrl-Break checking */
+        cpu->regs[DX] &= 0xff00;
+        break;
+
+    case 0x25:                  /* Set interrupt vector */
+        emu86_write16(cpu, 0, AL(m) * 4, cpu->regs[DX]);
+        emu86_write16(cpu, 0, AL(m) * 4 + 2, cpu->sregs[DS]);
+        break;
+
+    case 0x2a:                  /* Get date: Monday, January 1, 2024. */
+        cpu->regs[CX] = 2024;
+        cpu->regs[DX] = 0x0101;
+        set_al(m, 1);
+        break;
+
+    case 0x2c: {                /* Get time, from the tick count. */
+        const uint32_t cs = (uint32_t)((uint64_t) bios_ticks(m) * 1080 *
+                                       100 / 19663);
+
+        cpu->regs[CX] = ((cs / 360000) << 8) | ((cs / 6000) % 60);
+        cpu->regs[DX] = (((cs / 100) % 60) << 8) | (cs % 100);
+        break;
+    }
+
+    case 0x30:                  /* Get DOS version: 5.0 */
+        cpu->regs[AX] = 0x0005;
+        cpu->regs[BX] = 0;
+        cpu->regs[CX] = 0;
+        break;
+
+    case 0x31:                  /* Terminate and stay resident */
+        fprintf(stderr, "The program tried to stay resident.\n");
+        dos_exit(m, AL(m));
+        break;
+
+    case 0x35:                  /* Get interrupt vector */
+        cpu->regs[BX] = emu86_read16(cpu, 0, AL(m) * 4);
+        cpu->sregs[ES] = emu86_read16(cpu, 0, AL(m) * 4 + 2);
+        break;
+
+    case 0x3c:                  /* Create file */
+        dos_open(m, true);
+        break;
+
+    case 0x3d:                  /* Open file */
+        dos_open(m, false);
+        break;
+
+    case 0x3e: {                /* Close file */
+        const int fd = handle_fd(m, cpu->regs[BX]);
+
+        if (fd == -1) {
+            dos_fail(m, DOS_BAD_HANDLE);
+            break;
+        }
+
+        if (fd != FILE_DEVICE)
+            close(fd);
+
+        m->files[cpu->regs[BX]] = -1;
+        dos_ok(m);
+        break;
+    }
+
+    case 0x3f:                  /* Read */
+        dos_read(m);
+        break;
+
+    case 0x40:                  /* Write */
+        dos_write(m);
+        break;
+
+    case 0x41: {                /* Delete file */
+        char path[128];
+
+        host_path(m, cpu->sregs[DS], cpu->regs[DX], path, sizeof(path));
+        if (unlink(path) != 0)
+            dos_fail(m, errno == ENOENT ? DOS_NOT_FOUND : DOS_ACCESS_DENIED);
+        else
+            dos_ok(m);
+        break;
+    }
+
+    case 0x42:                  /* Seek */
+        dos_seek(m);
+        break;
+
+    case 0x44:                  /* IOCTL */
+        dos_ioctl(m);
+        break;
+
+    case 0x47:                  /* Get current directory: the root. */
+        emu86_write8(cpu, cpu->sregs[DS], cpu->regs[SI], 0);
+        cpu->regs[AX] = 0x0100;
+        dos_ok(m);
+        break;
+
+    case 0x48:                  /* Allocate memory */
+        dos_alloc(m);
+        break;
+
+    case 0x49:                  /* Free memory */
+        dos_free(m);
+        break;
+
+    case 0x4a:                  /* Resize memory block */
+        dos_resize(m);
+        break;
+
+    case 0x4c:                  /* Terminate with return code */
+        dos_exit(m, AL(m));
+        break;
+
+    case 0x4e:                  /* Find first */
+    case 0x4f:                  /* Find next */
+        dos_fail(m, DOS_NO_MORE_FILES);
+        break;
+
+    case 0x51:                  /* Get PSP */
+    case 0x62:
+        cpu->regs[BX] = m->psp;
+        break;
+
+    default:
+        if (!m->unknown[AH(m)]) {
+            fprintf(stderr, "INT 21h function %02xh is not emulated.\n",
+                    AH(m));
+            m->unknown[AH(m)] = true;
+        }
+
+        dos_fail(m, DOS_BAD_FUNCTION);
+        break;
+    }
+}
+
+static void
+trap(void *ctx, struct emu86 *cpu, uint8_t n)
+{
+    struct emu86_dos *const m = ctx;
+
+    switch (n) {
+    case 0x10:                  /* Video */
+        if (AH(m) == 0x0e)
+            print_char(m, AL(m));
+        else if (AH(m) == 0x0f)
+            cpu->regs[AX] = 0x5003;
+        break;
+
+    case 0x11:                  /* Equipment list */
+        cpu->regs[AX] = emu86_read16(cpu, BDA_SEG, 0x10);
+        break;
+
+    case 0x12:                  /* Memory size */
+        cpu->regs[AX] = emu86_read16(cpu, BDA_SEG, 0x13);
+        break;
+
+    case 0x16:                  /* Keyboard. No key is ever pressed. */
+        if ((AH(m) & 0xef) == 0x01)
+            set_return_flag(m, EMU86_ZF, true);
+        else if ((AH(m) & 0xef) == 0x00)
+            cpu->regs[AX] = 0x011b;
+        break;
+
+    case 0x1a:                  /* Time of day */
+        if (AH(m) == 0x00) {
+            const uint32_t ticks = bios_ticks(m);
+
+            cpu->regs[CX] = ticks >> 16;
+            cpu->regs[DX] = ticks & 0xffff;
+            set_al(m, 0);
+        }
+        break;
+
+    case 0x20:
+        dos_exit(m, 0);
+        break;
+
+    case 0x21:
+        int_21(m);
+        break;
+
+    default:
+        /* Anything else, such as INT 2Fh, finds nothing installed. */
+        break;
+    }
+}
+
+bool
+emu86_dos_init(struct emu86_dos *m, unsigned osc_div)
+{
+    memset(m, 0, sizeof(*m));
+
+    m->cpu.mem = calloc(1, EMU86_MEM_SIZE + EMU86_MEM_SLACK);
+    if (m->cpu.mem == NULL)
+        return false;
+
+    m->osc_div = osc_div;
+    m->cpu.bus8 = true;
+    m->cpu.io.ctx = m;
+    m->cpu.io.in = port_in;
+    m->cpu.io.out = port_out;
+    m->cpu.io.trap = trap;
+    emu86_reset(&m->cpu);
+
+    for (unsigned i = 0; i < EMU86_DOS_MAX_FILES; i++)
+        m->files[i] = i < FIRST_FILE ? FILE_DEVICE : -1;
+
+    for (unsigned i = 0; i < 256; i++) {
+        const uint16_t stub = STUB_OFFSET + 3 * i;
+
+        emu86_write16(&m->cpu, 0, i * 4, stub);
+        emu86_write16(&m->cpu, 0, i * 4 + 2, STUB_SEG);
+        emu86_write8(&m->cpu, STUB_SEG, stub, 0x0f);
+        emu86_write8(&m->cpu, STUB_SEG, stub + 1, i);
+        emu86_write8(&m->cpu, STUB_SEG, stub + 2, 0xcf);
+    }
+
+    /* Two floppy drives, 80 column color video, and 640KiB. The model byte
+     * is that of a PC.
+     */
+    emu86_write16(&m->cpu, BDA_SEG, 0x10, 0x0061);
+    emu86_write16(&m->cpu, BDA_SEG, 0x13, 640);
+    emu86_write8(&m->cpu, STUB_SEG, 0xfffe, 0xff);
+
+    m->pic_mask = 0xbc;
+    update_ticks(m);
+    return true;
+}
+
+void
+emu86_dos_free(struct emu86_dos *m)
+{
+    for (unsigned i = FIRST_FILE; i < EMU86_DOS_MAX_FILES; i++) {
+        if (m->files[i] >= 0)
+            close(m->files[i]);
+    }
+
+    free(m->cpu.mem);
+    free(m->output);
+    free(m->ports);
+}
+
+bool
+emu86_dos_load(struct emu86_dos *m, const uint8_t *exe, size_t size,
+               const char *name, const char *tail)
+{
+    struct emu86 *const cpu = &m->cpu;
+    struct mz_header h;
+
+    if (size < 0x1c || (le16(exe) != 0x5a4d && le16(exe) != 0x4d5a))
+        return false;
+
+    h.last_page_bytes = le16(exe + 0x02);
+    h.pages = le16(exe + 0x04);
+    h.relocations = le16(exe + 0x06);
+    h.header_paras = le16(exe + 0x08);
+    h.min_alloc = le16(exe + 0x0a);
+    h.ss = le16(exe + 0x0e);
+    h.sp = le16(exe + 0x10);
+    h.ip = le16(exe + 0x14);
+    h.cs = le16(exe + 0x16);
+    h.relocation_offset = le16(exe + 0x18);
+
+    const uint32_t header_bytes = (uint32_t) h.header_paras * 16;
+    uint32_t end = (uint32_t) h.pages * 512;
+
+    if (h.last_page_bytes != 0)
+        end -= 512 - h.last_page_bytes;
+
+    if (end > size || header_bytes > end ||
+        h.relocation_offset + 4ul * h.relocations > size)
+        return false;
+
+    const uint16_t load_seg = PSP_SEG + 0x10;
+    const uint32_t image = end - header_bytes;
+
+    if ((uint32_t) load_seg * 16 + image + (uint32_t) h.min_alloc * 16 >
+        (uint32_t) MEM_TOP * 16)
+        return false;
+
+    memcpy(&cpu->mem[(uint32_t) load_seg * 16], exe + header_bytes, image);
+
+    for (unsigned i = 0; i < h.relocations; i++) {
+        const uint8_t *const r = exe + h.relocation_offset + 4 * i;
+        const uint16_t seg = load_seg + le16(r + 2);
+        const uint16_t off = le16(r);
+
+        emu86_write16(cpu, seg, off, emu86_read16(cpu, seg, off) + load_seg);
+    }
+
+    /* The environment holds only COMSPEC, followed by the program name. */
+    static const char comspec[] = "COMSPEC=C:\\COMMAND.COM";
+    uint16_t off = 0;
+
+    for (const char *p = comspec; *p != '\0'; p++)
+        emu86_write8(cpu, ENV_SEG, off++, *p);
+
+    emu86_write8(cpu, ENV_SEG, off++, 0);
+    emu86_write8(cpu, ENV_SEG, off++, 0);
+    emu86_write16(cpu, ENV_SEG, off, 1);
+    off += 2;
+    for (const char *p = name; *p != '\0' && off < ENV_PARAS * 16 - 1; p++)
+        emu86_write8(cpu, ENV_SEG, off++, *p);
+
+    emu86_write8(cpu, ENV_SEG, off, 0);
+
+    /* PSP */
+    const size_t tail_len = strlen(tail) != 0 ? strlen(tail) + 1 : 0;
+
+    if (tail_len > 127)
+        return false;
+
+    m->psp = PSP_SEG;
+    emu86_write16(cpu, PSP_SEG, 0x00, 0x20cd);
+    emu86_write16(cpu, PSP_SEG, 0x02, MEM_TOP);
+    emu86_write16(cpu, PSP_SEG, 0x16, PSP_SEG);
+    emu86_write16(cpu, PSP_SEG, 0x2c, ENV_SEG);
+    emu86_write8(cpu, PSP_SEG, 0x80, tail_len);
+    if (tail_len != 0) {
+        emu86_write8(cpu, PSP_SEG, 0x81, ' ');
+        for (size_t i = 0; i < tail_len - 1; i++)
+            emu86_write8(cpu, PSP_SEG, 0x82 + i, tail[i]);
+    }
+
+    emu86_write8(cpu, PSP_SEG, 0x81 + tail_len, 0x0d);
+
+    m->blocks[0].seg = ENV_SEG;
+    m->blocks[0].paras = ENV_PARAS;
+    m->blocks[1].seg = PSP_SEG;
+    m->blocks[1].paras = MEM_TOP - PSP_SEG;
+    m->block_count = 2;
+
+    cpu->sregs[CS] = load_seg + h.cs;
+    cpu->ip = h.ip;
+    cpu->sregs[SS] = load_seg + h.ss;
+    cpu->regs[SP] = h.sp;
+    cpu->sregs[DS] = PSP_SEG;
+    cpu->sregs[ES] = PSP_SEG;
+    cpu->flags = 0xf202;
+    return true;
+}
+
+enum emu86_status
+emu86_dos_run(struct emu86_dos *m, uint64_t max_cycles)
+{
+    const uint64_t end = m->cpu.cycles + max_cycles;
+
+    while (m->cpu.cycles < end && emu86_step(&m->cpu)) {
+        if (m->cpu.cycles >= m->next_tick)
+            update_ticks(m);
+    }
+
+    if (m->exited)
+        return EMU86_STOPPED;
+
+    return m->cpu.status;
+}
+
+void
+emu86_dos_write_trace(const struct emu86_dos *m, FILE *fp)
+{
+    fprintf(fp, "# time (1.193182MHz clocks), direction, port, value, "
+            "CPU clocks\n");
+
+    for (size_t i = 0; i < m->port_count; i++) {
+        const struct emu86_port_access *const a = &m->ports[i];
+
+        fprintf(fp, "%llu %c %03x %02x %llu\n",
+                (unsigned long long) emu86_dos_pit_clocks(m, a->cycles),
+                a->is_write ? 'w' : 'r', a->port, a->value,
+                (unsigned long long) a->cycles);
+    }
+}
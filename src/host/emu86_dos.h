@@ -0,0 +1,176 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef EMU86_DOS_H
+#define EMU86_DOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "emu86.h"
+
+/**
+ * \file
+ * Just enough of a PC and of DOS to run vgmplay.exe under \c emu86.
+ *
+ * The BIOS and DOS services that the Open Watcom runtime and the player use
+ * run on the host. Each interrupt vector points at a three byte stub in
+ * segment f000 that traps to the host and then returns with IRET. A service
+ * takes only the time of its INT and IRET, which is far less than the real
+ * BIOS or DOS would take. The player does not call any of them while it is
+ * playing.
+ *
+ * Ports 40h through 43h are a PIT channel 0 that counts from the CPU
+ * clock. The BIOS tick count at 0040:006c and INT 1Ah follow it, as if
+ * IRQ 0 were taken at each reload, but no hardware interrupt is ever
+ * delivered. Everything else on the I/O bus reads as ffh and ignores
+ * writes.
+ *
+ * Every port access is recorded with the cycle count at which it was made.
+ */
+
+/* Frequency of the crystal that drives both the CPU and the PIT. */
+#define EMU86_OSC_HZ 14318180ul
+
+/* Divisors of \c EMU86_OSC_HZ for the CPU clock. The PIT always runs at
+ * the crystal divided by 12.
+ */
+#define EMU86_DIV_4_77MHZ 3     /* IBM PC, XT, and Tandy 1000 */
+#define EMU86_DIV_7_16MHZ 2     /* Tandy 1000 SX and HX, and "turbo" XTs */
+
+#define EMU86_DOS_MAX_FILES 20
+#define EMU86_DOS_MAX_BLOCKS 32
+
+struct emu86_port_access {
+    /** CPU clocks since the program started. */
+    uint64_t cycles;
+
+    uint16_t port;
+    uint8_t value;
+    bool is_write;
+};
+
+struct emu86_dos {
+    struct emu86 cpu;
+
+    /** The CPU clock is \c EMU86_OSC_HZ divided by this. */
+    unsigned osc_div;
+
+    /** Copy everything the program prints to stdout. */
+    bool echo;
+
+    /** Everything the program has printed, terminated. */
+    char *output;
+    size_t output_size;
+    size_t output_cap;
+
+    struct emu86_port_access *ports;
+    size_t port_count;
+    size_t port_cap;
+
+    /** Exit code, once \c exited is set. */
+    int exit_code;
+    bool exited;
+
+    /** Host file descriptors, indexed by DOS handle, or -1. */
+    int files[EMU86_DOS_MAX_FILES];
+
+    /** Allocated memory blocks, sorted by segment. */
+    struct {
+        uint16_t seg;
+        uint16_t paras;
+    } blocks[EMU86_DOS_MAX_BLOCKS];
+    unsigned block_count;
+
+    uint16_t psp;
+
+    /** Last values written to port 21h (the PIC mask) and port 61h. */
+    uint8_t pic_mask;
+    uint8_t port_b;
+
+    /** PIT channel 0. */
+    struct {
+        /** Reload value. Zero means 65536. */
+        uint16_t reload;
+
+        /** Value written to the low byte, while waiting for the high. */
+        uint8_t low;
+        bool have_low;
+
+        /** Latched count, and which of its bytes is read next. */
+        uint16_t latch;
+        bool latched;
+        bool read_high;
+    } pit;
+
+    /** CPU clock at which the BIOS tick count next changes. */
+    uint64_t next_tick;
+
+    /** DOS functions that were called but are not handled. */
+    bool unknown[256];
+};
+
+/**
+ * Set up a machine with 640KiB of memory and no program.
+ *
+ * \param osc_div See \c osc_div.
+ *
+ * \return
+ * False if memory could not be allocated.
+ */
+bool emu86_dos_init(struct emu86_dos *m, unsigned osc_div);
+
+void emu86_dos_free(struct emu86_dos *m);
+
+/**
+ * Load an MZ executable as DOS would, with a PSP and an environment.
+ *
+ * \param name Program name stored in the environment, such as
+ *             "C:\VGMPLAY.EXE".
+ * \param tail Command line after the program name, without the leading
+ *             space. At most 126 characters.
+ *
+ * \return
+ * False if the data is not an MZ executable that fits in memory.
+ */
+bool emu86_dos_load(struct emu86_dos *m, const uint8_t *exe, size_t size,
+                    const char *name, const char *tail);
+
+/**
+ * Run the loaded program until it exits, stops, or runs for \c max_cycles
+ * CPU clocks.
+ *
+ * \return
+ * \c EMU86_STOPPED if the program exited, \c EMU86_RUNNING if it ran out of
+ * time, or the status that stopped the CPU.
+ */
+enum emu86_status emu86_dos_run(struct emu86_dos *m, uint64_t max_cycles);
+
+/**
+ * Convert CPU clocks to PIT input clocks (1.193182MHz).
+ */
+static inline uint64_t
+emu86_dos_pit_clocks(const struct emu86_dos *m, uint64_t cycles)
+{
+    return (cycles * m->osc_div) / 12;
+}
+
+/**
+ * Get the CPU clock frequency in Hz.
+ */
+static inline double
+emu86_dos_cpu_hz(const struct emu86_dos *m)
+{
+    return (double) EMU86_OSC_HZ / m->osc_div;
+}
+
+/**
+ * Write the recorded port accesses in the format of VGMPLAY.TRC, followed
+ * by the CPU clock of each access.
+ */
+void emu86_dos_write_trace(const struct emu86_dos *m, FILE *fp);
+
+#endif /* ifndef EMU86_DOS_H */
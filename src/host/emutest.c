@@ -0,0 +1,455 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Self-test of the 8086 interpreter and of the DOS machine that vgmemu runs
+ * vgmplay.exe in.
+ *
+ * The programs are hand assembled, with the source in the comments. The
+ * expected cycle counts are sums of the documented 8086 clocks, plus 4 for
+ * each word transferred over the 8088's bus.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emu86.h"
+#include "emu86_dos.h"
+
+#define CODE_SEG 0x1000
+#define DATA_SEG 0x2000
+
+static unsigned failures = 0;
+
+static void
+check(bool ok, const char *name, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s: %s\n", name, what);
+        failures++;
+    }
+}
+
+static void
+check_eq(unsigned long long got, unsigned long long want, const char *name,
+         const char *what)
+{
+    if (got != want) {
+        printf("FAIL: %s: %s = %llu (0x%llx), expected %llu (0x%llx)\n",
+               name, what, got, got, want, want);
+        failures++;
+    }
+}
+
+/**
+ * Run code at CODE_SEG:0000 until it halts or stops.
+ */
+static void
+run(struct emu86 *cpu, const uint8_t *code, size_t size)
+{
+    emu86_reset(cpu);
+    memcpy(&cpu->mem[CODE_SEG * 16], code, size);
+
+    cpu->sregs[CS] = CODE_SEG;
+    cpu->sregs[DS] = DATA_SEG;
+    cpu->sregs[ES] = DATA_SEG;
+    cpu->sregs[SS] = DATA_SEG;
+    cpu->regs[SP] = 0xfffe;
+
+    for (unsigned i = 0; i < 100000 && emu86_step(cpu); i++)
+        /* empty */ ;
+}
+
+static void
+test_cycles(struct emu86 *cpu)
+{
+    /* mov $10, %cx ; 1: loop 1b ; hlt */
+    static const uint8_t loop[] = { 0xb9, 0x0a, 0x00, 0xe2, 0xfe, 0xf4 };
+    /* push %ax ; pop %bx ; hlt */
+    static const uint8_t push_pop[] = { 0x50, 0x5b, 0xf4 };
+    /* mov %ax, 4(%bx,%si) ; hlt */
+    static const uint8_t ea[] = { 0x89, 0x40, 0x04, 0xf4 };
+    /* mov $0x100, %si ; mov $0x200, %di ; mov $5, %cx ; cld ;
+     * rep movsb ; hlt
+     */
+    static const uint8_t rep[] = {
+        0xbe, 0x00, 0x01, 0xbf, 0x00, 0x02, 0xb9, 0x05, 0x00, 0xfc,
+        0xf3, 0xa4, 0xf4
+    };
+
+    run(cpu, loop, sizeof(loop));
+    check_eq(cpu->status, EMU86_HALTED, "loop", "status");
+    check_eq(cpu->cycles, 4 + 9 * 17 + 5 + 2, "loop", "cycles");
+    check_eq(cpu->instructions, 12, "loop", "instructions");
+    check_eq(cpu->op_count[0xe2], 10, "loop", "LOOP count");
+    check_eq(cpu->op_cycles[0xe2], 9 * 17 + 5, "loop", "LOOP cycles");
+
+    /* Each word on the stack costs 4 more clocks on an 8088. */
+    cpu->bus8 = true;
+    run(cpu, push_pop, sizeof(push_pop));
+    check_eq(cpu->cycles, (11 + 4) + (8 + 4) + 2, "push/pop 8088", "cycles");
+
+    cpu->bus8 = false;
+    run(cpu, push_pop, sizeof(push_pop));
+    check_eq(cpu->cycles, 11 + 8 + 2, "push/pop 8086", "cycles");
+
+    cpu->bus8 = true;
+    run(cpu, ea, sizeof(ea));
+    check_eq(cpu->cycles, (9 + 11 + 4) + 2, "mov disp8(bx,si)", "cycles");
+
+    memcpy(&cpu->mem[DATA_SEG * 16 + 0x100], "hello", 5);
+    run(cpu, rep, sizeof(rep));
+    check_eq(cpu->cycles, 4 + 4 + 4 + 2 + (2 + 9 + 5 * 17) + 2,
+             "rep movsb", "cycles");
+    check(memcmp(&cpu->mem[DATA_SEG * 16 + 0x200], "hello", 5) == 0,
+          "rep movsb", "copied data");
+    check_eq(cpu->regs[CX], 0, "rep movsb", "CX");
+    check_eq(cpu->regs[SI], 0x105, "rep movsb", "SI");
+}
+
+static void
+test_alu(struct emu86 *cpu)
+{
+    const uint16_t arith = EMU86_CF | EMU86_PF | EMU86_AF | EMU86_ZF |
+        EMU86_SF | EMU86_OF;
+
+    /* mov $0x7fff, %ax ; mov $1, %bx ; add %bx, %ax ; hlt */
+    static const uint8_t add[] = {
+        0xb8, 0xff, 0x7f, 0xbb, 0x01, 0x00, 0x01, 0xd8, 0xf4
+    };
+    run(cpu, add, sizeof(add));
+    check_eq(cpu->regs[AX], 0x8000, "add", "AX");
+    check_eq(cpu->flags & arith,
+             EMU86_PF | EMU86_AF | EMU86_SF | EMU86_OF, "add", "flags");
+
+    /* mov $0, %al ; mov $1, %bl ; sub %bl, %al ; hlt */
+    static const uint8_t sub[] = {
+        0xb0, 0x00, 0xb3, 0x01, 0x28, 0xd8, 0xf4
+    };
+    run(cpu, sub, sizeof(sub));
+    check_eq(cpu->regs[AX] & 0xff, 0xff, "sub", "AL");
+    check_eq(cpu->flags & arith,
+             EMU86_CF | EMU86_PF | EMU86_AF | EMU86_SF, "sub", "flags");
+
+    /* mov $0x15, %al ; add $0x27, %al ; daa ; hlt */
+    static const uint8_t daa[] = { 0xb0, 0x15, 0x04, 0x27, 0x27, 0xf4 };
+    run(cpu, daa, sizeof(daa));
+    check_eq(cpu->regs[AX] & 0xff, 0x42, "daa", "AL");
+    check_eq(cpu->flags & EMU86_CF, 0, "daa", "CF");
+
+    /* mov $0x81, %al ; shl $1, %al ; hlt */
+    static const uint8_t shl[] = { 0xb0, 0x81, 0xd0, 0xe0, 0xf4 };
+    run(cpu, shl, sizeof(shl));
+    check_eq(cpu->regs[AX] & 0xff, 0x02, "shl", "AL");
+    check_eq(cpu->flags & (EMU86_CF | EMU86_OF), EMU86_CF | EMU86_OF, "shl",
+             "CF and OF");
+
+    /* stc ; mov $1, %al ; rcr $1, %al ; hlt */
+    static const uint8_t rcr[] = { 0xf9, 0xb0, 0x01, 0xd0, 0xd8, 0xf4 };
+    run(cpu, rcr, sizeof(rcr));
+    check_eq(cpu->regs[AX] & 0xff, 0x80, "rcr", "AL");
+    check_eq(cpu->flags & EMU86_CF, EMU86_CF, "rcr", "CF");
+
+    /* mov $-2, %al ; mov $3, %bl ; imul %bl ; hlt */
+    static const uint8_t imul[] = {
+        0xb0, 0xfe, 0xb3, 0x03, 0xf6, 0xeb, 0xf4
+    };
+    run(cpu, imul, sizeof(imul));
+    check_eq(cpu->regs[AX], 0xfffa, "imul", "AX");
+    check_eq(cpu->flags & (EMU86_CF | EMU86_OF), 0, "imul", "CF and OF");
+
+    /* mov $100, %ax ; mov $7, %bl ; div %bl ; hlt */
+    static const uint8_t div[] = {
+        0xb8, 0x64, 0x00, 0xb3, 0x07, 0xf6, 0xf3, 0xf4
+    };
+    run(cpu, div, sizeof(div));
+    check_eq(cpu->regs[AX], 0x020e, "div", "AX");
+
+    /* xor %dx, %dx ; mov $1, %ax ; xor %bx, %bx ; div %bx ; nop
+     *
+     * Vector 0 points at a HLT, and the return address pushed by the divide
+     * error is that of the NOP.
+     */
+    static const uint8_t diverr[] = {
+        0x31, 0xd2, 0xb8, 0x01, 0x00, 0x31, 0xdb, 0xf7, 0xf3, 0x90, 0xf4
+    };
+    emu86_write16(cpu, 0, 0, 0x000a);
+    emu86_write16(cpu, 0, 2, CODE_SEG);
+    run(cpu, diverr, sizeof(diverr));
+    check_eq(cpu->status, EMU86_HALTED, "divide error", "status");
+    check_eq(cpu->ip, 0x000b, "divide error", "IP");
+    check_eq(emu86_read16(cpu, DATA_SEG, 0xfffe - 6), 0x0009,
+             "divide error", "pushed IP");
+
+    /* mov $0x300, %di ; mov $4, %cx ; mov $0x42, %al ; cld ;
+     * repne scasb ; hlt
+     */
+    static const uint8_t scas[] = {
+        0xbf, 0x00, 0x03, 0xb9, 0x04, 0x00, 0xb0, 0x42, 0xfc, 0xf2,
+        0xae, 0xf4
+    };
+    memcpy(&cpu->mem[DATA_SEG * 16 + 0x300], "ABCD", 4);
+    run(cpu, scas, sizeof(scas));
+    check_eq(cpu->regs[DI], 0x302, "repne scasb", "DI");
+    check_eq(cpu->regs[CX], 2, "repne scasb", "CX");
+    check_eq(cpu->flags & EMU86_ZF, EMU86_ZF, "repne scasb", "ZF");
+
+    /* call 1f ; hlt ; 1: mov $0x1234, %dx ; ret */
+    static const uint8_t call[] = {
+        0xe8, 0x01, 0x00, 0xf4, 0xba, 0x34, 0x12, 0xc3
+    };
+    run(cpu, call, sizeof(call));
+    check_eq(cpu->regs[DX], 0x1234, "call", "DX");
+    check_eq(cpu->regs[SP], 0xfffe, "call", "SP");
+    check_eq(cpu->ip, 0x0004, "call", "IP");
+
+    /* xor %ax, %ax ; push %ax ; popf ; pushf ; pop %ax ; hlt
+     *
+     * Code that tells an 8086 from a 286 or 386 depends on this.
+     */
+    static const uint8_t flags[] = {
+        0x31, 0xc0, 0x50, 0x9d, 0x9c, 0x58, 0xf4
+    };
+    run(cpu, flags, sizeof(flags));
+    check_eq(cpu->regs[AX] & 0xf000, 0xf000, "pushf", "bits 12 to 15");
+
+    /* les 0x10, %bx ; hlt */
+    static const uint8_t les[] = { 0xc4, 0x1e, 0x10, 0x00, 0xf4 };
+    emu86_write16(cpu, DATA_SEG, 0x10, 0x5678);
+    emu86_write16(cpu, DATA_SEG, 0x12, 0x9abc);
+    run(cpu, les, sizeof(les));
+    check_eq(cpu->regs[BX], 0x5678, "les", "BX");
+    check_eq(cpu->sregs[ES], 0x9abc, "les", "ES");
+
+    /* push $0x1234, an 80186 instruction. */
+    static const uint8_t bad[] = { 0x68, 0x34, 0x12 };
+    run(cpu, bad, sizeof(bad));
+    check_eq(cpu->status, EMU86_BAD_OPCODE, "80186 opcode", "status");
+    check_eq(cpu->fault_ip, 0, "80186 opcode", "fault IP");
+}
+
+/*
+ *     .byte 0xb8            # mov $seg, %ax, relocated
+ *     .word 0
+ *     mov %ax, %ds
+ *     mov $msg, %dx
+ *     mov $9, %ah
+ *     int $0x21
+ *     mov $0, %ah
+ *     int $0x1a
+ *     mov $0x9f, %al
+ *     out %al, $0xc0
+ *     mov $0, %al           # latch PIT channel 0 and read it
+ *     out %al, $0x43
+ *     in $0x40, %al
+ *     in $0x40, %al
+ *     mov $name, %dx        # create a file and write 4 bytes
+ *     xor %cx, %cx
+ *     mov $0x3c, %ah
+ *     int $0x21
+ *     jc fail
+ *     mov %ax, %bx
+ *     mov $data, %dx
+ *     mov $4, %cx
+ *     mov $0x40, %ah
+ *     int $0x21
+ *     jc fail
+ *     mov $0x3e, %ah
+ *     int $0x21
+ *     mov $name, %dx        # open it again and read it back
+ *     mov $0x3d00, %ax
+ *     int $0x21
+ *     jc fail
+ *     mov %ax, %bx
+ *     mov $buf, %dx
+ *     mov $16, %cx
+ *     mov $0x3f, %ah
+ *     int $0x21
+ *     jc fail
+ *     cmp $4, %ax
+ *     jne fail
+ *     mov $0x3e, %ah
+ *     int $0x21
+ *     mov buf, %ax
+ *     cmp data, %ax
+ *     jne fail
+ *     mov $name, %dx
+ *     mov $0x41, %ah
+ *     int $0x21
+ *     mov $0x62, %ah        # shrink the program, then allocate and free
+ *     int $0x21
+ *     mov %bx, %es
+ *     mov $0x1000, %bx
+ *     mov $0x4a, %ah
+ *     int $0x21
+ *     jc fail
+ *     mov $0x100, %bx
+ *     mov $0x48, %ah
+ *     int $0x21
+ *     jc fail
+ *     mov %ax, %es
+ *     mov $0x49, %ah
+ *     int $0x21
+ *     jc fail
+ *     mov $0x4c03, %ax
+ *     int $0x21
+ * fail:
+ *     mov $0x4c01, %ax
+ *     int $0x21
+ * msg:  .ascii "hello$"
+ * name: .asciz "EMUTEST.TMP"
+ * data: .ascii "VGM!"
+ * buf:  .space 16
+ */
+static const uint8_t dos_code[] = {
+    0xb8, 0x00, 0x00, 0x8e, 0xd8, 0xba, 0x94, 0x00, 0xb4, 0x09, 0xcd, 0x21,
+    0xb4, 0x00, 0xcd, 0x1a, 0xb0, 0x9f, 0xe6, 0xc0, 0xb0, 0x00, 0xe6, 0x43,
+    0xe4, 0x40, 0xe4, 0x40, 0xba, 0x9a, 0x00, 0x31, 0xc9, 0xb4, 0x3c, 0xcd,
+    0x21, 0x72, 0x68, 0x89, 0xc3, 0xba, 0xa6, 0x00, 0xb9, 0x04, 0x00, 0xb4,
+    0x40, 0xcd, 0x21, 0x72, 0x5a, 0xb4, 0x3e, 0xcd, 0x21, 0xba, 0x9a, 0x00,
+    0xb8, 0x00, 0x3d, 0xcd, 0x21, 0x72, 0x4c, 0x89, 0xc3, 0xba, 0xaa, 0x00,
+    0xb9, 0x10, 0x00, 0xb4, 0x3f, 0xcd, 0x21, 0x72, 0x3e, 0x83, 0xf8, 0x04,
+    0x75, 0x39, 0xb4, 0x3e, 0xcd, 0x21, 0xa1, 0xaa, 0x00, 0x3b, 0x06, 0xa6,
+    0x00, 0x75, 0x2c, 0xba, 0x9a, 0x00, 0xb4, 0x41, 0xcd, 0x21, 0xb4, 0x62,
+    0xcd, 0x21, 0x8e, 0xc3, 0xbb, 0x00, 0x10, 0xb4, 0x4a, 0xcd, 0x21, 0x72,
+    0x16, 0xbb, 0x00, 0x01, 0xb4, 0x48, 0xcd, 0x21, 0x72, 0x0d, 0x8e, 0xc0,
+    0xb4, 0x49, 0xcd, 0x21, 0x72, 0x05, 0xb8, 0x03, 0x4c, 0xcd, 0x21, 0xb8,
+    0x01, 0x4c, 0xcd, 0x21, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x24, 0x45, 0x4d,
+    0x55, 0x54, 0x45, 0x53, 0x54, 0x2e, 0x54, 0x4d, 0x50, 0x00, 0x56, 0x47,
+    0x4d, 0x21, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+/**
+ * Wrap \c dos_code in an MZ header with one relocation, for the segment in
+ * its first instruction, and a stack after the code.
+ */
+static size_t
+make_exe(uint8_t *exe)
+{
+    const size_t size = 0x20 + sizeof(dos_code);
+
+    memset(exe, 0, 0x20);
+    exe[0] = 'M';
+    exe[1] = 'Z';
+    put16(exe + 0x02, size % 512);
+    put16(exe + 0x04, (size + 511) / 512);
+    put16(exe + 0x06, 1);           /* relocations */
+    put16(exe + 0x08, 2);           /* header paragraphs */
+    put16(exe + 0x0a, 0x30);        /* minimum allocation */
+    put16(exe + 0x0c, 0xffff);
+    put16(exe + 0x0e, 0x20);        /* SS */
+    put16(exe + 0x10, 0x100);       /* SP */
+    put16(exe + 0x14, 0);           /* IP */
+    put16(exe + 0x16, 0);           /* CS */
+    put16(exe + 0x18, 0x1c);        /* relocation table */
+    put16(exe + 0x1c, 1);           /* offset of the segment */
+    put16(exe + 0x1e, 0);
+
+    memcpy(exe + 0x20, dos_code, sizeof(dos_code));
+    return size;
+}
+
+static void
+test_dos(unsigned osc_div, const char *name)
+{
+    struct emu86_dos m;
+    uint8_t exe[0x20 + sizeof(dos_code)];
+
+    if (!emu86_dos_init(&m, osc_div)) {
+        check(false, name, "could not allocate memory");
+        return;
+    }
+
+    const size_t size = make_exe(exe);
+
+    check(emu86_dos_load(&m, exe, size, "C:\\EMUTEST.EXE", "a b"), name,
+          "load");
+    check(!emu86_dos_load(&m, exe, 0x10, "C:\\EMUTEST.EXE", ""), name,
+          "truncated file not rejected");
+
+    const enum emu86_status s = emu86_dos_run(&m, 1000000);
+
+    check_eq(s, EMU86_STOPPED, name, "status");
+    check(m.exited, name, "program did not exit");
+    check_eq(m.exit_code, 3, name, "exit code");
+    check(m.output != NULL && strcmp(m.output, "hello") == 0, name,
+          "output");
+
+    /* The relocated segment is right after the PSP, which is right after
+     * the environment.
+     */
+    const uint16_t psp = m.psp;
+
+    check_eq(emu86_read16(&m.cpu, psp + 0x10, 1), psp + 0x10, name,
+             "relocated segment");
+    check_eq(emu86_read8(&m.cpu, psp, 0x80), 4, name, "command tail length");
+    check(memcmp(&m.cpu.mem[psp * 16 + 0x81], " a b\r", 5) == 0, name,
+          "command tail");
+
+    /* mov (4), mov (2), mov (4), mov (4), INT 21h (51 + 8 for the vector
+     * + 12 for the pushes), IRET (24 + 12 for the pops), mov (4), INT 1Ah
+     * (71 + 36), mov (4), and the OUT (10). The write happens at the end
+     * of the OUT.
+     */
+    const uint64_t out_cycles = 4 + 2 + 4 + 4 + 107 + 4 + 107 + 4 + 10;
+
+    check(m.port_count >= 4, name, "port accesses");
+    if (m.port_count >= 4) {
+        check_eq(m.ports[0].port, 0xc0, name, "first port");
+        check_eq(m.ports[0].value, 0x9f, name, "first value");
+        check(m.ports[0].is_write, name, "first access is a write");
+        check_eq(m.ports[0].cycles, out_cycles, name, "cycles of the write");
+
+        /* The latch was taken at the end of the second OUT, 4 + 10 clocks
+         * after the first. Channel 0 counts down from 65536.
+         */
+        const uint16_t count = m.ports[2].value | (m.ports[3].value << 8);
+        const uint64_t pit =
+            emu86_dos_pit_clocks(&m, out_cycles + 4 + 10);
+
+        check_eq(count, (uint16_t)(0x10000 - pit), name, "latched count");
+    }
+
+    check(access("EMUTEST.TMP", F_OK) != 0, name, "file was not deleted");
+
+    emu86_dos_free(&m);
+}
+
+int
+main(void)
+{
+    struct emu86 cpu;
+
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.mem = calloc(1, EMU86_MEM_SIZE + EMU86_MEM_SLACK);
+    if (cpu.mem == NULL) {
+        printf("FAIL: could not allocate memory\n");
+        return EXIT_FAILURE;
+    }
+
+    test_cycles(&cpu);
+    test_alu(&cpu);
+    free(cpu.mem);
+
+    test_dos(EMU86_DIV_4_77MHZ, "DOS at 4.77MHz");
+    test_dos(EMU86_DIV_7_16MHZ, "DOS at 7.16MHz");
+
+    if (failures != 0) {
+        printf("%u checks failed.\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All checks passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Stress test of the event queue in evq.h with a producer thread and a
+ * consumer thread.
+ *
+ * The producer pushes a numbered sequence of events as fast as it can, and
+ * the consumer checks that every one arrives once, in order, and with all of
+ * its fields intact. A torn or reordered event means that the data of an
+ * event became visible after the index that publishes it. The ring is made
+ * very small, so that it is full or empty most of the time, and enough
+ * events are sent to wrap the 16-bit indices many times.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* A small ring makes the full and empty cases as common as possible. */
+#define EVQ_SIZE 8u
+#include "../evq.h"
+
+#define EVENTS 4000000ul
+
+static unsigned failures = 0;
+
+static void
+check(bool ok, const char *name, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s: %s\n", name, what);
+        failures++;
+    }
+}
+
+static void
+check_eq(unsigned long long got, unsigned long long want, const char *name,
+         const char *what)
+{
+    if (got != want) {
+        printf("FAIL: %s: %s = %llu, expected %llu\n", name, what, got,
+               want);
+        failures++;
+    }
+}
+
+/* Every field of an event is derived from its sequence number. */
+static uint16_t
+delay_of(unsigned long i)
+{
+    return (uint16_t) i;
+}
+
+static uint16_t
+port_of(unsigned long i)
+{
+    return (uint16_t)(i >> 16) ^ (uint16_t)(i * 40503u);
+}
+
+static uint8_t
+value_of(unsigned long i)
+{
+    return (uint8_t)((i * 2654435761u) >> 24);
+}
+
+struct stress {
+    struct evq q;
+
+    /** Number of times the producer found the queue full. */
+    unsigned long full;
+
+    /** Number of times the consumer found the queue empty. */
+    unsigned long empty;
+
+    /** First event received out of sequence, or \c EVENTS. */
+    unsigned long bad;
+};
+
+static void *
+producer(void *data)
+{
+    struct stress *const s = data;
+
+    for (unsigned long i = 0; i < EVENTS; i++) {
+        while (!evq_push(&s->q, delay_of(i), port_of(i), value_of(i))) {
+            s->full++;
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void *
+consumer(void *data)
+{
+    struct stress *const s = data;
+
+    for (unsigned long i = 0; i < EVENTS; i++) {
+        volatile struct evq_event *e;
+
+        while ((e = evq_peek(&s->q)) == NULL) {
+            s->empty++;
+            sched_yield();
+        }
+
+        if (s->bad == EVENTS &&
+            (e->delay != delay_of(i) || e->port != port_of(i) ||
+             e->value != value_of(i)))
+            s->bad = i;
+
+        evq_pop(&s->q);
+    }
+
+    return NULL;
+}
+
+static void
+test_single_thread(void)
+{
+    static const char name[] = "one thread";
+    struct evq q;
+
+    evq_init(&q);
+    check(evq_peek(&q) == NULL, name, "new queue is not empty");
+
+    bool pushed = true;
+    for (unsigned i = 0; i < EVQ_SIZE; i++)
+        pushed = evq_push(&q, i, i + 1, i + 2) && pushed;
+
+    check(pushed, name, "push to a queue with room failed");
+    check(!evq_push(&q, 0, 0, 0), name, "push to a full queue succeeded");
+    check_eq(evq_count(&q), EVQ_SIZE, name, "count");
+    check_eq(q.high_water, EVQ_SIZE, name, "high water");
+
+    bool same = true;
+    for (unsigned i = 0; i < EVQ_SIZE; i++) {
+        volatile struct evq_event *const e = evq_peek(&q);
+
+        same = same && e != NULL && e->delay == i && e->port == i + 1 &&
+            e->value == i + 2;
+        evq_pop(&q);
+    }
+
+    check(same, name, "events changed in the queue");
+    check(evq_peek(&q) == NULL, name, "drained queue is not empty");
+    check_eq(q.low_water, 1, name, "low water");
+}
+
+static void
+test_two_threads(void)
+{
+    static const char name[] = "two threads";
+    struct stress s = { .bad = EVENTS };
+    pthread_t threads[2];
+
+    evq_init(&s.q);
+
+    if (pthread_create(&threads[0], NULL, consumer, &s) != 0 ||
+        pthread_create(&threads[1], NULL, producer, &s) != 0) {
+        printf("FAIL: %s: could not create the threads\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+
+    check_eq(s.bad, EVENTS, name, "first wrong event");
+    check_eq(evq_count(&s.q), 0, name, "events left");
+    check(s.q.high_water <= EVQ_SIZE, name, "high water past the size");
+    check(s.q.low_water >= 1, name, "low water below one");
+    check(s.full == 0 || s.q.high_water == EVQ_SIZE, name,
+          "queue was full, but the high water is below the size");
+
+    printf("%s: %lu events, queue full %lu times, empty %lu times\n", name,
+           EVENTS, s.full, s.empty);
+}
+
+int
+main(void)
+{
+    test_single_thread();
+    test_two_threads();
+
+    if (failures != 0) {
+        printf("%u checks failed.\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All checks passed.\n");
+    return EXIT_SUCCESS;
+}
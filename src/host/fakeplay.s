@@ -0,0 +1,227 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * A stand-in for vgmplay.exe, used by "make check" to test vgmtime without
+ * Open Watcom.
+ *
+ * It plays the SN76489 writes of a version 1.50 VGM file of less than 32KiB
+ * to port c0h, and prints the same calibration and elapsed time lines as
+ * the player. Instead of calibrating, each sample of a wait takes exactly
+ * 108 clocks, which is 44100Hz to within 0.3% on a 4.77MHz 8088 and far too
+ * fast on a 7.16MHz one.
+ *
+ * The file is a complete MZ executable. Build it with
+ *
+ *     as --32 -o fakeplay.o fakeplay.s
+ *     objcopy -O binary fakeplay.o fakeplay.exe
+ *
+ * Everything after the header is loaded at offset 0 of one 64KiB segment
+ * that holds the code, the file, and the stack. Addresses of data in the
+ * code are written relative to "code" for that reason.
+ */
+
+    .code16
+    .arch i8086
+
+    /* Buffers after the end of the code, which must stay below name. */
+    .set name, 0x0380
+    .set t0, 0x03fe
+    .set buf, 0x0400
+    .set BUF_SIZE, 0x8000
+
+header:
+    .ascii "MZ"
+    .word (end - header) % 512
+    .word (end - header + 511) / 512
+    .word 0                     /* relocations */
+    .word (code - header) / 16  /* header paragraphs */
+    .word 0x1000 - (end - code + 15) / 16
+    .word 0xffff
+    .word 0                     /* SS */
+    .word 0xfffe                /* SP */
+    .word 0                     /* checksum */
+    .word start - code          /* IP */
+    .word 0                     /* CS */
+    .word 0x1c                  /* relocation table */
+    .word 0                     /* overlay */
+    .word 0, 0
+
+code:
+start:
+    /* Copy the first word of the command tail from the PSP. */
+    push %cs
+    pop %es
+    mov $0x81, %si
+    mov $name, %di
+    cld
+1:  lodsb
+    cmp $' ', %al
+    je 1b
+2:  cmp $0x0d, %al
+    je 3f
+    cmp $' ', %al
+    je 3f
+    stosb
+    lodsb
+    jmp 2b
+3:  xor %al, %al
+    stosb
+    push %cs
+    pop %ds
+
+    mov $(calibration - code), %dx
+    mov $0x09, %ah
+    int $0x21
+
+    mov $name, %dx
+    mov $0x3d00, %ax
+    int $0x21
+    jc fail
+    mov %ax, %bx
+    mov $buf, %dx
+    mov $BUF_SIZE, %cx
+    mov $0x3f, %ah
+    int $0x21
+    jc fail
+    mov $0x3e, %ah
+    int $0x21
+
+    /* The data starts at 34h plus the offset stored there. */
+    mov $buf + 0x34, %si
+    add (%si), %si
+
+    mov $0x00, %ah
+    int $0x1a
+    mov %dx, t0
+
+next:
+    lodsb
+    cmp $0x50, %al
+    je psg
+    cmp $0x61, %al
+    je wait_n
+    cmp $0x62, %al
+    je wait_735
+    cmp $0x63, %al
+    je wait_882
+    cmp $0x66, %al
+    je done
+    mov %al, %ah
+    and $0xf0, %ah
+    cmp $0x70, %ah
+    je wait_short
+    jmp fail
+
+psg:
+    lodsb
+    out %al, $0xc0
+    jmp next
+
+wait_n:
+    lodsw
+    mov %ax, %dx
+    call wait
+    jmp next
+
+wait_735:
+    mov $735, %dx
+    call wait
+    jmp next
+
+wait_882:
+    mov $882, %dx
+    call wait
+    jmp next
+
+wait_short:
+    and $0x0f, %al
+    inc %al
+    xor %ah, %ah
+    mov %ax, %dx
+    call wait
+    jmp next
+
+done:
+    /* Silence all four voices. */
+    mov $0x9f, %al
+    out %al, $0xc0
+    mov $0xbf, %al
+    out %al, $0xc0
+    mov $0xdf, %al
+    out %al, $0xc0
+    mov $0xff, %al
+    out %al, $0xc0
+
+    mov $0x00, %ah
+    int $0x1a
+    sub t0, %dx
+    push %dx
+
+    mov $(elapsed - code), %dx
+    mov $0x09, %ah
+    int $0x21
+    pop %ax
+    call print_u16
+    mov $(ticks - code), %dx
+    mov $0x09, %ah
+    int $0x21
+
+    mov $0x4c00, %ax
+    int $0x21
+
+fail:
+    mov $(error - code), %dx
+    mov $0x09, %ah
+    int $0x21
+    mov $0x4c01, %ax
+    int $0x21
+
+/*
+ * Wait for DX samples. Each one takes 4 + (4 * 17 + 5) + 3 * 3 + 2 * 2 + 2
+ * + 16 = 108 clocks.
+ */
+wait:
+    test %dx, %dx
+    jz 2f
+1:  mov $5, %cx
+3:  loop 3b
+    nop
+    nop
+    nop
+    mov %bx, %bx
+    mov %bx, %bx
+    dec %dx
+    jnz 1b
+2:  ret
+
+/* Print AX in decimal. */
+print_u16:
+    mov $10, %bx
+    xor %cx, %cx
+1:  xor %dx, %dx
+    div %bx
+    push %dx
+    inc %cx
+    test %ax, %ax
+    jnz 1b
+2:  pop %dx
+    add $'0', %dl
+    mov $0x02, %ah
+    int $0x21
+    loop 2b
+    ret
+
+calibration:
+    .ascii "Delay loop parameters: n = 108, d = 1\r\n$"
+elapsed:
+    .ascii "Elapsed play time = 0.000s ($"
+ticks:
+    .ascii " ticks)\r\n$"
+error:
+    .ascii "Could not play the file.\r\n$"
+
+    .balign 16
+end:
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Check that the lfsr pass keeps the pitch of periodic noise.
+ *
+ * Each test file plays periodic noise clocked by tone voice 2. The file is
+ * rendered with the synth model of the chip it was recorded for, and again
+ * after the lfsr pass with the model of the Tandy's PSG. The pitch is
+ * measured from the time between the first and last pulses of the noise,
+ * and the two must agree to within the rounding of the corrected period.
+ *
+ * The files are rendered with two different feedback patterns. In periodic
+ * mode, the bit shifted out is fed straight back in, so the pattern must not
+ * change the pitch.
+ *
+ * The noise is set with a latch byte, or with a data byte after the noise
+ * register is latched. The pass must fix the period in either case.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "synth.h"
+#include "vgm_xlat.h"
+#include "../vgm_player.h"
+
+/* A high output rate puts the time of each pulse within a microsecond. */
+#define RATE 1000000
+#define SECONDS 2
+
+#define PSG_CLOCK 3579545
+
+static unsigned failures = 0;
+
+static void
+check(bool ok, const char *name, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s: %s\n", name, what);
+        failures++;
+    }
+}
+
+/**
+ * Make a file that sets voice 2 to \c period, silences it, and plays
+ * periodic noise clocked by it at full volume.
+ *
+ * \param data_byte  Set the noise with a data byte instead of a latch byte.
+ */
+static size_t
+make_vgm(uint8_t *buf, uint16_t taps, uint8_t width, uint16_t period,
+         bool data_byte)
+{
+    /* One second per wait. */
+    static const unsigned samples = 44100;
+    static const uint8_t latch_noise[] = { 0x50, 0xe3 };
+    static const uint8_t data_noise[] = { 0x50, 0xe0, 0x50, 0x03 };
+    const uint8_t head[] = {
+        0x50, 0xc0 | (period & 0x0f),
+        0x50, period >> 4,
+        0x50, 0xdf,
+    };
+    static const uint8_t tail[] = {
+        0x50, 0xf0,
+        0x61, samples & 0xff, samples >> 8 & 0xff,
+        0x61, samples & 0xff, samples >> 8 & 0xff,
+        0x66,
+    };
+    const uint8_t *const noise = data_byte ? data_noise : latch_noise;
+    const size_t noise_size =
+        data_byte ? sizeof(data_noise) : sizeof(latch_noise);
+    const size_t size = sizeof(head) + noise_size + sizeof(tail);
+    struct vgm_header h;
+
+    /* A version 1.51 header without any of the optional fields. */
+    memset(&h, 0, sizeof(h));
+    memcpy(h.ident, "Vgm ", 4);
+    h.version = 0x151;
+    h.sn76489_clock = PSG_CLOCK;
+    h.total_samples = SECONDS * samples;
+    h.sn76489_fb = taps;
+    h.sn76489_fsr_width = width;
+    h.vgm_data_offset = 0x80 - 0x34;
+    h.eof_offset = 0x80 + size - 4;
+
+    memcpy(buf, &h, 0x80);
+    memcpy(buf + 0x80, head, sizeof(head));
+    memcpy(buf + 0x80 + sizeof(head), noise, noise_size);
+    memcpy(buf + 0x80 + sizeof(head) + noise_size, tail, sizeof(tail));
+    return 0x80 + size;
+}
+
+/**
+ * Render a file with a model of a chip and measure the frequency of its
+ * output.
+ *
+ * \return
+ * The frequency in Hz, or zero if there are fewer than two pulses.
+ */
+static double
+measure(const uint8_t *file, size_t size, uint16_t taps, uint8_t width)
+{
+    struct vgm_player *const p = vgm_player_open_memory(file, size);
+    if (p == NULL)
+        return 0.0;
+
+    /* All of the writes are at the start of the file. */
+    static struct synth s;
+    struct vgm_port_write w;
+
+    synth_init(&s, PSG_CLOCK, RATE, taps, width, SYNTH_NAIVE);
+    vgm_player_step(p, 1);
+    while (vgm_player_next_write(p, &w))
+        synth_write(&s, w.port, w.value);
+
+    vgm_player_close(p);
+
+    static int16_t out[SECONDS * RATE];
+    long first = -1;
+    long last = -1;
+    unsigned pulses = 0;
+
+    synth_render(&s, out, SECONDS * RATE);
+
+    for (long i = 1; i < SECONDS * RATE; i++) {
+        if (out[i - 1] <= 0 && out[i] > 0) {
+            if (first < 0)
+                first = i;
+
+            last = i;
+            pulses++;
+        }
+    }
+
+    return pulses >= 2 ? (double)(pulses - 1) * RATE / (last - first) : 0.0;
+}
+
+/**
+ * Run the lfsr pass on a file.
+ *
+ * \return
+ * The size of the output, or zero if the pass failed.
+ */
+static size_t
+translate(const uint8_t *file, size_t size, uint8_t *out, size_t out_size)
+{
+    struct vgm_xlat x;
+
+    if (!vgm_xlat_open(&x, file, size))
+        return 0;
+
+    size_t bytes = 0;
+
+    if (vgm_xlat_run(&x, vgm_xlat_find("lfsr"))) {
+        vgm_xlat_finish(&x);
+
+        if (sizeof(x.header) + x.size <= out_size) {
+            memcpy(out, &x.header, sizeof(x.header));
+            memcpy(out + sizeof(x.header), x.data, x.size);
+            bytes = sizeof(x.header) + x.size;
+        }
+    }
+
+    vgm_xlat_close(&x);
+    return bytes;
+}
+
+static void
+test_pitch(uint16_t taps, uint8_t width, uint16_t period, bool data_byte)
+{
+    uint8_t file[512];
+    uint8_t fixed[1024];
+    char name[64];
+
+    snprintf(name, sizeof(name), "taps %04x, width %u, period %03x%s", taps,
+             width, period, data_byte ? ", data byte" : "");
+
+    const size_t size = make_vgm(file, taps, width, period, data_byte);
+    const size_t fixed_size = translate(file, size, fixed, sizeof(fixed));
+
+    check(fixed_size != 0, name, "lfsr pass failed");
+    if (fixed_size == 0)
+        return;
+
+    const double want = measure(file, size, taps, width);
+    const double tandy = measure(file, size, 0x0003, 15);
+    const double got = measure(fixed, fixed_size, 0x0003, 15);
+
+    /* The period was rounded to the nearest integer. */
+    const double corrected = (double) period * width / 15;
+    const double limit = 0.5 / floor(corrected + 0.5) + 1e-4;
+    const double error = want != 0.0 ? got / want - 1.0 : 1.0;
+
+    printf("%s: %.4fHz, %.4fHz uncorrected, %.4fHz corrected "
+           "(%+.3f%%)\n", name, want, tandy, got, error * 100.0);
+
+    check(want != 0.0, name, "no periodic noise in the original");
+    check(fabs(error) <= limit, name, "pitch changed");
+
+    /* Make sure that the test can tell the difference. */
+    check(fabs(tandy / want - (double) width / 15) < 1e-3, name,
+          "uncorrected pitch is not off by the ratio of the widths");
+}
+
+int
+main(void)
+{
+    static const uint16_t periods[] = { 0x040, 0x100, 0x155, 0x3b0 };
+    static const uint16_t taps[] = { 0x0009, 0x0003 };
+
+    for (unsigned t = 0; t < sizeof(taps) / sizeof(taps[0]); t++) {
+        for (unsigned i = 0; i < sizeof(periods) / sizeof(periods[0]); i++)
+            test_pitch(taps[t], 16, periods[i], false);
+    }
+
+    for (unsigned i = 0; i < sizeof(periods) / sizeof(periods[0]); i++)
+        test_pitch(0x0009, 16, periods[i], true);
+
+    if (failures != 0) {
+        printf("%u checks failed.\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All checks passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+static inline int32_t
+dot_scalar(const int16_t *x, const int16_t *h)
+{
+    /* Unsigned, so that overflow wraps exactly like the SIMD versions. */
+    uint32_t sum = 0;
+
+    for (unsigned i = 0; i < RESAMPLE_TAPS; i++)
+        sum += (uint32_t) ((int32_t) x[i] * h[i]);
+
+    return (int32_t) sum;
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2"))) static inline int32_t
+dot_sse2(const int16_t *x, const int16_t *h)
+{
+    __m128i sum = _mm_setzero_si128();
+
+    for (unsigned i = 0; i < RESAMPLE_TAPS; i += 8) {
+        const __m128i a = _mm_loadu_si128((const __m128i *) (x + i));
+        const __m128i b = _mm_load_si128((const __m128i *) (h + i));
+
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a, b));
+    }
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2"))) static inline int32_t
+dot_avx2(const int16_t *x, const int16_t *h)
+{
+    __m256i sum = _mm256_setzero_si256();
+
+    for (unsigned i = 0; i < RESAMPLE_TAPS; i += 16) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *) (x + i));
+        const __m256i b = _mm256_load_si256((const __m256i *) (h + i));
+
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                              _mm256_extracti128_si256(sum, 1));
+
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+
+    return _mm_cvtsi128_si32(s);
+}
+#endif
+
+static unsigned
+gcd(unsigned a, unsigned b)
+{
+    while (b != 0) {
+        const unsigned t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/**
+ * Design the prototype low-pass filter and split it into phases.
+ *
+ * The prototype is a Blackman windowed sinc at the upsampled rate. The
+ * cutoff is 90% of the lower of the two Nyquist frequencies.
+ */
+static void
+design_filter(struct resampler *r, unsigned in_rate, unsigned out_rate)
+{
+    const unsigned len = RESAMPLE_TAPS * r->up;
+    const double center = (len - 1) / 2.0;
+    const double lower = in_rate < out_rate ? in_rate : out_rate;
+    const double fc = 0.45 * lower / ((double) in_rate * r->up);
+
+    for (unsigned p = 0; p < r->up; p++) {
+        int16_t *const bank = r->coeffs + p * RESAMPLE_TAPS;
+        double h[RESAMPLE_TAPS];
+        double sum = 0.0;
+
+        for (unsigned t = 0; t < RESAMPLE_TAPS; t++) {
+            const double n = p + (double) t * r->up;
+            const double x = n - center;
+            const double w = 0.42 - 0.5 * cos(2.0 * M_PI * n / (len - 1))
+                + 0.08 * cos(4.0 * M_PI * n / (len - 1));
+            const double sinc = x == 0.0
+                ? 1.0 : sin(2.0 * M_PI * fc * x) / (2.0 * M_PI * fc * x);
+
+            h[t] = sinc * w;
+            sum += h[t];
+        }
+
+        /* Normalize each phase to unity gain at DC. Tap t applies to the
+         * input sample t samples before the newest one.
+         */
+        int total = 0;
+        unsigned peak = 0;
+
+        for (unsigned t = 0; t < RESAMPLE_TAPS; t++) {
+            const unsigned i = RESAMPLE_TAPS - 1 - t;
+
+            bank[i] = lrint(h[t] / sum * 32768.0);
+            total += bank[i];
+
+            if (abs(bank[i]) > abs(bank[peak]))
+                peak = i;
+        }
+
+        bank[peak] += 32768 - total;
+    }
+}
+
+void
+resampler_fini(struct resampler *r)
+{
+    free(r->coeffs);
+    r->coeffs = NULL;
+}
+
+size_t
+resampler_max_output(const struct resampler *r, size_t n)
+{
+    return (n * r->up + r->down - 1) / r->down + 1;
+}
+
+/**
+ * Produce every output sample that the samples in \c history allow.
+ *
+ * This is instantiated once for each inner loop so that the dot product is
+ * inlined.
+ */
+static inline __attribute__((always_inline)) size_t
+convert(struct resampler *r, int16_t *out,
+        int32_t (*dot)(const int16_t *x, const int16_t *h))
+{
+    const int16_t *const coeffs = r->coeffs;
+    const unsigned up = r->up;
+    const unsigned down = r->down;
+    unsigned phase = r->phase;
+    size_t pos = r->pos;
+    size_t produced = 0;
+
+    while (pos < r->history_len) {
+        const int16_t *const x = r->history + pos - (RESAMPLE_TAPS - 1);
+        const int32_t sum = dot(x, coeffs + phase * RESAMPLE_TAPS);
+        const int32_t v = ((int64_t) sum + (1 << 14)) >> 15;
+
+        out[produced++] = v > INT16_MAX
+            ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+
+        phase += down;
+        while (phase >= up) {
+            phase -= up;
+            pos++;
+        }
+    }
+
+    r->phase = phase;
+    r->pos = pos;
+
+    return produced;
+}
+
+static size_t
+convert_scalar(struct resampler *r, int16_t *out)
+{
+    return convert(r, out, dot_scalar);
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2"))) static size_t
+convert_sse2(struct resampler *r, int16_t *out)
+{
+    return convert(r, out, dot_sse2);
+}
+
+__attribute__((target("avx2"))) static size_t
+convert_avx2(struct resampler *r, int16_t *out)
+{
+    return convert(r, out, dot_avx2);
+}
+#endif
+
+static enum resample_isa
+best_isa(void)
+{
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return RESAMPLE_AVX2;
+
+    if (__builtin_cpu_supports("sse2"))
+        return RESAMPLE_SSE2;
+#endif
+
+    return RESAMPLE_SCALAR;
+}
+
+int
+resampler_init(struct resampler *r, unsigned in_rate, unsigned out_rate,
+               enum resample_isa isa)
+{
+    memset(r, 0, sizeof(*r));
+
+    if (in_rate == 0 || out_rate == 0)
+        return EINVAL;
+
+    const enum resample_isa best = best_isa();
+
+    if (isa == RESAMPLE_AUTO)
+        isa = best;
+    else if (isa > best)
+        return ENOTSUP;
+
+    switch (isa) {
+#ifdef HAVE_X86
+    case RESAMPLE_AVX2:
+        r->convert = convert_avx2;
+        break;
+    case RESAMPLE_SSE2:
+        r->convert = convert_sse2;
+        break;
+#endif
+    default:
+        r->convert = convert_scalar;
+        break;
+    }
+
+    r->isa = isa;
+
+    const unsigned g = gcd(in_rate, out_rate);
+
+    r->up = out_rate / g;
+    r->down = in_rate / g;
+
+    /* Aligned for the SIMD coefficient loads. */
+    void *coeffs;
+    if (posix_memalign(&coeffs, 32,
+                       (size_t) r->up * RESAMPLE_TAPS * sizeof(int16_t)) != 0)
+        return ENOMEM;
+
+    r->coeffs = coeffs;
+    design_filter(r, in_rate, out_rate);
+
+    /* Start with silence in the history. */
+    r->history_len = RESAMPLE_TAPS - 1;
+    r->pos = RESAMPLE_TAPS - 1;
+    r->phase = 0;
+
+    return 0;
+}
+
+size_t
+resampler_process(struct resampler *r, const int16_t *in, size_t n,
+                  int16_t *out)
+{
+    size_t produced = 0;
+
+    while (n > 0) {
+        const size_t count = n < RESAMPLE_CHUNK ? n : RESAMPLE_CHUNK;
+
+        memcpy(r->history + r->history_len, in, count * sizeof(int16_t));
+        r->history_len += count;
+        in += count;
+        n -= count;
+
+        produced += r->convert(r, out + produced);
+
+        /* Keep the samples the next outputs still need. */
+        const size_t keep = RESAMPLE_TAPS - 1;
+        const size_t drop = r->history_len - keep;
+
+        memmove(r->history, r->history + drop, keep * sizeof(int16_t));
+        r->history_len = keep;
+        r->pos -= drop;
+    }
+
+    return produced;
+}
+
+const char *
+resampler_isa_name(enum resample_isa isa)
+{
+    switch (isa) {
+    case RESAMPLE_SCALAR:
+        return "scalar";
+    case RESAMPLE_SSE2:
+        return "sse2";
+    case RESAMPLE_AVX2:
+        return "avx2";
+    default:
+        return "auto";
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \file
+ * Polyphase FIR sample rate converter for mono 16-bit audio.
+ *
+ * The conversion ratio is reduced to L / M. Conceptually the input is
+ * upsampled by L, low-pass filtered, and downsampled by M. Each output sample
+ * only needs one of the L phases of the filter, so each phase is stored as a
+ * separate bank of \c RESAMPLE_TAPS coefficients.
+ *
+ * Coefficients are Q15 and products are summed in 32 bits. Integer addition
+ * gives the same result in any order, so the scalar, SSE2, and AVX2 inner
+ * loops produce bit-identical output.
+ */
+
+#define RESAMPLE_TAPS 32
+
+/* Input samples processed at a time. */
+#define RESAMPLE_CHUNK 1024
+
+enum resample_isa {
+    RESAMPLE_AUTO,
+    RESAMPLE_SCALAR,
+    RESAMPLE_SSE2,
+    RESAMPLE_AVX2,
+};
+
+struct resampler {
+    unsigned up;
+    unsigned down;
+
+    /* Filter phase of the next output sample, and the index in \c history
+     * of the newest input sample it uses.
+     */
+    unsigned phase;
+    size_t pos;
+
+    /* \c up banks of \c RESAMPLE_TAPS coefficients. Each bank is stored
+     * reversed, so that it lines up with the input in time order.
+     */
+    int16_t *coeffs;
+
+    /* The last RESAMPLE_TAPS - 1 input samples followed by the current
+     * chunk.
+     */
+    int16_t history[RESAMPLE_TAPS - 1 + RESAMPLE_CHUNK];
+    size_t history_len;
+
+    enum resample_isa isa;
+    size_t (*convert)(struct resampler *r, int16_t *out);
+};
+
+/**
+ * \param isa Inner loop to use. \c RESAMPLE_AUTO picks the best one the CPU
+ *            supports.
+ *
+ * \return
+ * Zero on success, or an errno value on failure. Requesting an instruction
+ * set the CPU does not support fails with \c ENOTSUP.
+ */
+int resampler_init(struct resampler *r, unsigned in_rate, unsigned out_rate,
+                   enum resample_isa isa);
+
+void resampler_fini(struct resampler *r);
+
+/**
+ * Upper bound on the number of samples produced from \c n input samples.
+ */
+size_t resampler_max_output(const struct resampler *r, size_t n);
+
+/**
+ * Convert a block of samples.
+ *
+ * \return
+ * The number of samples written to \c out.
+ */
+size_t resampler_process(struct resampler *r, const int16_t *in, size_t n,
+                         int16_t *out);
+
+const char *resampler_isa_name(enum resample_isa isa);
+
+#endif /* ifndef RESAMPLE_H */
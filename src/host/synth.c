@@ -0,0 +1,433 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <math.h>
+#include <string.h>
+#include "synth.h"
+#include "vgm_player.h"
+
+#define PIT_CLOCK 1193182u
+
+/* Subsamples per output sample in SYNTH_OVERSAMPLE mode. */
+#define OVERSAMPLE 16
+
+/* Peak amplitude of one channel at full volume. Five channels at full volume
+ * still fit in an int16_t.
+ */
+#define FULL_SCALE 6000
+
+/* Each step of SN76489 attenuation is 2dB. */
+static const int16_t volume_table[16] = {
+    6000, 4766, 3786, 3007, 2389, 1897, 1507, 1197,
+     951,  755,  600,  477,  379,  301,  239,    0
+};
+
+static void
+square_set_period(struct synth_square *sq, uint32_t half_period)
+{
+    sq->half_period = half_period;
+}
+
+/**
+ * Advance a square wave by one output sample.
+ *
+ * \return
+ * The number of edges that occurred.
+ */
+static inline unsigned
+square_step(struct synth_square *sq, uint32_t step)
+{
+    unsigned edges = 0;
+
+    sq->counter -= step;
+    while (sq->counter <= 0) {
+        sq->counter += sq->half_period << 16;
+        sq->high = !sq->high;
+        edges++;
+    }
+
+    return edges;
+}
+
+static uint32_t
+tone_half_period(uint16_t reg)
+{
+    /* The counter reloads every N clocks of the clock / 16 input, and the
+     * output toggles on each reload. A period of zero acts like 0x400.
+     */
+    return reg == 0 ? 0x400 : reg;
+}
+
+static void
+update_noise_period(struct synth *s)
+{
+    const unsigned rate = s->psg_regs[6] & 3;
+
+    square_set_period(&s->noise, rate == 3
+                      ? tone_half_period(s->psg_regs[4])
+                      : 0x10u << rate);
+}
+
+/**
+ * Fill in the band-limited step tables.
+ *
+ * The tables actually hold a band-limited impulse (a Blackman windowed sinc
+ * with its cutoff just below Nyquist) for each phase. Integrating the
+ * accumulated impulses produces the steps. Each phase is normalized to sum to
+ * exactly 1.0 in Q15, so the integral never drifts.
+ */
+static void
+blep_init(struct synth *s)
+{
+    const double cutoff = 0.9;
+
+    for (unsigned p = 0; p < SYNTH_BLEP_PHASES; p++) {
+        const double frac = (double) p / SYNTH_BLEP_PHASES;
+        double h[SYNTH_BLEP_TAPS];
+        double sum = 0.0;
+
+        for (unsigned k = 0; k < SYNTH_BLEP_TAPS; k++) {
+            const double x = (double) k - (SYNTH_BLEP_TAPS / 2 - 1) - frac;
+            const double w = 0.42 + 0.5 * cos(2.0 * M_PI * x / SYNTH_BLEP_TAPS)
+                + 0.08 * cos(4.0 * M_PI * x / SYNTH_BLEP_TAPS);
+            const double sinc = x == 0.0
+                ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+
+            h[k] = sinc * w;
+            sum += h[k];
+        }
+
+        int total = 0;
+        unsigned peak = 0;
+
+        for (unsigned k = 0; k < SYNTH_BLEP_TAPS; k++) {
+            s->blep[p][k] = lrint(h[k] / sum * 32768.0);
+            total += s->blep[p][k];
+
+            if (s->blep[p][k] > s->blep[p][peak])
+                peak = k;
+        }
+
+        s->blep[p][peak] += 32768 - total;
+    }
+}
+
+void
+synth_init(struct synth *s, uint32_t psg_clock, uint32_t rate,
+           uint16_t lfsr_taps, uint8_t lfsr_width, enum synth_mode mode)
+{
+    memset(s, 0, sizeof(*s));
+
+    s->mode = mode;
+    s->rate = rate;
+    s->psg_step = ((uint64_t) psg_clock << 16) / (16 * (uint64_t) rate);
+    s->pit_step = ((uint64_t) PIT_CLOCK << 16) / rate;
+
+    s->lfsr_taps = lfsr_taps != 0 ? lfsr_taps : 0x0009;
+    s->lfsr_width = lfsr_width != 0 ? lfsr_width : 16;
+    s->lfsr = 1u << (s->lfsr_width - 1);
+
+    for (unsigned i = 0; i < 8; i++)
+        s->psg_regs[i] = (i & 1) != 0 ? 0x0f : 0;
+
+    for (unsigned i = 0; i < 3; i++)
+        square_set_period(&s->tone[i], tone_half_period(0));
+
+    update_noise_period(s);
+    square_set_period(&s->speaker, 0x8000);
+
+    if (mode == SYNTH_BLEP)
+        blep_init(s);
+}
+
+static void
+psg_write(struct synth *s, uint8_t value)
+{
+    if ((value & 0x80) != 0) {
+        s->psg_latch = (value >> 4) & 7;
+        s->psg_regs[s->psg_latch] =
+            (s->psg_regs[s->psg_latch] & ~0x000f) | (value & 0x0f);
+    } else if ((s->psg_latch & 1) == 0 && s->psg_latch != 6) {
+        s->psg_regs[s->psg_latch] = (s->psg_regs[s->psg_latch] & 0x000f) |
+            ((uint16_t)(value & 0x3f) << 4);
+    } else {
+        s->psg_regs[s->psg_latch] = value & 0x0f;
+    }
+
+    const unsigned reg = s->psg_latch;
+
+    if (reg == 6) {
+        /* Any write to the noise control register resets the shift
+         * register.
+         */
+        s->lfsr = 1u << (s->lfsr_width - 1);
+        update_noise_period(s);
+    } else if ((reg & 1) == 0) {
+        square_set_period(&s->tone[reg / 2],
+                          tone_half_period(s->psg_regs[reg]));
+
+        if (reg == 4)
+            update_noise_period(s);
+    }
+}
+
+void
+synth_write(struct synth *s, uint16_t port, uint8_t value)
+{
+    switch (port) {
+    case VGM_PORT_PSG:
+        psg_write(s, value);
+        break;
+
+    case VGM_PORT_PIT_CTRL:
+        /* Only the channel 2 programming used for the speaker is modeled. */
+        if ((value & 0xc0) == 0x80)
+            s->pit_lsb_next = true;
+        break;
+
+    case VGM_PORT_PIT_CH2:
+        if (s->pit_lsb_next) {
+            s->pit_period = (s->pit_period & 0xff00) | value;
+        } else {
+            s->pit_period = (s->pit_period & 0x00ff) | ((uint16_t)value << 8);
+            square_set_period(&s->speaker,
+                              s->pit_period == 0 ? 0x8000
+                              : (s->pit_period + 1) / 2);
+        }
+
+        s->pit_lsb_next = !s->pit_lsb_next;
+        break;
+
+    case VGM_PORT_SPEAKER:
+        s->speaker_on = (value & 0x03) == 0x03;
+        break;
+    }
+}
+
+static inline int16_t
+clamp_sample(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+}
+
+static inline void
+lfsr_shift(struct synth *s, bool white)
+{
+    const unsigned feedback = white
+        ? __builtin_parity(s->lfsr & s->lfsr_taps)
+        : (s->lfsr & 1);
+
+    s->lfsr = (s->lfsr >> 1) | (feedback << (s->lfsr_width - 1));
+}
+
+static inline int
+channel_output(const struct synth_square *sq, uint16_t attenuation)
+{
+    const int amplitude = volume_table[attenuation & 0x0f];
+
+    return sq->high ? amplitude : -amplitude;
+}
+
+/**
+ * Advance every source by one sample and sample its level.
+ */
+static inline int
+naive_sample(struct synth *s, uint32_t psg_step, uint32_t pit_step,
+             bool white)
+{
+    int sum = 0;
+
+    for (unsigned ch = 0; ch < 3; ch++) {
+        square_step(&s->tone[ch], psg_step);
+        sum += channel_output(&s->tone[ch], s->psg_regs[ch * 2 + 1]);
+    }
+
+    /* The shift register advances on each rising edge of the noise
+     * clock.
+     */
+    const bool was_high = s->noise.high;
+    unsigned edges = square_step(&s->noise, psg_step);
+
+    edges = (edges + !was_high) / 2;
+    while (edges-- != 0)
+        lfsr_shift(s, white);
+
+    const int noise_amp = volume_table[s->psg_regs[7] & 0x0f];
+    sum += (s->lfsr & 1) != 0 ? noise_amp : -noise_amp;
+
+    if (s->speaker_on) {
+        square_step(&s->speaker, pit_step);
+        sum += s->speaker.high ? FULL_SCALE : -FULL_SCALE;
+    }
+
+    return sum;
+}
+
+static void
+render_naive(struct synth *s, int16_t *out, unsigned samples)
+{
+    const bool white = (s->psg_regs[6] & 0x04) != 0;
+
+    for (unsigned i = 0; i < samples; i++)
+        out[i] = clamp_sample(naive_sample(s, s->psg_step, s->pit_step,
+                                           white));
+}
+
+static void
+render_oversample(struct synth *s, int16_t *out, unsigned samples)
+{
+    const bool white = (s->psg_regs[6] & 0x04) != 0;
+    const uint32_t psg_step = s->psg_step / OVERSAMPLE;
+    const uint32_t pit_step = s->pit_step / OVERSAMPLE;
+
+    /* A box filter over the subsamples is crude, but at 16x the aliases
+     * that remain are far below the naive renderer's.
+     */
+    for (unsigned i = 0; i < samples; i++) {
+        int32_t sum = 0;
+
+        for (unsigned j = 0; j < OVERSAMPLE; j++)
+            sum += naive_sample(s, psg_step, pit_step, white);
+
+        out[i] = clamp_sample(sum / OVERSAMPLE);
+    }
+}
+
+/**
+ * Add a band-limited step to the accumulation buffer.
+ *
+ * \param pos Time of the step in 1/65536 samples from the start of the
+ *            chunk.
+ */
+static inline void
+blep_add(struct synth *s, uint32_t pos, int delta)
+{
+    const int16_t *const k =
+        s->blep[((pos & 0xffff) * SYNTH_BLEP_PHASES) >> 16];
+    int32_t *const a = &s->accum[pos >> 16];
+
+    for (unsigned t = 0; t < SYNTH_BLEP_TAPS; t++)
+        a[t] += delta * k[t];
+}
+
+static inline void
+blep_level(struct synth *s, struct synth_square *sq, uint32_t pos, int level)
+{
+    if (level != sq->level) {
+        blep_add(s, pos, level - sq->level);
+        sq->level = level;
+    }
+}
+
+/**
+ * Add the edges of a square wave that occur in the next \c n samples.
+ */
+static void
+blep_square(struct synth *s, struct synth_square *sq, uint32_t step,
+            unsigned n, int amplitude)
+{
+    const int64_t end = (int64_t) n * step;
+    const int64_t period = (int64_t) sq->half_period << 16;
+    int64_t t = sq->counter;
+
+    /* A silent source has no edges, but it still has to stay in phase. */
+    if (amplitude == 0 && sq->level == 0) {
+        if (t <= end) {
+            const int64_t edges = (end - t) / period + 1;
+
+            t += edges * period;
+            if ((edges & 1) != 0)
+                sq->high = !sq->high;
+        }
+
+        sq->counter = t - end;
+        return;
+    }
+
+    /* The volume may have changed since the last chunk. */
+    blep_level(s, sq, 0, sq->high ? amplitude : -amplitude);
+
+    for (/* empty */; t <= end; t += period) {
+        sq->high = !sq->high;
+        blep_level(s, sq, (t << 16) / step, sq->high ? amplitude : -amplitude);
+    }
+
+    sq->counter = t - end;
+}
+
+static void
+blep_noise(struct synth *s, unsigned n, bool white)
+{
+    struct synth_square *const sq = &s->noise;
+    const int amplitude = volume_table[s->psg_regs[7] & 0x0f];
+    const int64_t end = (int64_t) n * s->psg_step;
+    const int64_t period = (int64_t) sq->half_period << 16;
+    int64_t t = sq->counter;
+
+    blep_level(s, sq, 0, (s->lfsr & 1) != 0 ? amplitude : -amplitude);
+
+    for (/* empty */; t <= end; t += period) {
+        sq->high = !sq->high;
+
+        if (sq->high) {
+            lfsr_shift(s, white);
+            blep_level(s, sq, (t << 16) / s->psg_step,
+                       (s->lfsr & 1) != 0 ? amplitude : -amplitude);
+        }
+    }
+
+    sq->counter = t - end;
+}
+
+static void
+render_blep(struct synth *s, int16_t *out, unsigned samples)
+{
+    const bool white = (s->psg_regs[6] & 0x04) != 0;
+
+    while (samples > 0) {
+        const unsigned n = samples < SYNTH_CHUNK ? samples : SYNTH_CHUNK;
+
+        for (unsigned ch = 0; ch < 3; ch++) {
+            blep_square(s, &s->tone[ch], s->psg_step, n,
+                        volume_table[s->psg_regs[ch * 2 + 1] & 0x0f]);
+        }
+
+        blep_noise(s, n, white);
+
+        if (s->speaker_on)
+            blep_square(s, &s->speaker, s->pit_step, n, FULL_SCALE);
+        else
+            blep_level(s, &s->speaker, 0, 0);
+
+        for (unsigned i = 0; i < n; i++) {
+            s->integral += s->accum[i];
+            out[i] = clamp_sample(s->integral >> 15);
+        }
+
+        /* Keep the tails of steps that extend past the chunk. */
+        memmove(s->accum, s->accum + n,
+                (SYNTH_BLEP_TAPS + 1) * sizeof(s->accum[0]));
+        memset(s->accum + SYNTH_BLEP_TAPS + 1, 0, n * sizeof(s->accum[0]));
+
+        out += n;
+        samples -= n;
+    }
+}
+
+void
+synth_render(struct synth *s, int16_t *out, unsigned samples)
+{
+    switch (s->mode) {
+    case SYNTH_BLEP:
+        render_blep(s, out, samples);
+        break;
+    case SYNTH_NAIVE:
+        render_naive(s, out, samples);
+        break;
+    case SYNTH_OVERSAMPLE:
+        render_oversample(s, out, samples);
+        break;
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * \file
+ * Model of the Tandy 1000 sound hardware for host rendering.
+ *
+ * The model is driven by the same port writes that the DOS player makes (see
+ * vgm_player.h): SN76489 writes to port 0xc0, and PC speaker writes to ports
+ * 0x42, 0x43, and 0x61.
+ *
+ * Every sound source is a square wave. Rendering one naively, by sampling its
+ * level once per output sample, aliases badly at 44.1kHz. The default BLEP
+ * mode instead adds a band-limited step to an accumulation buffer at the
+ * exact time of each edge, so the cost is proportional to the number of
+ * edges rather than the number of samples. The 16x oversampled mode is a
+ * slow reference for comparison.
+ */
+
+/* Band-limited step tables. Each edge touches SYNTH_BLEP_TAPS samples, and
+ * its time is rounded to 1 / SYNTH_BLEP_PHASES of a sample.
+ */
+#define SYNTH_BLEP_TAPS      16
+#define SYNTH_BLEP_PHASES    64
+
+/* Samples rendered at a time in BLEP mode. */
+#define SYNTH_CHUNK          1024
+
+enum synth_mode {
+    SYNTH_BLEP,
+    SYNTH_NAIVE,
+    SYNTH_OVERSAMPLE,
+};
+
+struct synth_square {
+    /* Time until the next edge, in 1/65536 units of the source clock. */
+    int32_t counter;
+
+    /* Source clocks between edges. */
+    uint32_t half_period;
+
+    bool high;
+
+    /* Output level at the last edge. Only used in BLEP mode. */
+    int level;
+};
+
+struct synth {
+    enum synth_mode mode;
+    uint32_t rate;
+
+    /* Source clocks per output sample, in 1/65536 units. */
+    uint32_t psg_step;
+    uint32_t pit_step;
+
+    /* SN76489 state. Registers are indexed as in a latch byte. */
+    uint16_t psg_regs[8];
+    uint8_t psg_latch;
+    struct synth_square tone[3];
+    struct synth_square noise;
+    uint16_t lfsr;
+    uint16_t lfsr_taps;
+    uint8_t lfsr_width;
+
+    /* PC speaker state (PIT channel 2 and the gate bits of port 0x61). */
+    uint16_t pit_period;
+    bool pit_lsb_next;
+    bool speaker_on;
+    struct synth_square speaker;
+
+    /* BLEP state. Steps are accumulated as differences in Q15 and integrated
+     * into \c integral as samples are output.
+     */
+    int32_t integral;
+    int32_t accum[SYNTH_CHUNK + SYNTH_BLEP_TAPS + 1];
+    int16_t blep[SYNTH_BLEP_PHASES][SYNTH_BLEP_TAPS];
+};
+
+/**
+ * \param psg_clock SN76489 input clock in Hz.
+ * \param rate Output sample rate in Hz.
+ * \param lfsr_taps Noise feedback pattern (VGM header sn76489_fb), or zero
+ *                  for the default.
+ * \param lfsr_width Noise shift register width (VGM header
+ *                   sn76489_fsr_width), or zero for the default.
+ * \param mode Rendering method.
+ */
+void synth_init(struct synth *s, uint32_t psg_clock, uint32_t rate,
+                uint16_t lfsr_taps, uint8_t lfsr_width,
+                enum synth_mode mode);
+
+void synth_write(struct synth *s, uint16_t port, uint8_t value);
+
+/**
+ * Render mono 16-bit samples.
+ *
+ * In BLEP mode, the output is delayed by \c SYNTH_BLEP_TAPS / 2 - 1
+ * samples.
+ */
+void synth_render(struct synth *s, int16_t *out, unsigned samples);
+
+#endif /* ifndef SYNTH_H */
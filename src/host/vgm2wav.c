@@ -0,0 +1,607 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Render a VGM file to a WAV file using the host model of the Tandy 1000
+ * sound hardware.
+ *
+ * The work is split across three threads connected by lock-free rings:
+ *
+ *     decoder --(evq of port writes)--> synth --(ring of blocks)--> writer
+ *
+ * The decoder runs the same vgm_player used by the other tools. The synth
+ * thread renders the writes into large audio blocks, and the writer thread
+ * writes each block with a single write() call. Use -d to open the output
+ * with O_DIRECT. The blocks are page aligned and a multiple of the page size,
+ * and the WAV header is part of the first block, so every write except the
+ * last is a full, aligned block.
+ *
+ * Use -s to select the synthesis method: blep (the default), naive, or x16
+ * (16x oversampling, a slow reference for comparing quality and speed).
+ *
+ * The chip is always rendered at 44.1kHz. Use -r to convert the output to a
+ * different rate, e.g., 48000 or 96000, and -x to force the scalar, sse2, or
+ * avx2 inner loop of the resampler.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "vgm_player.h"
+#include "vgm_file.h"
+#include "synth.h"
+#include "resample.h"
+
+#define EVQ_SIZE 4096u
+#include "evq.h"
+
+#define SAMPLE_RATE 44100u
+
+/* Number of samples decoded by each call to vgm_player_step. */
+#define STEP_SAMPLES 4096
+
+#define WAV_HEADER_SIZE 44
+
+/* Size and alignment of each audio block. Both must be multiples of the
+ * logical block size of the output device for O_DIRECT.
+ */
+#define BLOCK_BYTES (1024u * 1024)
+#define BLOCK_ALIGN 4096u
+#define NUM_BLOCKS 4u
+
+/**
+ * Ring of audio blocks passed from the synth thread to the writer thread.
+ *
+ * The blocks are filled and written in order, so the ring needs no free
+ * list. The synth thread owns block \c filled % \c NUM_BLOCKS until it
+ * publishes it by incrementing \c filled. The writer thread returns it by
+ * incrementing \c drained.
+ */
+struct block_ring {
+    uint8_t *data[NUM_BLOCKS];
+    size_t used[NUM_BLOCKS];
+
+    /** Only written by the synth thread. */
+    volatile unsigned filled;
+    volatile bool finished;
+
+    /** Only written by the writer thread. */
+    volatile unsigned drained;
+};
+
+struct pipeline {
+    struct vgm_player *player;
+    struct evq events;
+    volatile bool decode_finished;
+
+    struct synth synth;
+
+    /* Conversion from the synth rate to the output rate. */
+    unsigned out_rate;
+    bool resampling;
+    struct resampler resampler;
+    int16_t *converted;
+    double resample_seconds;
+    uint64_t resampled;
+
+    struct block_ring blocks;
+
+    /* Block being filled by the synth thread, and the offset in it. */
+    uint8_t *block;
+    size_t pos;
+
+    int fd;
+    bool direct;
+    uint64_t bytes_written;
+    int write_error;
+};
+
+static void
+wait_a_bit(void)
+{
+    sched_yield();
+}
+
+static void
+push_event(struct pipeline *pl, uint16_t delay, uint16_t port, uint8_t value)
+{
+    while (!evq_push(&pl->events, delay, port, value))
+        wait_a_bit();
+}
+
+static void
+push_delay(struct pipeline *pl, uint32_t samples)
+{
+    while (samples > 0) {
+        const uint16_t d = samples > 0xffff ? 0xffff : samples;
+
+        push_event(pl, d, 0, 0);
+        samples -= d;
+    }
+}
+
+static void *
+decode_thread(void *arg)
+{
+    struct pipeline *const pl = arg;
+    struct vgm_port_write w;
+    uint32_t last = 0;
+
+    while (!vgm_player_done(pl->player)) {
+        vgm_player_step(pl->player, STEP_SAMPLES);
+
+        while (vgm_player_next_write(pl->player, &w)) {
+            push_delay(pl, w.sample - last);
+            push_event(pl, 0, w.port, w.value);
+            last = w.sample;
+        }
+    }
+
+    push_delay(pl, vgm_player_position(pl->player) - last);
+    EVQ_STORE_RELEASE(pl->decode_finished, true);
+
+    return NULL;
+}
+
+/**
+ * Wait for the block after the last one published by the synth thread to be
+ * drained by the writer.
+ */
+static uint8_t *
+next_free_block(struct block_ring *r)
+{
+    while (r->filled - EVQ_LOAD_ACQUIRE(r->drained) >= NUM_BLOCKS)
+        wait_a_bit();
+
+    return r->data[r->filled % NUM_BLOCKS];
+}
+
+static void
+publish_block(struct block_ring *r, size_t used)
+{
+    r->used[r->filled % NUM_BLOCKS] = used;
+    EVQ_STORE_RELEASE(r->filled, r->filled + 1);
+}
+
+/**
+ * Copy samples into the current block, publishing blocks as they fill.
+ */
+static void
+emit_samples(struct pipeline *pl, const int16_t *samples, size_t n)
+{
+    struct block_ring *const r = &pl->blocks;
+
+    while (n > 0) {
+        const size_t space = (BLOCK_BYTES - pl->pos) / sizeof(int16_t);
+        const size_t count = n < space ? n : space;
+
+        memcpy(pl->block + pl->pos, samples, count * sizeof(int16_t));
+        pl->pos += count * sizeof(int16_t);
+        samples += count;
+        n -= count;
+
+        if (pl->pos == BLOCK_BYTES) {
+            publish_block(r, pl->pos);
+            pl->block = next_free_block(r);
+            pl->pos = 0;
+        }
+    }
+}
+
+static double
+thread_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Render samples, and convert them to the output rate if necessary.
+ */
+static void
+render(struct pipeline *pl, uint32_t samples)
+{
+    static int16_t rendered[RESAMPLE_CHUNK];
+
+    while (samples > 0) {
+        const unsigned n = samples < RESAMPLE_CHUNK ? samples : RESAMPLE_CHUNK;
+
+        synth_render(&pl->synth, rendered, n);
+
+        if (pl->resampling) {
+            const double start = thread_time();
+            const size_t count = resampler_process(&pl->resampler, rendered,
+                                                   n, pl->converted);
+
+            pl->resample_seconds += thread_time() - start;
+            pl->resampled += count;
+            emit_samples(pl, pl->converted, count);
+        } else {
+            emit_samples(pl, rendered, n);
+        }
+
+        samples -= n;
+    }
+}
+
+static void *
+synth_thread(void *arg)
+{
+    struct pipeline *const pl = arg;
+
+    /* The WAV header is filled in at the end. */
+    pl->block = next_free_block(&pl->blocks);
+    pl->pos = WAV_HEADER_SIZE;
+    memset(pl->block, 0, WAV_HEADER_SIZE);
+
+    for (;;) {
+        volatile struct evq_event *const e = evq_peek(&pl->events);
+
+        if (e == NULL) {
+            /* Check the queue again after seeing the flag. The decoder may
+             * have pushed more events before setting it.
+             */
+            if (EVQ_LOAD_ACQUIRE(pl->decode_finished) &&
+                evq_peek(&pl->events) == NULL)
+                break;
+
+            wait_a_bit();
+            continue;
+        }
+
+        const uint16_t delay = e->delay;
+        const uint16_t port = e->port;
+        const uint8_t value = e->value;
+
+        evq_pop(&pl->events);
+
+        if (port != 0)
+            synth_write(&pl->synth, port, value);
+
+        render(pl, delay);
+    }
+
+    publish_block(&pl->blocks, pl->pos);
+    EVQ_STORE_RELEASE(pl->blocks.finished, true);
+
+    return NULL;
+}
+
+static void
+clear_direct(struct pipeline *pl)
+{
+    if (!pl->direct)
+        return;
+
+    const int flags = fcntl(pl->fd, F_GETFL);
+
+    if (flags != -1)
+        fcntl(pl->fd, F_SETFL, flags & ~O_DIRECT);
+
+    pl->direct = false;
+}
+
+static int
+write_all(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t n = write(fd, data, size);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return errno;
+        }
+
+        data += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static void *
+write_thread(void *arg)
+{
+    struct pipeline *const pl = arg;
+    struct block_ring *const r = &pl->blocks;
+
+    for (;;) {
+        if (EVQ_LOAD_ACQUIRE(r->filled) == r->drained) {
+            /* Same as the synth thread, check again after seeing the flag.
+             */
+            if (EVQ_LOAD_ACQUIRE(r->finished) &&
+                EVQ_LOAD_ACQUIRE(r->filled) == r->drained)
+                break;
+
+            wait_a_bit();
+            continue;
+        }
+
+        const unsigned i = r->drained % NUM_BLOCKS;
+
+        /* Only the last block can be partial. O_DIRECT cannot write it. */
+        if (r->used[i] != BLOCK_BYTES)
+            clear_direct(pl);
+
+        /* After an error, keep draining blocks so that the synth thread does
+         * not wait forever.
+         */
+        if (pl->write_error == 0) {
+            pl->write_error = write_all(pl->fd, r->data[i], r->used[i]);
+            pl->bytes_written += r->used[i];
+        }
+
+        EVQ_STORE_RELEASE(r->drained, r->drained + 1);
+    }
+
+    return NULL;
+}
+
+static void
+put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+static int
+write_wav_header(struct pipeline *pl)
+{
+    const uint32_t data_size = pl->bytes_written - WAV_HEADER_SIZE;
+    uint8_t h[WAV_HEADER_SIZE];
+
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, data_size + WAV_HEADER_SIZE - 8);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le32(h + 16, 16);
+    put_le16(h + 20, 1);                    /* PCM */
+    put_le16(h + 22, 1);                    /* Mono */
+    put_le32(h + 24, pl->out_rate);
+    put_le32(h + 28, pl->out_rate * sizeof(int16_t));
+    put_le16(h + 32, sizeof(int16_t));
+    put_le16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put_le32(h + 40, data_size);
+
+    clear_direct(pl);
+
+    if (pwrite(pl->fd, h, sizeof(h), 0) != (ssize_t) sizeof(h))
+        return errno != 0 ? errno : EIO;
+
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-d] [-r rate] [-s blep|naive|x16] "
+            "[-x scalar|sse2|avx2] file.vgm file.wav\n", progname);
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct pipeline pl;
+    static const char *const mode_names[] = {
+        [SYNTH_BLEP] = "blep",
+        [SYNTH_NAIVE] = "naive",
+        [SYNTH_OVERSAMPLE] = "x16",
+    };
+    enum synth_mode mode = SYNTH_BLEP;
+    enum resample_isa isa = RESAMPLE_AUTO;
+    bool direct = false;
+    int opt;
+
+    pl.out_rate = SAMPLE_RATE;
+
+    while ((opt = getopt(argc, argv, "dr:s:x:")) != -1) {
+        switch (opt) {
+        case 'd':
+            direct = true;
+            break;
+        case 'r':
+            pl.out_rate = strtoul(optarg, NULL, 10);
+            if (pl.out_rate < 1000 || pl.out_rate > 384000) {
+                fprintf(stderr, "Invalid output rate \"%s\".\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'x':
+            for (isa = RESAMPLE_SCALAR; isa <= RESAMPLE_AVX2; isa++) {
+                if (strcmp(optarg, resampler_isa_name(isa)) == 0)
+                    break;
+            }
+
+            if (isa > RESAMPLE_AVX2) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's': {
+            unsigned i;
+
+            for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+                if (strcmp(optarg, mode_names[i]) == 0)
+                    break;
+            }
+
+            if (i == sizeof(mode_names) / sizeof(mode_names[0])) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            mode = i;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind + 2 != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *const in_path = argv[optind];
+    const char *const out_path = argv[optind + 1];
+    struct vgm_file f;
+    int err = vgm_file_open(&f, in_path, VGM_FILE_MMAP,
+                            VGM_FILE_SEQUENTIAL | VGM_FILE_HUGE);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", in_path,
+                strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    pl.player = vgm_player_open_memory(f.data, f.size);
+    if (pl.player == NULL) {
+        fprintf(stderr, "\"%s\" is not a VGM file.\n", in_path);
+        vgm_file_close(&f);
+        return EXIT_FAILURE;
+    }
+
+    const struct vgm_header *const h = vgm_player_header(pl.player);
+
+    /* Bits 30 and 31 of the clock select chip variants. */
+    const uint32_t clock = h->sn76489_clock & 0x3fffffff;
+
+    synth_init(&pl.synth, clock != 0 ? clock : 3579545, SAMPLE_RATE,
+               h->sn76489_fb, h->sn76489_fsr_width, mode);
+
+    if (pl.out_rate != SAMPLE_RATE) {
+        err = resampler_init(&pl.resampler, SAMPLE_RATE, pl.out_rate, isa);
+        if (err != 0) {
+            fprintf(stderr, "Could not set up the resampler: %s\n",
+                    strerror(err));
+            return EXIT_FAILURE;
+        }
+
+        pl.converted = malloc(resampler_max_output(&pl.resampler,
+                                                   RESAMPLE_CHUNK) *
+                              sizeof(int16_t));
+        if (pl.converted == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            return EXIT_FAILURE;
+        }
+
+        pl.resampling = true;
+    }
+
+    pl.fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC |
+                 (direct ? O_DIRECT : 0), 0666);
+    if (pl.fd < 0 && direct && errno == EINVAL) {
+        fprintf(stderr, "O_DIRECT is not supported for \"%s\". "
+                "Using buffered writes.\n", out_path);
+        direct = false;
+        pl.fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+
+    if (pl.fd < 0) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", out_path,
+                strerror(errno));
+        vgm_player_close(pl.player);
+        vgm_file_close(&f);
+        return EXIT_FAILURE;
+    }
+
+    pl.direct = direct;
+    evq_init(&pl.events);
+
+    for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+        void *block;
+
+        if (posix_memalign(&block, BLOCK_ALIGN, BLOCK_BYTES) != 0) {
+            fprintf(stderr, "Out of memory.\n");
+            return EXIT_FAILURE;
+        }
+
+        pl.blocks.data[i] = block;
+    }
+
+    const double start = now();
+    pthread_t decoder, synth, writer;
+
+    pthread_create(&decoder, NULL, decode_thread, &pl);
+    pthread_create(&synth, NULL, synth_thread, &pl);
+    pthread_create(&writer, NULL, write_thread, &pl);
+
+    pthread_join(decoder, NULL);
+    pthread_join(synth, NULL);
+    pthread_join(writer, NULL);
+
+    err = pl.write_error;
+    if (err == 0)
+        err = write_wav_header(&pl);
+
+    if (close(pl.fd) != 0 && err == 0)
+        err = errno;
+
+    const double elapsed = now() - start;
+
+    if (err != 0) {
+        fprintf(stderr, "Could not write \"%s\": %s\n", out_path,
+                strerror(err));
+    } else {
+        const double seconds = (double) (pl.bytes_written - WAV_HEADER_SIZE) /
+            (sizeof(int16_t) * pl.out_rate);
+
+        printf("%s: %.1fs of audio in %.3fs (%.1fx real time, %s)\n",
+               out_path, seconds, elapsed,
+               elapsed > 0 ? seconds / elapsed : 0.0, mode_names[mode]);
+        printf("event queue      high water %u, low water %u of %u\n",
+               pl.events.high_water, pl.events.low_water, EVQ_SIZE);
+
+        if (pl.resampling && pl.resample_seconds > 0) {
+            printf("resampler        %u to %u Hz, %s, %.1f MSamples/s\n",
+                   SAMPLE_RATE, pl.out_rate,
+                   resampler_isa_name(pl.resampler.isa),
+                   pl.resampled / pl.resample_seconds / 1e6);
+        }
+    }
+
+    if (pl.resampling) {
+        resampler_fini(&pl.resampler);
+        free(pl.converted);
+    }
+
+    for (unsigned i = 0; i < NUM_BLOCKS; i++)
+        free(pl.blocks.data[i]);
+
+    vgm_player_close(pl.player);
+    vgm_file_close(&f);
+
+    return err == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
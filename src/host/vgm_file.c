@@ -0,0 +1,170 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vgm_file.h"
+
+static int
+open_mmap(struct vgm_file *f, int fd, size_t size, unsigned flags)
+{
+    void *const map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return errno;
+
+    /* These are only hints. Failure is not an error. */
+    if ((flags & VGM_FILE_SEQUENTIAL) != 0)
+        madvise(map, size, MADV_SEQUENTIAL);
+
+#ifdef MADV_HUGEPAGE
+    if ((flags & VGM_FILE_HUGE) != 0 && size >= VGM_FILE_HUGE_MIN)
+        madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+    f->data = map;
+    return 0;
+}
+
+static int
+open_read(struct vgm_file *f, int fd, size_t size, unsigned flags)
+{
+    uint8_t *const buf = malloc(size == 0 ? 1 : size);
+    if (buf == NULL)
+        return ENOMEM;
+
+    if ((flags & VGM_FILE_SEQUENTIAL) != 0)
+        posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+    size_t total = 0;
+    while (total < size) {
+        const ssize_t bytes = read(fd, buf + total, size - total);
+
+        if (bytes < 0 && errno == EINTR)
+            continue;
+
+        if (bytes <= 0) {
+            const int err = bytes < 0 ? errno : EIO;
+
+            free(buf);
+            return err;
+        }
+
+        total += bytes;
+    }
+
+    f->data = buf;
+    return 0;
+}
+
+/**
+ * Read a pipe or other unseekable input until the end.
+ */
+static int
+open_stream(struct vgm_file *f, int fd)
+{
+    size_t capacity = VGM_FILE_MMAP_MIN;
+    size_t total = 0;
+    uint8_t *buf = malloc(capacity);
+
+    if (buf == NULL)
+        return ENOMEM;
+
+    for (;;) {
+        if (total == capacity) {
+            uint8_t *const bigger = realloc(buf, capacity * 2);
+
+            if (bigger == NULL) {
+                free(buf);
+                return ENOMEM;
+            }
+
+            buf = bigger;
+            capacity *= 2;
+        }
+
+        const ssize_t bytes = read(fd, buf + total, capacity - total);
+
+        if (bytes < 0 && errno == EINTR)
+            continue;
+
+        if (bytes < 0) {
+            const int err = errno;
+
+            free(buf);
+            return err;
+        }
+
+        if (bytes == 0)
+            break;
+
+        total += bytes;
+    }
+
+    f->data = buf;
+    f->size = total;
+    f->backend = VGM_FILE_READ;
+    return 0;
+}
+
+int
+vgm_file_open(struct vgm_file *f, const char *path,
+              enum vgm_file_backend backend, unsigned flags)
+{
+    if (strcmp(path, "-") == 0)
+        return open_stream(f, STDIN_FILENO);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int err = errno;
+
+        close(fd);
+        return err;
+    }
+
+    if (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)) {
+        const int err = open_stream(f, fd);
+
+        close(fd);
+        return err;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        return EINVAL;
+    }
+
+    f->size = st.st_size;
+    f->backend = f->size < VGM_FILE_MMAP_MIN ? VGM_FILE_READ : backend;
+
+    const int err = f->backend == VGM_FILE_MMAP
+        ? open_mmap(f, fd, f->size, flags)
+        : open_read(f, fd, f->size, flags);
+
+    /* A mapping stays valid after the file is closed. */
+    close(fd);
+    return err;
+}
+
+void
+vgm_file_close(struct vgm_file *f)
+{
+    if (f->backend == VGM_FILE_MMAP) {
+        munmap((void *) f->data, f->size);
+    } else {
+        free((void *) f->data);
+    }
+
+    f->data = NULL;
+    f->size = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_FILE_H
+#define VGM_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \file
+ * Access to VGM files for host tools.
+ *
+ * By default the file is mapped into memory, and the data pointer points
+ * straight at the mapped pages. The data is never copied. The read() backend
+ * copies the whole file into a heap buffer, like far_read() does on DOS.
+ *
+ * Setting up and tearing down a mapping costs more than copying a small
+ * file, so files smaller than \c VGM_FILE_MMAP_MIN bytes are always read.
+ *
+ * A path of "-" means standard input. Pipes and other inputs that cannot be
+ * mapped are read to the end with the read() backend.
+ */
+
+enum vgm_file_backend {
+    VGM_FILE_MMAP,
+    VGM_FILE_READ,
+};
+
+/** The file will be read from start to end, e.g., by a player or scanner. */
+#define VGM_FILE_SEQUENTIAL  (1u << 0)
+
+/**
+ * Request transparent huge pages for the mapping. This only has an effect for
+ * files of at least \c VGM_FILE_HUGE_MIN bytes, and only if the kernel
+ * supports huge pages for the page cache.
+ */
+#define VGM_FILE_HUGE        (1u << 1)
+
+#define VGM_FILE_HUGE_MIN    (2u * 1024 * 1024)
+
+#define VGM_FILE_MMAP_MIN    (64u * 1024)
+
+struct vgm_file {
+    const uint8_t *data;
+    size_t size;
+
+    /** Backend actually used to access the file. */
+    enum vgm_file_backend backend;
+};
+
+/**
+ * Open a file.
+ *
+ * \return
+ * Zero on success, or an errno value on failure.
+ */
+int vgm_file_open(struct vgm_file *f, const char *path,
+                  enum vgm_file_backend backend, unsigned flags);
+
+void vgm_file_close(struct vgm_file *f);
+
+#endif /* ifndef VGM_FILE_H */
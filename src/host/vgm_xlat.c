@@ -0,0 +1,335 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vgm_xlat.h"
+#include "vgm_player.h"
+#include "vgm_opll.h"
+#include "vgm_stereo.h"
+#include "vgm_nes.h"
+#include "vgm_gb.h"
+#include "vgm_lfsr.h"
+#include "vgm_voice.h"
+#include "vgm_volume.h"
+#include "vgm_mute.h"
+
+static bool
+opll_applies(const struct vgm_header *h)
+{
+    return h->ym2314_clock != 0;
+}
+
+/* The frequencies are converted for the OPL2 at its usual clock. */
+static void
+opll_update_header(struct vgm_header *h)
+{
+    h->ym3812_clock = OPL2_CLOCK_DIV4;
+    h->ym2314_clock = 0;
+}
+
+/* Stereo doubles the PSG writes, so it is only done when asked for. */
+static bool
+stereo_applies(const struct vgm_header *h)
+{
+    (void) h;
+    return false;
+}
+
+static void
+stereo_update_header(struct vgm_header *h)
+{
+    h->sn76489_clock |= 0x40000000;
+}
+
+/**
+ * Add the SN76489 of a Tandy 1000 for a chip that was translated to it.
+ */
+static void
+add_psg(struct vgm_header *h)
+{
+    if (h->sn76489_clock != 0)
+        return;
+
+    h->sn76489_clock = VGM_PSG_CLOCK;
+    h->sn76489_fb = 0x0003;
+    h->sn76489_fsr_width = TANDY_FSR_WIDTH;
+}
+
+static bool
+gb_applies(const struct vgm_header *h)
+{
+    return h->version >= 0x161 && h->gb_dmg_clock != 0;
+}
+
+static void
+gb_update_header(struct vgm_header *h)
+{
+    add_psg(h);
+    h->gb_dmg_clock = 0;
+}
+
+static bool
+nes_applies(const struct vgm_header *h)
+{
+    return h->version >= 0x161 && h->nes_apu_clock != 0;
+}
+
+static void
+nes_update_header(struct vgm_header *h)
+{
+    add_psg(h);
+    h->nes_apu_clock = 0;
+}
+
+static bool
+merge_applies(const struct vgm_header *h)
+{
+    return (h->sn76489_clock & 0x40000000) != 0;
+}
+
+static void
+merge_update_header(struct vgm_header *h)
+{
+    h->sn76489_clock &= ~0x40000000;
+}
+
+static bool
+lfsr_applies(const struct vgm_header *h)
+{
+    return h->sn76489_clock != 0 && vgm_fsr_width(h) != TANDY_FSR_WIDTH;
+}
+
+/* The output is for the Tandy's PSG, which has the TI noise taps. */
+static void
+lfsr_update_header(struct vgm_header *h)
+{
+    h->sn76489_fb = 0x0003;
+    h->sn76489_fsr_width = TANDY_FSR_WIDTH;
+}
+
+static bool
+vol_applies(const struct vgm_header *h)
+{
+    return volume_steps(h) != 0;
+}
+
+/* The modifier has been applied to the PSG writes. */
+static void
+vol_update_header(struct vgm_header *h)
+{
+    if (h->version >= 0x160)
+        h->volume_modifier = 0;
+}
+
+static bool
+mute_applies(const struct vgm_header *h)
+{
+    (void) h;
+    return mute_mask() != 0;
+}
+
+static void
+mute_update_header(struct vgm_header *h)
+{
+    (void) h;
+}
+
+const struct vgm_xlat_pass vgm_xlat_passes[VGM_XLAT_NUM_PASSES] = {
+    { "opll", opll_translate, opll_applies, opll_update_header },
+    { "gb", gb_translate, gb_applies, gb_update_header },
+    { "nes", nes_translate, nes_applies, nes_update_header },
+    { "merge", voice_merge, merge_applies, merge_update_header },
+    { "lfsr", lfsr_remap, lfsr_applies, lfsr_update_header },
+    { "mute", mute_apply, mute_applies, mute_update_header },
+    { "stereo", gg_stereo_split, stereo_applies, stereo_update_header },
+    { "vol", volume_remap, vol_applies, vol_update_header },
+};
+
+const struct vgm_xlat_pass *
+vgm_xlat_find(const char *name)
+{
+    for (unsigned i = 0; i < VGM_XLAT_NUM_PASSES; i++) {
+        if (strcmp(vgm_xlat_passes[i].name, name) == 0)
+            return &vgm_xlat_passes[i];
+    }
+
+    return NULL;
+}
+
+bool
+vgm_xlat_option(struct vgm_xlat_options *opts, int opt, const char *arg)
+{
+    switch (opt) {
+    case 't':
+        if (opts->num_selected == VGM_XLAT_NUM_PASSES) {
+            fprintf(stderr, "Too many passes.\n");
+            return false;
+        }
+
+        opts->selected[opts->num_selected] = vgm_xlat_find(arg);
+        if (opts->selected[opts->num_selected] == NULL) {
+            fprintf(stderr, "Unknown pass \"%s\".\n", arg);
+            return false;
+        }
+
+        opts->num_selected++;
+        return true;
+    case 'v':
+        volume_set_gain(atoi(arg));
+        return true;
+    case 'm':
+    case 's': {
+        const unsigned voice = atoi(arg);
+
+        if (voice >= MUTE_VOICES) {
+            fprintf(stderr, "Voice must be in the range [0, %u].\n",
+                    MUTE_VOICES - 1);
+            return false;
+        }
+
+        if (opt == 'm')
+            mute_voice(voice);
+        else
+            solo_voice(voice);
+
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool
+vgm_xlat_open(struct vgm_xlat *x, const uint8_t *file, size_t size)
+{
+    struct vgm_player *const p = vgm_player_open_memory(file, size);
+    if (p == NULL)
+        return false;
+
+    const struct vgm_header *const h = &x->header;
+    const uint32_t data_start = vgm_data_start(file, size);
+
+    x->header = *vgm_player_header(p);
+    vgm_player_close(p);
+
+    /* Keep a GD3 tag that follows the data. */
+    x->gd3 = NULL;
+    x->gd3_size = 0;
+
+    if (h->gd3_offset != 0 && h->gd3_offset + 0x14 >= data_start &&
+        h->gd3_offset + 0x14 + 12 <= size &&
+        memcmp(file + h->gd3_offset + 0x14, "Gd3 ", 4) == 0) {
+        x->gd3 = file + h->gd3_offset + 0x14;
+        x->gd3_size = 12 + (x->gd3[8] | (x->gd3[9] << 8) |
+                            (x->gd3[10] << 16) |
+                            ((uint32_t) x->gd3[11] << 24));
+
+        if (x->gd3_size > size - (h->gd3_offset + 0x14))
+            x->gd3_size = size - (h->gd3_offset + 0x14);
+    }
+
+    /* The data ends at the end of file given in the header, or at a GD3 tag
+     * that follows it.
+     */
+    x->size = size - data_start;
+
+    if (h->eof_offset + 4 > data_start && h->eof_offset + 4 < size)
+        x->size = h->eof_offset + 4 - data_start;
+
+    if (x->gd3 != NULL && x->gd3 - file < data_start + x->size)
+        x->size = x->gd3 - file - data_start;
+
+    x->loop = h->loop_offset != 0
+        ? h->loop_offset + 0x1c - data_start : VGM_BUF_SIZE_UNKNOWN;
+    x->data = malloc(x->size == 0 ? 1 : x->size);
+    if (x->data == NULL)
+        return false;
+
+    memcpy(x->data, file + data_start, x->size);
+    return true;
+}
+
+void
+vgm_xlat_close(struct vgm_xlat *x)
+{
+    free(x->data);
+    x->data = NULL;
+}
+
+bool
+vgm_xlat_run(struct vgm_xlat *x, const struct vgm_xlat_pass *p)
+{
+    struct vgm_buf v;
+    struct vgm_out o;
+
+    vgm_buf_init(&v, x->data, x->size);
+    vgm_out_init(&o, NULL, x->loop);
+
+    if (!p->run(&o, &v, &x->header))
+        return false;
+
+    uint8_t *const out = malloc(o.size == 0 ? 1 : o.size);
+    if (out == NULL)
+        return false;
+
+    vgm_out_init(&o, out, x->loop);
+    p->run(&o, &v, &x->header);
+
+    free(x->data);
+    x->data = out;
+    x->size = o.size;
+    x->loop = o.loop_out;
+
+    p->update_header(&x->header);
+    return true;
+}
+
+bool
+vgm_xlat_run_selected(struct vgm_xlat *x,
+                      const struct vgm_xlat_options *opts, const char *path)
+{
+    const struct vgm_xlat_pass *const *selected = opts->selected;
+    unsigned num_selected = opts->num_selected;
+    const struct vgm_xlat_pass *applies[VGM_XLAT_NUM_PASSES];
+
+    if (num_selected == 0) {
+        for (unsigned i = 0; i < VGM_XLAT_NUM_PASSES; i++) {
+            if (vgm_xlat_passes[i].applies(&x->header))
+                applies[num_selected++] = &vgm_xlat_passes[i];
+        }
+
+        selected = applies;
+    }
+
+    for (unsigned i = 0; i < num_selected; i++) {
+        if (!vgm_xlat_run(x, selected[i])) {
+            fprintf(stderr, "Pass \"%s\" failed on \"%s\".\n",
+                    selected[i]->name, path);
+            return false;
+        }
+
+        printf("%s: %lu bytes\n", selected[i]->name, (unsigned long) x->size);
+    }
+
+    return true;
+}
+
+void
+vgm_xlat_finish(struct vgm_xlat *x)
+{
+    struct vgm_header *const h = &x->header;
+
+    /* Clock fields after the original header may now be in use. */
+    if (h->version < 0x151)
+        h->version = 0x151;
+
+    /* The output always has a full header, with the data right after it. */
+    h->vgm_data_offset = sizeof(*h) - 0x34;
+    h->loop_offset = h->loop_offset != 0 ? x->loop + sizeof(*h) - 0x1c : 0;
+    h->gd3_offset = x->gd3_size != 0 ? x->size + sizeof(*h) - 0x14 : 0;
+    h->eof_offset = sizeof(*h) + x->size + x->gd3_size - 4;
+}
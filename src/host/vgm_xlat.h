@@ -0,0 +1,141 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_XLAT_H
+#define VGM_XLAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm.h"
+#include "vgm_pass.h"
+
+/**
+ * \file
+ * The player's load-time passes, run ahead of time on a host.
+ *
+ * The output of the passes is an ordinary VGM file that the DOS player can
+ * play without doing the work of the passes itself. It is laid out as a full
+ * header, the VGM data, and then the GD3 tag, if there is one.
+ */
+
+struct vgm_xlat_pass {
+    const char *name;
+    vgm_pass_fn run;
+
+    /** Determine whether the pass has anything to do for a file. */
+    bool (*applies)(const struct vgm_header *h);
+
+    /** Update the header for the chips used by the output. */
+    void (*update_header)(struct vgm_header *h);
+};
+
+#define VGM_XLAT_NUM_PASSES 8
+
+/**
+ * Every pass, in the order that the player runs them.
+ */
+extern const struct vgm_xlat_pass vgm_xlat_passes[VGM_XLAT_NUM_PASSES];
+
+/**
+ * The options that choose the passes and their settings, for getopt.
+ *
+ * -t selects a pass by name, and may be repeated. -v sets the gain of the vol
+ * pass in dB. -m and -s mute and solo a voice for the mute pass.
+ */
+#define VGM_XLAT_OPTIONS "t:v:m:s:"
+
+/**
+ * Passes selected on the command line.
+ */
+struct vgm_xlat_options {
+    const struct vgm_xlat_pass *selected[VGM_XLAT_NUM_PASSES];
+    unsigned num_selected;
+};
+
+/**
+ * A VGM file being translated.
+ */
+struct vgm_xlat {
+    struct vgm_header header;
+
+    /** VGM data, without the header. Owned by the \c vgm_xlat. */
+    uint8_t *data;
+    uint32_t size;
+
+    /** Position of the loop point in \c data. */
+    uint32_t loop;
+
+    /**
+     * GD3 tag that follows the data in the file, or NULL. It points into the
+     * file that was opened.
+     */
+    const uint8_t *gd3;
+    uint32_t gd3_size;
+};
+
+/**
+ * Find a pass by name.
+ *
+ * \return
+ * The pass, or NULL if there is no pass by that name.
+ */
+const struct vgm_xlat_pass *vgm_xlat_find(const char *name);
+
+/**
+ * Handle one of the options in \c VGM_XLAT_OPTIONS.
+ *
+ * \return
+ * False, after printing an error, if the argument is not valid.
+ */
+bool vgm_xlat_option(struct vgm_xlat_options *opts, int opt,
+                     const char *arg);
+
+/**
+ * Copy the VGM data out of a file in memory.
+ *
+ * The file must remain valid until \c vgm_xlat_close, since the GD3 tag is
+ * not copied.
+ *
+ * \return
+ * False if the data is not a VGM file or memory could not be allocated.
+ */
+bool vgm_xlat_open(struct vgm_xlat *x, const uint8_t *file, size_t size);
+
+void vgm_xlat_close(struct vgm_xlat *x);
+
+/**
+ * Replace the data with the output of a pass, and update the header.
+ *
+ * \return
+ * False if the data could not be parsed or memory could not be allocated.
+ * The data is unchanged.
+ */
+bool vgm_xlat_run(struct vgm_xlat *x, const struct vgm_xlat_pass *p);
+
+/**
+ * Run the selected passes, or every pass that applies to the file if none
+ * were selected.
+ *
+ * The size of the data after each pass is printed.
+ *
+ * \param path  Name of the file, for the error message.
+ *
+ * \return
+ * False, after printing an error, if a pass failed. The passes after it are
+ * not run.
+ */
+bool vgm_xlat_run_selected(struct vgm_xlat *x,
+                           const struct vgm_xlat_options *opts,
+                           const char *path);
+
+/**
+ * Set the offsets and version in the header for the output file.
+ *
+ * Call this once, after the last pass.
+ */
+void vgm_xlat_finish(struct vgm_xlat *x);
+
+#endif /* ifndef VGM_XLAT_H */
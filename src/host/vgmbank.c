@@ -0,0 +1,305 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Pack VGM files into a VGM bank (see vgb.h), or list the contents of a bank.
+ *
+ *     vgmbank bank.vgb file.vgm...
+ *     vgmbank -l bank.vgb
+ *
+ * The GD3 tag of each track is stripped, and its track name (or the file
+ * name, if there is no tag) becomes the title in the table of contents.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vgm_player.h"
+#include "vgm_file.h"
+#include "vgb.h"
+
+#define ENTRY_SIZE (5 * 4 + VGB_TITLE_SIZE)
+#define HEADER_SIZE 8
+
+/* The DOS player reads the header and the table directly into these. */
+_Static_assert(sizeof(struct vgb_header) == HEADER_SIZE, "vgb_header size");
+_Static_assert(sizeof(struct vgb_entry) == ENTRY_SIZE, "vgb_entry size");
+
+static void
+put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+static uint32_t
+get_le32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+        ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void
+set_title(char *title, const char *name)
+{
+    strncpy(title, name, VGB_TITLE_SIZE - 1);
+    title[VGB_TITLE_SIZE - 1] = '\0';
+}
+
+/**
+ * Title from the file name, without the directory or the extension.
+ */
+static void
+title_from_path(char *title, const char *path)
+{
+    const char *const slash = strrchr(path, '/');
+
+    set_title(title, slash != NULL ? slash + 1 : path);
+
+    char *const dot = strrchr(title, '.');
+    if (dot != NULL && dot != title)
+        *dot = '\0';
+}
+
+/**
+ * Append one VGM file to the bank.
+ *
+ * \return
+ * False if the file could not be added.
+ */
+static bool
+add_track(FILE *out, const char *path, struct vgb_entry *e)
+{
+    struct vgm_file f;
+    const int err = vgm_file_open(&f, path, VGM_FILE_MMAP,
+                                  VGM_FILE_SEQUENTIAL);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", path, strerror(err));
+        return false;
+    }
+
+    struct vgm_player *const p = vgm_player_open_memory(f.data, f.size);
+    if (p == NULL) {
+        fprintf(stderr, "\"%s\" is not a VGM file.\n", path);
+        vgm_file_close(&f);
+        return false;
+    }
+
+    const struct vgm_header *const h = vgm_player_header(p);
+
+    if (vgm_player_gd3(p, VGM_GD3_TRACK_NAME, e->title,
+                       sizeof(e->title)) <= 0)
+        title_from_path(e->title, path);
+
+    /* Drop a GD3 tag that follows the data, and anything after the end of
+     * the file given in the header.
+     */
+    const uint32_t data_start = vgm_data_start(f.data, f.size);
+    uint32_t length = f.size;
+
+    if (h->eof_offset + 4 >= 0x40 && h->eof_offset + 4 < length)
+        length = h->eof_offset + 4;
+
+    if (h->gd3_offset != 0 && h->gd3_offset + 0x14 >= data_start &&
+        h->gd3_offset + 0x14 < length)
+        length = h->gd3_offset + 0x14;
+
+    e->length = length;
+    e->total_samples = h->total_samples;
+    e->loop_offset = h->loop_offset != 0 ? h->loop_offset + 0x1c : 0;
+    e->loop_samples = h->loop_samples;
+
+    /* The header copy is patched for the missing GD3 tag and the new
+     * length.
+     */
+    uint8_t header[0x40];
+
+    memcpy(header, f.data, sizeof(header));
+    put_le32(header + 0x04, length - 4);
+    put_le32(header + 0x14, 0);
+
+    const bool ok = fwrite(header, sizeof(header), 1, out) == 1 &&
+        fwrite(f.data + sizeof(header), length - sizeof(header), 1, out) == 1;
+
+    if (!ok)
+        fprintf(stderr, "Could not write \"%s\": %s\n", path, strerror(errno));
+
+    vgm_player_close(p);
+    vgm_file_close(&f);
+
+    return ok;
+}
+
+static void
+encode_entry(uint8_t *p, const struct vgb_entry *e)
+{
+    put_le32(p + 0, e->offset);
+    put_le32(p + 4, e->length);
+    put_le32(p + 8, e->total_samples);
+    put_le32(p + 12, e->loop_offset);
+    put_le32(p + 16, e->loop_samples);
+    memcpy(p + 20, e->title, VGB_TITLE_SIZE);
+}
+
+static int
+pack(const char *bank, int count, char **paths)
+{
+    if (count > VGB_MAX_TRACKS) {
+        fprintf(stderr, "A bank can hold at most %d tracks.\n",
+                VGB_MAX_TRACKS);
+        return EXIT_FAILURE;
+    }
+
+    FILE *const out = fopen(bank, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", bank,
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct vgb_entry *const toc = calloc(count, sizeof(*toc));
+    uint32_t offset = HEADER_SIZE + count * ENTRY_SIZE;
+    int ret = EXIT_SUCCESS;
+
+    /* The tracks are written first, after space for the table of
+     * contents.
+     */
+    fseek(out, offset, SEEK_SET);
+
+    for (int i = 0; i < count; i++) {
+        toc[i].offset = offset;
+
+        if (!add_track(out, paths[i], &toc[i])) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        offset += toc[i].length;
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        uint8_t h[HEADER_SIZE];
+        uint8_t entry[ENTRY_SIZE];
+
+        memcpy(h, "Vgb ", 4);
+        put_le16(h + 4, VGB_VERSION);
+        put_le16(h + 6, count);
+
+        fseek(out, 0, SEEK_SET);
+        fwrite(h, sizeof(h), 1, out);
+
+        for (int i = 0; i < count; i++) {
+            encode_entry(entry, &toc[i]);
+            fwrite(entry, sizeof(entry), 1, out);
+        }
+    }
+
+    if (fclose(out) != 0 || ret != EXIT_SUCCESS) {
+        if (ret == EXIT_SUCCESS) {
+            fprintf(stderr, "Could not write \"%s\": %s\n", bank,
+                    strerror(errno));
+        }
+
+        remove(bank);
+        ret = EXIT_FAILURE;
+    } else {
+        printf("%s: %d tracks, %lu bytes\n", bank, count,
+               (unsigned long) offset);
+    }
+
+    free(toc);
+    return ret;
+}
+
+static int
+list(const char *bank)
+{
+    struct vgm_file f;
+    const int err = vgm_file_open(&f, bank, VGM_FILE_READ, 0);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", bank, strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    const unsigned count = f.size >= HEADER_SIZE
+        ? f.data[6] | (f.data[7] << 8) : 0;
+
+    if (f.size < HEADER_SIZE || memcmp(f.data, "Vgb ", 4) != 0 ||
+        f.size < HEADER_SIZE + (size_t) count * ENTRY_SIZE) {
+        fprintf(stderr, "\"%s\" is not a VGM bank.\n", bank);
+        vgm_file_close(&f);
+        return EXIT_FAILURE;
+    }
+
+    printf("track   offset   length   time  loop  title\n");
+
+    for (unsigned i = 0; i < count; i++) {
+        const uint8_t *const p = f.data + HEADER_SIZE + i * ENTRY_SIZE;
+        const uint32_t seconds = get_le32(p + 8) / 44100;
+
+        printf("%5u %8lu %8lu %3lu:%02lu  %-4s  %.*s\n", i + 1,
+               (unsigned long) get_le32(p), (unsigned long) get_le32(p + 4),
+               (unsigned long) seconds / 60, (unsigned long) seconds % 60,
+               get_le32(p + 12) != 0 ? "yes" : "no",
+               VGB_TITLE_SIZE, (const char *) p + 20);
+    }
+
+    vgm_file_close(&f);
+    return EXIT_SUCCESS;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s bank.vgb file.vgm...\n"
+            "       %s -l bank.vgb\n",
+            progname, progname);
+}
+
+int
+main(int argc, char **argv)
+{
+    bool listing = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l")) != -1) {
+        switch (opt) {
+        case 'l':
+            listing = true;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (listing) {
+        if (optind + 1 != argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        return list(argv[optind]);
+    }
+
+    if (optind + 2 > argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return pack(argv[optind], argc - optind - 1, argv + optind + 1);
+}
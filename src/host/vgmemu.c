@@ -0,0 +1,257 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Run a DOS program, normally vgmplay.exe, on an emulated 8088 PC and count
+ * the CPU clocks that it uses.
+ *
+ * Every port access is recorded with its cycle count. With -t, the accesses
+ * are written in the format of VGMPLAY.TRC, so "vgmtrace -c" can check the
+ * order of the writes. With -p, the clocks spent in each opcode are printed,
+ * which shows where the time goes in a delay loop or an event loop.
+ *
+ * See emu86.h and emu86_dos.h for what is and is not modeled. The counts are
+ * exact for the model, so a change in the player's code that makes it slower
+ * or faster shows up as a change in the counts.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emu86_dos.h"
+
+/* Longest command tail that fits in the PSP. */
+#define MAX_TAIL 126
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-q] [-p] [-m 4.77|7.16] [-s seconds] "
+            "[-t trace] program.exe [arguments...]\n", name);
+}
+
+static uint8_t *
+read_file(const char *path, size_t *size)
+{
+    FILE *const fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    uint8_t *data = NULL;
+    size_t cap = 0;
+
+    *size = 0;
+    for (;;) {
+        if (*size == cap) {
+            cap = cap != 0 ? cap * 2 : 65536;
+
+            uint8_t *const p = realloc(data, cap);
+            if (p == NULL) {
+                free(data);
+                fclose(fp);
+                return NULL;
+            }
+
+            data = p;
+        }
+
+        const size_t n = fread(data + *size, 1, cap - *size, fp);
+        if (n == 0)
+            break;
+
+        *size += n;
+    }
+
+    fclose(fp);
+    return data;
+}
+
+/**
+ * Print the opcodes that used the most clocks.
+ */
+static void
+print_profile(const struct emu86 *cpu)
+{
+    unsigned order[256];
+
+    for (unsigned i = 0; i < 256; i++)
+        order[i] = i;
+
+    /* There are only 256 entries, so a simple sort is fine. */
+    for (unsigned i = 1; i < 256; i++) {
+        const unsigned op = order[i];
+        unsigned j = i;
+
+        for (; j > 0 && cpu->op_cycles[order[j - 1]] < cpu->op_cycles[op];
+             j--)
+            order[j] = order[j - 1];
+
+        order[j] = op;
+    }
+
+    printf("opcode      count          clocks   clocks/op  share\n");
+    for (unsigned i = 0; i < 20 && cpu->op_count[order[i]] != 0; i++) {
+        const unsigned op = order[i];
+
+        printf("%02x   %12llu  %14llu  %10.1f  %5.1f%%\n", op,
+               (unsigned long long) cpu->op_count[op],
+               (unsigned long long) cpu->op_cycles[op],
+               (double) cpu->op_cycles[op] / cpu->op_count[op],
+               100.0 * cpu->op_cycles[op] / cpu->cycles);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned osc_div = EMU86_DIV_4_77MHZ;
+    double seconds = 600.0;
+    const char *trace_path = NULL;
+    bool profile = false;
+    bool quiet = false;
+    int opt;
+
+    /* Options after the program name belong to the program. */
+    while ((opt = getopt(argc, argv, "+qpm:s:t:")) != -1) {
+        switch (opt) {
+        case 'q':
+            quiet = true;
+            break;
+        case 'p':
+            profile = true;
+            break;
+        case 'm':
+            if (strcmp(optarg, "4.77") == 0) {
+                osc_div = EMU86_DIV_4_77MHZ;
+            } else if (strcmp(optarg, "7.16") == 0) {
+                osc_div = EMU86_DIV_7_16MHZ;
+            } else {
+                fprintf(stderr, "Invalid CPU clock \"%s\".\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            seconds = atof(optarg);
+            if (seconds <= 0) {
+                fprintf(stderr, "Invalid time limit \"%s\".\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char tail[MAX_TAIL + 1] = "";
+    size_t len = 0;
+
+    for (int i = optind + 1; i < argc; i++) {
+        const size_t n = strlen(argv[i]);
+
+        if (len + (len != 0) + n > MAX_TAIL) {
+            fprintf(stderr, "The command line is too long for DOS.\n");
+            return EXIT_FAILURE;
+        }
+
+        if (len != 0)
+            tail[len++] = ' ';
+
+        memcpy(tail + len, argv[i], n + 1);
+        len += n;
+    }
+
+    size_t size;
+    uint8_t *const exe = read_file(argv[optind], &size);
+    if (exe == NULL) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", argv[optind],
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct emu86_dos m;
+    if (!emu86_dos_init(&m, osc_div)) {
+        fprintf(stderr, "Out of memory.\n");
+        free(exe);
+        return EXIT_FAILURE;
+    }
+
+    m.echo = !quiet;
+
+    if (!emu86_dos_load(&m, exe, size, "C:\\VGMPLAY.EXE", tail)) {
+        fprintf(stderr, "\"%s\" is not a DOS program that fits in 640KiB.\n",
+                argv[optind]);
+        emu86_dos_free(&m);
+        free(exe);
+        return EXIT_FAILURE;
+    }
+
+    free(exe);
+
+    const enum emu86_status s =
+        emu86_dos_run(&m, (uint64_t)(seconds * emu86_dos_cpu_hz(&m)));
+    const struct emu86 *const cpu = &m.cpu;
+    int ret = EXIT_SUCCESS;
+
+    printf("\n");
+    switch (s) {
+    case EMU86_STOPPED:
+        printf("status           exited with code %d\n", m.exit_code);
+        ret = m.exit_code;
+        break;
+    case EMU86_RUNNING:
+        printf("status           still running after %.1fs\n", seconds);
+        ret = EXIT_FAILURE;
+        break;
+    case EMU86_HALTED:
+        printf("status           halted at %04x:%04x\n", cpu->fault_cs,
+               cpu->fault_ip);
+        ret = EXIT_FAILURE;
+        break;
+    case EMU86_BAD_OPCODE:
+        printf("status           invalid opcode %02x at %04x:%04x\n",
+               emu86_read8(cpu, cpu->fault_cs, cpu->fault_ip),
+               cpu->fault_cs, cpu->fault_ip);
+        ret = EXIT_FAILURE;
+        break;
+    }
+
+    printf("CPU clock        %.6f MHz\n", emu86_dos_cpu_hz(&m) / 1e6);
+    printf("clocks           %llu\n", (unsigned long long) cpu->cycles);
+    printf("emulated time    %.6fs\n",
+           cpu->cycles / emu86_dos_cpu_hz(&m));
+    printf("instructions     %llu\n",
+           (unsigned long long) cpu->instructions);
+    printf("port accesses    %zu\n", m.port_count);
+
+    if (profile)
+        print_profile(cpu);
+
+    if (trace_path != NULL) {
+        FILE *const fp = fopen(trace_path, "w");
+
+        if (fp == NULL) {
+            fprintf(stderr, "Could not create \"%s\": %s\n", trace_path,
+                    strerror(errno));
+            ret = EXIT_FAILURE;
+        } else {
+            emu86_dos_write_trace(&m, fp);
+            fclose(fp);
+        }
+    }
+
+    emu86_dos_free(&m);
+    return ret;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Decode every command in a set of VGM files and report statistics and
+ * throughput. Directories are scanned recursively.
+ *
+ * This is mostly a benchmark for the decoder and for the two vgm_file
+ * backends. Use -r to read files into heap buffers instead of mapping them.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "vgm_player.h"
+#include "vgm_iter.h"
+#include "vgm_file.h"
+
+struct scan_stats {
+    unsigned long files;
+    unsigned long not_vgm;
+    unsigned long parse_errors;
+    unsigned long long bytes;
+    unsigned long long events[VGM_EVENT_ERROR + 1];
+};
+
+static struct scan_stats stats;
+static enum vgm_file_backend backend = VGM_FILE_MMAP;
+static bool verbose = false;
+
+static void
+scan_file(const char *path)
+{
+    struct vgm_file f;
+    const int err = vgm_file_open(&f, path, backend,
+                                  VGM_FILE_SEQUENTIAL | VGM_FILE_HUGE);
+
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(err));
+        return;
+    }
+
+    stats.files++;
+    stats.bytes += f.size;
+
+    if (f.size < 0x40 || memcmp(f.data, "Vgm ", 4) != 0) {
+        stats.not_vgm++;
+        vgm_file_close(&f);
+        return;
+    }
+
+    const uint32_t start = vgm_data_start(f.data, f.size);
+    struct vgm_buf v;
+    struct vgm_event e;
+    unsigned long long count = 0;
+
+    vgm_buf_init(&v, (uint8_t *) f.data + start, f.size - start);
+
+    do {
+        vgm_next_event(&v, &e);
+        stats.events[e.type]++;
+        count++;
+    } while (e.type != VGM_EVENT_END && e.type != VGM_EVENT_ERROR);
+
+    if (e.type == VGM_EVENT_ERROR)
+        stats.parse_errors++;
+
+    if (verbose) {
+        printf("%s: %llu commands%s\n", path, count,
+               e.type == VGM_EVENT_ERROR ? ", parse error" : "");
+    }
+
+    vgm_file_close(&f);
+}
+
+static int
+visit(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void) st;
+    (void) ftw;
+
+    if (type == FTW_F)
+        scan_file(path);
+
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rv")) != -1) {
+        switch (opt) {
+        case 'r':
+            backend = VGM_FILE_READ;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-r] [-v] file-or-directory...\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-r] [-v] file-or-directory...\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const double start = now();
+
+    for (int i = optind; i < argc; i++)
+        nftw(argv[i], visit, 64, FTW_PHYS);
+
+    const double elapsed = now() - start;
+
+    printf("backend          %s\n",
+           backend == VGM_FILE_MMAP ? "mmap" : "read");
+    printf("files            %lu (%lu not VGM, %lu parse errors)\n",
+           stats.files, stats.not_vgm, stats.parse_errors);
+    printf("bytes            %llu\n", stats.bytes);
+    printf("PSG writes       %llu\n", stats.events[VGM_EVENT_PSG_WRITE]);
+    printf("PSG 2 writes     %llu\n", stats.events[VGM_EVENT_PSG2_WRITE]);
+    printf("waits            %llu\n", stats.events[VGM_EVENT_WAIT]);
+    printf("AY-8910 writes   %llu\n", stats.events[VGM_EVENT_AY8910_WRITE]);
+    printf("SAA1099 writes   %llu\n", stats.events[VGM_EVENT_SAA1099_WRITE]);
+    printf("YM3812 writes    %llu\n", stats.events[VGM_EVENT_OPL2_WRITE]);
+    printf("data blocks      %llu\n", stats.events[VGM_EVENT_DATA_BLOCK]);
+    printf("other writes     %llu\n", stats.events[VGM_EVENT_CHIP_WRITE]);
+    printf("elapsed          %.3fs\n", elapsed);
+
+    if (elapsed > 0) {
+        printf("throughput       %.3f GB/s, %.0f files/s\n",
+               stats.bytes / elapsed / 1e9, stats.files / elapsed);
+    }
+
+    return EXIT_SUCCESS;
+}
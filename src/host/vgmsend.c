@@ -0,0 +1,667 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Send a VGM file to "vgmplay /com:N" over a serial line.
+ *
+ *     vgmsend [-b baud] [-t pass]... [-v dB] [-m voice]... [-s voice]...
+ *             port file.vgm
+ *     vgmsend -T [-b baud] [-r] [-t pass]... ... file.vgm
+ *
+ * The player's load-time passes are run here, as by vgmxlat, and the result
+ * is sent using the protocol in link.h. Once the whole file has been
+ * acknowledged, the sender exits. If the player is restarted in the middle,
+ * the file is sent again from the start.
+ *
+ * With -T, no serial port is used. The file is sent over a pseudo-terminal
+ * pair to a receiver in this process that uses the same ring and credit
+ * logic as the player, and decodes the data as it arrives. -b limits the
+ * sender to the speed of a serial line at that rate, and -r makes the
+ * receiver play the waits in real time instead of as fast as it can. The
+ * report gives the throughput, the time from sending each block of
+ * LINK_ACK_BYTES bytes to its acknowledgement, and whether the receiver got
+ * exactly the bytes that were sent.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "vgm_file.h"
+#include "vgm_xlat.h"
+#include "vgm_iter.h"
+#include "link.h"
+
+#define SAMPLE_RATE 44100u
+
+/* Size of the receiver's stream buffer, the same as the player's. */
+#define STREAM_BUFFER_SIZE 0x2000u
+
+/* Bytes written at a time while the sender is limited to a bit rate. */
+#define PACED_CHUNK 64u
+
+struct send_stats {
+    double start;
+    double end;
+    uint64_t bytes;
+    unsigned restarts;
+
+    unsigned long acks;
+    double latency_sum;
+    double latency_min;
+    double latency_max;
+};
+
+/**
+ * The receiving end of the self-test. It stands in for the player: one
+ * thread is the UART interrupt handler, and the other is the player.
+ */
+struct receiver {
+    int fd;
+    bool realtime;
+
+    struct link_ring ring;
+    volatile bool stop;
+
+    /* Bytes of the file not yet read. See com_left in the player. */
+    uint32_t left;
+
+    /* Every byte read, to be compared with what was sent. */
+    uint8_t *copy;
+    uint32_t copied;
+    uint32_t capacity;
+
+    unsigned long events;
+    bool error;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+wait_a_bit(void)
+{
+    sched_yield();
+}
+
+static void
+sleep_until(double t)
+{
+    const double d = t - now();
+
+    if (d <= 0)
+        return;
+
+    struct timespec ts;
+
+    ts.tv_sec = (time_t) d;
+    ts.tv_nsec = (long) ((d - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+static speed_t
+baud_speed(unsigned long baud)
+{
+    switch (baud) {
+    case 1200:   return B1200;
+    case 2400:   return B2400;
+    case 4800:   return B4800;
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    default:     return B0;
+    }
+}
+
+/**
+ * Set a terminal to pass bytes through unchanged.
+ *
+ * \param baud Bit rate, or zero to leave it alone.
+ */
+static bool
+set_raw(int fd, unsigned long baud)
+{
+    struct termios t;
+
+    if (tcgetattr(fd, &t) != 0)
+        return false;
+
+    cfmakeraw(&t);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cflag &= ~CRTSCTS;
+    t.c_cc[VMIN] = 0;
+    t.c_cc[VTIME] = 0;
+
+    if (baud != 0 && cfsetspeed(&t, baud_speed(baud)) != 0)
+        return false;
+
+    return tcsetattr(fd, TCSANOW, &t) == 0;
+}
+
+/**
+ * Handle a byte from the receiver.
+ *
+ * \param sent_at Time that the last byte of each block was written.
+ */
+static void
+got_byte(uint8_t b, bool *ready, uint32_t *pos, struct link_credit *c,
+         const double *sent_at, struct send_stats *st)
+{
+    if (b == LINK_READY) {
+        if (*ready) {
+            printf("Receiver restarted. Sending the file again.\n");
+            st->restarts++;
+        }
+
+        *ready = true;
+        *pos = 0;
+        link_credit_init(c);
+        return;
+    }
+
+    if (b != LINK_ACK || !*ready)
+        return;
+
+    const uint32_t block = c->acked / LINK_ACK_BYTES;
+
+    if (!link_credit_ack(c)) {
+        printf("Acknowledgement for data that was not sent.\n");
+        return;
+    }
+
+    const double latency = now() - sent_at[block];
+
+    if (st->acks == 0 || latency < st->latency_min)
+        st->latency_min = latency;
+
+    if (latency > st->latency_max)
+        st->latency_max = latency;
+
+    st->latency_sum += latency;
+    st->acks++;
+}
+
+/**
+ * Send a file, and wait for all of it to be acknowledged.
+ *
+ * \param pace_baud Bit rate to limit the sender to, or zero to send as fast
+ *                  as the port takes the data.
+ */
+static bool
+send_file(int fd, const uint8_t *file, uint32_t size,
+          unsigned long pace_baud, struct send_stats *st)
+{
+    /* The receiver only acknowledges whole blocks. */
+    const uint32_t last_ack = size - size % LINK_ACK_BYTES;
+    double *const sent_at = calloc(size / LINK_ACK_BYTES + 1,
+                                   sizeof(double));
+    struct link_credit c;
+    uint32_t pos = 0;
+    bool ready = false;
+    double next_write = 0;
+
+    if (sent_at == NULL)
+        return false;
+
+    memset(st, 0, sizeof(*st));
+    link_credit_init(&c);
+
+    while (!ready || pos < size || c.acked < last_ack) {
+        const uint32_t room = ready ? link_credit_room(&c) : 0;
+        const bool can_send = ready && pos < size && room > 0;
+        int timeout = -1;
+
+        if (can_send) {
+            const double d = next_write - now();
+
+            timeout = d > 0 ? (int) (d * 1000) + 1 : 0;
+        }
+
+        struct pollfd p = { fd, POLLIN, 0 };
+
+        if (poll(&p, 1, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            free(sent_at);
+            return false;
+        }
+
+        if ((p.revents & POLLIN) != 0) {
+            uint8_t buf[64];
+            const ssize_t n = read(fd, buf, sizeof(buf));
+
+            for (ssize_t i = 0; i < n; i++)
+                got_byte(buf[i], &ready, &pos, &c, sent_at, st);
+
+            if (st->start == 0 && ready)
+                st->start = now();
+
+            continue;
+        }
+
+        if (!can_send || now() < next_write)
+            continue;
+
+        uint32_t n = size - pos < room ? size - pos : room;
+
+        if (pace_baud != 0 && n > PACED_CHUNK)
+            n = PACED_CHUNK;
+
+        const ssize_t written = write(fd, file + pos, n);
+
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+
+            perror("write");
+            free(sent_at);
+            return false;
+        }
+
+        const double t = now();
+
+        /* Record the time for every block whose last byte was sent. */
+        for (uint32_t end = pos + written, b = pos / LINK_ACK_BYTES;
+             (b + 1) * LINK_ACK_BYTES <= end; b++)
+            sent_at[b] = t;
+
+        pos += written;
+        link_credit_sent(&c, written);
+        st->bytes += written;
+
+        if (pace_baud != 0) {
+            /* 8N1 is 10 bits per byte. */
+            next_write = (next_write > t ? next_write : t) +
+                written * 10.0 / pace_baud;
+        }
+    }
+
+    st->end = now();
+    free(sent_at);
+    return true;
+}
+
+/**
+ * Stand-in for the UART interrupt handler.
+ */
+static void *
+uart_thread(void *arg)
+{
+    struct receiver *const r = arg;
+
+    while (!LINK_LOAD_ACQUIRE(r->stop)) {
+        struct pollfd p = { r->fd, POLLIN, 0 };
+        uint8_t buf[256];
+
+        if (poll(&p, 1, 10) <= 0)
+            continue;
+
+        const ssize_t n = read(r->fd, buf, sizeof(buf));
+
+        for (ssize_t i = 0; i < n; i++)
+            link_ring_put(&r->ring, buf[i]);
+    }
+
+    return NULL;
+}
+
+static void
+send_byte(struct receiver *r, uint8_t b)
+{
+    while (write(r->fd, &b, 1) != 1) {
+        if (errno != EINTR && errno != EAGAIN) {
+            r->error = true;
+            return;
+        }
+    }
+}
+
+/**
+ * Stand-in for serial_refill in the player.
+ */
+static uint16_t
+receiver_refill(void *ctx, uint8_t *dst, uint16_t max)
+{
+    struct receiver *const r = ctx;
+    uint16_t n;
+
+    if (r->left < max)
+        max = (uint16_t) r->left;
+
+    if (max == 0 || r->error)
+        return 0;
+
+    while ((n = link_ring_get(&r->ring, dst, max)) == 0)
+        wait_a_bit();
+
+    if (r->copied + n > r->capacity) {
+        r->error = true;
+        return 0;
+    }
+
+    memcpy(r->copy + r->copied, dst, n);
+    r->copied += n;
+    r->left -= n;
+
+    for (uint16_t acks = link_ring_acks(&r->ring); acks > 0; acks--)
+        send_byte(r, LINK_ACK);
+
+    return n;
+}
+
+/**
+ * Stand-in for the player. Reads the header, then decodes the data as a
+ * stream, and finally reads whatever follows the end of the data.
+ */
+static void *
+player_thread(void *arg)
+{
+    struct receiver *const r = arg;
+    static uint8_t buffer[STREAM_BUFFER_SIZE];
+    struct vgm_header header;
+    uint32_t bytes = 0;
+
+    r->left = VGM_BUF_SIZE_UNKNOWN;
+    send_byte(r, LINK_READY);
+
+    while (bytes < sizeof(header)) {
+        const uint16_t n = receiver_refill(r, (uint8_t *) &header + bytes,
+                                           sizeof(header) - bytes);
+
+        if (n == 0)
+            break;
+
+        bytes += n;
+    }
+
+    if (bytes < sizeof(header) || memcmp(header.ident, "Vgm ", 4) != 0 ||
+        header.eof_offset + 4 < sizeof(header)) {
+        r->error = true;
+        return NULL;
+    }
+
+    r->left = header.eof_offset + 4 - sizeof(header);
+
+    const uint32_t data_start = header.vgm_data_offset + 0x34;
+    uint16_t prefill = 0;
+
+    if (data_start < sizeof(header)) {
+        prefill = sizeof(header) - data_start;
+        memcpy(buffer, (const uint8_t *) &header + data_start, prefill);
+    } else {
+        for (uint32_t skip = data_start - sizeof(header); skip > 0;
+             /* empty */) {
+            const uint16_t n = receiver_refill(r, buffer,
+                                               skip > sizeof(buffer)
+                                               ? sizeof(buffer)
+                                               : (uint16_t) skip);
+
+            if (n == 0)
+                break;
+
+            skip -= n;
+        }
+    }
+
+    struct vgm_buf v;
+    double due = now();
+    bool playing = true;
+
+    vgm_buf_init_stream(&v, buffer, sizeof(buffer), prefill,
+                        receiver_refill, r);
+
+    while (playing && !r->error) {
+        struct vgm_event e;
+
+        r->events++;
+
+        switch (vgm_next_event(&v, &e)) {
+        case VGM_EVENT_WAIT:
+            if (r->realtime) {
+                due += (double) e.samples / SAMPLE_RATE;
+                sleep_until(due);
+            }
+
+            break;
+
+        case VGM_EVENT_END:
+            playing = false;
+            break;
+
+        case VGM_EVENT_ERROR:
+            r->error = true;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    /* The player reads a GD3 tag that follows the data, if there is one. */
+    while (receiver_refill(r, buffer, sizeof(buffer)) != 0)
+        /* empty */ ;
+
+    return NULL;
+}
+
+static void
+print_send_stats(const struct send_stats *st)
+{
+    const double elapsed = st->end - st->start;
+
+    printf("bytes sent       %llu (%u restarts)\n",
+           (unsigned long long) st->bytes, st->restarts);
+    printf("elapsed          %.3fs\n", elapsed);
+
+    if (elapsed > 0)
+        printf("throughput       %.1f KB/s\n", st->bytes / elapsed / 1e3);
+
+    if (st->acks != 0) {
+        printf("acks             %lu of %u bytes each\n", st->acks,
+               LINK_ACK_BYTES);
+        printf("ack latency      min %.3fms, mean %.3fms, max %.3fms\n",
+               st->latency_min * 1e3, st->latency_sum / st->acks * 1e3,
+               st->latency_max * 1e3);
+    }
+}
+
+/**
+ * Send a file over a pseudo-terminal pair to a receiver in this process.
+ */
+static bool
+self_test(const uint8_t *file, uint32_t size, unsigned long pace_baud,
+          bool realtime)
+{
+    const int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("Could not open a pseudo-terminal");
+        return false;
+    }
+
+    static struct receiver r;
+
+    r.fd = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (r.fd < 0 || !set_raw(r.fd, 0)) {
+        perror("Could not open the pseudo-terminal");
+        close(master);
+        return false;
+    }
+
+    r.realtime = realtime;
+    r.copy = malloc(size);
+    r.capacity = size;
+    link_ring_init(&r.ring);
+
+    pthread_t uart, player;
+
+    pthread_create(&uart, NULL, uart_thread, &r);
+    pthread_create(&player, NULL, player_thread, &r);
+
+    struct send_stats st;
+    const bool sent = send_file(master, file, size, pace_baud, &st);
+
+    pthread_join(player, NULL);
+    LINK_STORE_RELEASE(r.stop, true);
+    pthread_join(uart, NULL);
+
+    const bool same = sent && !r.error && r.copied == size &&
+        memcmp(r.copy, file, size) == 0;
+
+    print_send_stats(&st);
+    printf("events           %lu\n", r.events);
+    printf("ring high water  %u of %u bytes\n", r.ring.high_water,
+           LINK_RING_SIZE);
+    printf("dropped bytes    %u\n", r.ring.overflows);
+    printf("received data    %s\n", same ? "matches" : "DIFFERS");
+
+    free(r.copy);
+    close(r.fd);
+    close(master);
+    return same && r.ring.overflows == 0;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-b baud] [-t pass]... [-v dB] [-m voice]... "
+            "[-s voice]... port file.vgm\n"
+            "       %s -T [-b baud] [-r] [-t pass]... ... file.vgm\n"
+            "Passes:", progname, progname);
+
+    for (unsigned i = 0; i < VGM_XLAT_NUM_PASSES; i++)
+        fprintf(stderr, " %s", vgm_xlat_passes[i].name);
+
+    fprintf(stderr, "\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct vgm_xlat_options opts = { .num_selected = 0 };
+    unsigned long baud = 0;
+    bool test = false;
+    bool realtime = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:rT" VGM_XLAT_OPTIONS)) != -1) {
+        switch (opt) {
+        case 'b':
+            baud = strtoul(optarg, NULL, 10);
+            if (baud_speed(baud) == B0) {
+                fprintf(stderr, "Unsupported bit rate \"%s\".\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            realtime = true;
+            break;
+        case 'T':
+            test = true;
+            break;
+        case 't':
+        case 'v':
+        case 'm':
+        case 's':
+            if (!vgm_xlat_option(&opts, opt, optarg)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind + (test ? 1 : 2) != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *const in_path = argv[argc - 1];
+    struct vgm_file f;
+    const int err = vgm_file_open(&f, in_path, VGM_FILE_MMAP,
+                                  VGM_FILE_SEQUENTIAL);
+    if (err != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", in_path,
+                strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    struct vgm_xlat x;
+
+    if (!vgm_xlat_open(&x, f.data, f.size)) {
+        fprintf(stderr, "\"%s\" is not a VGM file.\n", in_path);
+        vgm_file_close(&f);
+        return EXIT_FAILURE;
+    }
+
+    int ret = vgm_xlat_run_selected(&x, &opts, in_path)
+        ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    vgm_xlat_finish(&x);
+
+    /* The file as it is sent: header, data, and GD3 tag. */
+    const uint32_t size = sizeof(x.header) + x.size + x.gd3_size;
+    uint8_t *const file = malloc(size);
+
+    if (ret == EXIT_SUCCESS && file != NULL) {
+        memcpy(file, &x.header, sizeof(x.header));
+        memcpy(file + sizeof(x.header), x.data, x.size);
+        if (x.gd3_size != 0)
+            memcpy(file + sizeof(x.header) + x.size, x.gd3, x.gd3_size);
+
+        if (test) {
+            if (!self_test(file, size, baud, realtime))
+                ret = EXIT_FAILURE;
+        } else {
+            const int fd = open(argv[optind], O_RDWR | O_NOCTTY);
+            struct send_stats st;
+
+            if (fd < 0 || !set_raw(fd, baud != 0 ? baud : 115200)) {
+                fprintf(stderr, "Could not set up \"%s\": %s\n",
+                        argv[optind], strerror(errno));
+                ret = EXIT_FAILURE;
+            } else {
+                printf("Waiting for the player on %s.\n", argv[optind]);
+
+                if (send_file(fd, file, size, 0, &st))
+                    print_send_stats(&st);
+                else
+                    ret = EXIT_FAILURE;
+            }
+
+            if (fd >= 0)
+                close(fd);
+        }
+    } else if (file == NULL) {
+        fprintf(stderr, "Could not allocate %lu bytes.\n",
+                (unsigned long) size);
+        ret = EXIT_FAILURE;
+    }
+
+    free(file);
+    vgm_xlat_close(&x);
+    vgm_file_close(&f);
+    return ret;
+}
@@ -0,0 +1,716 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Check the playback timing of vgmplay.exe on emulated 4.77MHz and 7.16MHz
+ * machines.
+ *
+ * A fixed set of VGM files is generated, and each one is played by the
+ * program under vgmemu's machine model. The writes the program makes are
+ * matched, in order, against the writes that vgm_player says the file
+ * contains, as "vgmtrace -c" does. The emulated clock of each write then
+ * gives:
+ *
+ *  - drift: the error in the time from the first write to the last one.
+ *  - rate: the error of the delay loop alone. A line is fit to the gaps
+ *    between writes, so the time that the event loop spends on each write
+ *    is measured separately as the overhead.
+ *  - jitter: how far any write is from the straight line between the first
+ *    and last writes.
+ *
+ * The "Delay loop parameters" and "Elapsed play time" lines that the player
+ * prints are checked as well. The elapsed ticks must agree with the emulated
+ * time, and, when both machines are run, the delay loop must have been
+ * calibrated to 1.5 times as many iterations on the faster one.
+ *
+ * Each check has a limit, and the exit status is nonzero if any run is past
+ * one of them. The emulator is deterministic, so a failure is a change in
+ * the player, not noise.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emu86_dos.h"
+#include "vgm_file.h"
+#include "../vgm_player.h"
+
+/* Longest command tail that fits in the PSP. */
+#define MAX_TAIL 126
+
+/* Number of samples decoded by each call to vgm_player_step. */
+#define STEP_SAMPLES 4096
+
+/* The stand-in player, and small DOS buffers, read at most this much. */
+#define MAX_VGM_SIZE 0x8000
+
+#define MAX_USER_FILES 8
+
+/* Default limits. */
+#define RATE_LIMIT_PERMILLE 5.0
+#define JITTER_LIMIT_MS 5.0
+#define TICK_LIMIT 2.0
+#define CALIBRATION_LIMIT_PERCENT 2.0
+#define USER_DRIFT_LIMIT_PERMILLE 10.0
+
+/* Emulated time, beyond the length of the file, before a run is stopped. */
+#define EXTRA_SECONDS 30.0
+
+/* BIOS ticks per PIT input clock. */
+#define PIT_CLOCKS_PER_TICK 65536.0
+#define PIT_HZ (EMU86_OSC_HZ / 12.0)
+
+struct vgm_data {
+    uint8_t *data;
+    size_t size;
+    size_t cap;
+    uint32_t samples;
+};
+
+struct test_file {
+    /** DOS file name, 8.3 and upper case. */
+    char name[13];
+
+    struct vgm_data vgm;
+
+    /** Largest drift allowed, in parts per thousand. */
+    double drift_limit;
+};
+
+struct limits {
+    double rate;
+    double drift;
+    double jitter;
+};
+
+struct run_result {
+    bool ok;
+    unsigned n;
+    unsigned d;
+    bool have_calibration;
+};
+
+static bool
+put(struct vgm_data *v, uint8_t b)
+{
+    if (v->size == v->cap) {
+        const size_t cap = v->cap != 0 ? v->cap * 2 : 4096;
+        uint8_t *const p = realloc(v->data, cap);
+
+        if (p == NULL)
+            return false;
+
+        v->data = p;
+        v->cap = cap;
+    }
+
+    v->data[v->size++] = b;
+    return true;
+}
+
+static bool
+put32(struct vgm_data *v, uint32_t x)
+{
+    return put(v, x) && put(v, x >> 8) && put(v, x >> 16) && put(v, x >> 24);
+}
+
+static bool
+psg(struct vgm_data *v, uint8_t value)
+{
+    return put(v, 0x50) && put(v, value);
+}
+
+static bool
+wait(struct vgm_data *v, unsigned samples)
+{
+    v->samples += samples;
+
+    if (samples == 735)
+        return put(v, 0x62);
+
+    if (samples >= 1 && samples <= 16)
+        return put(v, 0x70 | (samples - 1));
+
+    return put(v, 0x61) && put(v, samples) && put(v, samples >> 8);
+}
+
+/**
+ * Set a tone voice to a period and an attenuation.
+ */
+static bool
+tone(struct vgm_data *v, unsigned voice, unsigned period, unsigned atten)
+{
+    return psg(v, 0x80 | (voice << 5) | (period & 0x0f)) &&
+        psg(v, (period >> 4) & 0x3f) &&
+        psg(v, 0x90 | (voice << 5) | atten);
+}
+
+/**
+ * Start a version 1.50 file for a 3.579545MHz SN76489 with a 15-bit LFSR.
+ */
+static bool
+begin(struct vgm_data *v)
+{
+    static const uint8_t header[0x40] = {
+        'V', 'g', 'm', ' ', 0, 0, 0, 0, 0x50, 0x01, 0, 0,
+        0x99, 0x9e, 0x36, 0x00,
+        [0x24] = 60,
+        [0x28] = 0x03, 0x00, 15, 0,
+        [0x34] = 0x0c,
+    };
+
+    for (unsigned i = 0; i < sizeof(header); i++) {
+        if (!put(v, header[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static bool
+end(struct vgm_data *v)
+{
+    if (!put(v, 0x66))
+        return false;
+
+    const size_t size = v->size;
+
+    v->size = 0x04;
+    put32(v, size - 0x04);
+    v->size = 0x18;
+    put32(v, v->samples);
+    v->size = size;
+
+    return size <= MAX_VGM_SIZE;
+}
+
+/**
+ * A scale on one voice, with a note every 4 frames. Most of the time is spent
+ * in long waits, so this mostly measures the delay loop.
+ */
+static bool
+make_tones(struct vgm_data *v)
+{
+    if (!begin(v))
+        return false;
+
+    for (unsigned i = 0; i < 60; i++) {
+        if (!tone(v, 0, 0x3f8 - i * 16, i & 7) || !wait(v, 4 * 735))
+            return false;
+    }
+
+    return end(v);
+}
+
+/**
+ * Several writes to every voice at the start of each frame, like music
+ * ripped from a game's sound driver.
+ */
+static bool
+make_frames(struct vgm_data *v)
+{
+    if (!begin(v))
+        return false;
+
+    for (unsigned i = 0; i < 300; i++) {
+        for (unsigned voice = 0; voice < 3; voice++) {
+            if (!tone(v, voice, 0x100 + ((i * 7 + voice * 61) & 0x2ff),
+                      (i + voice) & 0x0f))
+                return false;
+        }
+
+        if (!psg(v, 0xe4 | (i & 3)) ||
+            !psg(v, 0xf0 | ((i >> 2) & 0x0f)) ||
+            !wait(v, 735))
+            return false;
+    }
+
+    return end(v);
+}
+
+/**
+ * Single writes separated by 1 to 16 samples, which is mostly the time of
+ * the event loop.
+ */
+static bool
+make_dense(struct vgm_data *v)
+{
+    if (!begin(v))
+        return false;
+
+    for (unsigned i = 0; i < 3000; i++) {
+        if (!psg(v, 0x90 | (i & 0x0f)) || !wait(v, 1 + (i * 5) % 16))
+            return false;
+    }
+
+    return end(v);
+}
+
+/**
+ * A few writes separated by quarter second waits.
+ */
+static bool
+make_long(struct vgm_data *v)
+{
+    if (!begin(v))
+        return false;
+
+    for (unsigned i = 0; i < 24; i++) {
+        if (!tone(v, 1, 0x080 + i * 8, i & 0x0f) || !wait(v, 11025))
+            return false;
+    }
+
+    return end(v);
+}
+
+static bool
+same_write(const struct vgm_port_write *a,
+           const struct emu86_port_access *b)
+{
+    if (!b->is_write || a->port != b->port)
+        return false;
+
+    /* The DOS player merges the speaker gate bits with the other bits of
+     * the port.
+     */
+    if (a->port == VGM_PORT_SPEAKER)
+        return (a->value & 0x03) == (b->value & 0x03);
+
+    return a->value == b->value;
+}
+
+/**
+ * Get the first unsigned number after \c label in the output.
+ */
+static bool
+find_number(const char *output, const char *label, unsigned long *value)
+{
+    const char *const p = strstr(output, label);
+
+    return p != NULL && sscanf(p + strlen(label), "%lu", value) == 1;
+}
+
+/**
+ * Play one file on one machine, and check its timing.
+ */
+static struct run_result
+run(const uint8_t *exe, size_t exe_size, const struct test_file *t,
+    unsigned osc_div, const char *args, const struct limits *limits)
+{
+    struct run_result r = { .ok = false };
+    char tail[MAX_TAIL + 1];
+
+    /* main has checked that the arguments and the name fit. */
+    size_t len = strlen(args);
+
+    memcpy(tail, args, len);
+    if (len != 0)
+        tail[len++] = ' ';
+
+    strcpy(tail + len, t->name);
+
+    struct emu86_dos m;
+    if (!emu86_dos_init(&m, osc_div)) {
+        fprintf(stderr, "Out of memory.\n");
+        return r;
+    }
+
+    m.echo = false;
+
+    if (!emu86_dos_load(&m, exe, exe_size, "C:\\VGMPLAY.EXE", tail)) {
+        fprintf(stderr, "The program is not a DOS program that fits in "
+                "640KiB.\n");
+        emu86_dos_free(&m);
+        return r;
+    }
+
+    const double hz = emu86_dos_cpu_hz(&m);
+    const double seconds = t->vgm.samples / 44100.0 + EXTRA_SECONDS;
+    const enum emu86_status s = emu86_dos_run(&m, (uint64_t)(seconds * hz));
+
+    printf("%s at %.2fMHz\n", t->name, hz / 1e6);
+
+    if (s != EMU86_STOPPED) {
+        printf("  status           did not exit (%d) at %04x:%04x\n", s,
+               m.cpu.fault_cs, m.cpu.fault_ip);
+        emu86_dos_free(&m);
+        return r;
+    }
+
+    if (m.exit_code != 0) {
+        printf("  status           exited with code %d\n", m.exit_code);
+        emu86_dos_free(&m);
+        return r;
+    }
+
+    struct vgm_player *const p =
+        vgm_player_open_memory(t->vgm.data, t->vgm.size);
+    if (p == NULL) {
+        printf("  status           not a VGM file\n");
+        emu86_dos_free(&m);
+        return r;
+    }
+
+    /* Match the writes, and collect the expected and actual time of each in
+     * seconds. The writes at startup and shutdown that are not in the file
+     * are skipped.
+     */
+    double *const expected = malloc(m.port_count * sizeof(double));
+    double *const actual = malloc(m.port_count * sizeof(double));
+    size_t count = 0;
+    size_t next = 0;
+    bool matched = true;
+
+    if (expected == NULL || actual == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        matched = false;
+    }
+
+    while (matched && !vgm_player_done(p)) {
+        struct vgm_port_write w;
+
+        vgm_player_step(p, STEP_SAMPLES);
+
+        while (matched && vgm_player_next_write(p, &w)) {
+            while (next < m.port_count && !same_write(&w, &m.ports[next]))
+                next++;
+
+            if (next == m.port_count) {
+                printf("  status           write %zu (%03x %02x) not made\n",
+                       count + 1, w.port, w.value);
+                matched = false;
+                break;
+            }
+
+            expected[count] = w.sample / 44100.0;
+            actual[count] = m.ports[next].cycles / hz;
+            count++;
+            next++;
+        }
+    }
+
+    vgm_player_close(p);
+
+    if (matched && count < 2) {
+        printf("  status           too few writes to measure\n");
+        matched = false;
+    }
+
+    if (!matched) {
+        free(expected);
+        free(actual);
+        emu86_dos_free(&m);
+        return r;
+    }
+
+    r.ok = true;
+
+    /* Fit actual gap = rate * expected gap + overhead by least squares. */
+    double sx = 0.0;
+    double sy = 0.0;
+    double sxx = 0.0;
+    double sxy = 0.0;
+
+    for (size_t i = 1; i < count; i++) {
+        const double x = expected[i] - expected[i - 1];
+        const double y = actual[i] - actual[i - 1];
+
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    const double gaps = count - 1;
+    const double det = gaps * sxx - sx * sx;
+    const double rate = det != 0.0 ? (gaps * sxy - sx * sy) / det : 1.0;
+    const double overhead = (sy - rate * sx) / gaps;
+    const double rate_error = (rate - 1.0) * 1000.0;
+
+    const double span = expected[count - 1] - expected[0];
+    const double elapsed = actual[count - 1] - actual[0];
+    const double drift = (elapsed - span) * 1000.0 / span;
+
+    double jitter = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        const double line = (expected[i] - expected[0]) * elapsed / span;
+        const double d = fabs(actual[i] - actual[0] - line) * 1000.0;
+
+        if (d > jitter)
+            jitter = d;
+    }
+
+    const double drift_limit = limits->drift > 0.0
+        ? limits->drift : t->drift_limit;
+    const bool rate_ok = fabs(rate_error) <= limits->rate;
+    const bool drift_ok = fabs(drift) <= drift_limit;
+    const bool jitter_ok = jitter <= limits->jitter;
+
+    printf("  writes           %zu\n", count);
+    printf("  expected time    %.6fs\n", span);
+    printf("  elapsed time     %.6fs\n", elapsed);
+    printf("  drift            %+.2f/1000 (limit %.1f)%s\n", drift,
+           drift_limit, drift_ok ? "" : "  FAIL");
+    printf("  delay rate       %+.2f/1000 (limit %.1f)%s\n", rate_error,
+           limits->rate, rate_ok ? "" : "  FAIL");
+    printf("  overhead/write   %.1fus\n", overhead * 1e6);
+    printf("  max jitter       %.3fms (limit %.1f)%s\n", jitter,
+           limits->jitter, jitter_ok ? "" : "  FAIL");
+
+    r.ok = rate_ok && drift_ok && jitter_ok;
+
+    unsigned long n;
+    unsigned long d;
+    if (find_number(m.output, "Delay loop parameters: n = ", &n) &&
+        find_number(m.output, ", d = ", &d) && d != 0) {
+        r.n = n;
+        r.d = d;
+        r.have_calibration = true;
+        printf("  delay loop       n = %lu, d = %lu (%.2f per sample)\n", n,
+               d, (double) n / d);
+    } else {
+        printf("  delay loop       not printed  FAIL\n");
+        r.ok = false;
+    }
+
+    unsigned long ticks;
+    const char *const e = strstr(m.output, "Elapsed play time = ");
+    if (e != NULL && find_number(e, "(", &ticks)) {
+        /* The player also times the waits before the first write and after
+         * the last one.
+         */
+        const double wait =
+            expected[0] + t->vgm.samples / 44100.0 - expected[count - 1];
+        const double true_ticks =
+            (elapsed + wait * rate) * PIT_HZ / PIT_CLOCKS_PER_TICK;
+        const bool ticks_ok = fabs(ticks - true_ticks) <= TICK_LIMIT;
+
+        printf("  elapsed ticks    %lu (emulated %.1f)%s\n", ticks,
+               true_ticks, ticks_ok ? "" : "  FAIL");
+        r.ok = r.ok && ticks_ok;
+    } else {
+        printf("  elapsed ticks    not printed  FAIL\n");
+        r.ok = false;
+    }
+
+    free(expected);
+    free(actual);
+    emu86_dos_free(&m);
+    return r;
+}
+
+static bool
+write_file(const struct test_file *t)
+{
+    FILE *const fp = fopen(t->name, "wb");
+
+    if (fp == NULL ||
+        fwrite(t->vgm.data, 1, t->vgm.size, fp) != t->vgm.size) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", t->name,
+                strerror(errno));
+        if (fp != NULL)
+            fclose(fp);
+
+        return false;
+    }
+
+    return fclose(fp) == 0;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-m 4.77|7.16] [-a arguments] "
+            "[-c permille] [-d permille] [-j ms] program.exe "
+            "[file.vgm...]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct limits limits = {
+        .rate = RATE_LIMIT_PERMILLE,
+        .drift = 0.0,
+        .jitter = JITTER_LIMIT_MS,
+    };
+    unsigned divs[2] = { EMU86_DIV_4_77MHZ, EMU86_DIV_7_16MHZ };
+    unsigned div_count = 2;
+    const char *args = "";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:a:c:d:j:")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "4.77") == 0) {
+                divs[0] = EMU86_DIV_4_77MHZ;
+            } else if (strcmp(optarg, "7.16") == 0) {
+                divs[0] = EMU86_DIV_7_16MHZ;
+            } else {
+                fprintf(stderr, "Invalid CPU clock \"%s\".\n", optarg);
+                return EXIT_FAILURE;
+            }
+
+            div_count = 1;
+            break;
+        case 'a':
+            args = optarg;
+            break;
+        case 'c':
+            limits.rate = atof(optarg);
+            break;
+        case 'd':
+            limits.drift = atof(optarg);
+            break;
+        case 'j':
+            limits.jitter = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || argc - optind - 1 > MAX_USER_FILES) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strlen(args) + 14 > MAX_TAIL) {
+        fprintf(stderr, "The command line is too long for DOS.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct test_file tests[4 + MAX_USER_FILES] = {
+        { "TONES.VGM", { NULL }, 5.0 },
+        { "FRAMES.VGM", { NULL }, 20.0 },
+        { "DENSE.VGM", { NULL }, 300.0 },
+        { "LONG.VGM", { NULL }, 5.0 },
+    };
+    unsigned test_count = 4;
+    int ret = EXIT_FAILURE;
+
+    if (!make_tones(&tests[0].vgm) || !make_frames(&tests[1].vgm) ||
+        !make_dense(&tests[2].vgm) || !make_long(&tests[3].vgm)) {
+        fprintf(stderr, "Could not generate the test files.\n");
+        goto done;
+    }
+
+    /* Files are read before changing to the temporary directory, so that
+     * relative paths work.
+     */
+    struct vgm_file exe;
+    int err = vgm_file_open(&exe, argv[optind], VGM_FILE_READ, 0);
+    if (err != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", argv[optind],
+                strerror(err));
+        goto done;
+    }
+
+    for (int i = optind + 1; i < argc; i++) {
+        struct test_file *const t = &tests[test_count];
+        struct vgm_file f;
+
+        err = vgm_file_open(&f, argv[i], VGM_FILE_READ, 0);
+        if (err != 0) {
+            fprintf(stderr, "Could not read \"%s\": %s\n", argv[i],
+                    strerror(err));
+            goto close_exe;
+        }
+
+        snprintf(t->name, sizeof(t->name), "USER%u.VGM", test_count - 4);
+        t->vgm.data = malloc(f.size);
+        t->vgm.size = f.size;
+        t->drift_limit = USER_DRIFT_LIMIT_PERMILLE;
+        test_count++;
+
+        if (t->vgm.data == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            vgm_file_close(&f);
+            goto close_exe;
+        }
+
+        memcpy(t->vgm.data, f.data, f.size);
+        vgm_file_close(&f);
+
+        /* The expected time comes from the header of a user file. */
+        struct vgm_player *const p =
+            vgm_player_open_memory(t->vgm.data, t->vgm.size);
+        if (p == NULL) {
+            fprintf(stderr, "\"%s\" is not a VGM file.\n", argv[i]);
+            goto close_exe;
+        }
+
+        t->vgm.samples = vgm_player_header(p)->total_samples;
+        vgm_player_close(p);
+    }
+
+    char dir[] = "/tmp/vgmtimeXXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        fprintf(stderr, "Could not create a temporary directory: %s\n",
+                strerror(errno));
+        goto close_exe;
+    }
+
+    unsigned failures = 0;
+    unsigned runs = 0;
+
+    for (unsigned i = 0; i < test_count; i++) {
+        struct run_result results[2];
+
+        if (!write_file(&tests[i])) {
+            failures++;
+            continue;
+        }
+
+        for (unsigned j = 0; j < div_count; j++) {
+            results[j] = run(exe.data, exe.size, &tests[i], divs[j], args,
+                             &limits);
+            failures += !results[j].ok;
+            runs++;
+        }
+
+        /* The delay loop takes the same number of clocks per iteration on
+         * either machine, so it should run 1.5 times as many iterations per
+         * sample on the faster one.
+         */
+        if (div_count == 2 && results[0].have_calibration &&
+            results[1].have_calibration) {
+            const double ratio =
+                ((double) results[1].n / results[1].d) /
+                ((double) results[0].n / results[0].d);
+            const bool ok =
+                fabs(ratio / 1.5 - 1.0) * 100.0 <= CALIBRATION_LIMIT_PERCENT;
+
+            printf("%s calibration ratio %.3f (expected 1.500)%s\n",
+                   tests[i].name, ratio, ok ? "" : "  FAIL");
+            failures += !ok;
+        }
+
+        unlink(tests[i].name);
+        printf("\n");
+    }
+
+    if (chdir("/") == 0)
+        rmdir(dir);
+
+    if (failures == 0) {
+        printf("All %u runs passed.\n", runs);
+        ret = EXIT_SUCCESS;
+    } else {
+        printf("%u checks failed.\n", failures);
+    }
+
+close_exe:
+    vgm_file_close(&exe);
+
+done:
+    for (unsigned i = 0; i < test_count; i++)
+        free(tests[i].vgm.data);
+
+    return ret;
+}
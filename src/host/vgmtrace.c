@@ -0,0 +1,226 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Print the port writes that vgmplay would make for a VGM file.
+ *
+ * The output uses the same format as the VGMPLAY.TRC file written by a DOS
+ * build with PORT_TRACE defined, so the two can be compared directly.
+ *
+ * With -c, the writes are instead checked against such a trace. Only the
+ * order of the writes is compared, not their timing. This catches things
+ * like an SAA1099 data write that is sent before its address write.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vgm_player.h"
+#include "vgm_file.h"
+
+/* Number of samples decoded by each call to vgm_player_step. */
+#define STEP_SAMPLES 4096
+
+/**
+ * Get the next write from a VGMPLAY.TRC file.
+ *
+ * \return
+ * False at the end of the file.
+ */
+static bool
+next_trace_write(FILE *fp, unsigned long *line, struct vgm_port_write *w)
+{
+    char buf[128];
+
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        unsigned long clocks;
+        char dir;
+        unsigned port;
+        unsigned value;
+
+        (*line)++;
+
+        if (sscanf(buf, "%lu %c %x %x", &clocks, &dir, &port, &value) != 4 ||
+            dir != 'w')
+            continue;
+
+        w->sample = clocks;
+        w->port = port;
+        w->value = value;
+        return true;
+    }
+
+    return false;
+}
+
+static bool
+same_write(const struct vgm_port_write *a, const struct vgm_port_write *b)
+{
+    if (a->port != b->port)
+        return false;
+
+    /* The DOS player merges the speaker gate bits with the other bits of
+     * the port.
+     */
+    if (a->port == VGM_PORT_SPEAKER)
+        return (a->value & 0x03) == (b->value & 0x03);
+
+    return a->value == b->value;
+}
+
+/**
+ * Check the writes of a player against a trace from the DOS player.
+ *
+ * The DOS player also makes writes at startup and shutdown that the library
+ * does not, so writes in the trace that do not match are skipped.
+ *
+ * \return
+ * True if every write was found in the trace, in order.
+ */
+static bool
+check_trace(struct vgm_player *p, const char *path)
+{
+    FILE *const fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", path, strerror(errno));
+        return false;
+    }
+
+    unsigned long line = 0;
+    unsigned long matched = 0;
+    bool ok = true;
+
+    while (ok && !vgm_player_done(p)) {
+        struct vgm_port_write w;
+
+        vgm_player_step(p, STEP_SAMPLES);
+
+        while (ok && vgm_player_next_write(p, &w)) {
+            struct vgm_port_write t;
+
+            do {
+                ok = next_trace_write(fp, &line, &t);
+            } while (ok && !same_write(&w, &t));
+
+            if (!ok) {
+                const unsigned long clocks =
+                    ((unsigned long long) w.sample * 1193182) / 44100;
+
+                printf("%s: write %lu (%lu w %03x %02x) not found after "
+                       "line %lu\n", path, matched + 1, clocks, w.port,
+                       w.value, line);
+            } else {
+                matched++;
+            }
+        }
+    }
+
+    fclose(fp);
+
+    if (ok)
+        printf("%s: %lu writes match\n", path, matched);
+
+    return ok;
+}
+
+static void
+print_info(const struct vgm_player *p)
+{
+    static const char *const names[] = {
+        "Track", "Game", "System", "Author", "Date", "Ripper", "Notes"
+    };
+    static const enum vgm_gd3_field fields[] = {
+        VGM_GD3_TRACK_NAME, VGM_GD3_GAME_NAME, VGM_GD3_SYSTEM_NAME,
+        VGM_GD3_AUTHOR, VGM_GD3_DATE, VGM_GD3_RIPPER, VGM_GD3_NOTES
+    };
+    const struct vgm_header *const h = vgm_player_header(p);
+    char buf[256];
+
+    printf("# header version = %x\n", h->version);
+    printf("# SN76489 clock = %lu\n", (unsigned long) h->sn76489_clock);
+    printf("# total samples = %lu\n", (unsigned long) h->total_samples);
+
+    for (unsigned i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (vgm_player_gd3(p, fields[i], buf, sizeof(buf)) > 0)
+            printf("# %s: %s\n", names[i], buf);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *check = NULL;
+    bool info = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:i")) != -1) {
+        switch (opt) {
+        case 'c':
+            check = optarg;
+            break;
+        case 'i':
+            info = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-i] [-c VGMPLAY.TRC] file.vgm\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-i] [-c VGMPLAY.TRC] file.vgm\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct vgm_file f;
+    const int err = vgm_file_open(&f, argv[optind], VGM_FILE_MMAP,
+                                  VGM_FILE_SEQUENTIAL);
+    if (err != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", argv[optind],
+                strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    struct vgm_player *const p = vgm_player_open_memory(f.data, f.size);
+    if (p == NULL) {
+        fprintf(stderr, "\"%s\" is not a VGM file.\n", argv[optind]);
+        vgm_file_close(&f);
+        return EXIT_FAILURE;
+    }
+
+    if (check != NULL) {
+        const bool ok = check_trace(p, check);
+
+        vgm_player_close(p);
+        vgm_file_close(&f);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (info)
+        print_info(p);
+
+    printf("# time (1.193182MHz clocks), direction, port, value\n");
+
+    while (!vgm_player_done(p)) {
+        struct vgm_port_write w;
+
+        vgm_player_step(p, STEP_SAMPLES);
+
+        while (vgm_player_next_write(p, &w)) {
+            const unsigned long clocks =
+                ((unsigned long long) w.sample * 1193182) / 44100;
+
+            printf("%lu w %03x %02x\n", clocks, w.port, w.value);
+        }
+    }
+
+    vgm_player_close(p);
+    vgm_file_close(&f);
+    return EXIT_SUCCESS;
+}
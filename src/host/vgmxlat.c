@@ -0,0 +1,120 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+/*
+ * Run the player's load-time passes ahead of time.
+ *
+ *     vgmxlat [-t pass]... [-v dB] [-m voice]... [-s voice]... in.vgm out.vgm
+ *
+ * The output is an ordinary VGM file that the DOS player can load without
+ * doing the work of the passes itself. With no -t, every pass that applies
+ * to the file is run. -v changes the volume, and -m and -s mute and solo
+ * voices, like the player's /vol, /mute, and /solo.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vgm_player.h"
+#include "vgm_file.h"
+#include "vgm_xlat.h"
+
+static bool
+write_vgm(const char *path, const struct vgm_xlat *x)
+{
+    FILE *const fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", path,
+                strerror(errno));
+        return false;
+    }
+
+    const bool ok = fwrite(&x->header, sizeof(x->header), 1, fp) == 1 &&
+        fwrite(x->data, x->size, 1, fp) == 1 &&
+        (x->gd3_size == 0 || fwrite(x->gd3, x->gd3_size, 1, fp) == 1);
+
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "Could not write \"%s\": %s\n", path,
+                strerror(errno));
+        remove(path);
+        return false;
+    }
+
+    return true;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-t pass]... [-v dB] [-m voice]... "
+            "[-s voice]... in.vgm out.vgm\n"
+            "Passes:", progname);
+
+    for (unsigned i = 0; i < VGM_XLAT_NUM_PASSES; i++)
+        fprintf(stderr, " %s", vgm_xlat_passes[i].name);
+
+    fprintf(stderr, "\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct vgm_xlat_options opts = { .num_selected = 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, VGM_XLAT_OPTIONS)) != -1) {
+        switch (opt) {
+        case 't':
+        case 'v':
+        case 'm':
+        case 's':
+            if (!vgm_xlat_option(&opts, opt, optarg)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind + 2 != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct vgm_file f;
+    const int err = vgm_file_open(&f, argv[optind], VGM_FILE_MMAP,
+                                  VGM_FILE_SEQUENTIAL);
+    if (err != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", argv[optind],
+                strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    struct vgm_xlat x;
+
+    if (!vgm_xlat_open(&x, f.data, f.size)) {
+        fprintf(stderr, "\"%s\" is not a VGM file.\n", argv[optind]);
+        vgm_file_close(&f);
+        return EXIT_FAILURE;
+    }
+
+    int ret = vgm_xlat_run_selected(&x, &opts, argv[optind])
+        ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    vgm_xlat_finish(&x);
+
+    if (ret == EXIT_SUCCESS && !write_vgm(argv[optind + 1], &x))
+        ret = EXIT_FAILURE;
+
+    vgm_xlat_close(&x);
+    vgm_file_close(&f);
+    return ret;
+}
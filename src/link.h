@@ -0,0 +1,223 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_buf.h"
+
+/**
+ * \file
+ * Serial link used to send VGM data to the player.
+ *
+ * The sender (vgmsend on a host) runs the load-time passes and sends the
+ * resulting VGM file, header first, as a plain byte stream. On the receiving
+ * end, the UART interrupt handler stores each byte in a ring, and the player
+ * reads the ring as a stream.
+ *
+ * Flow control is by credit. The sender never has more than \c LINK_WINDOW
+ * bytes that have not been acknowledged, and the receiver sends \c LINK_ACK
+ * each time the player takes \c LINK_ACK_BYTES bytes out of the ring. The
+ * ring holds a whole window, so it cannot overflow no matter how slowly the
+ * player reads. Only the transmit and receive lines are needed, and nothing
+ * in the VGM data has to be escaped.
+ *
+ * The receiver sends \c LINK_READY once it is listening. The sender waits
+ * for it before sending anything. If it arrives again in the middle of a
+ * file, the receiver was restarted, so the sender starts the file over with
+ * a full window.
+ *
+ * The ring follows the same rules as \c evq: the producer (the interrupt
+ * handler) only ever writes \c tail, and the consumer (the player) only ever
+ * writes \c head.
+ */
+
+#define LINK_READY 0x05
+#define LINK_ACK   0x06
+
+#define LINK_ACK_BYTES 256u
+
+#ifndef LINK_RING_SIZE
+#define LINK_RING_SIZE 4096u
+#endif
+
+#define LINK_WINDOW LINK_RING_SIZE
+
+#if (LINK_RING_SIZE & (LINK_RING_SIZE - 1)) != 0 || \
+    LINK_RING_SIZE > 32768u || LINK_RING_SIZE < LINK_ACK_BYTES
+#error "LINK_RING_SIZE must be a power of two in [LINK_ACK_BYTES, 32768]."
+#endif
+
+#if defined(__GNUC__)
+#define LINK_LOAD_ACQUIRE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define LINK_STORE_RELEASE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+/* Single CPU. See evq.h. */
+#define LINK_LOAD_ACQUIRE(x) (x)
+#define LINK_STORE_RELEASE(x, v) ((x) = (v))
+#endif
+
+struct link_ring {
+    /** Index of the next byte to read. Only written by the consumer. */
+    volatile uint16_t head;
+
+    /** Index of the next free slot. Only written by the producer. */
+    volatile uint16_t tail;
+
+    /** Most bytes ever in the ring. Only written by the producer. */
+    uint16_t high_water;
+
+    /**
+     * Bytes that arrived while the ring was full. Only written by the
+     * producer. This stays at zero unless the sender ignores the window.
+     */
+    uint16_t overflows;
+
+    /**
+     * Bytes read since the last acknowledgement. Only written by the
+     * consumer.
+     */
+    uint16_t unacked;
+
+    volatile uint8_t data[LINK_RING_SIZE];
+};
+
+/**
+ * Credit of the sender.
+ */
+struct link_credit {
+    /** Bytes sent and bytes acknowledged since \c LINK_READY. */
+    uint32_t sent;
+    uint32_t acked;
+};
+
+static inline void
+link_ring_init(struct link_ring *r)
+{
+    r->head = 0;
+    r->tail = 0;
+    r->high_water = 0;
+    r->overflows = 0;
+    r->unacked = 0;
+}
+
+/**
+ * Number of bytes in the ring.
+ */
+static inline uint16_t
+link_ring_count(const struct link_ring *r)
+{
+    return (uint16_t)(r->tail - r->head);
+}
+
+/**
+ * Add a received byte to the ring.
+ *
+ * May only be called by the producer.
+ *
+ * \return
+ * False if the ring is full. The byte is dropped.
+ */
+static inline bool
+link_ring_put(struct link_ring *r, uint8_t value)
+{
+    const uint16_t tail = r->tail;
+    const uint16_t count = (uint16_t)(tail - LINK_LOAD_ACQUIRE(r->head));
+
+    if (count >= LINK_RING_SIZE) {
+        r->overflows++;
+        return false;
+    }
+
+    r->data[tail & (LINK_RING_SIZE - 1)] = value;
+    LINK_STORE_RELEASE(r->tail, (uint16_t)(tail + 1));
+
+    if (count + 1 > r->high_water)
+        r->high_water = count + 1;
+
+    return true;
+}
+
+/**
+ * Take up to \c max bytes out of the ring.
+ *
+ * May only be called by the consumer. Call \c link_ring_acks afterward to
+ * find out how many acknowledgements to send.
+ *
+ * \return
+ * Number of bytes stored in \c dst. Zero if the ring is empty.
+ */
+static inline uint16_t
+link_ring_get(struct link_ring *r, uint8_t far *dst, uint16_t max)
+{
+    const uint16_t head = r->head;
+    uint16_t n = (uint16_t)(LINK_LOAD_ACQUIRE(r->tail) - head);
+
+    if (n > max)
+        n = max;
+
+    for (uint16_t i = 0; i < n; i++)
+        dst[i] = r->data[(uint16_t)(head + i) & (LINK_RING_SIZE - 1)];
+
+    LINK_STORE_RELEASE(r->head, (uint16_t)(head + n));
+    r->unacked += n;
+    return n;
+}
+
+/**
+ * Get the number of \c LINK_ACK bytes that the consumer should send now.
+ *
+ * May only be called by the consumer.
+ */
+static inline uint16_t
+link_ring_acks(struct link_ring *r)
+{
+    const uint16_t acks = r->unacked / LINK_ACK_BYTES;
+
+    r->unacked -= acks * LINK_ACK_BYTES;
+    return acks;
+}
+
+static inline void
+link_credit_init(struct link_credit *c)
+{
+    c->sent = 0;
+    c->acked = 0;
+}
+
+/**
+ * Number of bytes that the sender may send now.
+ */
+static inline uint32_t
+link_credit_room(const struct link_credit *c)
+{
+    return LINK_WINDOW - (c->sent - c->acked);
+}
+
+static inline void
+link_credit_sent(struct link_credit *c, uint32_t n)
+{
+    c->sent += n;
+}
+
+/**
+ * Handle a \c LINK_ACK from the receiver.
+ *
+ * \return
+ * False if more bytes were acknowledged than were sent.
+ */
+static inline bool
+link_credit_ack(struct link_credit *c)
+{
+    if (c->sent - c->acked < LINK_ACK_BYTES)
+        return false;
+
+    c->acked += LINK_ACK_BYTES;
+    return true;
+}
+
+#endif /* ifndef LINK_H */
@@ -10,20 +10,37 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <io.h>
 #include <assert.h>
 #include <malloc.h>
 #include <i86.h>
+#include <dos.h>
 #include <conio.h>
 #include "vgm.h"
+#include "vgm_buf.h"
+#include "vgm_iter.h"
+#include "vgm_pass.h"
+#include "vgm_opll.h"
+#include "vgm_stereo.h"
+#include "vgm_nes.h"
+#include "vgm_gb.h"
+#include "vgm_lfsr.h"
+#include "vgm_voice.h"
+#include "vgm_volume.h"
+#include "vgm_mute.h"
+#include "unreal.h"
+#include "serial.h"
+#include "vgm_shadow.h"
+#include "evq.h"
+#include "vgb.h"
 
 /* Uncomment the next line to get added debug logging. */
 //#define DEBUG_LOG
 
-struct vgm_buf {
-    uint8_t far *buffer;
-    uint32_t size;
-    uint32_t pos;
-};
+/* Uncomment the next line to record a timestamped trace of every I/O port
+ * access made during playback in VGMPLAY.TRC.
+ */
+//#define PORT_TRACE
 
 /*
  * \param gd3_offset True offset of the start of the GD3 block in the
@@ -97,7 +114,7 @@ far_read(int handle, void far *buf, uint32_t len)
         if (bytes_read == -1 || bytes_read == 0)
             return total_read == 0 ? -1 : total_read;
 
-        _fmemcpy(total_read + (uint8_t far *)buf, tmp_buf, bytes_read);
+        _fmemcpy(normalize_ptr(buf, total_read), tmp_buf, bytes_read);
 
         total_read += bytes_read;
     }
@@ -105,56 +122,265 @@ far_read(int handle, void far *buf, uint32_t len)
     return total_read;
 }
 
-static void
-skip_bytes(struct vgm_buf *v, unsigned bytes_to_skip)
+/**
+ * Allocate a buffer that may be larger than 64k.
+ *
+ * \c _fmalloc cannot allocate more than 64k, so get the memory directly from
+ * DOS. The returned pointer has an offset of zero.
+ */
+static uint8_t far *
+far_alloc(uint32_t size)
+{
+    unsigned short seg;
+
+    if (size > 0xffff0UL)
+        return NULL;
+
+    if (_dos_allocmem((uint16_t)((size + 15) >> 4), &seg) != 0)
+        return NULL;
+
+    return MK_FP(seg, 0);
+}
+
+/* Buffer for forward-only input. Data is read at most STREAM_READ_MAX bytes
+ * at a time, since a refill in the middle of playback stalls it.
+ */
+#define STREAM_BUFFER_SIZE 0x2000u
+#define STREAM_READ_MAX 4096u
+
+static uint16_t
+stream_refill(void *ctx, uint8_t far *dst, uint16_t max)
 {
-    v->pos += bytes_to_skip;
+    const int32_t bytes = far_read(*(int *) ctx, dst,
+                                   max > STREAM_READ_MAX
+                                   ? STREAM_READ_MAX : max);
 
-    if (v->pos > v->size)
-        v->pos = v->size;
+    return bytes < 0 ? 0 : (uint16_t) bytes;
 }
 
-static inline uint8_t
-get_uint8(struct vgm_buf *v)
+/* COM port that the VGM data is received from, or zero to read a file. */
+static uint8_t com_port = 0;
+static uint32_t com_baud = SERIAL_MAX_BAUD;
+
+/* Bytes of the VGM file that have not been received yet. */
+static uint32_t com_left = VGM_BUF_SIZE_UNKNOWN;
+
+/* The last VGM header passed to clear_old_fields, as it was read. */
+static uint8_t raw_header[sizeof(struct vgm_header)];
+
+/**
+ * Clear the fields that are not part of the header's version.
+ *
+ * The header is first copied to \c raw_header. The fields are past the end
+ * of a short header, so they may hold the start of the VGM data that
+ * \c stream_open needs.
+ */
+static void
+clear_old_fields(struct vgm_header *header)
 {
-    if (v->pos >= v->size)
-        return 0x66;
+    memcpy(raw_header, header, sizeof(raw_header));
 
-    return v->buffer[v->pos++];
+    if (header->version < 0x151) {
+        header->sn76489_flags = 0;
+        header->ay8910_clock = 0;
+    }
 }
 
-static inline uint16_t
-get_uint16(struct vgm_buf *v)
+/**
+ * Set up forward-only reading of the VGM data.
+ *
+ * \param fd File positioned just after the header.
+ * \param header Header read from the file.
+ * \param raw The same bytes before any fields were changed, such as
+ *            \c raw_header.
+ * \param header_bytes Number of bytes of \c header read from the file. Some
+ *                     of these may be the start of the VGM data.
+ */
+static bool
+stream_open(struct vgm_buf *v, int *fd, const struct vgm_header *header,
+            const uint8_t *raw, uint16_t header_bytes)
 {
-    if (v->pos + 2 > v->size) {
-        v->pos = v->size;
-        return 0;
+    const uint32_t data_start = header->vgm_data_offset + 0x34;
+    const vgm_refill_fn refill =
+        com_port != 0 ? serial_refill : stream_refill;
+    void *const ctx = com_port != 0 ? (void *) &com_left : (void *) fd;
+    uint8_t far *buffer = far_alloc(STREAM_BUFFER_SIZE);
+    uint16_t prefill = 0;
+
+    if (buffer == NULL) {
+        printf("Could not allocate %u bytes of memory.\n",
+               STREAM_BUFFER_SIZE);
+        return false;
+    }
+
+    if (data_start < header_bytes) {
+        prefill = header_bytes - (uint16_t) data_start;
+        _fmemcpy(buffer, raw + data_start, prefill);
     } else {
-        uint16_t result = (uint16_t)v->buffer[v->pos] |
-            ((uint16_t)v->buffer[v->pos + 1] << 8);
+        /* Anything between the header and the data, including a GD3 tag
+         * stored there, is skipped.
+         */
+        for (uint32_t skip = data_start - header_bytes; skip > 0;
+             /* empty */) {
+            const uint16_t bytes = refill(ctx, buffer,
+                                          skip > STREAM_BUFFER_SIZE
+                                          ? STREAM_BUFFER_SIZE
+                                          : (uint16_t) skip);
+
+            if (bytes == 0) {
+                printf("Unable to read up to the start of the VGM data.\n");
+                _dos_freemem(FP_SEG(buffer));
+                return false;
+            }
 
-        v->pos += 2;
+            skip -= bytes;
+        }
+    }
+
+    vgm_buf_init_stream(v, buffer, STREAM_BUFFER_SIZE, prefill, refill, ctx);
+    return true;
+}
+
+/**
+ * Receive the header of a VGM file from the COM port.
+ *
+ * \return
+ * Number of bytes received, which is less than the size of the header if
+ * the wait was stopped.
+ */
+static size_t
+com_read_header(struct vgm_header *header)
+{
+    uint8_t far *const dst = (uint8_t far *) header;
+    size_t bytes = 0;
+
+    com_left = VGM_BUF_SIZE_UNKNOWN;
+
+    while (bytes < sizeof(*header)) {
+        const uint16_t n = serial_refill(&com_left, dst + bytes,
+                                         sizeof(*header) - bytes);
+
+        if (n == 0)
+            break;
+
+        bytes += n;
+    }
+
+    return bytes;
+}
+
+/**
+ * Set the length of the stream from the COM port.
+ *
+ * Nothing marks the end of the data on the serial line, so the stream ends
+ * at the end of file given in the header.
+ */
+static bool
+com_set_length(const struct vgm_header *header, size_t bytes)
+{
+    const uint32_t length = header->eof_offset + 4;
 
-        return result;
+    if (header->eof_offset == 0 || length < bytes) {
+        printf("The header does not give the length of the file.\n");
+        return false;
     }
+
+    com_left = length - bytes;
+    return true;
 }
 
-static inline uint32_t
-get_uint32(struct vgm_buf *v)
+/* VGM data that is too large for conventional memory. */
+static struct flat_buf flat;
+
+/**
+ * Load VGM data into extended memory, and set up reading it as a stream.
+ *
+ * This is the fallback for data that does not fit in conventional memory. It
+ * needs a 386, so the data is copied back out through a small buffer instead
+ * of being paged in by the XMS driver.
+ *
+ * \param fd File positioned at the start of the VGM data.
+ */
+static bool
+flat_open(struct vgm_buf *v, int fd, uint32_t size)
 {
-    if (v->pos + 4 > v->size) {
-        v->pos = v->size;
-        return 0;
-    } else {
-        uint32_t result = (uint32_t)v->buffer[v->pos] |
-            ((uint32_t)v->buffer[v->pos + 1] << 8) |
-            ((uint32_t)v->buffer[v->pos + 2] << 16) |
-            ((uint32_t)v->buffer[v->pos + 3] << 24);
+    if (!flat_init())
+        return false;
+
+    uint8_t far *buffer = far_alloc(STREAM_BUFFER_SIZE);
+    if (buffer == NULL)
+        return false;
+
+    if (!flat_alloc(&flat, size)) {
+        _dos_freemem(FP_SEG(buffer));
+        return false;
+    }
 
-        v->pos += 4;
+    for (uint32_t pos = 0; pos < size; /* empty */) {
+        const int32_t bytes = far_read(fd, buffer,
+                                       size - pos > STREAM_BUFFER_SIZE
+                                       ? STREAM_BUFFER_SIZE
+                                       : (uint16_t)(size - pos));
+
+        if (bytes <= 0) {
+            printf("Unable to read %lu bytes from file.\n",
+                   (unsigned long) size);
+            flat_free(&flat);
+            _dos_freemem(FP_SEG(buffer));
+            return false;
+        }
+
+        flat_write(&flat, pos, buffer, (uint16_t) bytes);
+        pos += bytes;
+    }
+
+    printf("Playing %lu bytes from extended memory. Load-time "
+           "translations are not\navailable.\n", (unsigned long) size);
+
+    vgm_buf_init_stream(v, buffer, STREAM_BUFFER_SIZE, 0, flat_refill,
+                        &flat);
+    return true;
+}
+
+/**
+ * Print a GD3 tag that follows the VGM data in a stream.
+ *
+ * \param gd3_pos Position of the GD3 tag relative to the start of the VGM
+ *                data. It must not be before the current position.
+ */
+static void
+stream_dump_gd3(struct vgm_buf *v, uint32_t gd3_pos)
+{
+    vgm_buf_seek(v, gd3_pos);
+    skip_bytes(v, 4);
+
+    const uint32_t version = get_uint32(v);
+    const uint32_t length = get_uint32(v);
+
+    if (vgm_buf_tell(v) != gd3_pos + sizeof(struct gd3_header)) {
+        printf("Could not read GD3 header.\n");
+        return;
+    }
+
+    if (version != 0x00000100)
+        printf("Unknown GD3 version %x\n", version);
+
+    printf("\n--- Start of GD3 data ---\n");
+    for (uint32_t i = 0; i + 1 < length; i += 2) {
+        /* Stop at the end of the stream. The size may still be
+         * VGM_BUF_SIZE_UNKNOWN, so subtract instead of adding.
+         */
+        if (v->size - vgm_buf_tell(v) < 2)
+            break;
 
-        return result;
+        const uint8_t lo = get_uint8(v);
+        const uint8_t hi = get_uint8(v);
+
+        if (hi == 0)
+            printf("%c", lo == 0 ? '\n' : lo);
     }
+
+    printf("--- End of GD3 data ---\n");
 }
 
 static uint32_t
@@ -168,6 +394,154 @@ get_tick()
     return r.w.dx | ((uint32_t) r.w.cx << 16);
 }
 
+#ifdef PORT_TRACE
+struct trace_entry {
+    uint32_t time;
+    uint16_t port;
+    uint8_t value;
+    uint8_t is_write;
+};
+
+/* Number of entries that fit in a single 64k allocation. */
+#define TRACE_MAX_ENTRIES 8000u
+
+static struct trace_entry far *trace_buf;
+static uint16_t trace_count;
+static uint32_t trace_overflow;
+static uint32_t trace_base;
+
+/**
+ * Read a timestamp in units of the PIT input clock (1.193182MHz).
+ *
+ * The upper 16 bits come from the BIOS tick count, and the lower 16 bits come
+ * from PIT channel 0. \c trace_begin puts channel 0 in mode 2 so that the
+ * counter can be read reliably.
+ *
+ * \note The trace functions call the real \c inp and \c outp by wrapping
+ * the names in parenthesis. That prevents the tracing macros below from
+ * being expanded.
+ */
+static uint32_t
+trace_timestamp(void)
+{
+    volatile uint32_t far *const bios_ticks = MK_FP(0x40, 0x6c);
+
+    _disable();
+    (outp)(0x43, 0x00);
+    uint16_t count = (inp)(0x40);
+    count |= (uint16_t)(inp)(0x40) << 8;
+    uint32_t ticks = *bios_ticks;
+
+    /* If the counter reloaded after interrupts were disabled, the BIOS has
+     * not counted that tick yet. In that case IRQ 0 will be pending in the
+     * PIC's interrupt request register.
+     */
+    (outp)(0x20, 0x0a);
+    if (((inp)(0x20) & 0x01) != 0 && count > 0x8000)
+        ticks++;
+    _enable();
+
+    return (ticks << 16) | (uint16_t)(0 - count);
+}
+
+static void
+trace_record(unsigned port, unsigned value, bool is_write)
+{
+    if (trace_count >= TRACE_MAX_ENTRIES) {
+        trace_overflow++;
+        return;
+    }
+
+    struct trace_entry far *const e = &trace_buf[trace_count++];
+
+    e->time = trace_timestamp() - trace_base;
+    e->port = port;
+    e->value = value;
+    e->is_write = is_write;
+}
+
+static unsigned
+trace_outp(unsigned port, unsigned value)
+{
+    trace_record(port, value, true);
+    return (outp)(port, value);
+}
+
+static unsigned
+trace_inp(unsigned port)
+{
+    const unsigned value = (inp)(port);
+
+    trace_record(port, value, false);
+    return value;
+}
+
+static void
+trace_begin(void)
+{
+    trace_buf = _fmalloc(TRACE_MAX_ENTRIES * sizeof(struct trace_entry));
+    if (trace_buf == NULL) {
+        printf("Could not allocate port trace buffer.\n");
+        exit(-1);
+    }
+
+    /* Reprogram channel 0 to mode 2 with the same period that the BIOS uses.
+     * Unlike mode 3, the count in mode 2 decrements by one for each input
+     * clock.
+     */
+    (outp)(0x43, 0x34);
+    (outp)(0x40, 0x00);
+    (outp)(0x40, 0x00);
+
+    trace_count = 0;
+    trace_overflow = 0;
+    trace_base = trace_timestamp();
+}
+
+static void
+trace_end(void)
+{
+    /* Restore channel 0 to the mode 3 setting used by the BIOS. */
+    (outp)(0x43, 0x36);
+    (outp)(0x40, 0x00);
+    (outp)(0x40, 0x00);
+
+    FILE *fp = fopen("VGMPLAY.TRC", "w");
+    if (fp == NULL) {
+        printf("Could not create VGMPLAY.TRC.\n");
+        return;
+    }
+
+    fprintf(fp, "# time (1.193182MHz clocks), direction, port, value\n");
+    for (unsigned i = 0; i < trace_count; i++) {
+        fprintf(fp, "%lu %c %03x %02x\n",
+                (unsigned long) trace_buf[i].time,
+                trace_buf[i].is_write ? 'w' : 'r',
+                trace_buf[i].port,
+                trace_buf[i].value);
+    }
+
+    fclose(fp);
+
+    printf("Wrote %u port accesses to VGMPLAY.TRC.\n", trace_count);
+    if (trace_overflow != 0) {
+        printf("%lu port accesses did not fit in the trace buffer.\n",
+               (unsigned long) trace_overflow);
+    }
+}
+
+/* Route all of the port accesses made by the player through the trace
+ * functions. Each access takes considerably longer while tracing, so the
+ * timestamps show the order and spacing of writes rather than the exact
+ * timing of an untraced build.
+ */
+#define outp(port, value) trace_outp((port), (value))
+#define inp(port) trace_inp((port))
+#else
+#define trace_begin() do { } while (false)
+#define trace_end() do { } while (false)
+#endif
+
 static uint16_t adj_up;
 static uint16_t adj_dn = 0;
 static uint16_t initial;
@@ -362,327 +736,172 @@ calibrate_delay()
 #endif
 }
 
+/* I/O port of a second SN76489, or zero if there is none. */
+static uint16_t psg2_port = 0;
+
+/**
+ * Silence every voice of one SN76489.
+ */
 static void
-sn76489_off(void)
+psg_off(uint16_t port)
 {
-    outp(0xc0, 0x9f);
-    outp(0xc0, 0xbf);
-    outp(0xc0, 0xdf);
-    outp(0xc0, 0xff);
+    outp(port, 0x9f);
+    outp(port, 0xbf);
+    outp(port, 0xdf);
+    outp(port, 0xff);
 }
 
 static void
-pc_speaker_start(unsigned freq)
+sn76489_off(void)
 {
-    uint16_t period = 0xfffe & (0x1234dcUL / freq);
-
-    outp(0x43, 0xb6);
-    outp(0x42, period & 0x00ff);
-    outp(0x42, period >> 8);
+    psg_off(0xc0);
 
-    uint8_t al = inp(0x61);
-    outp(0x61, al | 0x03);
+    if (psg2_port != 0)
+        psg_off(psg2_port);
 }
 
-static void
-pc_speaker_stop(void)
+/* Base I/O port of a Creative Music System / Game Blaster card, or zero if
+ * there is none. Each of the two SAA1099 chips has a data port and an
+ * address port: base + 0 and base + 1 for the first, and base + 2 and
+ * base + 3 for the second.
+ */
+static uint16_t cms_port = 0;
+
+/**
+ * Write an SAA1099 register.
+ *
+ * \param reg Register number. Bit 7 selects the second chip.
+ */
+static inline void
+cms_write(uint8_t reg, uint8_t value)
 {
-    uint8_t al = inp(0x61);
-    outp(0x61, al & 0xfc);
+    const uint16_t port = cms_port + ((reg & 0x80) != 0 ? 2 : 0);
+
+    outp(port + 1, reg & 0x1f);
+    outp(port, value);
 }
 
 static void
-play_Tandy_sound(struct vgm_buf *v, struct vgm_header *header)
+cms_off(void)
 {
-    bool done = false;
+    if (cms_port == 0)
+        return;
 
-    /* AY-8910 channel A period */
-    uint16_t period = 0;
+    for (unsigned chip = 0; chip <= 0x80; chip += 0x80) {
+        /* Silence all six amplitudes, then disable and reset the chip. */
+        for (uint8_t reg = 0x00; reg < 0x06; reg++)
+            cms_write(chip | reg, 0x00);
 
-    while (!done) {
-        uint8_t command = get_uint8(v);
-
-        switch (command) {
-        case 0x30: /* reserved one-byte command. */
-        case 0x31: /* AY8910 stereo mask */
-        case 0x32: /* reserved one-byte command. */
-        case 0x33: /* reserved one-byte command. */
-        case 0x34: /* reserved one-byte command. */
-        case 0x35: /* reserved one-byte command. */
-        case 0x36: /* reserved one-byte command. */
-        case 0x37: /* reserved one-byte command. */
-        case 0x38: /* reserved one-byte command. */
-        case 0x39: /* reserved one-byte command. */
-        case 0x3a: /* reserved one-byte command. */
-        case 0x3b: /* reserved one-byte command. */
-        case 0x3c: /* reserved one-byte command. */
-        case 0x3d: /* reserved one-byte command. */
-        case 0x3e: /* reserved one-byte command. */
-        case 0x3f: /* reserved one-byte command. */
-        case 0x4f: /* Game Gear PSG stereo */
-        case 0x94: /* Stop stream */
-            printf("command = 0x%02x\n", (unsigned) command);
-            skip_bytes(v, 1);
-            break;
+        cms_write(chip | 0x1c, 0x02);
+        cms_write(chip | 0x1c, 0x00);
+    }
+}
 
-        case 0x40: /* Mikey write */
-        case 0x41: /* reserved two-byte command. */
-        case 0x42: /* reserved two-byte command. */
-        case 0x43: /* reserved two-byte command. */
-        case 0x44: /* reserved two-byte command. */
-        case 0x45: /* reserved two-byte command. */
-        case 0x46: /* reserved two-byte command. */
-        case 0x47: /* reserved two-byte command. */
-        case 0x48: /* reserved two-byte command. */
-        case 0x49: /* reserved two-byte command. */
-        case 0x4a: /* reserved two-byte command. */
-        case 0x4b: /* reserved two-byte command. */
-        case 0x4c: /* reserved two-byte command. */
-        case 0x4d: /* reserved two-byte command. */
-        case 0x4e: /* reserved two-byte command. */
-        case 0x51: /* YM2413 write */
-        case 0x52: /* YM2612 port 0 write */
-        case 0x53: /* YM2612 port 1 write */
-        case 0x54: /* YM2151 write */
-        case 0x55: /* YM2203 write */
-        case 0x56: /* YM2608 port 0 write */
-        case 0x57: /* YM2608 port 1 write */
-        case 0x58: /* YM2610 port 0 write */
-        case 0x59: /* YM2610 port 1 write */
-        case 0x5a: /* YM3812 write */
-        case 0x5b: /* YM3526 write */
-        case 0x5c: /* Y8950 write */
-        case 0x5d: /* YMZ280B write */
-        case 0x5e: /* YMF262 port 0 write */
-        case 0x5f: /* YMF262 port 1 write */
-        case 0xa1: /* YM2413 write (second chip) */
-        case 0xa2: /* YM2612 port 0 write (second chip) */
-        case 0xa3: /* YM2612 port 1 write (second chip) */
-        case 0xa4: /* YM2151 write (second chip) */
-        case 0xa5: /* YM2203 write (second chip) */
-        case 0xa6: /* YM2608 port 0 write (second chip) */
-        case 0xa7: /* YM2608 port 1 write (second chip) */
-        case 0xa8: /* YM2610 port 0 write (second chip) */
-        case 0xa9: /* YM2610 port 1 write (second chip) */
-        case 0xaa: /* YM3812 write (second chip) */
-        case 0xab: /* YM3526 write (second chip) */
-        case 0xac: /* Y8950 write (second chip) */
-        case 0xad: /* YMZ280B write (second chip) */
-        case 0xae: /* YMF262 port 0 write (second chip) */
-        case 0xaf: /* YMF262 port 1 write (second chip) */
-        case 0xb0: /* RF5C68 write */
-        case 0xb1: /* RF5C164 write */
-        case 0xb2: /* PWM write */
-        case 0xb3: /* GameBoy DMG write */
-        case 0xb4: /* NES APU write */
-        case 0xb5: /* MultiPCM write */
-        case 0xb6: /* uPD7759 write */
-        case 0xb7: /* OKIM6258 write */
-        case 0xb8: /* OKIM6295 write */
-        case 0xb9: /* HuC6280 write */
-        case 0xba: /* K053260 write */
-        case 0xbb: /* Pokey write */
-        case 0xbc: /* WonderSwan write */
-        case 0xbd: /* SAA1099 write */
-        case 0xbe: /* ES5506 write */
-        case 0xbf: /* GA20 write */
-            printf("command = 0x%02x\n", (unsigned) command);
-            skip_bytes(v, 2);
-            break;
+/* Base I/O port of an OPL2 (AdLib or Sound Blaster FM), or zero if there is
+ * none. The address port is base + 0, and the data port is base + 1.
+ */
+static uint16_t opl_port = 0;
 
-        case 0xc0: /* Sega PCM write */
-        case 0xc1: /* RF5C68 write */
-        case 0xc2: /* RF5C164 write */
-        case 0xc3: /* MultiPCM write */
-        case 0xc4: /* QSound write */
-        case 0xc5: /* SCSP write */
-        case 0xc6: /* WonderSwan write */
-        case 0xc7: /* VSU write */
-        case 0xc8: /* X1-010 write */
-        case 0xc9: /* reserved three-byte command. */
-        case 0xca: /* reserved three-byte command. */
-        case 0xcb: /* reserved three-byte command. */
-        case 0xcc: /* reserved three-byte command. */
-        case 0xcd: /* reserved three-byte command. */
-        case 0xce: /* reserved three-byte command. */
-        case 0xcf: /* reserved three-byte command. */
-        case 0xd0: /* YMF278B port write */
-        case 0xd1: /* YMF271 port write */
-        case 0xd2: /* SCC1 port write */
-        case 0xd3: /* K054539 write */
-        case 0xd4: /* C140 write */
-        case 0xd5: /* ES5503 write */
-        case 0xd6: /* ES5506 write */
-        case 0xd7: /* reserved three-byte command. */
-        case 0xd8: /* reserved three-byte command. */
-        case 0xd9: /* reserved three-byte command. */
-        case 0xda: /* reserved three-byte command. */
-        case 0xdb: /* reserved three-byte command. */
-        case 0xdc: /* reserved three-byte command. */
-        case 0xdd: /* reserved three-byte command. */
-        case 0xde: /* reserved three-byte command. */
-        case 0xdf: /* reserved three-byte command. */
-        case 0xe1: /* C352 write */
-            printf("command = 0x%02x\n", (unsigned) command);
-            skip_bytes(v, 3);
-            break;
+/**
+ * Write an OPL2 register.
+ *
+ * The OPL2 needs 3.3us after an address write and 23us after a data write
+ * before it can accept another write. Reading the status port is the usual
+ * way to wait, since it takes about the same time on any machine.
+ */
+static void
+opl_write(uint8_t reg, uint8_t value)
+{
+    outp(opl_port, reg);
+    for (unsigned i = 0; i < 6; i++)
+        inp(opl_port);
 
-        case 0xe0: /* Seek to offset in PCM data bank. */
-        case 0xe2: /* reserved four-byte command. */
-        case 0xe3: /* reserved four-byte command. */
-        case 0xe4: /* reserved four-byte command. */
-        case 0xe5: /* reserved four-byte command. */
-        case 0xe6: /* reserved four-byte command. */
-        case 0xe7: /* reserved four-byte command. */
-        case 0xe8: /* reserved four-byte command. */
-        case 0xe9: /* reserved four-byte command. */
-        case 0xea: /* reserved four-byte command. */
-        case 0xeb: /* reserved four-byte command. */
-        case 0xec: /* reserved four-byte command. */
-        case 0xed: /* reserved four-byte command. */
-        case 0xee: /* reserved four-byte command. */
-        case 0xef: /* reserved four-byte command. */
-        case 0xf0: /* reserved four-byte command. */
-        case 0xf1: /* reserved four-byte command. */
-        case 0xf2: /* reserved four-byte command. */
-        case 0xf3: /* reserved four-byte command. */
-        case 0xf4: /* reserved four-byte command. */
-        case 0xf5: /* reserved four-byte command. */
-        case 0xf6: /* reserved four-byte command. */
-        case 0xf7: /* reserved four-byte command. */
-        case 0xf8: /* reserved four-byte command. */
-        case 0xf9: /* reserved four-byte command. */
-        case 0xfa: /* reserved four-byte command. */
-        case 0xfb: /* reserved four-byte command. */
-        case 0xfc: /* reserved four-byte command. */
-        case 0xfd: /* reserved four-byte command. */
-        case 0xfe: /* reserved four-byte command. */
-        case 0xff: /* reserved four-byte command. */
-        case 0x90: /* Setup stream control */
-        case 0x91: /* Set stream data */
-        case 0x95: /* Start stream (fast call) */
-            printf("command = 0x%02x\n", (unsigned) command);
-            skip_bytes(v, 4);
-            break;
+    outp(opl_port + 1, value);
+    for (unsigned i = 0; i < 35; i++)
+        inp(opl_port);
+}
 
-        case 0x92: /* Set stream frequency */
-            printf("command = 0x%02x\n", (unsigned) command);
-            skip_bytes(v, 5);
-            break;
+/**
+ * Clear every OPL2 register, which stops all notes.
+ */
+static void
+opl_off(void)
+{
+    if (opl_port == 0)
+        return;
 
-        case 0x93: /* Start stream */
-            printf("command = 0x%02x\n", (unsigned) command);
-            skip_bytes(v, 10);
-            break;
+    for (unsigned reg = 0x01; reg <= 0xf5; reg++)
+        opl_write(reg, 0x00);
+}
 
-        case 0x50: {
-            /* SN76489 / SN76496 write */
-            uint8_t d = get_uint8(v);
+static void
+pc_speaker_start(unsigned freq)
+{
+    uint16_t period = 0xfffe & (0x1234dcUL / freq);
 
-            outp(0xc0, d);
-            break;
-        }
+    outp(0x43, 0xb6);
+    outp(0x42, period & 0x00ff);
+    outp(0x42, period >> 8);
 
-        case 0x61:
-            /* Wait n samples. n is 16-bit value. */
-            wait_44khz(get_uint16(v));
-            break;
+    uint8_t al = inp(0x61);
+    outp(0x61, al | 0x03);
+}
 
-        case 0x62:
-            /* Wait 735 samples */
-            wait_44khz(735);
-            break;
+static void
+pc_speaker_stop(void)
+{
+    uint8_t al = inp(0x61);
+    outp(0x61, al & 0xfc);
+}
 
-        case 0x63:
-            /* Wait 882 samples */
-            wait_44khz(882);
-            break;
+/* AY-8910 channel A period */
+static uint16_t ay_period;
 
-        case 0x66:
-            /* End of sound data. */
-            done = true;
-            break;
+/* State of the sound hardware. This is only kept up to date while a loop is
+ * to be played.
+ */
+static bool shadowing = false;
+static struct vgm_shadow shadow;
 
-        case 0x67: {
-            /* Data block. */
-            printf("command = 0x%02x\n", (unsigned) command);
+/**
+ * Play VGM commands until the end of the data.
+ *
+ * \return
+ * False if the data could not be decoded.
+ */
+static bool
+play_events(struct vgm_buf *v, const struct vgm_header *header)
+{
+    uint16_t period = ay_period;
 
-            /* Should be 0x66, followed by a byte for the data type. */
-            uint8_t marker = get_uint8(v);
-            if (marker != 0x66)
-                goto parse_error;
+    while (true) {
+        struct vgm_event e;
+        const uint8_t type = vgm_next_event(v, &e);
 
-            skip_bytes(v, 1);
+        if (shadowing)
+            vgm_shadow_event(&shadow, &e);
 
-            /* The next four bytes specify how much data follows. */
-            skip_bytes(v, get_uint32(v));
+        switch (type) {
+        case VGM_EVENT_PSG_WRITE:
+            outp(0xc0, e.value);
             break;
-        }
-
-        case 0x68: {
-            /* PCM RAM write. */
-            printf("command = 0x%02x\n", (unsigned) command);
-
-            /* Should be 0x66, followed by a byte for the chip type, and 12
-             * bytes of offsets and sizes.
-             */
-            uint8_t marker = get_uint8(v);
-            if (marker != 0x66)
-                goto parse_error;
 
-            skip_bytes(v, 13);
-            break;
-        }
+        case VGM_EVENT_PSG2_WRITE:
+            if (psg2_port != 0)
+                outp(psg2_port, e.value);
 
-        case 0x70:
-        case 0x71:
-        case 0x72:
-        case 0x73:
-        case 0x74:
-        case 0x75:
-        case 0x76:
-        case 0x77:
-        case 0x78:
-        case 0x79:
-        case 0x7a:
-        case 0x7b:
-        case 0x7c:
-        case 0x7d:
-        case 0x7e:
-        case 0x7f:
-            /* Wait n+1 samples. */
-            wait_44khz((command & 0x0f) + 1);
             break;
 
-        case 0x80:
-        case 0x81:
-        case 0x82:
-        case 0x83:
-        case 0x84:
-        case 0x85:
-        case 0x86:
-        case 0x87:
-        case 0x88:
-        case 0x89:
-        case 0x8a:
-        case 0x8b:
-        case 0x8c:
-        case 0x8d:
-        case 0x8e:
-        case 0x8f:
-            printf("command = 0x%02x\n", (unsigned) command);
-            /* YM2612 port 0 write from data pointer, then wait. */
+        case VGM_EVENT_WAIT:
+            wait_44khz(e.samples);
             break;
 
-        case 0xa0: {
-            /* AY8910 write */
-            uint8_t v1 = get_uint8(v);
-            uint8_t v2 = get_uint8(v);
-
-            if (v1 == 0) {
-                period = (period & 0xff00) | v2;
-            } else if (v1 == 1) {
-                period = 0x0fff & ((period & 0x00ff) | ((uint16_t)v2 << 8));
+        case VGM_EVENT_AY8910_WRITE:
+            if (e.reg == 0) {
+                period = (period & 0xff00) | e.value;
+            } else if (e.reg == 1) {
+                period = 0x0fff & ((period & 0x00ff) |
+                                   ((uint16_t)e.value << 8));
 
                 /* The documentation for the AY-8910 says:
                  *
@@ -695,282 +914,2054 @@ play_Tandy_sound(struct vgm_buf *v, struct vgm_header *header)
                  * This is not very clear to me. However, clk / (16 * period)
                  * seems to produce credible results.
                  */
-                pc_speaker_start(header->ay8910_clock / (16 * period));
-            } else if (v1 == 7) {
-                if ((v2 & 1) != 0 && period != 0) {
+                if (period != 0)
+                    pc_speaker_start(header->ay8910_clock / (16 * period));
+            } else if (e.reg == 7) {
+                if ((e.value & 1) != 0 && period != 0) {
                     pc_speaker_start(header->ay8910_clock / (16 * period));
                 }
-            } else if (v1 == 8) {
-                if ((v2 & 1) == 0)
+            } else if (e.reg == 8) {
+                if ((e.value & 1) == 0)
                     pc_speaker_stop();
             } else {
-                printf("ay8910 - unsupported register 0x%02x\n", v1);
+                printf("ay8910 - unsupported register 0x%02x\n", e.reg);
             }
 
             break;
-        }
 
-        default:
-            printf("command = 0x%02x\n", (unsigned) command);
-            goto parse_error;
+        case VGM_EVENT_SAA1099_WRITE:
+            if (cms_port == 0)
+                break;
+
+            cms_write(e.reg, e.value);
+
+            /* Register updates come in bursts with no waits between them.
+             * Send the rest of the burst straight from the buffer instead of
+             * going back through the decoder for each write.
+             */
+            while (v->remain >= 3 && v->ptr[0] == 0xbd) {
+                if (shadowing)
+                    vgm_shadow_saa(&shadow, v->ptr[1], v->ptr[2]);
+
+                cms_write(v->ptr[1], v->ptr[2]);
+                v->ptr += 3;
+                v->remain -= 3;
+            }
+
+            break;
+
+        case VGM_EVENT_OPL2_WRITE:
+            if (opl_port != 0)
+                opl_write(e.reg, e.value);
+
+            break;
+
+        case VGM_EVENT_DATA_BLOCK:
+        case VGM_EVENT_CHIP_WRITE:
+            /* Without a second PSG, Game Gear stereo folds to mono by
+             * ignoring the pan mask.
+             */
+            if (e.command != 0x4f)
+                printf("command = 0x%02x\n", (unsigned) e.command);
+
+            break;
+
+        case VGM_EVENT_END:
+            ay_period = period;
+            return true;
+
+        case VGM_EVENT_ERROR:
+            printf("command = 0x%02x\n", (unsigned) e.command);
+            printf("parse error\n");
+            return false;
         }
     }
+}
 
-    sn76489_off();
-    pc_speaker_stop();
-    return;
+/* Number of times the looped part of a track is played again. */
+static uint16_t loop_count = 0;
 
- parse_error:
-    printf("parse error\n");
-    sn76489_off();
-    return;
-}
+/* Largest looped part of a stream that can be kept in memory. */
+#define LOOP_PIN_SIZE 0xfff0u
 
-static void
-show_help(const char *progname)
-{
-    printf("Usage: %s [/delay:####:####] filename.vgm\n"
-           "\n"
-           "Optional parameters:\n"
-           "    /delay:####:#### - specify delay loop control parameters. "
-           "The parameters\n"
+/**
+ * Reader for a stream with a loop.
+ *
+ * It sits between the vgm_buf and the real reader. The first time through,
+ * it stops the stream at the loop point, so that playback can take a copy of
+ * the hardware state there. After that, it keeps a copy of the data from
+ * the loop point on, so that the loop can be played again without reading
+ * the stream.
+ */
+struct loop_pin {
+    vgm_refill_fn refill;
+    void *refill_ctx;
+
+    /* Position of the loop point in the stream, and the numbers of bytes
+     * read from the real reader and passed on to the vgm_buf. A few bytes
+     * past the loop point may be read before the loop point is reached, so
+     * these are not always the same.
+     */
+    uint32_t start;
+    uint32_t read;
+    uint32_t delivered;
+
+    /* Stop the stream at the loop point. */
+    bool stop;
+
+    /* Copy of the data from the loop point. It is incomplete if overflow is
+     * set. The buffer is NULL if nothing is kept.
+     */
+    uint8_t far *buffer;
+    uint16_t size;
+    bool overflow;
+};
+
+static void
+loop_pin_keep(struct loop_pin *p, const uint8_t far *src, uint16_t n)
+{
+    if (p->overflow || LOOP_PIN_SIZE - p->size < n) {
+        p->overflow = true;
+        return;
+    }
+
+    _fmemcpy(p->buffer + p->size, src, n);
+    p->size += n;
+}
+
+static uint16_t
+loop_pin_refill(void *ctx, uint8_t far *dst, uint16_t max)
+{
+    struct loop_pin *const p = ctx;
+    uint16_t n;
+
+    if (p->delivered < p->read) {
+        /* Bytes past the loop point that were read before it. */
+        const uint32_t left = p->read - p->delivered;
+
+        n = left > max ? max : (uint16_t) left;
+        _fmemcpy(dst, p->buffer + (uint16_t)(p->delivered - p->start), n);
+    } else {
+        if (p->stop) {
+            if (p->delivered >= p->start)
+                return 0;
+
+            if (p->start - p->delivered < max)
+                max = (uint16_t)(p->start - p->delivered);
+        }
+
+        n = p->refill(p->refill_ctx, dst, max);
+
+        if (p->read >= p->start && p->buffer != NULL)
+            loop_pin_keep(p, dst, n);
+
+        p->read += n;
+    }
+
+    p->delivered += n;
+    return n;
+}
+
+/**
+ * Put a loop_pin in front of the reader of a stream that was just opened.
+ */
+static bool
+loop_pin_open(struct loop_pin *p, struct vgm_buf *v, uint32_t start)
+{
+    p->refill = v->refill;
+    p->refill_ctx = v->refill_ctx;
+    p->start = start;
+    p->read = v->filled;
+    p->delivered = v->filled;
+    p->stop = true;
+    p->size = 0;
+    p->overflow = false;
+
+    /* Extended memory already holds all of the data. */
+    if (v->refill == flat_refill) {
+        p->buffer = NULL;
+        p->overflow = true;
+    } else {
+        p->buffer = far_alloc(LOOP_PIN_SIZE);
+        if (p->buffer == NULL) {
+            printf("Could not allocate %u bytes of memory.\n",
+                   LOOP_PIN_SIZE);
+            return false;
+        }
+    }
+
+    /* Opening the stream may have read past the loop point. Those bytes are
+     * handed out again after it.
+     */
+    if (v->filled > start) {
+        if (p->buffer != NULL) {
+            loop_pin_keep(p, v->buffer + (uint16_t) start,
+                          (uint16_t)(v->filled - start));
+        } else {
+            /* Extended memory can simply be read again. */
+            flat.pos = start;
+            p->read = start;
+        }
+
+        v->filled = start;
+        p->delivered = start;
+    }
+
+    v->refill = loop_pin_refill;
+    v->refill_ctx = p;
+    vgm_buf_seek(v, 0);
+    return true;
+}
+
+/**
+ * Get the position of the loop point in the VGM data.
+ *
+ * \return
+ * The position, or VGM_BUF_SIZE_UNKNOWN if the track does not loop.
+ */
+static uint32_t
+loop_start(const struct vgm_header *header)
+{
+    const uint32_t data_start = header->vgm_data_offset + 0x34;
+
+    if (header->loop_offset == 0 || header->loop_offset + 0x1c < data_start)
+        return VGM_BUF_SIZE_UNKNOWN;
+
+    return header->loop_offset + 0x1c - data_start;
+}
+
+/**
+ * Play a track, and then play its looped part loop_count more times.
+ *
+ * The first time through, playback stops at the loop point to take a copy
+ * of the hardware state. Each time the end is reached, only the registers
+ * that differ from that copy are written before jumping back, so every loop
+ * starts the way the first one did. The data of the loop stays in memory, so
+ * the jump never reads the disk.
+ *
+ * \param start Position of the loop point. If all of the data is in memory,
+ *              it must be before the end.
+ * \param pin Reader of the stream, or NULL if all of the data is in memory.
+ *
+ * \return
+ * Number of times the looped part was played after the first time. This is
+ * less than \c loop_count if the loop could not be kept in memory or the
+ * data could not be read.
+ */
+static unsigned
+play_looped(struct vgm_buf *v, const struct vgm_header *header,
+            uint32_t start, struct loop_pin *pin)
+{
+    static uint8_t burst[VGM_SHADOW_DIFF_MAX];
+    static struct vgm_shadow entry;
+    const uint32_t size = v->size;
+    unsigned loops = loop_count;
+
+    vgm_shadow_init(&shadow);
+    shadowing = true;
+
+    /* Up to the loop point. */
+    if (pin == NULL) {
+        v->size = start;
+        vgm_buf_seek(v, 0);
+    }
+
+    bool ok = play_events(v, header);
+
+    entry = shadow;
+
+    if (pin == NULL) {
+        v->size = size;
+    } else {
+        pin->stop = false;
+        v->size = VGM_BUF_SIZE_UNKNOWN;
+    }
+
+    vgm_buf_seek(v, start);
+    ok = ok && play_events(v, header);
+
+    /* Where the loop is played from. */
+    struct vgm_buf pinned;
+    struct vgm_buf *body = v;
+    uint32_t body_start = start;
+
+    if (pin != NULL && !pin->overflow) {
+        vgm_buf_init(&pinned, pin->buffer, pin->size);
+        body = &pinned;
+        body_start = 0;
+    } else if (pin != NULL && pin->refill != flat_refill) {
+        printf("The loop is too long to keep in memory while streaming.\n");
+        loops = 0;
+    }
+
+    unsigned played = 0;
+
+    for (/* empty */; ok && played < loops; played++) {
+        struct vgm_buf diff;
+
+        vgm_buf_init(&diff, burst, vgm_shadow_diff(&entry, &shadow, burst));
+        play_events(&diff, header);
+
+        if (pin != NULL && pin->overflow) {
+            /* Read the loop from extended memory again. */
+            flat.pos = start;
+            vgm_buf_init_stream(v, v->buffer, v->capacity, 0, flat_refill,
+                                &flat);
+            body_start = 0;
+        } else {
+            vgm_buf_seek(body, body_start);
+        }
+
+        ok = play_events(body, header);
+    }
+
+    /* A loop that could not be read to the end does not count. */
+    if (!ok && played > 0)
+        played--;
+
+    shadowing = false;
+    return played;
+}
+
+/**
+ * \param loop Position of the loop point to play the loop from, or
+ *             VGM_BUF_SIZE_UNKNOWN to play the track once.
+ * \param pin Reader of the stream if the data is not all in memory.
+ *
+ * \return
+ * Number of times the looped part was played after the first time.
+ */
+static unsigned
+play_Tandy_sound(struct vgm_buf *v, struct vgm_header *header,
+                 uint32_t loop, struct loop_pin *pin)
+{
+    unsigned loops = 0;
+
+    ay_period = 0;
+
+    /* Neither the SAA1099 nor the OPL2 resets on its own, so a previous
+     * program may have left them making noise.
+     */
+    cms_off();
+    opl_off();
+
+    if (loop != VGM_BUF_SIZE_UNKNOWN)
+        loops = play_looped(v, header, loop, pin);
+    else
+        play_events(v, header);
+
+    sn76489_off();
+    pc_speaker_stop();
+    cms_off();
+    opl_off();
+
+    return loops;
+}
+
+/* Interrupt multiplex (INT 2Fh) function number used to find a resident
+ * copy of the player. 0xc0 through 0xff are available to applications.
+ */
+#define TSR_MUX_ID 0xd7
+
+/* PIT channel 0 divisor used while playing in the background. This gives an
+ * interrupt rate of about 1kHz, so event times are quantized to 1ms.
+ */
+#define TSR_PIT_DIVISOR 1193u
+
+/* Longest delay stored in a single event. This keeps the countdown in the
+ * interrupt handler within an int16_t.
+ */
+#define TSR_MAX_DELAY 0x7fffu
+
+/* Number of events that can be read through a normalized far pointer. */
+#define TSR_EVENT_WINDOW (CURSOR_MAX / sizeof(struct evq_event))
+
+/* Port 0x61 is shared with other hardware, so events for it only carry the
+ * PC speaker gate bits. The interrupt handler merges them with the current
+ * value of the port.
+ */
+#define TSR_SPEAKER_PORT 0x61
+
+typedef void (__interrupt __far *isr_ptr)();
+
+/**
+ * State of the resident player.
+ *
+ * A non-resident copy of the player finds this through INT 2Fh in order to
+ * unload the resident copy.
+ */
+struct tsr_state {
+    char signature[8];
+
+    isr_ptr old_timer;
+    isr_ptr old_mux;
+    isr_ptr timer_isr;
+    isr_ptr mux_isr;
+
+    /* Segments that are freed when the resident copy is unloaded. */
+    uint16_t psp;
+    uint16_t event_seg;
+
+    /* Next event to play. next is a normalized far pointer, and window is the
+     * number of events that can be read through it before it must be
+     * renormalized.
+     */
+    const struct evq_event far *next;
+    uint16_t window;
+    uint32_t events_left;
+
+    /* PIT clocks until the next event is due. */
+    int16_t due;
+
+    /* PIT clocks since the BIOS timer handler last ran. */
+    uint16_t bios_clocks;
+
+    bool finished;
+};
+
+static struct tsr_state tsr = {
+    { 'V', 'G', 'M', 'P', 'L', 'A', 'Y', '\0' }
+};
+
+static void
+tsr_stop_sound(void)
+{
+    sn76489_off();
+    pc_speaker_stop();
+    cms_off();
+}
+
+/**
+ * Timer interrupt handler used while playing in the background.
+ *
+ * The BIOS handler is still called at the normal 18.2Hz rate so that the time
+ * of day and diskette motor timeouts are unaffected.
+ */
+static void __interrupt __far
+tsr_timer_isr(void)
+{
+    if (tsr.finished) {
+        _chain_intr(tsr.old_timer);
+        return;
+    }
+
+    tsr.due -= (int16_t) TSR_PIT_DIVISOR;
+
+    while (tsr.due <= 0) {
+        if (tsr.events_left == 0) {
+            tsr_stop_sound();
+
+            /* Restore the BIOS timer rate. From now on, every interrupt goes
+             * straight to the BIOS handler.
+             */
+            outp(0x43, 0x36);
+            outp(0x40, 0x00);
+            outp(0x40, 0x00);
+
+            tsr.finished = true;
+            break;
+        }
+
+        if (tsr.window == 0) {
+            tsr.next = MK_FP(FP_SEG(tsr.next) + (FP_OFF(tsr.next) >> 4),
+                             FP_OFF(tsr.next) & 0x0f);
+            tsr.window = TSR_EVENT_WINDOW;
+        }
+
+        const struct evq_event far *const e = tsr.next;
+
+        if (e->port == TSR_SPEAKER_PORT)
+            outp(TSR_SPEAKER_PORT, (inp(TSR_SPEAKER_PORT) & 0xfc) | e->value);
+        else if (e->port != 0)
+            outp(e->port, e->value);
+
+        tsr.due += e->delay;
+        tsr.next++;
+        tsr.window--;
+        tsr.events_left--;
+    }
+
+    const uint16_t old_clocks = tsr.bios_clocks;
+
+    tsr.bios_clocks += TSR_PIT_DIVISOR;
+    if (tsr.bios_clocks < old_clocks) {
+        /* The BIOS handler sends the end-of-interrupt. */
+        tsr.old_timer();
+    } else {
+        outp(0x20, 0x20);
+    }
+}
+
+static void __interrupt __far
+tsr_mux_isr(union INTPACK r)
+{
+    if (r.h.ah != TSR_MUX_ID) {
+        _chain_intr(tsr.old_mux);
+        return;
+    }
+
+    /* Installation check. Return a pointer to the resident state. */
+    if (r.h.al == 0x00) {
+        r.h.al = 0xff;
+        r.w.es = FP_SEG((void __far *)&tsr);
+        r.w.bx = FP_OFF((void __far *)&tsr);
+    }
+}
+
+/**
+ * Find the state of a resident copy of the player.
+ *
+ * \return
+ * Pointer to the resident state, or NULL if no copy is resident.
+ */
+static struct tsr_state far *
+tsr_find_resident(void)
+{
+    union REGS r;
+    struct SREGS s;
+
+    segread(&s);
+    r.h.ah = TSR_MUX_ID;
+    r.h.al = 0x00;
+    r.w.bx = 0;
+    int86x(0x2f, &r, &r, &s);
+
+    if (r.h.al != 0xff)
+        return NULL;
+
+    struct tsr_state far *const state = MK_FP(s.es, r.w.bx);
+
+    if (_fmemcmp(state->signature, tsr.signature, sizeof(tsr.signature)) != 0)
+        return NULL;
+
+    return state;
+}
+
+struct tsr_compiler {
+    /* Where the next event is written, or NULL when only counting. */
+    struct evq_event far *out;
+    uint16_t window;
+
+    uint32_t count;
+
+    /* The most recent write. It is not stored until all of the delay that
+     * follows it is known.
+     */
+    uint16_t port;
+    uint8_t value;
+    uint32_t delay;
+
+    /* Fractional PIT clocks, in units of 1/65536, not yet added to delay. */
+    uint16_t frac;
+};
+
+static void
+tsr_store(struct tsr_compiler *c, uint16_t delay, uint16_t port,
+          uint8_t value)
+{
+    c->count++;
+
+    if (c->out == NULL)
+        return;
+
+    if (c->window == 0) {
+        c->out = (struct evq_event far *) normalize_ptr(c->out, 0);
+        c->window = TSR_EVENT_WINDOW;
+    }
+
+    c->out->delay = delay;
+    c->out->port = port;
+    c->out->value = value;
+    c->out++;
+    c->window--;
+}
+
+/**
+ * Store the pending write and its delay.
+ *
+ * Delays too long to fit in one event are split into additional delay-only
+ * events.
+ */
+static void
+tsr_flush(struct tsr_compiler *c)
+{
+    uint16_t port = c->port;
+    uint8_t value = c->value;
+
+    do {
+        const uint16_t d = c->delay > TSR_MAX_DELAY
+            ? TSR_MAX_DELAY : (uint16_t) c->delay;
+
+        tsr_store(c, d, port, value);
+        c->delay -= d;
+        port = 0;
+        value = 0;
+    } while (c->delay != 0);
+}
+
+static void
+tsr_write(struct tsr_compiler *c, uint16_t port, uint8_t value)
+{
+    tsr_flush(c);
+    c->port = port;
+    c->value = value;
+}
+
+static void
+tsr_wait(struct tsr_compiler *c, uint16_t samples)
+{
+    /* There are 1193182 / 44100 = 27.05628 PIT clocks per 44.1kHz sample.
+     * 0.05628 * 65536 = 3688.
+     */
+    const uint32_t frac = (uint32_t) samples * 3688 + c->frac;
+
+    c->delay += (uint32_t) samples * 27 + (frac >> 16);
+    c->frac = frac & 0xffff;
+}
+
+static void
+tsr_speaker_start(struct tsr_compiler *c, unsigned freq)
+{
+    uint16_t period = 0xfffe & (0x1234dcUL / freq);
+
+    tsr_write(c, 0x43, 0xb6);
+    tsr_write(c, 0x42, period & 0x00ff);
+    tsr_write(c, 0x42, period >> 8);
+    tsr_write(c, TSR_SPEAKER_PORT, 0x03);
+}
+
+/**
+ * Convert the VGM command stream to a list of timed port writes.
+ *
+ * This is done once at load time so that the resident part of the player
+ * does not need to decode VGM data.
+ *
+ * \return
+ * True on success, false on a parse error.
+ */
+static bool
+tsr_compile(struct tsr_compiler *c, struct vgm_buf *v,
+            const struct vgm_header *header)
+{
+    /* AY-8910 channel A period */
+    uint16_t period = 0;
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        struct vgm_event e;
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_PSG_WRITE:
+            tsr_write(c, 0xc0, e.value);
+            break;
+
+        case VGM_EVENT_PSG2_WRITE:
+            if (psg2_port != 0)
+                tsr_write(c, psg2_port, e.value);
+
+            break;
+
+        case VGM_EVENT_WAIT:
+            tsr_wait(c, e.samples);
+            break;
+
+        case VGM_EVENT_AY8910_WRITE:
+            /* See play_Tandy_sound. */
+            if (e.reg == 0) {
+                period = (period & 0xff00) | e.value;
+            } else if (e.reg == 1) {
+                period = 0x0fff & ((period & 0x00ff) |
+                                   ((uint16_t)e.value << 8));
+                if (period != 0)
+                    tsr_speaker_start(c, header->ay8910_clock /
+                                      (16 * period));
+            } else if (e.reg == 7) {
+                if ((e.value & 1) != 0 && period != 0)
+                    tsr_speaker_start(c, header->ay8910_clock /
+                                      (16 * period));
+            } else if (e.reg == 8) {
+                if ((e.value & 1) == 0)
+                    tsr_write(c, TSR_SPEAKER_PORT, 0x00);
+            }
+
+            break;
+
+        case VGM_EVENT_SAA1099_WRITE:
+            if (cms_port != 0) {
+                const uint16_t port =
+                    cms_port + ((e.reg & 0x80) != 0 ? 2 : 0);
+
+                tsr_write(c, port + 1, e.reg & 0x1f);
+                tsr_write(c, port, e.value);
+            }
+
+            break;
+
+        case VGM_EVENT_OPL2_WRITE:
+        case VGM_EVENT_DATA_BLOCK:
+        case VGM_EVENT_CHIP_WRITE:
+            break;
+
+        case VGM_EVENT_END:
+            /* Silence the chips at the end so that the final delay is
+             * played out.
+             */
+            tsr_write(c, 0, 0);
+            tsr_flush(c);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+        }
+    }
+}
+
+/**
+ * Convert the VGM data to events, hook the timer, and terminate and stay
+ * resident.
+ *
+ * The VGM data is freed before going resident. Only the program image and
+ * the event list stay in memory.
+ *
+ * \return
+ * Only returns on failure.
+ */
+static void
+tsr_install(struct vgm_buf *v, const struct vgm_header *header)
+{
+    struct tsr_compiler c;
+
+    /* The first pass only counts events. */
+    memset(&c, 0, sizeof(c));
+    if (!tsr_compile(&c, v, header)) {
+        printf("parse error\n");
+        return;
+    }
+
+    const uint32_t count = c.count;
+    const uint32_t event_bytes = count * sizeof(struct evq_event);
+    struct evq_event far *const events =
+        (struct evq_event far *) far_alloc(event_bytes);
+
+    if (events == NULL) {
+        printf("Could not allocate %lu bytes for %lu events.\n",
+               (unsigned long) event_bytes, (unsigned long) count);
+        return;
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.out = events;
+    c.window = TSR_EVENT_WINDOW;
+    tsr_compile(&c, v, header);
+
+    _dos_freemem(FP_SEG(v->buffer));
+    v->buffer = NULL;
+
+    /* The environment is not needed by the resident copy. */
+    uint16_t far *const env_seg = MK_FP(_psp, 0x2c);
+    _dos_freemem(*env_seg);
+    *env_seg = 0;
+
+    /* Size of the memory block that holds the program image, from the DOS
+     * memory control block in the paragraph before the PSP.
+     */
+    const uint16_t program_paragraphs = *(uint16_t far *)MK_FP(_psp - 1, 3);
+    const uint32_t resident_bytes = ((uint32_t) program_paragraphs << 4) +
+        (((event_bytes + 15) >> 4) << 4);
+
+    printf("%lu events.\n"
+           "Resident size = %lu bytes (program %lu, events %lu).\n"
+           "Run \"vgmplay /unload\" to stop playback and free the memory.\n",
+           (unsigned long) count,
+           (unsigned long) resident_bytes,
+           (unsigned long) program_paragraphs << 4,
+           (unsigned long) event_bytes);
+
+    tsr.psp = _psp;
+    tsr.event_seg = FP_SEG(events);
+    tsr.next = events;
+    tsr.window = TSR_EVENT_WINDOW;
+    tsr.events_left = count;
+    tsr.due = 0;
+    tsr.bios_clocks = 0;
+    tsr.finished = false;
+    tsr.timer_isr = tsr_timer_isr;
+    tsr.mux_isr = (isr_ptr) tsr_mux_isr;
+    tsr.old_timer = _dos_getvect(0x08);
+    tsr.old_mux = _dos_getvect(0x2f);
+
+    _disable();
+    _dos_setvect(0x2f, tsr.mux_isr);
+    _dos_setvect(0x08, tsr.timer_isr);
+    outp(0x43, 0x34);
+    outp(0x40, TSR_PIT_DIVISOR & 0xff);
+    outp(0x40, TSR_PIT_DIVISOR >> 8);
+    _enable();
+
+    _dos_keep(0, program_paragraphs);
+}
+
+/**
+ * Stop and remove a resident copy of the player.
+ *
+ * \return
+ * Zero on success, non-zero on failure.
+ */
+static int
+tsr_uninstall(void)
+{
+    struct tsr_state far *const state = tsr_find_resident();
+
+    if (state == NULL) {
+        printf("VGMPLAY is not resident.\n");
+        return 1;
+    }
+
+    /* If some other program hooked either interrupt after the player, the
+     * vectors cannot be restored without breaking that program.
+     */
+    if (_dos_getvect(0x08) != state->timer_isr ||
+        _dos_getvect(0x2f) != state->mux_isr) {
+        printf("Another program has hooked the timer or multiplex "
+               "interrupt.\nUnload it first.\n");
+        return 1;
+    }
+
+    _disable();
+    state->finished = true;
+    outp(0x43, 0x36);
+    outp(0x40, 0x00);
+    outp(0x40, 0x00);
+    _dos_setvect(0x08, state->old_timer);
+    _dos_setvect(0x2f, state->old_mux);
+    _enable();
+
+    tsr_stop_sound();
+
+    _dos_freemem(state->event_seg);
+    _dos_freemem(state->psp);
+
+    printf("VGMPLAY unloaded.\n");
+    return 0;
+}
+
+static void
+show_help(const char *progname)
+{
+    printf("Usage: %s [options] filename.vgm\n"
+           "       %s [options] /bank:filename.vgb [track...]\n"
+           "       %s /unload\n"
+           "\n"
+           "Optional parameters:\n"
+           "    /delay:####:#### - specify delay loop control parameters. "
+           "The parameters\n"
            "                       are two numbers between 1 and 32767 "
            "(inclusive).\n"
            "                       /delay:27000:23895 works well on Tandy "
            "1000HX.\n"
+           "    /maxdrift:##.#   - exit with errorlevel 1 if the elapsed "
+           "play time differs\n"
+           "                       from the expected play time by more "
+           "than ##.# percent.\n"
+           "    /cms:###         - Play SAA1099 music on a CMS / Game "
+           "Blaster card at\n"
+           "                       the given base port (in hex, usually "
+           "220).\n"
+           "    /psg2:###        - Play Game Gear stereo and dual SN76489 "
+           "music with a\n"
+           "                       second SN76489 at the given port (in "
+           "hex) as the\n"
+           "                       right channel.\n"
+           "    /opl[:###]       - Play YM3812 music, and YM2413 music "
+           "translated at load\n"
+           "                       time, on an AdLib (or at the given port "
+           "in hex).\n"
+           "    /vol:##          - Change the volume by ## dB (-30 to 30) "
+           "in 2dB steps,\n"
+           "                       on top of the volume set in the file.\n"
+           "    /mute:#          - Silence a voice: 0 to 2 are the tone "
+           "voices, 3 is the\n"
+           "                       noise, and 4 is the PC speaker. May be "
+           "repeated.\n"
+           "    /solo:#          - Silence every voice except this one. "
+           "May be repeated.\n"
+           "    /loop:##         - Play the looped part of the track ## "
+           "more times (1 to\n"
+           "                       99).\n"
+           "    /tsr             - Play in the background and return to "
+           "DOS.\n"
+           "    /unload          - Stop background playback and free its "
+           "memory.\n"
+           "    /stream          - Read the file from start to end without "
+           "seeking, and\n"
+           "                       start playing before all of it is "
+           "read.\n"
+           "    /bank:file.vgb   - Play tracks from a VGM bank. The tracks are "
+           "given by\n"
+           "                       number, starting at 1. With no track "
+           "numbers, every\n"
+           "                       track is played in order.\n"
+           "    /fade:##         - Crossfade ## seconds (1 to 30) between "
+           "the tracks of a\n"
+           "                       bank on two SN76489s. Requires /psg2.\n"
+           "    /com:#           - Receive the VGM data from vgmsend on COM "
+           "port # (1 to 4)\n"
+           "                       instead of reading a file.\n"
+           "    /baud:#          - Bit rate for /com. The default is "
+           "115200.\n"
            "    /help            - Display this help message.\n"
            "\n"
            "Required parameter:\n"
-           "    filename.vgm - Uncompressed VGM file to be played.\n",
-           progname);
+           "    filename.vgm - Uncompressed VGM file to be played. Use - to "
+           "stream it\n"
+           "                   from standard input.\n",
+           progname, progname, progname);
+}
+
+/* Maximum allowed timing drift in tenths of a percent. Zero disables the
+ * check.
+ */
+static uint16_t max_drift_permille = 0;
+
+static bool tsr_mode = false;
+static bool tsr_unload = false;
+static bool stream_mode = false;
+static const char *bank_name = NULL;
+
+/* Length of the crossfade between the tracks of a bank, in samples, or zero
+ * to play the tracks one after another.
+ */
+static uint32_t fade_samples = 0;
+
+static int
+parse_args(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '/') {
+            if (strcmp(argv[i], "/help") == 0 ||
+                strcmp(argv[i], "/h") == 0 ||
+                strcmp(argv[i], "/?") == 0) {
+                return -1;
+            } else if (strncmp(argv[i], "/delay:", 7) == 0) {
+                unsigned long n = atol(&argv[i][7]);
+
+                char *next = strchr(&argv[i][7], ':');
+                if (next == NULL) {
+                    printf("Malformed parameter \"%s\".\n\n",
+                           argv[i]);
+                    return -1;
+                }
+
+                /* The +1 skips over the ':'. */
+                unsigned long d = atol(next + 1);
+
+                if (d == 0 || d > 0x7fff || n == 0 || n > 0x7fff) {
+                    printf("Each delay loop parameter must be in the range "
+                           "[1, 32767].\nGot %lu, %lu.\n\n",
+                           n, d);
+                    return -1;
+                }
+
+                set_delay_parameters(n, d);
+            } else if (strncmp(argv[i], "/maxdrift:", 10) == 0) {
+                /* The limit is given in percent with an optional single
+                 * decimal place.
+                 */
+                const char *p = &argv[i][10];
+                unsigned long permille = 10 * atol(p);
+
+                p = strchr(p, '.');
+                if (p != NULL && p[1] >= '0' && p[1] <= '9')
+                    permille += p[1] - '0';
+
+                if (permille == 0 || permille > 1000) {
+                    printf("Drift limit must be in the range (0, 100].\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][10]);
+                    return -1;
+                }
+
+                max_drift_permille = permille;
+            } else if (strcmp(argv[i], "/tsr") == 0) {
+                tsr_mode = true;
+            } else if (strncmp(argv[i], "/cms:", 5) == 0) {
+                cms_port = strtoul(&argv[i][5], NULL, 16);
+
+                if (cms_port < 0x100 || cms_port > 0x3fc) {
+                    printf("CMS port must be in the range [100, 3fc].\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][5]);
+                    return -1;
+                }
+            } else if (strncmp(argv[i], "/psg2:", 6) == 0) {
+                psg2_port = strtoul(&argv[i][6], NULL, 16);
+
+                if (psg2_port < 0x100 || psg2_port > 0x3ff) {
+                    printf("Second PSG port must be in the range "
+                           "[100, 3ff].\nGot \"%s\".\n\n",
+                           &argv[i][6]);
+                    return -1;
+                }
+            } else if (strcmp(argv[i], "/opl") == 0) {
+                opl_port = 0x388;
+            } else if (strncmp(argv[i], "/opl:", 5) == 0) {
+                opl_port = strtoul(&argv[i][5], NULL, 16);
+
+                if (opl_port < 0x100 || opl_port > 0x3fe) {
+                    printf("OPL port must be in the range [100, 3fe].\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][5]);
+                    return -1;
+                }
+            } else if (strncmp(argv[i], "/vol:", 5) == 0) {
+                const long db = strtol(&argv[i][5], NULL, 10);
+
+                if (db < -30 || db > 30) {
+                    printf("Volume must be in the range [-30, 30] dB.\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][5]);
+                    return -1;
+                }
+
+                volume_set_gain((int) db);
+            } else if (strncmp(argv[i], "/mute:", 6) == 0 ||
+                       strncmp(argv[i], "/solo:", 6) == 0) {
+                const char *const p = &argv[i][6];
+                const unsigned voice = *p - '0';
+
+                if (voice >= MUTE_VOICES || p[1] != '\0') {
+                    printf("Voice must be in the range [0, %u].\n"
+                           "Got \"%s\".\n\n",
+                           MUTE_VOICES - 1, p);
+                    return -1;
+                }
+
+                if (argv[i][1] == 'm')
+                    mute_voice(voice);
+                else
+                    solo_voice(voice);
+            } else if (strncmp(argv[i], "/loop:", 6) == 0) {
+                const unsigned long n = strtoul(&argv[i][6], NULL, 10);
+
+                if (n < 1 || n > 99) {
+                    printf("Loop count must be in the range [1, 99].\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][6]);
+                    return -1;
+                }
+
+                loop_count = (uint16_t) n;
+            } else if (strncmp(argv[i], "/bank:", 6) == 0) {
+                bank_name = &argv[i][6];
+            } else if (strncmp(argv[i], "/fade:", 6) == 0) {
+                const unsigned long n = strtoul(&argv[i][6], NULL, 10);
+
+                if (n < 1 || n > 30) {
+                    printf("Fade time must be in the range [1, 30].\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][6]);
+                    return -1;
+                }
+
+                fade_samples = n * 44100;
+            } else if (strncmp(argv[i], "/com:", 5) == 0) {
+                const unsigned long n = strtoul(&argv[i][5], NULL, 10);
+
+                if (n < 1 || n > 4) {
+                    printf("COM port must be in the range [1, 4].\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][5]);
+                    return -1;
+                }
+
+                com_port = (uint8_t) n;
+            } else if (strncmp(argv[i], "/baud:", 6) == 0) {
+                const unsigned long n = strtoul(&argv[i][6], NULL, 10);
+
+                if (n < 2 || n > SERIAL_MAX_BAUD ||
+                    SERIAL_MAX_BAUD % n != 0) {
+                    printf("Bit rate must evenly divide 115200.\n"
+                           "Got \"%s\".\n\n",
+                           &argv[i][6]);
+                    return -1;
+                }
+
+                com_baud = n;
+            } else if (strcmp(argv[i], "/stream") == 0) {
+                stream_mode = true;
+            } else if (strcmp(argv[i], "/unload") == 0) {
+                tsr_unload = true;
+                return 0;
+            } else {
+                printf("Unknown parameter \"%s\".\n\n",
+                       argv[i]);
+                return -1;
+            }
+        } else {
+            return i;
+        }
+    }
+
+    /* Track numbers are optional for a bank, and the VGM data of /com comes
+     * from the COM port.
+     */
+    if (bank_name != NULL || com_port != 0)
+        return argc;
+
+    /* No arguments left for the file name. Error. */
+    printf("VGM filename not specified.\n\n");
+    return -1;
+}
+
+/**
+ * Replace the VGM data with the output of a load-time pass.
+ *
+ * The pass runs once to size the output and again to write it. Both copies
+ * of the data are in memory until the second run finishes.
+ *
+ * \return
+ * False if the data could not be parsed or there is not enough memory.
+ */
+static bool
+run_pass(struct vgm_buf *v, vgm_pass_fn pass, struct vgm_header *header)
+{
+    const uint32_t data_start = header->vgm_data_offset + 0x34;
+    const uint32_t loop = header->loop_offset != 0
+        ? header->loop_offset + 0x1c - data_start : VGM_BUF_SIZE_UNKNOWN;
+    struct vgm_out o;
+
+    vgm_out_init(&o, NULL, loop);
+    if (!pass(&o, v, header)) {
+        printf("parse error\n");
+        return false;
+    }
+
+    uint8_t far *const out = far_alloc(o.size);
+    if (out == NULL) {
+        printf("Could not allocate %lu bytes of memory.\n",
+               (unsigned long) o.size);
+        return false;
+    }
+
+    vgm_out_init(&o, out, loop);
+    pass(&o, v, header);
+
+    _dos_freemem(FP_SEG(v->buffer));
+    vgm_buf_init(v, out, o.size);
+
+    if (header->loop_offset != 0)
+        header->loop_offset = o.loop_out + data_start - 0x1c;
+
+    return true;
+}
+
+/**
+ * Play one VGM file.
+ *
+ * \param fd File positioned at the start of the VGM header.
+ * \param base Offset of the VGM header in the file. Offsets in the header are
+ *             relative to it.
+ * \param length Length of the VGM file, or zero if it extends to the end of
+ *               the file.
+ *
+ * \return
+ * 1 if the timing drift exceeds the limit, or 0 otherwise.
+ */
+static int
+play_vgm(int fd, uint32_t base, uint32_t length)
+{
+    int ret = 0;
+    struct vgm_header header;
+    struct vgm_buf v;
+    struct loop_pin pin;
+
+    assert(sizeof(header) == 256);
+    v.buffer = NULL;
+    pin.buffer = NULL;
+
+    size_t bytes = com_port != 0
+        ? com_read_header(&header) : read(fd, &header, sizeof(header));
+    if (bytes == (size_t)-1 || bytes < sizeof(header)) {
+        printf("Could not read header from VGM file.\n"
+               "Error = %s.\n"
+               "Got %u bytes.\n",
+               strerror(errno),
+               bytes);
+        goto fail;
+    }
+
+    static const char ident[4] = { 'V', 'g', 'm', ' ' };
+    if (memcmp(header.ident, ident, sizeof(ident)) != 0) {
+        printf("Header identifier does not match expected value.\n");
+
+        if (header.ident[0] == (char)0x1f &&
+            header.ident[1] == (char)0x8b) {
+            printf("File appears to be GZIP data. This player cannot handle "
+                   "VGZ files.\n");
+        }
+
+        goto fail;
+    }
+
+    printf("header version = %x\n", header.version);
+
+    if (header.version < 0x150) {
+        printf("Header version too old. At least 150 is required.\n");
+        goto fail;
+    }
+
+    clear_old_fields(&header);
+
+    printf("SN76489 clock = %lu\n", (unsigned long)header.sn76489_clock);
+    printf("SN76489 feedback = 0x%x\n", header.sn76489_fb);
+    printf("SN76489 FSR width = %d\n", header.sn76489_fsr_width);
+    printf("SN76489 flags = 0x%x\n", header.sn76489_flags);
+
+    if (header.ay8910_clock != 0) {
+        printf("AY-8910 clock = %lu\n", (unsigned long)header.ay8910_clock);
+        printf("AY-8910 chip type = %d\n", header.ay8910_type);
+        printf("AY-8910 flags = 0x%02x 0x%02x 0x%02x\n",
+               header.ay8910_flags[0],
+               header.ay8910_flags[1],
+               header.ay8910_flags[2]);
+
+        /* The only VGM files that I have observed with this quirk are
+         * from the Tandy 1000 version of Castlevania.
+         */
+        printf("\nAY-8910 is assumed to be placeholder for PC speaker.\n");
+    }
+
+#define VALIDATE_CHIP(clk, name)					   \
+    do {								   \
+        if (header. clk != 0)						   \
+            printf("Sound chip %s not supported by this player.\n", name); \
+    } while (false)
+
+    if (opl_port == 0)
+        VALIDATE_CHIP(ym2314_clock, "YM2413");
+
+    VALIDATE_CHIP(ym2612_clock, "YM2612");
+    VALIDATE_CHIP(ym2151_clock, "YM2151");
+
+    if (header.version >= 0x151) {
+        VALIDATE_CHIP(sega_pcm_clock, "Sega PCM");
+        VALIDATE_CHIP(rf5c68_clock, "RF5C68");
+        VALIDATE_CHIP(ym2203_clock, "YM2203");
+        VALIDATE_CHIP(ym2608_clock, "YM2608");
+        VALIDATE_CHIP(ym2610_clock, "YM2610");
+        if (opl_port == 0)
+            VALIDATE_CHIP(ym3812_clock, "YM3812");
+        VALIDATE_CHIP(ym3526_clock, "YM3526");
+        VALIDATE_CHIP(y8950_clock, "Y8950");
+        VALIDATE_CHIP(ymf262_clock, "YMF262");
+        VALIDATE_CHIP(ymf278b_clock, "YMF278b");
+        VALIDATE_CHIP(ymf271_clock, "YMF271");
+        VALIDATE_CHIP(ymz280b_clock, "YMZ280b");
+        VALIDATE_CHIP(rf5c164_clock, "RF5C164");
+        VALIDATE_CHIP(pwm_clock, "PWM");
+    }
+
+    if (header.version >= 0x161) {
+        if (stream_mode) {
+            VALIDATE_CHIP(gb_dmg_clock, "Gameboy DMG");
+            VALIDATE_CHIP(nes_apu_clock, "NES APU");
+        }
+        VALIDATE_CHIP(multipcm_clock, "Multi PCM");
+        VALIDATE_CHIP(uPD7759_clock, "uPD7759");
+        VALIDATE_CHIP(okim6258_clock, "OKIM6258");
+        VALIDATE_CHIP(okim6295_clock, "OKIM6295");
+        VALIDATE_CHIP(k051649_clock, "K051649");
+        VALIDATE_CHIP(k054539_clock, "K054539");
+        VALIDATE_CHIP(HuC6280_clock, "HuC6280");
+        VALIDATE_CHIP(c140_clock, "C140");
+        VALIDATE_CHIP(k053260_clock, "K053260");
+        VALIDATE_CHIP(pokey_clock, "Pokey");
+        VALIDATE_CHIP(qsound_clock, "Qsound");
+    }
+
+    if (header.version >= 0x171) {
+        VALIDATE_CHIP(scsp_clock, "SCSP");
+        VALIDATE_CHIP(wonderswan_clock, "WonderSwan");
+        VALIDATE_CHIP(vsu_clock, "VSU");
+        if (cms_port == 0)
+            VALIDATE_CHIP(saa1099_clock, "SAA1099");
+        VALIDATE_CHIP(es5503_clock, "ES5503");
+        VALIDATE_CHIP(es5506_clock, "ES5506");
+        VALIDATE_CHIP(x1_010_clock, "X1-010");
+        VALIDATE_CHIP(c352_clock, "C352");
+        VALIDATE_CHIP(ga20_clock, "GA20");
+    }
+
+    if (header.version >= 0x172) {
+        VALIDATE_CHIP(mikey_clock, "Mikey");
+    }
+
+    if (stream_mode) {
+        if (opl_port != 0 && header.ym2314_clock != 0)
+            printf("YM2413 music cannot be translated while streaming.\n");
+
+        if (psg2_port != 0 && (header.sn76489_clock & 0x40000000) == 0)
+            printf("Stereo is not available while streaming.\n");
+
+        if (header.sn76489_clock != 0 &&
+            vgm_fsr_width(&header) != TANDY_FSR_WIDTH)
+            printf("Periodic noise is not corrected while streaming.\n");
+
+        if (psg2_port == 0 && (header.sn76489_clock & 0x40000000) != 0)
+            printf("The second PSG is not played while streaming.\n");
+
+        if (volume_steps(&header) != 0)
+            printf("The volume cannot be changed while streaming.\n");
+
+        if (mute_mask() != 0)
+            printf("Voices cannot be muted while streaming.\n");
+
+        if (com_port != 0 && !com_set_length(&header, bytes))
+            goto fail;
+
+        if (!stream_open(&v, &fd, &header, raw_header, bytes))
+            goto fail;
+    } else {
+        if (header.gd3_offset != 0)
+            dump_gd3(fd, base + header.gd3_offset + 0x14);
+
+        off_t end_pos = length != 0
+            ? (off_t)(base + length) : lseek(fd, 0, SEEK_END);
+        if (end_pos == (int32_t) -1)
+            goto fail;
+
+        off_t pos = lseek(fd, base + header.vgm_data_offset + 0x34,
+                          SEEK_SET);
+        if (pos == (off_t) -1)
+            goto fail;
+
+        off_t size = end_pos - pos;
+        uint8_t far *buffer = far_alloc(size);
+
+        /* The resident player needs all of the data in conventional
+         * memory.
+         */
+        if (buffer == NULL && !tsr_mode && flat_open(&v, fd, size))
+            goto loaded;
+
+        if (buffer == NULL) {
+            printf("Could not allocate %lu bytes of memory.\n",
+                   (unsigned long) size);
+            goto fail;
+        }
+
+        vgm_buf_init(&v, buffer, size);
+
+        if (far_read(fd, buffer, size) < size) {
+            printf("Unable to read %lu bytes from file.\n",
+                   (unsigned long) size);
+            goto fail;
+        }
+
+        if (opl_port != 0 && header.ym2314_clock != 0 &&
+            !run_pass(&v, opll_translate, &header))
+            goto fail;
+
+        /* Game Boy and NES music is played on the SN76489. */
+        if (header.version >= 0x161 && header.gb_dmg_clock != 0 &&
+            !run_pass(&v, gb_translate, &header))
+            goto fail;
+
+        if (header.version >= 0x161 && header.nes_apu_clock != 0 &&
+            !run_pass(&v, nes_translate, &header))
+            goto fail;
+
+        /* Without a second PSG, the voices of both chips share one. */
+        if (psg2_port == 0 && (header.sn76489_clock & 0x40000000) != 0 &&
+            !run_pass(&v, voice_merge, &header))
+            goto fail;
+
+        if (header.sn76489_clock != 0 &&
+            vgm_fsr_width(&header) != TANDY_FSR_WIDTH &&
+            !run_pass(&v, lfsr_remap, &header))
+            goto fail;
+
+        /* Muting comes before the stereo split so that both sides are
+         * muted.
+         */
+        if (mute_mask() != 0 && !run_pass(&v, mute_apply, &header))
+            goto fail;
+
+        /* Bit 30 of the clock means the file already uses two PSGs. */
+        if (psg2_port != 0 && (header.sn76489_clock & 0x40000000) == 0 &&
+            !run_pass(&v, gg_stereo_split, &header))
+            goto fail;
+
+        if (volume_steps(&header) != 0 &&
+            !run_pass(&v, volume_remap, &header))
+            goto fail;
+    }
+
+ loaded:
+    if (tsr_mode) {
+        close(fd);
+        tsr_install(&v, &header);
+        exit(-1);
+    }
+
+    uint32_t loop = loop_count != 0
+        ? loop_start(&header) : VGM_BUF_SIZE_UNKNOWN;
+    uint32_t total_samples = header.total_samples;
+
+    if (v.refill == NULL && loop >= v.size)
+        loop = VGM_BUF_SIZE_UNKNOWN;
+
+    if (loop != VGM_BUF_SIZE_UNKNOWN) {
+        if (v.refill != NULL && !loop_pin_open(&pin, &v, loop))
+            goto fail;
+
+        total_samples += loop_count * header.loop_samples;
+    }
+
+    if (adj_dn == 0)
+        calibrate_delay();
+
+    uint32_t expected_ms = (10 * total_samples) / 441;
+    printf("Expected play time = %lu.%03lus (%lu samples @ 44100Hz)\n",
+           expected_ms / 1000, expected_ms % 1000,
+           total_samples);
+
+    trace_begin();
+
+    uint32_t before = get_tick();
+    const unsigned loops = play_Tandy_sound(&v, &header, loop,
+                                            v.refill != NULL ? &pin : NULL);
+    uint32_t after = get_tick();
+
+    trace_end();
+
+    /* The drift is measured against the loops that were actually played. */
+    if (loop != VGM_BUF_SIZE_UNKNOWN && loops != loop_count) {
+        total_samples = header.total_samples + loops * header.loop_samples;
+        expected_ms = (10 * total_samples) / 441;
+        printf("Only %u of %u loops were played. Expected play time = "
+               "%lu.%03lus\n", loops, loop_count, expected_ms / 1000,
+               expected_ms % 1000);
+    }
+
+    /* One BIOS tick is 86400000 / 1573040 = 54.9254ms. Using 55ms would
+     * overstate the elapsed time by about 0.14%.
+     */
+    const uint32_t ticks = after - before;
+    uint32_t elapsed_ms = 55ul * ticks - (746ul * ticks) / 10000;
+    printf("Elapsed play time = %lu.%03lus (%lu ticks)\n",
+           elapsed_ms / 1000, elapsed_ms % 1000,
+           ticks);
+
+    /* Positive drift means that playback was too slow. The elapsed time is
+     * only known to within one tick, so short tracks will show some jitter.
+     */
+    const bool slow = elapsed_ms >= expected_ms;
+    const uint32_t drift_ms = slow
+        ? elapsed_ms - expected_ms : expected_ms - elapsed_ms;
+    const uint32_t drift_permille = expected_ms == 0
+        ? 0 : (1000 * drift_ms) / expected_ms;
+
+    printf("Timing drift = %c%lu.%03lus (%c%lu.%lu%%)\n",
+           slow ? '+' : '-', drift_ms / 1000, drift_ms % 1000,
+           slow ? '+' : '-', drift_permille / 10, drift_permille % 10);
+
+    if (max_drift_permille != 0 && drift_permille > max_drift_permille) {
+        printf("Timing drift exceeds the limit of %u.%u%%.\n",
+               max_drift_permille / 10, max_drift_permille % 10);
+        ret = 1;
+    }
+
+    /* A stream cannot seek back to a GD3 tag. Only one that follows the
+     * data can be shown, after playback.
+     */
+    if (stream_mode && header.gd3_offset != 0 &&
+        header.gd3_offset + 0x14 >= header.vgm_data_offset + 0x34) {
+        stream_dump_gd3(&v, header.gd3_offset + 0x14 -
+                        (header.vgm_data_offset + 0x34));
+    }
+
+ fail:
+    if (v.buffer != NULL)
+        _dos_freemem(FP_SEG(v.buffer));
+
+    if (pin.buffer != NULL)
+        _dos_freemem(FP_SEG(pin.buffer));
+
+    flat_free(&flat);
+
+    return ret;
+}
+
+/* Attenuation of a voice at each fade step. Each step is 2dB. */
+static uint8_t fade_ramp[16][16];
+
+/**
+ * A track of a bank that is crossfaded with the next one.
+ *
+ * Each track is read as a stream through its own file handle, so that two
+ * tracks can be read at the same time.
+ */
+struct fade_track {
+    int fd;
+    struct vgm_header header;
+    struct vgm_buf v;
+
+    /* SN76489 that the track is played on. */
+    uint16_t port;
+
+    /* Samples until the next command, and samples played so far. */
+    uint32_t wait;
+    uint32_t time;
+    bool done;
+
+    /* Registers of the track's SN76489, indexed by the register bits of a
+     * latch byte, and the latched register. latched is false once a fade
+     * step has moved the chip's latch somewhere else.
+     */
+    uint16_t regs[8];
+    uint8_t latch;
+    bool latched;
+
+    /* Fade step added to every attenuation. */
+    uint8_t fade;
+};
+
+static struct fade_track fade_tracks[2];
+
+/* Track that is playing and is faded out by the next one, or NULL. */
+static struct fade_track *fade_playing = NULL;
+
+/**
+ * Determine whether a track only uses a single SN76489.
+ *
+ * Other chips cannot be played by two tracks at once, and Game Boy and NES
+ * music needs the load-time translation.
+ */
+static bool
+fade_supported(const struct vgm_header *h)
+{
+    if (h->sn76489_clock == 0 || (h->sn76489_clock & 0x40000000) != 0 ||
+        h->ym2314_clock != 0 || h->ay8910_clock != 0)
+        return false;
+
+    if (h->version >= 0x151 && h->ym3812_clock != 0)
+        return false;
+
+    if (h->version >= 0x161 && (h->gb_dmg_clock != 0 ||
+                                h->nes_apu_clock != 0))
+        return false;
+
+    return h->version < 0x171 || h->saa1099_clock == 0;
+}
+
+static void
+fade_close(struct fade_track *t)
+{
+    if (t->v.buffer != NULL)
+        _dos_freemem(FP_SEG(t->v.buffer));
+
+    t->v.buffer = NULL;
+    close(t->fd);
+}
+
+/**
+ * Open a track of the bank. A track that can be crossfaded is opened as a
+ * stream.
+ */
+static bool
+fade_open(struct fade_track *t, const struct vgb_entry *e)
+{
+    static const char ident[4] = { 'V', 'g', 'm', ' ' };
+
+    t->v.buffer = NULL;
+    t->fd = open(bank_name, O_RDONLY | O_BINARY);
+    if (t->fd < 0) {
+        printf("Could not open file \"%s\".\n", bank_name);
+        return false;
+    }
+
+    const size_t bytes = lseek(t->fd, e->offset, SEEK_SET) == (off_t) -1
+        ? 0 : read(t->fd, &t->header, sizeof(t->header));
+
+    if (bytes == (size_t)-1 || bytes < sizeof(t->header) ||
+        memcmp(t->header.ident, ident, sizeof(ident)) != 0 ||
+        t->header.version < 0x150) {
+        printf("Could not read a VGM header for the track.\n");
+        fade_close(t);
+        return false;
+    }
+
+    clear_old_fields(&t->header);
+
+    if (!fade_supported(&t->header))
+        return true;
+
+    if (volume_steps(&t->header) != 0 || mute_mask() != 0 ||
+        vgm_fsr_width(&t->header) != TANDY_FSR_WIDTH)
+        printf("Load-time translations are not run on crossfaded "
+               "tracks.\n");
+
+    t->wait = 0;
+    t->time = 0;
+    t->done = false;
+    t->latch = 0;
+    t->latched = true;
+    t->fade = 0;
+
+    for (unsigned reg = 0; reg < 8; reg++)
+        t->regs[reg] = (reg & 1) != 0 ? 0x0f : 0;
+
+    if (!stream_open(&t->v, &t->fd, &t->header, raw_header, bytes)) {
+        fade_close(t);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Write a byte to a track's SN76489 with the fade applied.
+ */
+static void
+fade_write(struct fade_track *t, uint8_t value)
+{
+    uint16_t *const regs = t->regs;
+
+    if ((value & 0x80) != 0) {
+        t->latch = (value >> 4) & 7;
+        t->latched = true;
+        regs[t->latch] = (regs[t->latch] & ~0x000f) | (value & 0x0f);
+    } else {
+        const unsigned reg = t->latch;
+
+        /* A fade step wrote the attenuations since the file latched this
+         * register. Latch it again so that the data byte goes to it.
+         */
+        if (!t->latched) {
+            const uint8_t low = (reg & 1) != 0
+                ? fade_ramp[t->fade][regs[reg]] : regs[reg] & 0x0f;
+
+            outp(t->port, 0x80 | (reg << 4) | low);
+            t->latched = true;
+        }
+
+        if ((reg & 1) == 0 && reg != 6)
+            regs[reg] = (regs[reg] & 0x000f) |
+                ((uint16_t)(value & 0x3f) << 4);
+        else
+            regs[reg] = value & 0x0f;
+    }
+
+    if ((t->latch & 1) != 0)
+        value = (value & 0xf0) | fade_ramp[t->fade][regs[t->latch]];
+
+    outp(t->port, value);
+}
+
+/**
+ * Move a track to a fade step, and write every attenuation that it changes.
+ */
+static void
+fade_step(struct fade_track *t, uint8_t fade)
+{
+    if (t->fade == fade)
+        return;
+
+    t->fade = fade;
+
+    for (unsigned voice = 0; voice < 4; voice++) {
+        outp(t->port, 0x90 | (voice << 5) |
+             fade_ramp[fade][t->regs[voice * 2 + 1]]);
+    }
+
+    t->latched = false;
 }
 
-static int
-parse_args(int argc, char **argv)
+static void
+fade_event(struct fade_track *t)
 {
-    for (int i = 1; i < argc; i++) {
-        if (argv[i][0] == '/') {
-            if (strcmp(argv[i], "/help") == 0 ||
-                strcmp(argv[i], "/h") == 0 ||
-                strcmp(argv[i], "/?") == 0) {
-                return -1;
-            } else if (strncmp(argv[i], "/delay:", 7) == 0) {
-                unsigned long n = atol(&argv[i][7]);
+    struct vgm_event e;
+
+    switch (vgm_next_event(&t->v, &e)) {
+    case VGM_EVENT_PSG_WRITE:
+        fade_write(t, e.value);
+        break;
+
+    case VGM_EVENT_WAIT:
+        t->wait = e.samples;
+        break;
+
+    case VGM_EVENT_END:
+        t->done = true;
+        break;
+
+    case VGM_EVENT_ERROR:
+        printf("command = 0x%02x\n", (unsigned) e.command);
+        printf("parse error\n");
+        t->done = true;
+        break;
+
+    default:
+        /* Game Gear stereo and data blocks. */
+        break;
+    }
+}
 
-                char *next = strchr(&argv[i][7], ':');
-                if (next == NULL) {
-                    printf("Malformed parameter \"%s\".\n\n",
-                           argv[i]);
-                    return -1;
-                }
+/**
+ * Play a track to its end while the next track fades in over its last
+ * fade_samples samples.
+ *
+ * The commands of the two tracks are interleaved by time in a single decode
+ * loop. The fade is 15 steps of 2dB, at times worked out before the fade
+ * starts. Only the attenuation writes of each track are changed, and each
+ * fade step rewrites the four attenuations of both chips.
+ *
+ * \param b Track to fade in on the other chip, or NULL to just play \c a.
+ */
+static void
+fade_play(struct fade_track *a, struct fade_track *b)
+{
+    const uint32_t left = a->header.total_samples > a->time
+        ? a->header.total_samples - a->time : 0;
+    const uint32_t window = left < fade_samples ? left : fade_samples;
+    uint32_t step_at[16];
+    unsigned step = 0;
+    uint32_t now = 0;
+
+    for (unsigned i = 0; i < 16; i++)
+        step_at[i] = left - window + (window * i) / 15;
+
+    if (b != NULL) {
+        /* The incoming track starts out silent. */
+        b->wait = step_at[0];
+        b->fade = 15;
+    }
 
-                /* The +1 skips over the ':'. */
-                unsigned long d = atol(next + 1);
+    if (adj_dn == 0)
+        calibrate_delay();
 
-                if (d == 0 || d > 0x7fff || n == 0 || n > 0x7fff) {
-                    printf("Each delay loop parameter must be in the range "
-                           "[1, 32767].\nGot %lu, %lu.\n\n",
-                           n, d);
-                    return -1;
-                }
+    while (!a->done) {
+        if (a->wait == 0) {
+            fade_event(a);
+            continue;
+        }
 
-                set_delay_parameters(n, d);
-            } else {
-                printf("Unknown parameter \"%s\".\n\n",
-                       argv[i]);
-                return -1;
-            }
-        } else {
-            return i;
+        const bool b_on = b != NULL && !b->done;
+
+        if (b_on && b->wait == 0) {
+            fade_event(b);
+            continue;
+        }
+
+        /* Both tracks are waiting. Wait until the first one has a command,
+         * or the next fade step.
+         */
+        uint32_t n = a->wait;
+
+        if (b_on && b->wait < n)
+            n = b->wait;
+
+        if (b != NULL && step < 15 && step_at[step + 1] - now < n)
+            n = step_at[step + 1] - now;
+
+        if (n > 0xffff)
+            n = 0xffff;
+
+        if (n != 0)
+            wait_44khz((uint16_t) n);
+
+        a->wait -= n;
+        a->time += n;
+
+        if (b_on) {
+            b->wait -= n;
+            if (now >= step_at[0])
+                b->time += n;
+        }
+
+        now += n;
+
+        if (b != NULL && step < 15 && now >= step_at[step + 1]) {
+            while (step < 15 && now >= step_at[step + 1])
+                step++;
+
+            fade_step(a, step);
+            fade_step(b, 15 - step);
         }
     }
 
-    /* No arguments left for the file name. Error. */
-    printf("VGM filename not specified.\n\n");
-    return -1;
+    psg_off(a->port);
+
+    /* The outgoing track may end before its header says it will. */
+    if (b != NULL)
+        fade_step(b, 0);
 }
 
-int
-main(int argc, char **argv)
+/**
+ * Play the rest of the track that is playing, if there is one.
+ */
+static void
+fade_finish(void)
 {
-    int filename_idx = parse_args(argc, argv);
-    if (filename_idx < 0) {
-        show_help(argv[0]);
+    if (fade_playing == NULL)
+        return;
+
+    fade_play(fade_playing, NULL);
+    fade_close(fade_playing);
+    fade_playing = NULL;
+}
+
+/**
+ * Play a track of a bank with a crossfade from the track before it.
+ *
+ * A track only starts to play when the next track is opened, since it
+ * fades out into that one. Tracks that use anything other than a single
+ * SN76489 are played as usual, after the track before them ends.
+ */
+static int
+fade_track(int fd, const struct vgb_entry *e)
+{
+    struct fade_track *const prev = fade_playing;
+    struct fade_track *const t =
+        prev == &fade_tracks[0] ? &fade_tracks[1] : &fade_tracks[0];
+
+    if (prev == NULL) {
+        for (unsigned fade = 0; fade < 16; fade++) {
+            for (unsigned atten = 0; atten < 16; atten++) {
+                fade_ramp[fade][atten] =
+                    fade + atten < 15 ? fade + atten : 15;
+            }
+        }
+    }
+
+    if (!fade_open(t, e))
         return -1;
+
+    if (!fade_supported(&t->header)) {
+        fade_close(t);
+        fade_finish();
+        return play_vgm(fd, e->offset, e->length);
     }
 
-    struct vgm_header header;
-    assert(sizeof(header) == 256);
-    int fd = open(argv[filename_idx], O_RDONLY | O_BINARY);
+    /* The tracks take turns on the two chips. */
+    t->port = prev != NULL && prev->port == 0xc0 ? psg2_port : 0xc0;
+
+    if (prev != NULL) {
+        fade_play(prev, t);
+        fade_close(prev);
+    }
+
+    fade_playing = t;
+    return 0;
+}
 
+/**
+ * Play tracks from a VGM bank.
+ *
+ * The table of contents is read once and kept in memory, so each track
+ * after the first costs a single seek.
+ *
+ * \param tracks Track numbers (starting at 1) as strings. If there are none,
+ *               every track is played.
+ */
+static int
+play_bank(int num_tracks, char **tracks)
+{
+    int fd = open(bank_name, O_RDONLY | O_BINARY);
     if (fd < 0) {
-        printf("Could not open file \"%s\".\n", argv[filename_idx]);
+        printf("Could not open file \"%s\".\n", bank_name);
         return -1;
     }
 
-    size_t bytes = read(fd, &header, sizeof(header));
-    if (bytes == (size_t)-1 || bytes < sizeof(header)) {
-        printf("Could not read header from VGM file.\n"
-               "Error = %s.\n"
-               "Got %u bytes.\n",
-               strerror(errno),
-               bytes);
-        goto fail;
+    struct vgb_header bh;
+    static const char ident[4] = { 'V', 'g', 'b', ' ' };
+
+    size_t bytes = read(fd, &bh, sizeof(bh));
+    if (bytes != sizeof(bh) || memcmp(bh.ident, ident, sizeof(ident)) != 0) {
+        printf("\"%s\" is not a VGM bank.\n", bank_name);
+        close(fd);
+        return -1;
     }
 
-    static const char ident[4] = { 'V', 'g', 'm', ' ' };
-    if (memcmp(header.ident, ident, sizeof(ident)) != 0) {
-        printf("Header identifier does not match expected value.\n");
+    if (bh.version != VGB_VERSION || bh.count > VGB_MAX_TRACKS) {
+        printf("Unsupported VGM bank version %x.\n", bh.version);
+        close(fd);
+        return -1;
+    }
 
-        if (header.ident[0] == (char)0x1f &&
-            header.ident[1] == (char)0x8b) {
-            printf("File appears to be GZIP data. This player cannot handle "
-                   "VGZ files.\n");
-        }
+    const size_t toc_bytes = bh.count * sizeof(struct vgb_entry);
+    struct vgb_entry *toc = malloc(toc_bytes);
 
-        goto fail;
+    if (toc != NULL)
+        bytes = read(fd, toc, toc_bytes);
+
+    if (toc == NULL || bytes != toc_bytes) {
+        printf("Could not read the table of contents.\n");
+        free(toc);
+        close(fd);
+        return -1;
     }
 
-    printf("header version = %x\n", header.version);
+    const unsigned count = num_tracks == 0 ? bh.count : num_tracks;
 
-    if (header.version < 0x150) {
-        printf("Header version too old. At least 150 is required.\n");
-        goto fail;
+    if (tsr_mode && count > 1) {
+        printf("/tsr can only play a single track.\n");
+        free(toc);
+        close(fd);
+        return -1;
     }
 
-    if (header.version < 0x151) {
-        header.sn76489_flags = 0;
-        header.ay8910_clock = 0;
-    }
+    int ret = 0;
 
-    printf("SN76489 clock = %lu\n", (unsigned long)header.sn76489_clock);
-    printf("SN76489 feedback = 0x%x\n", header.sn76489_fb);
-    printf("SN76489 FSR width = %d\n", header.sn76489_fsr_width);
-    printf("SN76489 flags = 0x%x\n", header.sn76489_flags);
+    for (unsigned i = 0; i < count; i++) {
+        const unsigned t = num_tracks == 0 ? i + 1 : atoi(tracks[i]);
 
-    if (header.ay8910_clock != 0) {
-        printf("AY-8910 clock = %lu\n", (unsigned long)header.ay8910_clock);
-        printf("AY-8910 chip type = %d\n", header.ay8910_type);
-        printf("AY-8910 flags = 0x%02x 0x%02x 0x%02x\n",
-               header.ay8910_flags[0],
-               header.ay8910_flags[1],
-               header.ay8910_flags[2]);
+        if (t < 1 || t > bh.count) {
+            printf("Track \"%s\" is not in the range [1, %u].\n",
+                   tracks[i], bh.count);
+            ret = -1;
+            continue;
+        }
 
-        /* The only VGM files that I have observed with this quirk are
-         * from the Tandy 1000 version of Castlevania.
-         */
-        printf("\nAY-8910 is assumed to be placeholder for PC speaker.\n");
-    }
+        const struct vgb_entry *const e = &toc[t - 1];
 
-#define VALIDATE_CHIP(clk, name)					   \
-    do {								   \
-        if (header. clk != 0)						   \
-            printf("Sound chip %s not supported by this player.\n", name); \
-    } while (false)
+        printf("\nTrack %u of %u: %.*s\n", t, bh.count,
+               VGB_TITLE_SIZE, e->title);
 
-    VALIDATE_CHIP(ym2612_clock, "YM2612");
-    VALIDATE_CHIP(ym2151_clock, "YM2151");
+        if (lseek(fd, e->offset, SEEK_SET) == (off_t) -1) {
+            printf("Could not seek to track %u.\n", t);
+            ret = -1;
+            continue;
+        }
 
-    if (header.version >= 0x151) {
-        VALIDATE_CHIP(sega_pcm_clock, "Sega PCM");
-        VALIDATE_CHIP(rf5c68_clock, "RF5C68");
-        VALIDATE_CHIP(ym2203_clock, "YM2203");
-        VALIDATE_CHIP(ym2608_clock, "YM2608");
-        VALIDATE_CHIP(ym2610_clock, "YM2610");
-        VALIDATE_CHIP(ym3812_clock, "YM3812");
-        VALIDATE_CHIP(ym3526_clock, "YM3526");
-        VALIDATE_CHIP(y8950_clock, "Y8950");
-        VALIDATE_CHIP(ymf262_clock, "YMF262");
-        VALIDATE_CHIP(ymf278b_clock, "YMF278b");
-        VALIDATE_CHIP(ymf271_clock, "YMF271");
-        VALIDATE_CHIP(ymz280b_clock, "YMZ280b");
-        VALIDATE_CHIP(rf5c164_clock, "RF5C164");
-        VALIDATE_CHIP(pwm_clock, "PWM");
+        const int r = fade_samples != 0
+            ? fade_track(fd, e) : play_vgm(fd, e->offset, e->length);
+        if (r != 0 && ret == 0)
+            ret = r;
     }
 
-    if (header.version >= 0x161) {
-        VALIDATE_CHIP(gb_dmg_clock, "Gameboy DMG");
-        VALIDATE_CHIP(nes_apu_clock, "NES APU");
-        VALIDATE_CHIP(multipcm_clock, "Multi PCM");
-        VALIDATE_CHIP(uPD7759_clock, "uPD7759");
-        VALIDATE_CHIP(okim6258_clock, "OKIM6258");
-        VALIDATE_CHIP(okim6295_clock, "OKIM6295");
-        VALIDATE_CHIP(k051649_clock, "K051649");
-        VALIDATE_CHIP(k054539_clock, "K054539");
-        VALIDATE_CHIP(HuC6280_clock, "HuC6280");
-        VALIDATE_CHIP(c140_clock, "C140");
-        VALIDATE_CHIP(k053260_clock, "K053260");
-        VALIDATE_CHIP(pokey_clock, "Pokey");
-        VALIDATE_CHIP(qsound_clock, "Qsound");
+    fade_finish();
+
+    free(toc);
+    close(fd);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    int filename_idx = parse_args(argc, argv);
+    if (filename_idx < 0) {
+        show_help(argv[0]);
+        return -1;
     }
 
-    if (header.version >= 0x171) {
-        VALIDATE_CHIP(scsp_clock, "SCSP");
-        VALIDATE_CHIP(wonderswan_clock, "WonderSwan");
-        VALIDATE_CHIP(vsu_clock, "VSU");
-        VALIDATE_CHIP(saa1099_clock, "SAA1099");
-        VALIDATE_CHIP(es5503_clock, "ES5503");
-        VALIDATE_CHIP(es5506_clock, "ES5506");
-        VALIDATE_CHIP(x1_010_clock, "X1-010");
-        VALIDATE_CHIP(c352_clock, "C352");
-        VALIDATE_CHIP(ga20_clock, "GA20");
+    if (tsr_unload)
+        return tsr_uninstall();
+
+    if (tsr_mode && tsr_find_resident() != NULL) {
+        printf("VGMPLAY is already resident. Run \"%s /unload\" first.\n",
+               argv[0]);
+        return -1;
     }
 
-    if (header.version >= 0x172) {
-        VALIDATE_CHIP(mikey_clock, "Mikey");
+    if (loop_count != 0 && tsr_mode) {
+        printf("/loop cannot be used with /tsr.\n");
+        return -1;
     }
 
-    if (header.gd3_offset != 0)
-        dump_gd3(fd, header.gd3_offset + 0x14);
+    if (opl_port != 0 && tsr_mode) {
+        printf("/opl cannot be used with /tsr.\n");
+        return -1;
+    }
 
+    if (fade_samples != 0) {
+        if (bank_name == NULL) {
+            printf("/fade can only be used with /bank.\n");
+            return -1;
+        }
 
-    off_t end_pos = lseek(fd, 0, SEEK_END);
-    if (end_pos == (int32_t) -1)
-        goto fail;
+        if (psg2_port == 0) {
+            printf("/fade needs a second SN76489 (/psg2).\n");
+            return -1;
+        }
 
-    off_t pos = lseek(fd, header.vgm_data_offset + 0x34, SEEK_SET);
-    if (pos == (off_t) -1)
-        goto fail;
+        if (loop_count != 0) {
+            printf("/loop cannot be used with /fade.\n");
+            return -1;
+        }
 
-    off_t size = end_pos - pos;
-    if (size >= 0xffffUL) {
-        printf("Files larger than 64k are not yet supported.\n");
-        goto fail;
+        if (tsr_mode) {
+            printf("/fade cannot be used with /tsr.\n");
+            return -1;
+        }
     }
 
-    uint8_t far *buffer = _fmalloc(size);
-    if (buffer == NULL) {
-        printf("Could not allocate %lu bytes of memory.\n",
-               (unsigned long) size);
-        goto fail;
+    if (com_port != 0) {
+        if (tsr_mode) {
+            printf("/com cannot be used with /tsr.\n");
+            return -1;
+        }
+
+        if (bank_name != NULL) {
+            printf("/com cannot be used with /bank.\n");
+            return -1;
+        }
+
+        if (!serial_open(com_port, com_baud))
+            return -1;
+
+        stream_mode = true;
+
+        const int ret = play_vgm(-1, 0, 0);
+        struct serial_stats stats;
+
+        serial_close();
+        serial_stats(&stats);
+
+        printf("Most bytes waiting = %u, dropped bytes = %u, line "
+               "errors = %u\n", stats.high_water, stats.overflows,
+               stats.line_errors);
+
+        return ret;
     }
 
-    if (far_read(fd, buffer, size) < size) {
-        printf("Unable to read %lu bytes from file.\n",
-               (unsigned long) size);
-        goto fail;
+    if (bank_name != NULL) {
+        if (stream_mode) {
+            printf("/stream cannot be used with /bank.\n");
+            return -1;
+        }
+
+        return play_bank(argc - filename_idx, argv + filename_idx);
     }
 
-    struct vgm_buf v = { buffer, size, 0 };
+    const bool from_stdin = strcmp(argv[filename_idx], "-") == 0;
+    int fd;
 
-    if (adj_dn == 0)
-        calibrate_delay();
+    if (from_stdin) {
+        stream_mode = true;
+        fd = STDIN_FILENO;
+        setmode(fd, O_BINARY);
+    } else {
+        fd = open(argv[filename_idx], O_RDONLY | O_BINARY);
+    }
 
-    uint32_t expected_ms = (10 * header.total_samples) / 441;
-    printf("Expected play time = %lu.%03lus (%lu samples @ 44100Hz)\n",
-           expected_ms / 1000, expected_ms % 1000,
-           header.total_samples);
+    if (stream_mode && tsr_mode) {
+        printf("/tsr cannot be used with streaming input.\n");
+        return -1;
+    }
 
-    uint32_t before = get_tick();
-    play_Tandy_sound(&v, &header);
-    uint32_t after = get_tick();
+    if (fd < 0) {
+        printf("Could not open file \"%s\".\n", argv[filename_idx]);
+        return -1;
+    }
 
-    uint32_t elapsed_ms = 55ul * (after - before);
-    printf("Elapsed play time = %lu.%03lus (%lu ticks)\n",
-           elapsed_ms / 1000, elapsed_ms % 1000,
-           after - before);
+    const int ret = play_vgm(fd, 0, 0);
 
- fail:
-    close(fd);
-    return 0;
+    if (!from_stdin)
+        close(fd);
+
+    return ret;
 }
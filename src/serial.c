@@ -0,0 +1,175 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stdio.h>
+#include <i86.h>
+#include <dos.h>
+#include <conio.h>
+#include "serial.h"
+#include "link.h"
+
+/* UART registers, relative to the base port. */
+#define UART_DATA 0     /* RBR / THR, or the divisor low byte */
+#define UART_IER  1     /* Interrupt enable, or the divisor high byte */
+#define UART_FCR  2     /* FIFO control (write) / interrupt ID (read) */
+#define UART_IIR  2
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+
+#define LSR_DATA_READY 0x01
+#define LSR_ERRORS     0x0e     /* Overrun, parity, and framing errors. */
+#define LSR_THR_EMPTY  0x20
+
+#define LCR_8N1  0x03
+#define LCR_DLAB 0x80
+
+/* DTR and RTS, so that the other end sees the port as ready, and OUT2,
+ * which connects the UART's interrupt line to the PIC on a PC.
+ */
+#define MCR_DTR_RTS_OUT2 0x0b
+
+typedef void (__interrupt __far *isr_ptr)();
+
+static struct link_ring ring;
+
+static uint16_t base = 0;
+static uint8_t irq;
+static isr_ptr old_isr;
+static uint16_t line_errors;
+
+/**
+ * UART interrupt handler. Only the received data interrupt is enabled.
+ *
+ * Everything in the UART's FIFO is taken, so a 16550 interrupts once for
+ * every few bytes.
+ */
+static void __interrupt __far
+serial_isr(void)
+{
+    uint8_t lsr;
+
+    while (((lsr = inp(base + UART_LSR)) & LSR_DATA_READY) != 0) {
+        if ((lsr & LSR_ERRORS) != 0)
+            line_errors++;
+
+        link_ring_put(&ring, inp(base + UART_DATA));
+    }
+
+    outp(0x20, 0x20);
+}
+
+static void
+serial_send(uint8_t value)
+{
+    while ((inp(base + UART_LSR) & LSR_THR_EMPTY) == 0)
+        /* empty */ ;
+
+    outp(base + UART_DATA, value);
+}
+
+bool
+serial_open(unsigned com, uint32_t baud)
+{
+    /* The BIOS stores the base port of each COM port it found. */
+    const uint16_t port = *(const uint16_t far *)MK_FP(0x40, 2 * (com - 1));
+
+    if (port == 0) {
+        printf("COM%u is not installed.\n", com);
+        return false;
+    }
+
+    const uint16_t divisor = (uint16_t)(SERIAL_MAX_BAUD / baud);
+
+    base = port;
+    irq = (com & 1) != 0 ? 4 : 3;
+    line_errors = 0;
+    link_ring_init(&ring);
+
+    outp(base + UART_IER, 0x00);
+    outp(base + UART_LCR, LCR_DLAB);
+    outp(base + UART_DATA, divisor & 0xff);
+    outp(base + UART_IER, divisor >> 8);
+    outp(base + UART_LCR, LCR_8N1);
+
+    /* Enable and clear the FIFO, with an interrupt at 8 bytes. Only a
+     * 16550A reports both FIFO bits set. The FIFO of the original 16550
+     * does not work, and an 8250 or 16450 has none.
+     */
+    outp(base + UART_FCR, 0x87);
+    if ((inp(base + UART_IIR) & 0xc0) != 0xc0)
+        outp(base + UART_FCR, 0x00);
+
+    /* Throw away anything that arrived before the port was set up. */
+    while ((inp(base + UART_LSR) & LSR_DATA_READY) != 0)
+        inp(base + UART_DATA);
+
+    old_isr = _dos_getvect(8 + irq);
+
+    _disable();
+    _dos_setvect(8 + irq, serial_isr);
+    outp(base + UART_MCR, MCR_DTR_RTS_OUT2);
+    outp(base + UART_IER, 0x01);
+    outp(0x21, inp(0x21) & ~(1 << irq));
+    _enable();
+
+    printf("Waiting for data on COM%u (port %x) at %lu baud. Press Esc to "
+           "stop.\n", com, base, (unsigned long) baud);
+
+    serial_send(LINK_READY);
+    return true;
+}
+
+void
+serial_close(void)
+{
+    if (base == 0)
+        return;
+
+    _disable();
+    outp(0x21, inp(0x21) | (1 << irq));
+    outp(base + UART_IER, 0x00);
+    outp(base + UART_MCR, 0x00);
+    _dos_setvect(8 + irq, old_isr);
+    _enable();
+
+    base = 0;
+}
+
+void
+serial_stats(struct serial_stats *s)
+{
+    s->high_water = ring.high_water;
+    s->overflows = ring.overflows;
+    s->line_errors = line_errors;
+}
+
+uint16_t
+serial_refill(void *ctx, uint8_t far *dst, uint16_t max)
+{
+    uint32_t *const left = ctx;
+    uint16_t n;
+
+    if (*left < max)
+        max = (uint16_t) *left;
+
+    if (max == 0)
+        return 0;
+
+    while ((n = link_ring_get(&ring, dst, max)) == 0) {
+        if (kbhit() && getch() == 27) {
+            printf("Stopped waiting for data.\n");
+            *left = 0;
+            return 0;
+        }
+    }
+
+    *left -= n;
+
+    for (uint16_t acks = link_ring_acks(&ring); acks > 0; acks--)
+        serial_send(LINK_ACK);
+
+    return n;
+}
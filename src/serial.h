@@ -0,0 +1,70 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_buf.h"
+
+/**
+ * \file
+ * Interrupt-driven reception of VGM data from a COM port.
+ *
+ * Received bytes go into a \c link_ring, and are read back through a stream
+ * refill function. See link.h for the protocol. Only one port can be open at
+ * a time.
+ */
+
+/* Fastest rate of the UART. Every rate is this divided by a whole number. */
+#define SERIAL_MAX_BAUD 115200ul
+
+/**
+ * Statistics of the link, reported after playback.
+ */
+struct serial_stats {
+    /** Most bytes that were ever waiting in the ring. */
+    uint16_t high_water;
+
+    /** Bytes dropped because the ring was full. */
+    uint16_t overflows;
+
+    /** Bytes received with an overrun, parity, or framing error. */
+    uint16_t line_errors;
+};
+
+/**
+ * Set up a COM port, hook its interrupt, and tell the sender to start.
+ *
+ * \param com COM port number, from 1 to 4. The I/O port comes from the BIOS.
+ * \param baud Bit rate. Must evenly divide \c SERIAL_MAX_BAUD.
+ *
+ * \return
+ * False if the port is not installed. The reason is printed.
+ */
+bool serial_open(unsigned com, uint32_t baud);
+
+/**
+ * Unhook the interrupt and turn off the UART. Nothing happens if no port is
+ * open.
+ */
+void serial_close(void);
+
+void serial_stats(struct serial_stats *s);
+
+/**
+ * Stream refill function that reads received bytes.
+ *
+ * Waits until at least one byte has arrived, and sends an acknowledgement
+ * for each \c LINK_ACK_BYTES bytes read. Pressing Esc while waiting ends the
+ * stream.
+ *
+ * \c ctx must be a \c uint32_t that holds the number of bytes left in the
+ * stream. The stream ends when it reaches zero.
+ */
+uint16_t serial_refill(void *ctx, uint8_t far *dst, uint16_t max);
+
+#endif /* ifndef SERIAL_H */
@@ -0,0 +1,301 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stdio.h>
+#include <i86.h>
+#include <dos.h>
+#include "unreal.h"
+
+/* The player is built for the 8088, so the in-line assembler does not accept
+ * 386 instructions. Those are spelled out as bytes, with the instruction in
+ * a comment.
+ */
+
+/**
+ * Read back FLAGS after trying to set bits 12 through 14.
+ *
+ * Bits 12 through 15 are always set on an 8086 and always clear on a 286 in
+ * real mode. Only a 386 or later lets bits 12 through 14 be set.
+ */
+uint16_t flags_probe(void);
+#pragma aux flags_probe = \
+    "pushf" \
+    "pop bx" \
+    "mov ax, bx" \
+    "or ax, 7000h" \
+    "push ax" \
+    "popf" \
+    "pushf" \
+    "pop ax" \
+    "push bx" \
+    "popf" \
+    value [ax] \
+    modify [bx];
+
+/**
+ * Read the machine status word. Bit 0 is set in virtual 8086 mode.
+ */
+uint16_t machine_status(void);
+#pragma aux machine_status = \
+    0x0f 0x01 0xe0              /* smsw ax */ \
+    value [ax];
+
+/**
+ * Call the XMS driver.
+ *
+ * \return
+ * DX in the upper 16 bits and AX in the lower 16 bits.
+ */
+uint32_t xms_call(uint16_t ax, uint16_t dx, void far *entry);
+#pragma aux xms_call = \
+    "push bp" \
+    "push es" \
+    "push bx" \
+    "mov bp, sp" \
+    "call dword ptr [bp]" \
+    "add sp, 4" \
+    "pop bp" \
+    parm [ax] [dx] [es bx] \
+    value [dx ax] \
+    modify [bx];
+
+/**
+ * Lock an XMS block.
+ *
+ * \return
+ * The linear address of the block, or zero on failure.
+ */
+uint32_t xms_lock(uint16_t handle, void far *entry);
+#pragma aux xms_lock = \
+    "push bp" \
+    "push es" \
+    "push bx" \
+    "mov bp, sp" \
+    "mov ah, 0ch" \
+    "call dword ptr [bp]" \
+    "add sp, 4" \
+    "pop bp" \
+    "neg ax" \
+    "and bx, ax" \
+    "and dx, ax" \
+    "mov ax, bx" \
+    parm [dx] [es bx] \
+    value [dx ax] \
+    modify [bx];
+
+/**
+ * Give DS and ES a 4GB limit.
+ *
+ * Selector 8 of the GDT is loaded into both while in protected mode. Back in
+ * real mode, their old values are restored, which resets the bases but not
+ * the limits. The jumps flush the prefetch queue after each mode switch.
+ */
+void enter_unreal(const void *gdtr);
+#pragma aux enter_unreal = \
+    "pushf" \
+    "cli" \
+    "push ds" \
+    "push es" \
+    0x0f 0x01 0x14              /* lgdt [si] */ \
+    0x0f 0x20 0xc0              /* mov eax, cr0 */ \
+    "or al, 1" \
+    0x0f 0x22 0xc0              /* mov cr0, eax */ \
+    0xeb 0x00                   /* jmp $+2 */ \
+    "mov bx, 8" \
+    "mov ds, bx" \
+    "mov es, bx" \
+    "and al, 0feh" \
+    0x0f 0x22 0xc0              /* mov cr0, eax */ \
+    0xeb 0x00                   /* jmp $+2 */ \
+    "pop es" \
+    "pop ds" \
+    "popf" \
+    parm [si] \
+    modify [ax bx];
+
+struct flat_move {
+    uint32_t dst;
+    uint32_t src;
+    uint16_t count;
+};
+
+/**
+ * Copy between two linear addresses.
+ *
+ * DS and ES are set to zero, so the 32-bit offsets are the linear addresses.
+ * Everything but the last few bytes is moved a dword at a time.
+ */
+void flat_move(const struct flat_move *m);
+#pragma aux flat_move = \
+    "push ds" \
+    "push es" \
+    0x66 0x31 0xc9              /* xor ecx, ecx */ \
+    "mov cx, [si+8]" \
+    0x66 0x8b 0x3c              /* mov edi, [si] */ \
+    0x66 0x8b 0x74 0x04         /* mov esi, [si+4] */ \
+    "xor ax, ax" \
+    "mov ds, ax" \
+    "mov es, ax" \
+    "cld" \
+    "mov ax, cx" \
+    "and ax, 3" \
+    0x66 0xc1 0xe9 0x02         /* shr ecx, 2 */ \
+    0x67 0x66 0xf3 0xa5         /* rep movsd (32-bit addresses) */ \
+    "mov cx, ax" \
+    0x67 0xf3 0xa4              /* rep movsb (32-bit addresses) */ \
+    "pop es" \
+    "pop ds" \
+    parm [si] \
+    modify [ax cx si di];
+
+/* Null descriptor and a 4GB read / write data descriptor at base 0. */
+static const uint8_t gdt[16] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00,
+};
+
+static struct {
+    uint16_t limit;
+    uint32_t base;
+} gdtr;
+
+static void far *xms_entry;
+
+static uint32_t
+linear(const void far *p)
+{
+    return ((uint32_t) FP_SEG(p) << 4) + FP_OFF(p);
+}
+
+/**
+ * Copy \c n bytes between linear addresses.
+ *
+ * Anything that switches to protected mode and back, like a BIOS block move,
+ * resets the segment limits. Unreal mode is entered again before every copy,
+ * and interrupts are disabled until the copy is done.
+ */
+static void
+flat_copy(uint32_t dst, uint32_t src, uint16_t n)
+{
+    struct flat_move m;
+
+    m.dst = dst;
+    m.src = src;
+    m.count = n;
+
+    _disable();
+    enter_unreal(&gdtr);
+    flat_move(&m);
+    _enable();
+}
+
+bool
+flat_init(void)
+{
+    if ((flags_probe() & 0xf000) != 0x7000) {
+        printf("Extended memory can only be used on a 386 or later.\n");
+        return false;
+    }
+
+    if ((machine_status() & 1) != 0) {
+        printf("Extended memory cannot be used in virtual 8086 mode. "
+               "Unload EMM386\nor any other memory manager that uses "
+               "it.\n");
+        return false;
+    }
+
+    union REGS r;
+    struct SREGS sr;
+
+    segread(&sr);
+    r.w.ax = 0x4300;
+    int86x(0x2f, &r, &r, &sr);
+    if (r.h.al != 0x80) {
+        printf("Extended memory can only be used with an XMS driver "
+               "(HIMEM.SYS).\n");
+        return false;
+    }
+
+    r.w.ax = 0x4310;
+    int86x(0x2f, &r, &r, &sr);
+    xms_entry = MK_FP(sr.es, r.w.bx);
+
+    gdtr.limit = sizeof(gdt) - 1;
+    gdtr.base = linear(gdt);
+    return true;
+}
+
+bool
+flat_alloc(struct flat_buf *f, uint32_t size)
+{
+    const uint32_t kb = (size + 1023) >> 10;
+
+    f->handle = 0;
+
+    if (kb > 0xffff) {
+        printf("%lu bytes is more than XMS can allocate.\n",
+               (unsigned long) size);
+        return false;
+    }
+
+    const uint32_t alloc = xms_call(0x0900, (uint16_t) kb, xms_entry);
+    if ((uint16_t) alloc != 1) {
+        printf("Could not allocate %luKB of extended memory.\n",
+               (unsigned long) kb);
+        return false;
+    }
+
+    f->handle = alloc >> 16;
+    f->linear = xms_lock(f->handle, xms_entry);
+    f->size = size;
+    f->pos = 0;
+
+    /* Without A20, every address past 1MB wraps back to the start of
+     * memory.
+     */
+    if (f->linear == 0 ||
+        (uint16_t) xms_call(0x0500, 0, xms_entry) != 1) {
+        printf("Could not lock extended memory.\n");
+        if (f->linear != 0)
+            xms_call(0x0d00, f->handle, xms_entry);
+
+        xms_call(0x0a00, f->handle, xms_entry);
+        f->handle = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void
+flat_free(struct flat_buf *f)
+{
+    if (f->handle == 0)
+        return;
+
+    xms_call(0x0600, 0, xms_entry);
+    xms_call(0x0d00, f->handle, xms_entry);
+    xms_call(0x0a00, f->handle, xms_entry);
+    f->handle = 0;
+}
+
+void
+flat_write(struct flat_buf *f, uint32_t pos, const void far *src,
+           uint16_t n)
+{
+    flat_copy(f->linear + pos, linear(src), n);
+}
+
+uint16_t
+flat_refill(void *ctx, uint8_t far *dst, uint16_t max)
+{
+    struct flat_buf *const f = ctx;
+    const uint32_t left = f->size - f->pos;
+    const uint16_t n = left > max ? max : (uint16_t) left;
+
+    flat_copy(linear(dst), f->linear + f->pos, n);
+    f->pos += n;
+    return n;
+}
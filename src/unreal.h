@@ -0,0 +1,77 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef UNREAL_H
+#define UNREAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_buf.h"
+
+/**
+ * \file
+ * VGM data in extended memory, read through 32-bit flat addressing.
+ *
+ * A real mode program normally cannot address anything past the first 1MB
+ * (plus the HMA). On a 386 or later, briefly switching to protected mode to
+ * load a segment register with a 4GB limit, and then switching back, leaves
+ * that limit in place. In this "unreal" mode, real mode code can use 32-bit
+ * offsets to reach all of memory. The extended memory itself is allocated
+ * from the XMS driver, so that it does not collide with anything else.
+ *
+ * Protected mode cannot be entered from virtual 8086 mode, so none of this
+ * works under an EMS emulator like EMM386.
+ */
+
+/**
+ * A block of extended memory.
+ */
+struct flat_buf {
+    /* XMS handle. Zero when nothing is allocated. */
+    uint16_t handle;
+
+    /* Linear address and size of the block. */
+    uint32_t linear;
+    uint32_t size;
+
+    /* Read position used by flat_refill. */
+    uint32_t pos;
+};
+
+/**
+ * Determine whether extended memory can be used.
+ *
+ * This must be called, and must succeed, before any other function here is
+ * called. None of the 386 instructions are executed unless a 386 is found.
+ * The reason is printed on failure.
+ */
+bool flat_init(void);
+
+/**
+ * Allocate and lock a block of extended memory.
+ *
+ * On success, the A20 line is enabled until the block is freed.
+ */
+bool flat_alloc(struct flat_buf *f, uint32_t size);
+
+/**
+ * Free a block from \c flat_alloc. Nothing happens if \c f is not allocated.
+ */
+void flat_free(struct flat_buf *f);
+
+/**
+ * Copy \c n bytes from conventional memory to position \c pos in a block.
+ */
+void flat_write(struct flat_buf *f, uint32_t pos, const void far *src,
+                uint16_t n);
+
+/**
+ * Stream refill function that reads a block from \c f->pos onward.
+ *
+ * \c ctx must be a \c struct \c flat_buf.
+ */
+uint16_t flat_refill(void *ctx, uint8_t far *dst, uint16_t max);
+
+#endif /* ifndef UNREAL_H */
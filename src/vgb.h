@@ -0,0 +1,61 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGB_H
+#define VGB_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ * VGM bank (.VGB) file format.
+ *
+ * A bank is a set of complete VGM files stored back to back after a table of
+ * contents, so that a whole game's music is one file. The player reads the
+ * table once, and each track is then a single seek away. GD3 tags are
+ * stripped from the tracks. The title of each track is kept in its table
+ * entry instead.
+ *
+ * All values are little-endian. The table of contents immediately follows the
+ * header.
+ */
+
+#define VGB_VERSION 0x0100
+
+/* Limits the table of contents to 16k. */
+#define VGB_MAX_TRACKS 256
+
+#define VGB_TITLE_SIZE 44
+
+struct vgb_header {
+    char ident[4];              /* "Vgb " */
+    uint16_t version;
+    uint16_t count;
+};
+
+struct vgb_entry {
+    /** Offset of the track's VGM header from the start of the bank. */
+    uint32_t offset;
+
+    /** Length of the track's VGM file. */
+    uint32_t length;
+
+    /** Length of the track in 44.1kHz samples. */
+    uint32_t total_samples;
+
+    /**
+     * Offset of the loop point from the start of the track's VGM file, or
+     * zero if the track does not loop.
+     */
+    uint32_t loop_offset;
+
+    /** Length of the loop in 44.1kHz samples. */
+    uint32_t loop_samples;
+
+    /** ASCII title terminated by a zero byte. */
+    char title[VGB_TITLE_SIZE];
+};
+
+#endif /* ifndef VGB_H */
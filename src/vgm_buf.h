@@ -0,0 +1,302 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_BUF_H
+#define VGM_BUF_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __WATCOMC__
+#include <i86.h>
+#define vgm_buf_memmove _fmemmove
+#else
+/* Host builds have a flat address space. */
+#define far
+#define vgm_buf_memmove memmove
+#endif
+
+/* Largest number of bytes that can be read through a normalized far pointer
+ * before the offset wraps. A normalized pointer has an offset in [0, 15].
+ */
+#define CURSOR_MAX 0xfff0u
+
+/* Size of a stream whose end has not been reached yet. */
+#define VGM_BUF_SIZE_UNKNOWN 0xffffffffUL
+
+/* A refill of a stream stops once this many bytes are buffered, so that the
+ * operands of any command can be read through the cursor.
+ */
+#define VGM_BUF_MIN_FILL 16u
+
+/**
+ * Read more of a stream.
+ *
+ * \return
+ * The number of bytes stored in \c dst, at most \c max. Zero means the end
+ * of the stream (or an error).
+ */
+typedef uint16_t (*vgm_refill_fn)(void *ctx, uint8_t far *dst, uint16_t max);
+
+struct vgm_buf {
+    uint8_t far *buffer;
+
+    /* Size of the data. For a stream, this is VGM_BUF_SIZE_UNKNOWN until the
+     * end of the stream is reached.
+     */
+    uint32_t size;
+
+    /* Read cursor. ptr is a normalized far pointer to the next byte, and
+     * remain is the number of bytes that can be read through ptr before it
+     * must be renormalized (or the end of the buffer is reached). This keeps
+     * all of the arithmetic in the common case 16-bit.
+     *
+     * The 32-bit position is not stored. It is reconstructed from window_end,
+     * the position of ptr + remain, only when it is needed.
+     */
+    uint8_t far *ptr;
+    uint16_t remain;
+    uint32_t window_end;
+
+    /* Forward-only streaming. refill is NULL when all of the data is in
+     * memory. Otherwise buffer holds the filled bytes of the stream starting
+     * at position base, and capacity is at most CURSOR_MAX. Positions before
+     * base can no longer be read.
+     */
+    vgm_refill_fn refill;
+    void *refill_ctx;
+    uint32_t base;
+    uint32_t filled;
+    uint16_t capacity;
+};
+
+/**
+ * Add a 32-bit offset to a far pointer.
+ *
+ * Adding to a far pointer only changes the 16-bit offset, so crossing a 64k
+ * boundary wraps. Instead, generate a normalized pointer (offset in [0, 15])
+ * to the same linear address.
+ */
+static inline uint8_t far *
+normalize_ptr(const void far *base, uint32_t offset)
+{
+#ifdef __WATCOMC__
+    const uint32_t linear = ((uint32_t)FP_SEG(base) << 4) + FP_OFF(base) +
+        offset;
+
+    return MK_FP((uint16_t)(linear >> 4), (uint16_t)(linear & 0x0f));
+#else
+    return (uint8_t *) base + offset;
+#endif
+}
+
+/**
+ * Get the current read position in the buffer.
+ */
+static inline uint32_t
+vgm_buf_tell(const struct vgm_buf *v)
+{
+    return v->window_end - v->remain;
+}
+
+/**
+ * Make the stream data at \c pos available at the start of the buffer.
+ *
+ * Data before \c pos is discarded, and data up to \c pos that is not
+ * buffered yet is read and thrown away. Each call makes as few reads as
+ * possible, since a refill in the middle of playback stalls it.
+ */
+static inline void
+vgm_buf_fill(struct vgm_buf *v, uint32_t pos)
+{
+    const uint32_t end = v->base + v->filled;
+
+    if (pos < end) {
+        const uint16_t keep = (uint16_t)(end - pos);
+
+        vgm_buf_memmove(v->buffer, v->buffer + (uint16_t)(pos - v->base),
+                        keep);
+        v->filled = keep;
+    } else {
+        v->filled = 0;
+
+        for (uint32_t skip = pos - end; skip > 0; /* empty */) {
+            const uint16_t n = v->refill(v->refill_ctx, v->buffer,
+                                         skip > v->capacity
+                                         ? v->capacity : (uint16_t) skip);
+
+            if (n == 0) {
+                v->base = pos - skip;
+                v->size = v->base;
+                return;
+            }
+
+            skip -= n;
+        }
+    }
+
+    v->base = pos;
+
+    while (v->filled < VGM_BUF_MIN_FILL) {
+        const uint16_t n = v->refill(v->refill_ctx, v->buffer + v->filled,
+                                     v->capacity - (uint16_t) v->filled);
+
+        if (n == 0) {
+            v->size = v->base + v->filled;
+            break;
+        }
+
+        v->filled += n;
+    }
+}
+
+/**
+ * Set the read position in the buffer.
+ *
+ * This is the only place the cursor is (re)normalized. Positions past the end
+ * of the buffer are clamped to the end. A stream is refilled as needed, and
+ * positions before the buffered part of a stream are clamped to its start.
+ */
+static inline void
+vgm_buf_seek(struct vgm_buf *v, uint32_t pos)
+{
+    if (v->refill != NULL) {
+        if (pos < v->base)
+            pos = v->base;
+
+        if (pos + VGM_BUF_MIN_FILL > v->base + v->filled &&
+            v->size == VGM_BUF_SIZE_UNKNOWN)
+            vgm_buf_fill(v, pos);
+    }
+
+    if (pos > v->size)
+        pos = v->size;
+
+    const uint32_t end = v->refill != NULL ? v->base + v->filled : v->size;
+    const uint32_t avail = end > pos ? end - pos : 0;
+
+    v->ptr = normalize_ptr(v->buffer, pos - v->base);
+    v->remain = avail > CURSOR_MAX ? CURSOR_MAX : (uint16_t) avail;
+    v->window_end = pos + v->remain;
+}
+
+static inline void
+vgm_buf_init(struct vgm_buf *v, uint8_t far *buffer, uint32_t size)
+{
+    v->buffer = buffer;
+    v->size = size;
+    v->refill = NULL;
+    v->refill_ctx = NULL;
+    v->base = 0;
+    v->filled = size;
+    v->capacity = 0;
+    vgm_buf_seek(v, 0);
+}
+
+/**
+ * Set up forward-only reading of a stream.
+ *
+ * \param buffer Buffer of \c capacity bytes. The first \c prefill bytes of
+ *               the stream are already in it.
+ * \param capacity Size of the buffer. At most \c CURSOR_MAX.
+ */
+static inline void
+vgm_buf_init_stream(struct vgm_buf *v, uint8_t far *buffer,
+                    uint16_t capacity, uint16_t prefill,
+                    vgm_refill_fn refill, void *ctx)
+{
+    v->buffer = buffer;
+    v->size = VGM_BUF_SIZE_UNKNOWN;
+    v->refill = refill;
+    v->refill_ctx = ctx;
+    v->base = 0;
+    v->filled = prefill;
+    v->capacity = capacity;
+    vgm_buf_seek(v, 0);
+}
+
+static inline void
+skip_bytes(struct vgm_buf *v, unsigned bytes_to_skip)
+{
+    if (bytes_to_skip <= v->remain) {
+        v->ptr += bytes_to_skip;
+        v->remain -= bytes_to_skip;
+    } else {
+        vgm_buf_seek(v, vgm_buf_tell(v) + bytes_to_skip);
+    }
+}
+
+/**
+ * Slow path of \c get_uint8 taken when the cursor window is exhausted.
+ */
+static inline uint8_t
+get_uint8_slow(struct vgm_buf *v)
+{
+    vgm_buf_seek(v, v->window_end);
+
+    if (v->remain == 0)
+        return 0x66;
+
+    v->remain--;
+    return *v->ptr++;
+}
+
+static inline uint8_t
+get_uint8(struct vgm_buf *v)
+{
+    if (v->remain == 0)
+        return get_uint8_slow(v);
+
+    v->remain--;
+    return *v->ptr++;
+}
+
+static inline uint16_t
+get_uint16(struct vgm_buf *v)
+{
+    if (v->remain >= 2) {
+        const uint16_t result = (uint16_t)v->ptr[0] |
+            ((uint16_t)v->ptr[1] << 8);
+
+        v->ptr += 2;
+        v->remain -= 2;
+
+        return result;
+    } else if (vgm_buf_tell(v) + 2 > v->size) {
+        vgm_buf_seek(v, v->size);
+        return 0;
+    } else {
+        /* The value straddles the end of the cursor window. */
+        const uint16_t lo = get_uint8(v);
+
+        return lo | ((uint16_t)get_uint8(v) << 8);
+    }
+}
+
+static inline uint32_t
+get_uint32(struct vgm_buf *v)
+{
+    if (v->remain >= 4) {
+        const uint32_t result = (uint32_t)v->ptr[0] |
+            ((uint32_t)v->ptr[1] << 8) |
+            ((uint32_t)v->ptr[2] << 16) |
+            ((uint32_t)v->ptr[3] << 24);
+
+        v->ptr += 4;
+        v->remain -= 4;
+
+        return result;
+    } else if (vgm_buf_tell(v) + 4 > v->size) {
+        vgm_buf_seek(v, v->size);
+        return 0;
+    } else {
+        /* The value straddles the end of the cursor window. */
+        const uint32_t lo = get_uint16(v);
+
+        return lo | ((uint32_t)get_uint16(v) << 16);
+    }
+}
+
+#endif /* ifndef VGM_BUF_H */
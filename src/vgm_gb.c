@@ -0,0 +1,374 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_gb.h"
+#include "vgm_iter.h"
+
+/* 1/64 samples between ticks of the sequencer that runs the note lengths.
+ * The frequency sweep runs at half of this rate, and envelopes run at a
+ * quarter of it.
+ */
+#define LENGTH_TICK (44100UL * 64 / 256)
+
+/* Registers are numbered from 0xff10 (NR10). */
+#define NR10 0x00
+#define NR13 0x03
+#define NR14 0x04
+#define NR30 0x0a
+#define NR32 0x0c
+#define NR43 0x12
+#define NR50 0x14
+#define NR51 0x15
+#define NR52 0x16
+
+enum {
+    SQUARE1,
+    SQUARE2,
+    WAVE,
+    NOISE,
+};
+
+/* First register (NRx0) of each voice. NR20 and NR40 do not exist, but
+ * treating them as if they did keeps all four voices the same.
+ */
+static const uint8_t voice_base[4] = { 0x00, 0x05, 0x0a, 0x0f };
+
+/* Attenuation for each wave output level (mute, 100%, 50%, and 25%). */
+static const uint8_t wave_atten[4] = { 0x0f, 0, 3, 6 };
+
+static struct {
+    /* Shadow of the registers 0xff10 through 0xff3f. */
+    uint8_t regs[0x30];
+
+    /* Voices that are playing. A voice stops when its length runs out. */
+    uint8_t on;
+
+    /* Length counter of each voice, and volume and envelope timer of each
+     * voice except the wave.
+     */
+    uint16_t length[4];
+    uint8_t volume[4];
+    uint8_t env_timer[4];
+
+    /* Count of length ticks, for running the sweep and the envelopes. */
+    uint8_t tick;
+
+    /* Frequency sweep of square 1. The sweep works from its own copy of the
+     * frequency, which is written back to NR13 and NR14 at each step.
+     */
+    uint16_t sweep_freq;
+    uint8_t sweep_timer;
+    bool sweep_on;
+
+    struct vgm_ticker ticker;
+    struct vgm_psg_out psg;
+
+    /* SN76489 period (before it is fit into 10 bits) for each square
+     * frequency value. The wave is an octave lower at the same value.
+     */
+    uint16_t period[2048];
+
+    uint32_t clock;
+} s;
+
+/**
+ * Build the period table for a DMG clock.
+ *
+ * A square plays at clock / (32 * (2048 - x)), and an SN76489 tone plays at
+ * VGM_PSG_CLOCK / (32 * period).
+ */
+static void
+build_period_table(uint32_t clock)
+{
+    const uint32_t ratio = vgm_clock_ratio(VGM_PSG_CLOCK, clock);
+
+    for (unsigned x = 0; x < 2048; x++)
+        s.period[x] = ((uint32_t)(2048 - x) * ratio + 0x8000) >> 16;
+}
+
+static uint8_t
+reg(unsigned voice, unsigned n)
+{
+    return s.regs[voice_base[voice] + n];
+}
+
+static uint16_t
+frequency(unsigned voice)
+{
+    return reg(voice, 3) | ((reg(voice, 4) & 0x07) << 8);
+}
+
+static bool
+dac_on(unsigned voice)
+{
+    return voice == WAVE
+        ? (s.regs[NR30] & 0x80) != 0 : (reg(voice, 2) & 0xf8) != 0;
+}
+
+/**
+ * Noise shift rate for the setting in NR43.
+ *
+ * The shift register is clocked at clock / 16 / (r * 2^s), where r of zero
+ * is treated as 0.5.
+ */
+static uint8_t
+noise_rate(void)
+{
+    const uint8_t nr43 = s.regs[NR43];
+    const uint32_t div = (uint32_t)((nr43 & 0x07) != 0
+                                    ? 2 * (nr43 & 0x07) : 1) << (nr43 >> 4);
+
+    return vgm_psg_noise_rate((s.clock >> 3) / div);
+}
+
+/**
+ * Calculate the next frequency of the square 1 sweep.
+ *
+ * Square 1 stops if the result is past the largest frequency value, even if
+ * the result is not used.
+ */
+static uint16_t
+sweep_next(void)
+{
+    const uint8_t nr10 = s.regs[NR10];
+    const uint16_t delta = s.sweep_freq >> (nr10 & 0x07);
+    const uint16_t next = (nr10 & 0x08) != 0
+        ? s.sweep_freq - delta : s.sweep_freq + delta;
+
+    if (next > 2047)
+        s.on &= ~(1 << SQUARE1);
+
+    return next;
+}
+
+/**
+ * Run one 128Hz step of the square 1 sweep.
+ */
+static void
+sweep_tick(void)
+{
+    const uint8_t period = (s.regs[NR10] >> 4) & 0x07;
+
+    if (--s.sweep_timer != 0)
+        return;
+
+    /* A period of zero reloads the timer with 8, but does not sweep. */
+    s.sweep_timer = period != 0 ? period : 8;
+
+    if (!s.sweep_on || period == 0)
+        return;
+
+    const uint16_t next = sweep_next();
+
+    if (next <= 2047 && (s.regs[NR10] & 0x07) != 0) {
+        s.sweep_freq = next;
+        s.regs[NR13] = next & 0xff;
+        s.regs[NR14] = (s.regs[NR14] & 0xf8) | (next >> 8);
+
+        /* The new frequency is checked again right away. */
+        sweep_next();
+    }
+}
+
+/**
+ * Write the SN76489 registers that differ from the DMG state.
+ */
+static void
+update(struct vgm_out *o)
+{
+    uint8_t atten[4];
+
+    for (unsigned voice = 0; voice < 4; voice++) {
+        /* A voice that is not sent to either output is silent. */
+        const bool on = (s.on & (1 << voice)) != 0 &&
+            (s.regs[NR51] & (0x11 << voice)) != 0;
+
+        if (!on)
+            atten[voice] = 0x0f;
+        else if (voice == WAVE)
+            atten[voice] = wave_atten[(s.regs[NR32] >> 5) & 3];
+        else
+            atten[voice] = vgm_psg_linear_atten(s.volume[voice]);
+    }
+
+    for (unsigned voice = SQUARE1; voice <= WAVE; voice++) {
+        const uint32_t period = (uint32_t) s.period[frequency(voice)]
+            << (voice == WAVE ? 1 : 0);
+
+        vgm_psg_tone(o, &s.psg, voice, vgm_psg_fold_period(period));
+    }
+
+    /* The 7-bit mode of the DMG noise is still noise, not the SN76489's
+     * periodic noise, so white noise is always used.
+     */
+    vgm_psg_noise(o, &s.psg, 0x04 | noise_rate());
+
+    for (unsigned voice = 0; voice < 4; voice++)
+        vgm_psg_atten(o, &s.psg, voice, atten[voice]);
+}
+
+/**
+ * Run one 256Hz tick of the sequencer.
+ */
+static void
+sequencer_tick(struct vgm_out *o)
+{
+    for (unsigned voice = 0; voice < 4; voice++) {
+        if ((reg(voice, 4) & 0x40) == 0 || s.length[voice] == 0)
+            continue;
+
+        if (--s.length[voice] == 0)
+            s.on &= ~(1 << voice);
+    }
+
+    s.tick++;
+
+    /* The sweep runs at 128Hz, and envelopes run at 64Hz. */
+    if ((s.tick & 1) == 0)
+        sweep_tick();
+
+    if ((s.tick & 3) == 0) {
+        for (unsigned voice = 0; voice < 4; voice++) {
+            const uint8_t env = reg(voice, 2);
+            const uint8_t period = env & 0x07;
+
+            if (voice == WAVE || period == 0 || --s.env_timer[voice] != 0)
+                continue;
+
+            s.env_timer[voice] = period;
+
+            if ((env & 0x08) != 0 && s.volume[voice] < 15)
+                s.volume[voice]++;
+            else if ((env & 0x08) == 0 && s.volume[voice] > 0)
+                s.volume[voice]--;
+        }
+    }
+
+    update(o);
+}
+
+static void
+trigger(unsigned voice)
+{
+    const uint8_t env = reg(voice, 2);
+
+    if (dac_on(voice))
+        s.on |= 1 << voice;
+
+    if (s.length[voice] == 0)
+        s.length[voice] = voice == WAVE ? 256 : 64;
+
+    s.volume[voice] = env >> 4;
+    s.env_timer[voice] = env & 0x07;
+
+    if (voice == SQUARE1) {
+        const uint8_t nr10 = s.regs[NR10];
+        const uint8_t period = (nr10 >> 4) & 0x07;
+
+        s.sweep_freq = frequency(SQUARE1);
+        s.sweep_timer = period != 0 ? period : 8;
+        s.sweep_on = (nr10 & 0x77) != 0;
+
+        /* With a shift, overflow is checked when the note starts. */
+        if ((nr10 & 0x07) != 0)
+            sweep_next();
+    }
+}
+
+static void
+dmg_write(struct vgm_out *o, uint8_t r, uint8_t value)
+{
+    if (r >= sizeof(s.regs))
+        return;
+
+    s.regs[r] = value;
+
+    if (r == NR52) {
+        /* Power off. */
+        if ((value & 0x80) == 0)
+            s.on = 0;
+    } else if (r < NR50) {
+        const unsigned voice = r / 5;
+        const unsigned n = r % 5;
+
+        switch (n) {
+        case 0:
+        case 2:
+            if (!dac_on(voice))
+                s.on &= ~(1 << voice);
+
+            break;
+
+        case 1:
+            s.length[voice] = voice == WAVE
+                ? 256 - value : 64 - (value & 0x3f);
+            break;
+
+        case 4:
+            if ((value & 0x80) != 0)
+                trigger(voice);
+
+            break;
+        }
+    }
+
+    update(o);
+}
+
+bool
+gb_translate(struct vgm_out *o, struct vgm_buf *v,
+             const struct vgm_header *header)
+{
+    memset(&s, 0, sizeof(s));
+    s.clock = header->gb_dmg_clock & 0x3fffffff;
+    build_period_table(s.clock);
+    vgm_ticker_init(&s.ticker, LENGTH_TICK);
+    vgm_psg_out_init(&s.psg);
+
+    /* Send every voice to both outputs until the file says otherwise. */
+    s.regs[NR51] = 0xff;
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_WAIT:
+            s.ticker.remain = (uint32_t) e.samples * 64;
+            while (vgm_ticker_step(o, &s.ticker))
+                sequencer_tick(o);
+
+            break;
+
+        case VGM_EVENT_CHIP_WRITE:
+            if (e.command == 0xb3) {
+                /* Bit 7 of the register selects the second chip. */
+                if ((e.data[0] & 0x80) == 0)
+                    dmg_write(o, e.data[0], e.data[1]);
+
+                break;
+            }
+
+            vgm_out_copy(o, v, start);
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
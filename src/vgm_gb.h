@@ -0,0 +1,26 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_GB_H
+#define VGM_GB_H
+
+#include "vgm_pass.h"
+
+/**
+ * Load-time pass that translates Game Boy DMG writes to SN76489 writes.
+ *
+ * The two square voices and the wave voice are played on the three tone
+ * voices, and the noise on the noise voice. The wave voice is played as a
+ * square wave at its volume setting. Each 0xb3 command updates a shadow of
+ * the DMG registers, and the SN76489 registers that change are written as
+ * 0x50 commands. Envelopes, note lengths, and the frequency sweep of
+ * square 1 are run from the DMG's 256Hz sequencer, so waits are split where
+ * they change the volume or the pitch. The second chip is dropped. All
+ * other commands are copied unchanged.
+ */
+bool gb_translate(struct vgm_out *o, struct vgm_buf *v,
+                  const struct vgm_header *header);
+
+#endif /* ifndef VGM_GB_H */
@@ -0,0 +1,407 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_ITER_H
+#define VGM_ITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_buf.h"
+
+/**
+ * \file
+ * Pull-based decoder for the VGM command stream.
+ *
+ * Each call to \c vgm_next_event decodes one command and describes it in a
+ * \c vgm_event. The decoder has no side effects other than advancing the
+ * buffer, allocates nothing, and does not copy operands. Operands of writes
+ * to chips that are not decoded, and the contents of data blocks, are
+ * returned as pointers into the buffer.
+ *
+ * Every consumer of VGM data (the players, load-time passes, and host tools)
+ * uses this decoder.
+ */
+
+enum vgm_event_type {
+    /** SN76489 write. The byte is in \c value. */
+    VGM_EVENT_PSG_WRITE,
+
+    /** Write of \c value to the second SN76489. */
+    VGM_EVENT_PSG2_WRITE,
+
+    /** Wait for \c samples 44.1kHz samples. */
+    VGM_EVENT_WAIT,
+
+    /** AY-8910 write of \c value to register \c reg. */
+    VGM_EVENT_AY8910_WRITE,
+
+    /**
+     * SAA1099 write of \c value to register \c reg. Bit 7 of \c reg
+     * selects the second chip.
+     */
+    VGM_EVENT_SAA1099_WRITE,
+
+    /** YM3812 (OPL2) write of \c value to register \c reg. */
+    VGM_EVENT_OPL2_WRITE,
+
+    /**
+     * Data block (command 0x67) of type \c reg. The \c size bytes of data
+     * start at \c data. When reading a stream, the data is skipped and
+     * \c data is NULL.
+     */
+    VGM_EVENT_DATA_BLOCK,
+
+    /**
+     * Any other command. The \c size operand bytes start at \c data. For
+     * commands 0x80 through 0x8f (YM2612 DAC write then wait), \c samples is
+     * the wait.
+     */
+    VGM_EVENT_CHIP_WRITE,
+
+    /** End of sound data, or the end of the buffer. */
+    VGM_EVENT_END,
+
+    /** Invalid data. The command byte is in \c command. */
+    VGM_EVENT_ERROR,
+};
+
+struct vgm_event {
+    uint8_t type;
+    uint8_t command;
+    uint8_t reg;
+    uint8_t value;
+    uint16_t samples;
+    uint32_t size;
+    const uint8_t far *data;
+};
+
+/**
+ * Point \c e->data at the \c n operand bytes following the command.
+ *
+ * \return
+ * False if the command is truncated by the end of the buffer.
+ */
+static inline bool
+vgm_event_operands(struct vgm_buf *v, struct vgm_event *e, unsigned n)
+{
+    /* Make sure all of the operands can be read through the pointer without
+     * its offset wrapping.
+     */
+    if (v->remain < n) {
+        vgm_buf_seek(v, vgm_buf_tell(v));
+
+        if (v->remain < n) {
+            vgm_buf_seek(v, v->size);
+            return false;
+        }
+    }
+
+    e->size = n;
+    e->data = v->ptr;
+    skip_bytes(v, n);
+    return true;
+}
+
+/**
+ * Decode the next command.
+ *
+ * \return
+ * The type of the event, also stored in \c e->type.
+ */
+static inline uint8_t
+vgm_next_event(struct vgm_buf *v, struct vgm_event *e)
+{
+    const uint8_t command = get_uint8(v);
+    unsigned operand_bytes;
+
+    e->command = command;
+
+    switch (command) {
+    case 0x50:
+        /* SN76489 / SN76496 write */
+        e->value = get_uint8(v);
+        return e->type = VGM_EVENT_PSG_WRITE;
+
+    case 0x30:
+        /* SN76489 write (second chip) */
+        e->value = get_uint8(v);
+        return e->type = VGM_EVENT_PSG2_WRITE;
+
+    case 0x61:
+        /* Wait n samples. n is 16-bit value. */
+        e->samples = get_uint16(v);
+        return e->type = VGM_EVENT_WAIT;
+
+    case 0x62:
+        /* Wait 735 samples */
+        e->samples = 735;
+        return e->type = VGM_EVENT_WAIT;
+
+    case 0x63:
+        /* Wait 882 samples */
+        e->samples = 882;
+        return e->type = VGM_EVENT_WAIT;
+
+    case 0x70:
+    case 0x71:
+    case 0x72:
+    case 0x73:
+    case 0x74:
+    case 0x75:
+    case 0x76:
+    case 0x77:
+    case 0x78:
+    case 0x79:
+    case 0x7a:
+    case 0x7b:
+    case 0x7c:
+    case 0x7d:
+    case 0x7e:
+    case 0x7f:
+        /* Wait n+1 samples. */
+        e->samples = (command & 0x0f) + 1;
+        return e->type = VGM_EVENT_WAIT;
+
+    case 0x66:
+        /* End of sound data. */
+        return e->type = VGM_EVENT_END;
+
+    case 0xa0:
+        /* AY8910 write */
+        e->reg = get_uint8(v);
+        e->value = get_uint8(v);
+        return e->type = VGM_EVENT_AY8910_WRITE;
+
+    case 0xbd:
+        /* SAA1099 write */
+        e->reg = get_uint8(v);
+        e->value = get_uint8(v);
+        return e->type = VGM_EVENT_SAA1099_WRITE;
+
+    case 0x5a:
+        /* YM3812 write */
+        e->reg = get_uint8(v);
+        e->value = get_uint8(v);
+        return e->type = VGM_EVENT_OPL2_WRITE;
+
+    case 0x67:
+        /* Data block. Should be 0x66, followed by a byte for the data type,
+         * and four bytes for the size of the data that follows.
+         */
+        if (get_uint8(v) != 0x66)
+            return e->type = VGM_EVENT_ERROR;
+
+        e->reg = get_uint8(v);
+        e->size = get_uint32(v);
+        e->data = v->refill == NULL ? normalize_ptr(v->ptr, 0) : NULL;
+        vgm_buf_seek(v, vgm_buf_tell(v) + e->size);
+        return e->type = VGM_EVENT_DATA_BLOCK;
+
+    case 0x68:
+        /* PCM RAM write. Should be 0x66, followed by a byte for the chip
+         * type, and 9 bytes of offsets and sizes.
+         */
+        if (get_uint8(v) != 0x66)
+            return e->type = VGM_EVENT_ERROR;
+
+        operand_bytes = 10;
+        break;
+
+    case 0x80:
+    case 0x81:
+    case 0x82:
+    case 0x83:
+    case 0x84:
+    case 0x85:
+    case 0x86:
+    case 0x87:
+    case 0x88:
+    case 0x89:
+    case 0x8a:
+    case 0x8b:
+    case 0x8c:
+    case 0x8d:
+    case 0x8e:
+    case 0x8f:
+        /* YM2612 port 0 write from data pointer, then wait. */
+        e->samples = command & 0x0f;
+        e->size = 0;
+        e->data = v->ptr;
+        return e->type = VGM_EVENT_CHIP_WRITE;
+
+    case 0x31: /* AY8910 stereo mask */
+    case 0x32: /* reserved one-byte command. */
+    case 0x33: /* reserved one-byte command. */
+    case 0x34: /* reserved one-byte command. */
+    case 0x35: /* reserved one-byte command. */
+    case 0x36: /* reserved one-byte command. */
+    case 0x37: /* reserved one-byte command. */
+    case 0x38: /* reserved one-byte command. */
+    case 0x39: /* reserved one-byte command. */
+    case 0x3a: /* reserved one-byte command. */
+    case 0x3b: /* reserved one-byte command. */
+    case 0x3c: /* reserved one-byte command. */
+    case 0x3d: /* reserved one-byte command. */
+    case 0x3e: /* reserved one-byte command. */
+    case 0x3f: /* Game Gear PSG stereo (second chip) */
+    case 0x4f: /* Game Gear PSG stereo */
+    case 0x94: /* Stop stream */
+        operand_bytes = 1;
+        break;
+
+    case 0x40: /* Mikey write */
+    case 0x41: /* reserved two-byte command. */
+    case 0x42: /* reserved two-byte command. */
+    case 0x43: /* reserved two-byte command. */
+    case 0x44: /* reserved two-byte command. */
+    case 0x45: /* reserved two-byte command. */
+    case 0x46: /* reserved two-byte command. */
+    case 0x47: /* reserved two-byte command. */
+    case 0x48: /* reserved two-byte command. */
+    case 0x49: /* reserved two-byte command. */
+    case 0x4a: /* reserved two-byte command. */
+    case 0x4b: /* reserved two-byte command. */
+    case 0x4c: /* reserved two-byte command. */
+    case 0x4d: /* reserved two-byte command. */
+    case 0x4e: /* reserved two-byte command. */
+    case 0x51: /* YM2413 write */
+    case 0x52: /* YM2612 port 0 write */
+    case 0x53: /* YM2612 port 1 write */
+    case 0x54: /* YM2151 write */
+    case 0x55: /* YM2203 write */
+    case 0x56: /* YM2608 port 0 write */
+    case 0x57: /* YM2608 port 1 write */
+    case 0x58: /* YM2610 port 0 write */
+    case 0x59: /* YM2610 port 1 write */
+    case 0x5b: /* YM3526 write */
+    case 0x5c: /* Y8950 write */
+    case 0x5d: /* YMZ280B write */
+    case 0x5e: /* YMF262 port 0 write */
+    case 0x5f: /* YMF262 port 1 write */
+    case 0xa1: /* YM2413 write (second chip) */
+    case 0xa2: /* YM2612 port 0 write (second chip) */
+    case 0xa3: /* YM2612 port 1 write (second chip) */
+    case 0xa4: /* YM2151 write (second chip) */
+    case 0xa5: /* YM2203 write (second chip) */
+    case 0xa6: /* YM2608 port 0 write (second chip) */
+    case 0xa7: /* YM2608 port 1 write (second chip) */
+    case 0xa8: /* YM2610 port 0 write (second chip) */
+    case 0xa9: /* YM2610 port 1 write (second chip) */
+    case 0xaa: /* YM3812 write (second chip) */
+    case 0xab: /* YM3526 write (second chip) */
+    case 0xac: /* Y8950 write (second chip) */
+    case 0xad: /* YMZ280B write (second chip) */
+    case 0xae: /* YMF262 port 0 write (second chip) */
+    case 0xaf: /* YMF262 port 1 write (second chip) */
+    case 0xb0: /* RF5C68 write */
+    case 0xb1: /* RF5C164 write */
+    case 0xb2: /* PWM write */
+    case 0xb3: /* GameBoy DMG write */
+    case 0xb4: /* NES APU write */
+    case 0xb5: /* MultiPCM write */
+    case 0xb6: /* uPD7759 write */
+    case 0xb7: /* OKIM6258 write */
+    case 0xb8: /* OKIM6295 write */
+    case 0xb9: /* HuC6280 write */
+    case 0xba: /* K053260 write */
+    case 0xbb: /* Pokey write */
+    case 0xbc: /* WonderSwan write */
+    case 0xbe: /* ES5506 write */
+    case 0xbf: /* GA20 write */
+        operand_bytes = 2;
+        break;
+
+    case 0xc0: /* Sega PCM write */
+    case 0xc1: /* RF5C68 write */
+    case 0xc2: /* RF5C164 write */
+    case 0xc3: /* MultiPCM write */
+    case 0xc4: /* QSound write */
+    case 0xc5: /* SCSP write */
+    case 0xc6: /* WonderSwan write */
+    case 0xc7: /* VSU write */
+    case 0xc8: /* X1-010 write */
+    case 0xc9: /* reserved three-byte command. */
+    case 0xca: /* reserved three-byte command. */
+    case 0xcb: /* reserved three-byte command. */
+    case 0xcc: /* reserved three-byte command. */
+    case 0xcd: /* reserved three-byte command. */
+    case 0xce: /* reserved three-byte command. */
+    case 0xcf: /* reserved three-byte command. */
+    case 0xd0: /* YMF278B port write */
+    case 0xd1: /* YMF271 port write */
+    case 0xd2: /* SCC1 port write */
+    case 0xd3: /* K054539 write */
+    case 0xd4: /* C140 write */
+    case 0xd5: /* ES5503 write */
+    case 0xd6: /* ES5506 write */
+    case 0xd7: /* reserved three-byte command. */
+    case 0xd8: /* reserved three-byte command. */
+    case 0xd9: /* reserved three-byte command. */
+    case 0xda: /* reserved three-byte command. */
+    case 0xdb: /* reserved three-byte command. */
+    case 0xdc: /* reserved three-byte command. */
+    case 0xdd: /* reserved three-byte command. */
+    case 0xde: /* reserved three-byte command. */
+    case 0xdf: /* reserved three-byte command. */
+    case 0xe1: /* C352 write */
+        operand_bytes = 3;
+        break;
+
+    case 0xe0: /* Seek to offset in PCM data bank. */
+    case 0xe2: /* reserved four-byte command. */
+    case 0xe3: /* reserved four-byte command. */
+    case 0xe4: /* reserved four-byte command. */
+    case 0xe5: /* reserved four-byte command. */
+    case 0xe6: /* reserved four-byte command. */
+    case 0xe7: /* reserved four-byte command. */
+    case 0xe8: /* reserved four-byte command. */
+    case 0xe9: /* reserved four-byte command. */
+    case 0xea: /* reserved four-byte command. */
+    case 0xeb: /* reserved four-byte command. */
+    case 0xec: /* reserved four-byte command. */
+    case 0xed: /* reserved four-byte command. */
+    case 0xee: /* reserved four-byte command. */
+    case 0xef: /* reserved four-byte command. */
+    case 0xf0: /* reserved four-byte command. */
+    case 0xf1: /* reserved four-byte command. */
+    case 0xf2: /* reserved four-byte command. */
+    case 0xf3: /* reserved four-byte command. */
+    case 0xf4: /* reserved four-byte command. */
+    case 0xf5: /* reserved four-byte command. */
+    case 0xf6: /* reserved four-byte command. */
+    case 0xf7: /* reserved four-byte command. */
+    case 0xf8: /* reserved four-byte command. */
+    case 0xf9: /* reserved four-byte command. */
+    case 0xfa: /* reserved four-byte command. */
+    case 0xfb: /* reserved four-byte command. */
+    case 0xfc: /* reserved four-byte command. */
+    case 0xfd: /* reserved four-byte command. */
+    case 0xfe: /* reserved four-byte command. */
+    case 0xff: /* reserved four-byte command. */
+    case 0x90: /* Setup stream control */
+    case 0x91: /* Set stream data */
+    case 0x95: /* Start stream (fast call) */
+        operand_bytes = 4;
+        break;
+
+    case 0x92: /* Set stream frequency */
+        operand_bytes = 5;
+        break;
+
+    case 0x93: /* Start stream */
+        operand_bytes = 10;
+        break;
+
+    default:
+        return e->type = VGM_EVENT_ERROR;
+    }
+
+    if (!vgm_event_operands(v, e, operand_bytes))
+        return e->type = VGM_EVENT_END;
+
+    return e->type = VGM_EVENT_CHIP_WRITE;
+}
+
+#endif /* ifndef VGM_ITER_H */
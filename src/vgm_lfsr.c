@@ -0,0 +1,158 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_lfsr.h"
+#include "vgm_iter.h"
+
+/* Registers in the latch byte. */
+#define TONE2 4
+#define NOISE 6
+
+/* Noise control bits for periodic noise clocked by tone voice 2. */
+#define NOISE_PERIODIC_TONE2 0x03
+
+static struct {
+    /* Latched register and voice 2 period as the file sees them. */
+    uint8_t latch;
+    uint16_t period;
+
+    /* Voice 2 period that was last written to the chip. */
+    uint16_t out;
+
+    /* Noise control bits. */
+    uint8_t noise;
+
+    /* Voice 2 period that gives the same periodic noise pitch on the Tandy
+     * for each period in the file.
+     */
+    uint16_t corrected[1024];
+} s;
+
+static void
+build_table(uint8_t width)
+{
+    for (unsigned n = 0; n < 1024; n++) {
+        const uint32_t c = ((uint32_t) n * width + TANDY_FSR_WIDTH / 2) /
+            TANDY_FSR_WIDTH;
+
+        s.corrected[n] = c > 0x3ff ? 0x3ff : (uint16_t) c;
+    }
+}
+
+static void
+psg_byte(struct vgm_out *o, uint8_t value)
+{
+    vgm_out_byte(o, 0x50);
+    vgm_out_byte(o, value);
+}
+
+static uint16_t
+wanted_period(void)
+{
+    return (s.noise & 0x07) == NOISE_PERIODIC_TONE2
+        ? s.corrected[s.period] : s.period;
+}
+
+/**
+ * Write the voice 2 period for the current noise setting.
+ *
+ * \param latch  Always write the latch byte. The chip's latch must be voice
+ *               2 if this is false.
+ */
+static void
+write_period(struct vgm_out *o, bool latch)
+{
+    const uint16_t want = wanted_period();
+
+    if (latch || ((want ^ s.out) & 0x0f) != 0)
+        psg_byte(o, 0x80 | (TONE2 << 4) | (want & 0x0f));
+
+    if (((want ^ s.out) >> 4) != 0)
+        psg_byte(o, want >> 4);
+
+    s.out = want;
+}
+
+static void
+psg_write(struct vgm_out *o, uint8_t value)
+{
+    if ((value & 0x80) == 0) {
+        if (s.latch == TONE2) {
+            s.period = (s.period & 0x0f) | ((uint16_t)(value & 0x3f) << 4);
+            write_period(o, false);
+        } else if (s.latch == NOISE) {
+            /* A data byte also sets the noise control. Fixing the period
+             * moves the chip's latch to voice 2, so the noise control is
+             * then written with a latch byte.
+             */
+            s.noise = value & 0x07;
+
+            if (wanted_period() != s.out) {
+                write_period(o, true);
+                psg_byte(o, 0x80 | (NOISE << 4) | (value & 0x0f));
+            } else {
+                psg_byte(o, value);
+            }
+        } else {
+            psg_byte(o, value);
+        }
+
+        return;
+    }
+
+    s.latch = (value >> 4) & 7;
+
+    if (s.latch == TONE2) {
+        s.period = (s.period & 0x3f0) | (value & 0x0f);
+        write_period(o, true);
+    } else if (s.latch == NOISE) {
+        s.noise = value & 0x07;
+
+        /* The period is fixed before the noise write so that the latch is
+         * left on the noise register, as the file expects.
+         */
+        if (wanted_period() != s.out)
+            write_period(o, true);
+
+        psg_byte(o, value);
+    } else {
+        psg_byte(o, value);
+    }
+}
+
+bool
+lfsr_remap(struct vgm_out *o, struct vgm_buf *v,
+           const struct vgm_header *header)
+{
+    memset(&s, 0, sizeof(s));
+    build_table(vgm_fsr_width(header));
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_PSG_WRITE:
+            psg_write(o, e.value);
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_LFSR_H
+#define VGM_LFSR_H
+
+#include "vgm_pass.h"
+
+/* Width of the noise shift register in the Tandy 1000's PSG. */
+#define TANDY_FSR_WIDTH 15
+
+/**
+ * Width of the noise shift register that a file was recorded for.
+ *
+ * Files that do not say are for the 16-bit register of the Sega chips.
+ */
+static inline uint8_t
+vgm_fsr_width(const struct vgm_header *header)
+{
+    return header->version >= 0x110 && header->sn76489_fsr_width != 0
+        ? header->sn76489_fsr_width : 16;
+}
+
+/**
+ * Load-time pass that corrects the pitch of periodic noise for the Tandy's
+ * 15-bit noise shift register.
+ *
+ * Periodic noise is a pulse once every pass through the shift register, so
+ * its pitch depends on the width of the register. Music for the Sega chips,
+ * which have a 16-bit register, plays 16/15 too high on a Tandy. When the
+ * noise is periodic and clocked by tone voice 2, as in most periodic noise
+ * bass lines, the period of voice 2 is scaled by a table built for the
+ * file's register width. Voice 2 is normally silent while it clocks the
+ * noise, so its own pitch does not matter. The fixed noise rates cannot be
+ * corrected. Only the first PSG (0x50) is changed.
+ *
+ * The feedback taps in the header (\c sn76489_fb) are not used. In periodic
+ * mode the bit shifted out is fed straight back in, so the taps have no
+ * effect on the pitch. They only change the sound of white noise, which
+ * the Tandy's fixed TI taps cannot be made to match.
+ */
+bool lfsr_remap(struct vgm_out *o, struct vgm_buf *v,
+                const struct vgm_header *header);
+
+#endif /* ifndef VGM_LFSR_H */
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_mute.h"
+#include "vgm_iter.h"
+
+static uint8_t muted = 0;
+static uint8_t soloed = 0;
+
+static struct {
+    /* Registers (by the register bits of a latch byte) whose writes are
+     * removed, and the latched register in the input.
+     */
+    uint8_t drop;
+    uint8_t latch;
+} s;
+
+void
+mute_voice(unsigned voice)
+{
+    muted |= 1 << voice;
+}
+
+void
+solo_voice(unsigned voice)
+{
+    soloed |= 1 << voice;
+}
+
+uint8_t
+mute_mask(void)
+{
+    const uint8_t all = (1 << MUTE_VOICES) - 1;
+
+    return (muted | (soloed != 0 ? all & ~soloed : 0)) & all;
+}
+
+bool
+mute_apply(struct vgm_out *o, struct vgm_buf *v,
+           const struct vgm_header *header)
+{
+    const uint8_t mask = mute_mask();
+
+    (void) header;
+
+    memset(&s, 0, sizeof(s));
+
+    /* Both registers of each muted voice. The noise uses registers 6 and
+     * 7. Tone voice 2 keeps its period when the noise is played.
+     */
+    for (unsigned voice = 0; voice <= MUTE_NOISE; voice++) {
+        if ((mask & (1 << voice)) == 0)
+            continue;
+
+        s.drop |= voice == 2 && (mask & (1 << MUTE_NOISE)) == 0
+            ? 0x20 : 0x03 << (voice * 2);
+
+        vgm_out_byte(o, 0x50);
+        vgm_out_byte(o, 0x9f | (voice << 5));
+    }
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_PSG_WRITE:
+            /* A data byte goes to the same register as the latch byte
+             * before it, so it is removed along with it.
+             */
+            if ((e.value & 0x80) != 0)
+                s.latch = (e.value >> 4) & 7;
+
+            if ((s.drop & (1 << s.latch)) == 0)
+                vgm_out_copy(o, v, start);
+
+            break;
+
+        case VGM_EVENT_AY8910_WRITE:
+            if ((mask & (1 << MUTE_SPEAKER)) == 0)
+                vgm_out_copy(o, v, start);
+
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_MUTE_H
+#define VGM_MUTE_H
+
+#include "vgm_pass.h"
+
+/* Voices that can be muted. Voices 0 through 2 are the SN76489 tone
+ * voices.
+ */
+#define MUTE_NOISE   3
+#define MUTE_SPEAKER 4
+#define MUTE_VOICES  5
+
+/**
+ * Silence a voice.
+ */
+void mute_voice(unsigned voice);
+
+/**
+ * Play a voice when any voice is soloed. Every voice that is not soloed is
+ * silenced.
+ */
+void solo_voice(unsigned voice);
+
+/**
+ * \return
+ * Bit mask of the voices that are silenced, or zero if all are played.
+ */
+uint8_t mute_mask(void);
+
+/**
+ * Load-time pass that silences voices.
+ *
+ * Writes to the registers of a muted SN76489 voice are removed, and muted
+ * voices are silenced at the start. When the noise is played, the period
+ * of tone voice 2 is kept because it may set the noise rate. When the PC
+ * speaker is muted, the AY-8910 writes that drive it are removed. Nothing
+ * is checked during playback. All other commands are copied unchanged.
+ */
+bool mute_apply(struct vgm_out *o, struct vgm_buf *v,
+                const struct vgm_header *header);
+
+#endif /* ifndef VGM_MUTE_H */
@@ -0,0 +1,339 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_nes.h"
+#include "vgm_iter.h"
+
+/* 1/64 samples between quarter frames of the 240Hz frame counter. */
+#define QUARTER_FRAME (44100UL * 64 / 240)
+
+/* The triangle has no volume control. It is a bit quieter than a pulse at
+ * full volume.
+ */
+#define TRIANGLE_ATTEN 2
+
+enum {
+    PULSE1,
+    PULSE2,
+    TRIANGLE,
+    NOISE,
+};
+
+/* Note lengths, in half frames, loaded by the upper 5 bits of the fourth
+ * register of each voice.
+ */
+static const uint8_t length_table[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+/* Noise shift register period, in CPU clocks, for each setting of 0x400e. */
+static const uint16_t noise_period[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+struct envelope {
+    bool start;
+    uint8_t divider;
+    uint8_t decay;
+};
+
+struct sweep {
+    bool reload;
+    uint8_t divider;
+};
+
+static struct {
+    /* Shadow of the APU registers 0x4000 through 0x4017. */
+    uint8_t regs[0x18];
+
+    /* Length counter and envelope of each voice. The triangle has no
+     * envelope.
+     */
+    uint8_t length[4];
+    struct envelope env[4];
+
+    /* Frequency sweep of each pulse. */
+    struct sweep sweep[2];
+
+    /* Every other quarter frame is also a half frame. */
+    bool half_frame;
+
+    struct vgm_ticker ticker;
+    struct vgm_psg_out psg;
+
+    /* SN76489 period (before it is fit into 10 bits) for each pulse timer
+     * value. The triangle is an octave lower at the same timer value.
+     */
+    uint16_t period[2048];
+
+    /* SN76489 noise shift rate for each setting of 0x400e. */
+    uint8_t noise_rate[16];
+} s;
+
+/**
+ * Build the period and noise tables for an APU clock.
+ *
+ * A pulse plays at clock / (16 * (t + 1)), and an SN76489 tone plays at
+ * VGM_PSG_CLOCK / (32 * period).
+ */
+static void
+build_tables(uint32_t clock)
+{
+    const uint32_t ratio = vgm_clock_ratio(VGM_PSG_CLOCK, 2 * clock);
+
+    for (unsigned t = 0; t < 2048; t++)
+        s.period[t] = ((uint32_t)(t + 1) * ratio + 0x8000) >> 16;
+
+    for (unsigned i = 0; i < 16; i++)
+        s.noise_rate[i] = vgm_psg_noise_rate(clock / noise_period[i]);
+}
+
+static uint16_t
+timer(unsigned voice)
+{
+    return s.regs[voice * 4 + 2] | ((s.regs[voice * 4 + 3] & 0x07) << 8);
+}
+
+/**
+ * Calculate the timer value that the sweep of a pulse moves toward.
+ */
+static uint16_t
+sweep_target(unsigned voice)
+{
+    const uint8_t r = s.regs[voice * 4 + 1];
+    const uint16_t t = timer(voice);
+    const uint16_t delta = t >> (r & 0x07);
+
+    if ((r & 0x08) == 0)
+        return t + delta;
+
+    /* Pulse 1 negates with the ones' complement, so it subtracts one more
+     * than pulse 2.
+     */
+    return voice == PULSE1 ? t - delta - 1 : t - delta;
+}
+
+/**
+ * Determine whether the sweep unit silences a pulse.
+ *
+ * The target is checked even when the sweep is disabled, so a low note with
+ * a shift of zero and no negate is silent. Drivers set the negate bit to
+ * avoid this.
+ */
+static bool
+sweep_mutes(unsigned voice)
+{
+    return timer(voice) < 8 || sweep_target(voice) > 0x7ff;
+}
+
+/**
+ * Run one half frame step of the sweep of a pulse.
+ */
+static void
+sweep_tick(unsigned voice)
+{
+    struct sweep *const w = &s.sweep[voice];
+    const uint8_t r = s.regs[voice * 4 + 1];
+
+    if (w->divider == 0 && (r & 0x80) != 0 && (r & 0x07) != 0 &&
+        !sweep_mutes(voice)) {
+        const uint16_t t = sweep_target(voice);
+
+        s.regs[voice * 4 + 2] = t & 0xff;
+        s.regs[voice * 4 + 3] = (s.regs[voice * 4 + 3] & 0xf8) | (t >> 8);
+    }
+
+    if (w->divider == 0 || w->reload) {
+        w->divider = (r >> 4) & 0x07;
+        w->reload = false;
+    } else {
+        w->divider--;
+    }
+}
+
+static uint8_t
+volume(unsigned voice)
+{
+    const uint8_t r = s.regs[voice * 4];
+
+    return (r & 0x10) != 0 ? r & 0x0f : s.env[voice].decay;
+}
+
+/**
+ * Write the SN76489 registers that differ from the APU state.
+ */
+static void
+update(struct vgm_out *o)
+{
+    for (unsigned voice = PULSE1; voice <= PULSE2; voice++) {
+        const uint16_t t = timer(voice);
+        const bool on = s.length[voice] != 0 && !sweep_mutes(voice);
+
+        vgm_psg_tone(o, &s.psg, voice, vgm_psg_fold_period(s.period[t]));
+        vgm_psg_atten(o, &s.psg, voice,
+                      on ? vgm_psg_linear_atten(volume(voice)) : 0x0f);
+    }
+
+    /* Drivers usually silence the triangle by clearing its linear counter
+     * reload value, so that is treated as note off.
+     */
+    const uint16_t t = timer(TRIANGLE);
+    const bool on = s.length[TRIANGLE] != 0 && (s.regs[0x08] & 0x7f) != 0 &&
+        t >= 2;
+
+    vgm_psg_tone(o, &s.psg, TRIANGLE,
+                 vgm_psg_fold_period(2 * (uint32_t) s.period[t]));
+    vgm_psg_atten(o, &s.psg, TRIANGLE, on ? TRIANGLE_ATTEN : 0x0f);
+
+    /* The short mode of the NES noise is a 93 step sequence, which is much
+     * closer to white noise than to the SN76489's periodic noise.
+     */
+    vgm_psg_noise(o, &s.psg, 0x04 | s.noise_rate[s.regs[0x0e] & 0x0f]);
+    vgm_psg_atten(o, &s.psg, NOISE, s.length[NOISE] != 0
+                  ? vgm_psg_linear_atten(volume(NOISE)) : 0x0f);
+}
+
+static void
+clock_envelope(unsigned voice)
+{
+    struct envelope *const e = &s.env[voice];
+    const uint8_t r = s.regs[voice * 4];
+
+    if (e->start) {
+        e->start = false;
+        e->decay = 15;
+        e->divider = r & 0x0f;
+    } else if (e->divider != 0) {
+        e->divider--;
+    } else {
+        e->divider = r & 0x0f;
+
+        if (e->decay != 0)
+            e->decay--;
+        else if ((r & 0x20) != 0)
+            e->decay = 15;
+    }
+}
+
+/**
+ * Run one quarter frame of the frame counter.
+ */
+static void
+frame_tick(struct vgm_out *o)
+{
+    clock_envelope(PULSE1);
+    clock_envelope(PULSE2);
+    clock_envelope(NOISE);
+
+    if (s.half_frame) {
+        /* The same bit that loops the envelope halts the length counter. */
+        static const uint8_t halt[4] = { 0x20, 0x20, 0x80, 0x20 };
+
+        for (unsigned voice = 0; voice < 4; voice++) {
+            if (s.length[voice] != 0 &&
+                (s.regs[voice * 4] & halt[voice]) == 0)
+                s.length[voice]--;
+        }
+
+        sweep_tick(PULSE1);
+        sweep_tick(PULSE2);
+    }
+
+    s.half_frame = !s.half_frame;
+    update(o);
+}
+
+static void
+apu_write(struct vgm_out *o, uint8_t reg, uint8_t value)
+{
+    if (reg >= sizeof(s.regs))
+        return;
+
+    s.regs[reg] = value;
+
+    switch (reg) {
+    case 0x01:
+    case 0x05:
+        s.sweep[reg >> 2].reload = true;
+        break;
+
+    case 0x03:
+    case 0x07:
+    case 0x0b:
+    case 0x0f: {
+        const unsigned voice = reg >> 2;
+
+        /* A new note. The length is only loaded if the voice is enabled. */
+        if ((s.regs[0x15] & (1 << voice)) != 0)
+            s.length[voice] = length_table[value >> 3];
+
+        s.env[voice].start = true;
+        break;
+    }
+
+    case 0x15:
+        for (unsigned voice = 0; voice < 4; voice++) {
+            if ((value & (1 << voice)) == 0)
+                s.length[voice] = 0;
+        }
+
+        break;
+    }
+
+    update(o);
+}
+
+bool
+nes_translate(struct vgm_out *o, struct vgm_buf *v,
+              const struct vgm_header *header)
+{
+    memset(&s, 0, sizeof(s));
+    build_tables(header->nes_apu_clock & 0x3fffffff);
+    vgm_ticker_init(&s.ticker, QUARTER_FRAME);
+    vgm_psg_out_init(&s.psg);
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_WAIT:
+            s.ticker.remain = (uint32_t) e.samples * 64;
+            while (vgm_ticker_step(o, &s.ticker))
+                frame_tick(o);
+
+            break;
+
+        case VGM_EVENT_CHIP_WRITE:
+            if (e.command == 0xb4) {
+                /* Bit 7 of the register selects the second chip. */
+                if ((e.data[0] & 0x80) == 0)
+                    apu_write(o, e.data[0], e.data[1]);
+
+                break;
+            }
+
+            vgm_out_copy(o, v, start);
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
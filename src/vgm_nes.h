@@ -0,0 +1,25 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_NES_H
+#define VGM_NES_H
+
+#include "vgm_pass.h"
+
+/**
+ * Load-time pass that translates NES APU writes to SN76489 writes.
+ *
+ * The two pulse voices and the triangle are played on the three tone
+ * voices, and the noise on the noise voice. Each 0xb4 command updates a
+ * shadow of the APU registers, and the SN76489 registers that change are
+ * written as 0x50 commands. Envelopes, note lengths and the pulse sweeps
+ * are run at the APU's frame rate, so waits are split where they change the
+ * volume or the pitch. The DMC and the second chip are dropped. All other
+ * commands are copied unchanged.
+ */
+bool nes_translate(struct vgm_out *o, struct vgm_buf *v,
+                   const struct vgm_header *header);
+
+#endif /* ifndef VGM_NES_H */
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_opll.h"
+#include "vgm_iter.h"
+
+#define RHYTHM_MODE 0x20
+
+/* Instruments 1 through 15 of the OPLL ROM, then the three rhythm
+ * instruments (bass drum, high-hat and snare drum, tom-tom and top cymbal).
+ * Instrument 0 is the user instrument in registers 0x00 through 0x07, and
+ * each instrument uses the same layout:
+ *
+ *     0: modulator AM, VIB, EG type, KSR, MULT
+ *     1: carrier AM, VIB, EG type, KSR, MULT
+ *     2: modulator KSL, TL
+ *     3: carrier KSL, carrier waveform, modulator waveform, feedback
+ *     4: modulator AR, DR
+ *     5: carrier AR, DR
+ *     6: modulator SL, RR
+ *     7: carrier SL, RR
+ */
+static const uint8_t rom_patches[19][8] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x71, 0x61, 0x1e, 0x17, 0xd0, 0x78, 0x00, 0x17 }, /* Violin */
+    { 0x13, 0x41, 0x1a, 0x0d, 0xd8, 0xf7, 0x23, 0x13 }, /* Guitar */
+    { 0x13, 0x01, 0x99, 0x00, 0xf2, 0xc4, 0x21, 0x23 }, /* Piano */
+    { 0x11, 0x61, 0x0e, 0x07, 0x8d, 0x64, 0x70, 0x27 }, /* Flute */
+    { 0x32, 0x21, 0x1e, 0x06, 0xe1, 0x76, 0x01, 0x28 }, /* Clarinet */
+    { 0x31, 0x22, 0x16, 0x05, 0xe0, 0x71, 0x00, 0x18 }, /* Oboe */
+    { 0x21, 0x61, 0x1d, 0x07, 0x82, 0x81, 0x11, 0x07 }, /* Trumpet */
+    { 0x33, 0x21, 0x2d, 0x13, 0xb0, 0x70, 0x00, 0x07 }, /* Organ */
+    { 0x61, 0x61, 0x1b, 0x06, 0x64, 0x65, 0x10, 0x17 }, /* Horn */
+    { 0x41, 0x61, 0x0b, 0x18, 0x85, 0xf0, 0x81, 0x07 }, /* Synthesizer */
+    { 0x33, 0x01, 0x83, 0x11, 0xea, 0xef, 0x10, 0x04 }, /* Harpsichord */
+    { 0x17, 0xc1, 0x24, 0x07, 0xf8, 0xf8, 0x22, 0x12 }, /* Vibraphone */
+    { 0x61, 0x50, 0x0c, 0x05, 0xd2, 0xf5, 0x40, 0x42 }, /* Synth bass */
+    { 0x01, 0x01, 0x55, 0x03, 0xe9, 0x90, 0x03, 0x02 }, /* Acoustic bass */
+    { 0x41, 0x41, 0x89, 0x03, 0xf1, 0xe4, 0xc0, 0x13 }, /* Electric guitar */
+    { 0x01, 0x01, 0x18, 0x0f, 0xdf, 0xf8, 0x6a, 0x6d }, /* Bass drum */
+    { 0x01, 0x01, 0x00, 0x00, 0xc8, 0xd8, 0xa7, 0x68 }, /* HH / SD */
+    { 0x05, 0x01, 0x00, 0x00, 0xf8, 0xaa, 0x59, 0x55 }, /* TOM / CYM */
+};
+
+/* Offset of the modulator of each OPL2 channel in the operator registers.
+ * The carrier is 3 operators later.
+ */
+static const uint8_t mod_slot[9] = {
+    0x00, 0x01, 0x02, 0x08, 0x09, 0x0a, 0x10, 0x11, 0x12
+};
+
+static struct {
+    /* Shadow of the OPLL registers. */
+    uint8_t regs[0x40];
+
+    /* Shadow of the OPL2 registers, so that writes that do not change
+     * anything can be dropped.
+     */
+    uint8_t opl[0x100];
+
+    /* OPL2 F-number for each OPLL F-number at the same block. Values larger
+     * than 10 bits are moved to a higher block when they are used.
+     */
+    uint16_t fnum[512];
+} s;
+
+static void
+opl_write(struct vgm_out *o, uint8_t reg, uint8_t value)
+{
+    if (s.opl[reg] == value)
+        return;
+
+    s.opl[reg] = value;
+    vgm_out_write(o, 0x5a, reg, value);
+}
+
+/**
+ * Build the F-number table for an OPLL clock.
+ *
+ * An OPL2 F-number has one more bit of precision than an OPLL F-number, so
+ * at the standard clocks each entry is just twice its index.
+ */
+static void
+build_fnum_table(uint32_t clock)
+{
+    const uint32_t ratio = vgm_clock_ratio(clock, OPL2_CLOCK_DIV4);
+
+    for (unsigned f = 0; f < 512; f++) {
+        const uint32_t opl_fnum = ((uint32_t) f * 2 * ratio + 0x8000) >> 16;
+
+        s.fnum[f] = opl_fnum > 0xffff ? 0xffff : (uint16_t) opl_fnum;
+    }
+}
+
+/**
+ * Write every OPL2 register of a channel from the OPLL state.
+ *
+ * The frequency and key-on register is written last, so a note starts with
+ * all of the other settings in place, and a note that is released uses the
+ * release rate for its sustain setting.
+ */
+static void
+update_channel(struct vgm_out *o, unsigned ch)
+{
+    const bool rhythm = ch >= 6 && (s.regs[0x0e] & RHYTHM_MODE) != 0;
+    const uint8_t inst_vol = s.regs[0x30 + ch];
+    const uint8_t ctrl = s.regs[0x20 + ch];
+    const unsigned inst = rhythm ? ch + 10 : inst_vol >> 4;
+    const uint8_t *const p = inst == 0 ? s.regs : rom_patches[inst];
+    const uint8_t mod = mod_slot[ch];
+    const uint8_t car = mod + 3;
+
+    /* In rhythm mode, the keys are in register 0x0e instead. */
+    const bool key = !rhythm && (ctrl & 0x10) != 0;
+
+    /* The OPLL has 3dB volume steps, and the OPL2 has 0.75dB steps. In
+     * rhythm mode, the upper half of the volume byte is the volume of the
+     * high-hat or tom-tom, which are played by the modulator.
+     */
+    const uint8_t mod_tl = rhythm && ch != 6
+        ? (inst_vol >> 4) << 2 : p[2] & 0x3f;
+    const uint8_t car_tl = (inst_vol & 0x0f) << 2;
+
+    /* A released note decays at the OPLL's fixed rate for its sustain
+     * setting instead of at the instrument's release rate.
+     */
+    uint8_t car_rr = p[7] & 0x0f;
+
+    if (!rhythm && !key) {
+        if ((ctrl & 0x20) != 0)
+            car_rr = 5;
+        else if ((p[1] & 0x20) == 0)
+            car_rr = 7;
+    }
+
+    opl_write(o, 0x20 + mod, p[0]);
+    opl_write(o, 0x20 + car, p[1]);
+    opl_write(o, 0x40 + mod, (p[2] & 0xc0) | mod_tl);
+    opl_write(o, 0x40 + car, (p[3] & 0xc0) | car_tl);
+    opl_write(o, 0x60 + mod, p[4]);
+    opl_write(o, 0x60 + car, p[5]);
+    opl_write(o, 0x80 + mod, p[6]);
+    opl_write(o, 0x80 + car, (p[7] & 0xf0) | car_rr);
+    opl_write(o, 0xe0 + mod, (p[3] >> 3) & 1);
+    opl_write(o, 0xe0 + car, (p[3] >> 4) & 1);
+
+    /* Feedback, and always FM. */
+    opl_write(o, 0xc0 + ch, (p[3] & 0x07) << 1);
+
+    uint16_t fnum = s.fnum[s.regs[0x10 + ch] | ((ctrl & 0x01) << 8)];
+    uint8_t block = (ctrl >> 1) & 0x07;
+
+    while (fnum > 0x3ff && block < 7) {
+        fnum >>= 1;
+        block++;
+    }
+
+    if (fnum > 0x3ff)
+        fnum = 0x3ff;
+
+    opl_write(o, 0xa0 + ch, fnum & 0xff);
+    opl_write(o, 0xb0 + ch, (key ? 0x20 : 0) | (block << 2) | (fnum >> 8));
+}
+
+static void
+opll_write(struct vgm_out *o, uint8_t reg, uint8_t value)
+{
+    if (reg >= sizeof(s.regs))
+        return;
+
+    s.regs[reg] = value;
+
+    if (reg < 0x08) {
+        /* User instrument. Update every channel that uses it. */
+        for (unsigned ch = 0; ch < 9; ch++) {
+            if ((s.regs[0x30 + ch] & 0xf0) == 0)
+                update_channel(o, ch);
+        }
+    } else if (reg == 0x0e) {
+        for (unsigned ch = 6; ch < 9; ch++)
+            update_channel(o, ch);
+
+        /* The OPLL always uses the deeper AM and vibrato. The rhythm bits
+         * are in the same places in both chips.
+         */
+        opl_write(o, 0xbd, 0xc0 | (value & 0x3f));
+    } else if ((reg & 0x0f) < 9 && reg >= 0x10) {
+        update_channel(o, reg & 0x0f);
+    }
+}
+
+bool
+opll_translate(struct vgm_out *o, struct vgm_buf *v,
+               const struct vgm_header *header)
+{
+    memset(&s, 0, sizeof(s));
+    build_fnum_table(header->ym2314_clock & 0x3fffffff);
+
+    /* Allow the waveform select registers to be used. */
+    opl_write(o, 0x01, 0x20);
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_CHIP_WRITE:
+            if (e.command == 0x51) {
+                opll_write(o, e.data[0], e.data[1]);
+                break;
+            }
+
+            vgm_out_copy(o, v, start);
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_OPLL_H
+#define VGM_OPLL_H
+
+#include "vgm_pass.h"
+
+/* Clock of the YM3812 on an AdLib or Sound Blaster, which is 3.579545MHz,
+ * the 14.318180MHz system crystal divided by 4. Both the OPL2 and the OPLL
+ * divide their clock by 72, so at this clock the OPL2 has the same sample
+ * rate as an OPLL at 3.579545MHz.
+ */
+#define OPL2_CLOCK_DIV4 3579545UL
+
+/**
+ * Load-time pass that translates YM2413 (OPLL) writes to YM3812 (OPL2)
+ * writes.
+ *
+ * Each 0x51 command is replaced by the 0x5a commands that make an OPL2 (an
+ * AdLib or Sound Blaster) play the same notes. The OPLL instruments are
+ * loaded from a table of the patches in its ROM, and frequencies are
+ * converted by a table built for the clock in the header. Only OPL2
+ * registers that change are written. All other commands are copied
+ * unchanged.
+ */
+bool opll_translate(struct vgm_out *o, struct vgm_buf *v,
+                    const struct vgm_header *header);
+
+#endif /* ifndef VGM_OPLL_H */
@@ -0,0 +1,384 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_PASS_H
+#define VGM_PASS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm.h"
+#include "vgm_buf.h"
+
+/**
+ * \file
+ * Load-time rewriting of VGM data.
+ *
+ * A pass reads all of the VGM data in a \c vgm_buf and writes a new command
+ * stream to a \c vgm_out. Work that would otherwise be done for every
+ * command during playback (translating writes for one chip into writes for
+ * another, for example) is done once, before playback starts.
+ *
+ * Each pass runs twice. The first run only counts the bytes of output so that
+ * the caller can allocate exactly enough memory, and the second run writes
+ * them. A pass must produce the same output both times, so all of its state
+ * is initialized at the start of the pass.
+ *
+ * The state of a pass is usually too large for the DOS stack, so it is kept
+ * in a static struct at file scope. This is safe because only one pass runs
+ * at a time.
+ */
+
+struct vgm_out {
+    /* Where the next byte is written, or NULL when only counting. ptr is a
+     * normalized far pointer, and window is the number of bytes that can be
+     * written through it before it must be renormalized.
+     */
+    uint8_t far *ptr;
+    uint16_t window;
+
+    /* Number of bytes written (or counted). */
+    uint32_t size;
+
+    /* Position of the loop point in the input, and where it ended up in the
+     * output. loop_in is VGM_BUF_SIZE_UNKNOWN if there is no loop.
+     */
+    uint32_t loop_in;
+    uint32_t loop_out;
+};
+
+/**
+ * Run a pass over all of the data in \c v.
+ *
+ * \return
+ * False if the VGM data could not be parsed.
+ */
+typedef bool (*vgm_pass_fn)(struct vgm_out *o, struct vgm_buf *v,
+                            const struct vgm_header *header);
+
+/**
+ * Prepare to run a pass.
+ *
+ * \param out  Output buffer, or NULL to only count the output.
+ * \param loop Position of the loop point in the input data.
+ */
+static inline void
+vgm_out_init(struct vgm_out *o, uint8_t far *out, uint32_t loop)
+{
+    o->ptr = out;
+    o->window = 0;
+    o->size = 0;
+    o->loop_in = loop;
+    o->loop_out = loop;
+}
+
+static inline void
+vgm_out_byte(struct vgm_out *o, uint8_t b)
+{
+    o->size++;
+
+    if (o->ptr == NULL)
+        return;
+
+    if (o->window == 0) {
+        o->ptr = normalize_ptr(o->ptr, 0);
+        o->window = CURSOR_MAX;
+    }
+
+    *o->ptr++ = b;
+    o->window--;
+}
+
+/**
+ * Write a command with two operand bytes, such as 0x5a (YM3812 write).
+ */
+static inline void
+vgm_out_write(struct vgm_out *o, uint8_t command, uint8_t a, uint8_t b)
+{
+    vgm_out_byte(o, command);
+    vgm_out_byte(o, a);
+    vgm_out_byte(o, b);
+}
+
+/**
+ * Note the position of the next command in the input.
+ *
+ * Call this before decoding each command so that the loop point can be
+ * found in the output.
+ */
+static inline void
+vgm_out_mark(struct vgm_out *o, const struct vgm_buf *v)
+{
+    if (vgm_buf_tell(v) == o->loop_in)
+        o->loop_out = o->size;
+}
+
+/**
+ * Copy the input from \c start to the current position unchanged.
+ *
+ * This is used for every command that a pass does not rewrite.
+ */
+static inline void
+vgm_out_copy(struct vgm_out *o, const struct vgm_buf *v, uint32_t start)
+{
+    const uint32_t end = vgm_buf_tell(v);
+
+    if (o->ptr == NULL) {
+        o->size += end - start;
+        return;
+    }
+
+    /* Data blocks can be larger than 64k, so the source is renormalized
+     * along with the destination.
+     */
+    for (uint32_t pos = start; pos < end; /* empty */) {
+        const uint8_t far *src = normalize_ptr(v->buffer, pos);
+        const uint16_t n = end - pos > CURSOR_MAX
+            ? CURSOR_MAX : (uint16_t)(end - pos);
+
+        for (uint16_t i = 0; i < n; i++)
+            vgm_out_byte(o, *src++);
+
+        pos += n;
+    }
+}
+
+/**
+ * Write a wait of any length.
+ */
+static inline void
+vgm_out_wait(struct vgm_out *o, uint32_t samples)
+{
+    while (samples != 0) {
+        const uint16_t n = samples > 0xffff ? 0xffff : (uint16_t) samples;
+
+        if (n <= 16) {
+            vgm_out_byte(o, 0x70 | (n - 1));
+        } else {
+            vgm_out_byte(o, 0x61);
+            vgm_out_byte(o, n & 0xff);
+            vgm_out_byte(o, n >> 8);
+        }
+
+        samples -= n;
+    }
+}
+
+/**
+ * Calculate num / den as 16.16 fixed point.
+ *
+ * This is done as long division so that nothing overflows 32 bits, even for
+ * clocks in the tens of MHz.
+ */
+static inline uint32_t
+vgm_clock_ratio(uint32_t num, uint32_t den)
+{
+    uint32_t ratio = num / den;
+    uint32_t rem = num % den;
+
+    for (unsigned i = 0; i < 2; i++) {
+        rem <<= 8;
+        ratio = (ratio << 8) | (rem / den);
+        rem %= den;
+    }
+
+    return ratio;
+}
+
+/**
+ * Periodic events inside of waits.
+ *
+ * Chips that are translated to the SN76489 do some of their work (envelopes
+ * and note lengths) from a timer. A pass that models them splits each wait
+ * at the timer ticks. Time is kept in 1/64 samples, which is exact for the
+ * 240Hz NES frame counter and the 256Hz Game Boy sequencer.
+ */
+struct vgm_ticker {
+    /* 1/64 samples between ticks, and until the next tick. */
+    uint32_t period;
+    uint32_t next;
+
+    /* 1/64 samples of the current wait that have not been written. */
+    uint32_t remain;
+
+    /* Fraction of a sample, in 1/64 samples, that has not been written. */
+    uint8_t frac;
+};
+
+static inline void
+vgm_ticker_init(struct vgm_ticker *t, uint32_t period)
+{
+    t->period = period;
+    t->next = period;
+    t->remain = 0;
+    t->frac = 0;
+}
+
+static inline void
+vgm_ticker_emit(struct vgm_out *o, struct vgm_ticker *t, uint32_t units)
+{
+    const uint32_t total = units + t->frac;
+
+    vgm_out_wait(o, total >> 6);
+    t->frac = total & 63;
+}
+
+/**
+ * Write the part of a wait up to the next tick.
+ *
+ * Use as
+ *
+ *     t.remain = samples * 64;
+ *     while (vgm_ticker_step(o, &t))
+ *         tick();
+ *
+ * \return
+ * True if a tick happens before the end of the wait.
+ */
+static inline bool
+vgm_ticker_step(struct vgm_out *o, struct vgm_ticker *t)
+{
+    if (t->remain < t->next) {
+        vgm_ticker_emit(o, t, t->remain);
+        t->next -= t->remain;
+        t->remain = 0;
+        return false;
+    }
+
+    vgm_ticker_emit(o, t, t->next);
+    t->remain -= t->next;
+    t->next = t->period;
+    return true;
+}
+
+/* Clock of the SN76489 in the Tandy 1000. Passes that translate other chips
+ * to the SN76489 convert their frequencies for this clock.
+ */
+#define VGM_PSG_CLOCK 3579545UL
+
+/**
+ * Shadow of the SN76489 state written by a translating pass.
+ *
+ * The pass sets the state it wants for each voice, and only the registers
+ * that change are written.
+ */
+struct vgm_psg_out {
+    uint16_t tone[3];
+    uint8_t atten[4];
+    uint8_t noise;
+};
+
+static inline void
+vgm_psg_out_init(struct vgm_psg_out *p)
+{
+    for (unsigned ch = 0; ch < 3; ch++)
+        p->tone[ch] = 0;
+
+    /* All voices silent, as left by the player before it starts. */
+    for (unsigned ch = 0; ch < 4; ch++)
+        p->atten[ch] = 0x0f;
+
+    p->noise = 0;
+}
+
+/**
+ * Set the 10-bit period of a tone voice.
+ */
+static inline void
+vgm_psg_tone(struct vgm_out *o, struct vgm_psg_out *p, unsigned ch,
+             uint16_t period)
+{
+    if (p->tone[ch] == period)
+        return;
+
+    p->tone[ch] = period;
+    vgm_out_byte(o, 0x50);
+    vgm_out_byte(o, 0x80 | (ch << 5) | (period & 0x0f));
+    vgm_out_byte(o, 0x50);
+    vgm_out_byte(o, (period >> 4) & 0x3f);
+}
+
+/**
+ * Set the attenuation (0 is loudest, 15 is silent) of a voice. Voice 3 is
+ * the noise.
+ */
+static inline void
+vgm_psg_atten(struct vgm_out *o, struct vgm_psg_out *p, unsigned ch,
+              uint8_t atten)
+{
+    if (p->atten[ch] == atten)
+        return;
+
+    p->atten[ch] = atten;
+    vgm_out_byte(o, 0x50);
+    vgm_out_byte(o, 0x90 | (ch << 5) | atten);
+}
+
+/**
+ * Set the noise control bits (feedback and shift rate).
+ *
+ * Writing the noise control resets the noise generator, so it is only done
+ * when the setting changes.
+ */
+static inline void
+vgm_psg_noise(struct vgm_out *o, struct vgm_psg_out *p, uint8_t noise)
+{
+    if (p->noise == noise)
+        return;
+
+    p->noise = noise;
+    vgm_out_byte(o, 0x50);
+    vgm_out_byte(o, 0xe0 | noise);
+}
+
+/**
+ * Fit a tone period into the 10 bits of the SN76489.
+ *
+ * Notes that are too low are played an octave (or more) higher instead of
+ * all at the lowest note.
+ */
+static inline uint16_t
+vgm_psg_fold_period(uint32_t period)
+{
+    while (period > 0x3ff)
+        period >>= 1;
+
+    return period == 0 ? 1 : (uint16_t) period;
+}
+
+/**
+ * Convert a volume with 16 linear steps (15 is loudest) to an SN76489
+ * attenuation with 2dB steps.
+ */
+static inline uint8_t
+vgm_psg_linear_atten(uint8_t volume)
+{
+    static const uint8_t atten[16] = {
+        15, 12, 9, 7, 6, 5, 4, 3, 3, 2, 2, 1, 1, 1, 0, 0
+    };
+
+    return atten[volume & 0x0f];
+}
+
+/**
+ * Pick the SN76489 noise shift rate closest to a shift register clock.
+ *
+ * \param freq  Rate, in Hz, at which the source chip's noise shifts.
+ * \return
+ * The shift rate bits of the noise control (0, 1, or 2). The rates are the
+ * PSG clock divided by 512, 1024, and 2048, and the cut-over points are half
+ * way between them on a log scale.
+ */
+static inline uint8_t
+vgm_psg_noise_rate(uint32_t freq)
+{
+    if (freq >= VGM_PSG_CLOCK / 724)
+        return 0;
+    else if (freq >= VGM_PSG_CLOCK / 1448)
+        return 1;
+    else
+        return 2;
+}
+
+#endif /* ifndef VGM_PASS_H */
@@ -0,0 +1,528 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "vgm_player.h"
+#include "vgm_buf.h"
+#include "vgm_iter.h"
+
+/* Enough for the state restored by a seek: three tone channels (latch, data,
+ * and volume each) and the noise channel (control and volume) of each
+ * SN76489, starting the PC speaker, the 29 registers of each SAA1099, and
+ * the 245 registers of the OPL2 (address and data each).
+ */
+#define MAX_PENDING 680
+
+/* Registers of each SAA1099 that hold state. 0x1c (sound enable and reset)
+ * is the last one.
+ */
+#define SAA_REGS 0x1d
+
+struct vgm_player {
+    struct vgm_header header;
+
+    const uint8_t *data;
+    size_t size;
+
+    struct vgm_buf v;
+
+    /* Time of the decoder, and the end of the current window. */
+    uint32_t time;
+    uint32_t limit;
+
+    /* Part of the current wait command that has not elapsed. */
+    uint32_t wait;
+
+    /* Writes are not returned while seeking. Only the shadow state is
+     * updated.
+     */
+    bool seeking;
+    bool done;
+
+    /* Shadow of the registers of each SN76489, indexed by the register bits
+     * of a latch byte (bits 4 through 6). The second chip is only restored
+     * by a seek if the file has written to it.
+     */
+    uint16_t psg_regs[2][8];
+    uint8_t psg_latch[2];
+    bool psg2_used;
+
+    /* AY-8910 channel A period and the PC speaker state derived from it. */
+    uint16_t ay_period;
+    uint16_t speaker_period;
+    bool speaker_on;
+
+    /* Shadow of the SAA1099 registers. The state is only restored by a seek
+     * if the file has written to either chip.
+     */
+    uint8_t saa_regs[2][SAA_REGS];
+    bool saa_used;
+
+    /* Shadow of the OPL2 registers. Like the SAA1099, the state is only
+     * restored if the file has written to the chip.
+     */
+    uint8_t opl_regs[0x100];
+    bool opl_used;
+
+    struct vgm_port_write pending[MAX_PENDING];
+    unsigned pending_head;
+    unsigned pending_count;
+};
+
+static void
+queue_write(struct vgm_player *p, uint16_t port, uint8_t value)
+{
+    if (p->seeking || p->pending_count >= MAX_PENDING)
+        return;
+
+    struct vgm_port_write *const w =
+        &p->pending[(p->pending_head + p->pending_count) % MAX_PENDING];
+
+    w->sample = p->time;
+    w->port = port;
+    w->value = value;
+    p->pending_count++;
+}
+
+static const uint16_t psg_ports[2] = { VGM_PORT_PSG, VGM_PORT_PSG2 };
+
+static void
+psg_write(struct vgm_player *p, unsigned chip, uint8_t value)
+{
+    uint16_t *const regs = p->psg_regs[chip];
+    const unsigned latch = p->psg_latch[chip];
+
+    if ((value & 0x80) != 0) {
+        const unsigned reg = (value >> 4) & 7;
+
+        p->psg_latch[chip] = reg;
+        regs[reg] = (regs[reg] & ~0x000f) | (value & 0x0f);
+    } else if ((latch & 1) == 0 && latch != 6) {
+        /* Data byte for a tone register supplies the upper 6 bits. */
+        regs[latch] = (regs[latch] & 0x000f) |
+            ((uint16_t)(value & 0x3f) << 4);
+    } else {
+        regs[latch] = value & 0x0f;
+    }
+
+    queue_write(p, psg_ports[chip], value);
+}
+
+static void
+speaker_start(struct vgm_player *p, unsigned freq)
+{
+    if (freq == 0)
+        return;
+
+    const uint32_t period = 0x1234dcUL / freq;
+
+    p->speaker_period = period > 0xfffe ? 0xfffe : (period & 0xfffe);
+    p->speaker_on = true;
+
+    queue_write(p, VGM_PORT_PIT_CTRL, 0xb6);
+    queue_write(p, VGM_PORT_PIT_CH2, p->speaker_period & 0x00ff);
+    queue_write(p, VGM_PORT_PIT_CH2, p->speaker_period >> 8);
+    queue_write(p, VGM_PORT_SPEAKER, 0x03);
+}
+
+static void
+speaker_stop(struct vgm_player *p)
+{
+    p->speaker_on = false;
+    queue_write(p, VGM_PORT_SPEAKER, 0x00);
+}
+
+static void
+ay8910_write(struct vgm_player *p, uint8_t reg, uint8_t value)
+{
+    /* Only channel A is played, on the PC speaker. See play_Tandy_sound in
+     * main.c.
+     */
+    if (reg == 0) {
+        p->ay_period = (p->ay_period & 0xff00) | value;
+    } else if (reg == 1) {
+        p->ay_period = 0x0fff & ((p->ay_period & 0x00ff) |
+                                 ((uint16_t)value << 8));
+        if (p->ay_period != 0)
+            speaker_start(p, p->header.ay8910_clock / (16 * p->ay_period));
+    } else if (reg == 7) {
+        if ((value & 1) != 0 && p->ay_period != 0)
+            speaker_start(p, p->header.ay8910_clock / (16 * p->ay_period));
+    } else if (reg == 8) {
+        if ((value & 1) == 0)
+            speaker_stop(p);
+    }
+}
+
+static void
+saa1099_write(struct vgm_player *p, uint8_t reg, uint8_t value)
+{
+    const unsigned chip = (reg & 0x80) != 0 ? 1 : 0;
+    const uint16_t port = VGM_PORT_CMS + chip * 2;
+
+    if ((reg & 0x1f) < SAA_REGS)
+        p->saa_regs[chip][reg & 0x1f] = value;
+
+    p->saa_used = true;
+
+    queue_write(p, port + 1, reg & 0x1f);
+    queue_write(p, port, value);
+}
+
+static void
+opl2_write(struct vgm_player *p, uint8_t reg, uint8_t value)
+{
+    p->opl_regs[reg] = value;
+    p->opl_used = true;
+
+    queue_write(p, VGM_PORT_OPL, reg);
+    queue_write(p, VGM_PORT_OPL + 1, value);
+}
+
+/**
+ * Decode one command.
+ */
+static void
+decode_command(struct vgm_player *p)
+{
+    struct vgm_event e;
+
+    switch (vgm_next_event(&p->v, &e)) {
+    case VGM_EVENT_PSG_WRITE:
+        psg_write(p, 0, e.value);
+        break;
+
+    case VGM_EVENT_PSG2_WRITE:
+        psg_write(p, 1, e.value);
+        p->psg2_used = true;
+        break;
+
+    case VGM_EVENT_WAIT:
+        p->wait = e.samples;
+        break;
+
+    case VGM_EVENT_AY8910_WRITE:
+        ay8910_write(p, e.reg, e.value);
+        break;
+
+    case VGM_EVENT_SAA1099_WRITE:
+        saa1099_write(p, e.reg, e.value);
+        break;
+
+    case VGM_EVENT_OPL2_WRITE:
+        opl2_write(p, e.reg, e.value);
+        break;
+
+    case VGM_EVENT_DATA_BLOCK:
+    case VGM_EVENT_CHIP_WRITE:
+        break;
+
+    case VGM_EVENT_END:
+    case VGM_EVENT_ERROR:
+        p->done = true;
+        break;
+    }
+}
+
+/**
+ * Decode until there is a pending write, the end of the window is reached,
+ * or the end of the data is reached.
+ */
+static void
+decode(struct vgm_player *p)
+{
+    while (p->pending_count == 0) {
+        if (p->wait != 0) {
+            if (p->time >= p->limit)
+                return;
+
+            const uint32_t advance = p->limit - p->time < p->wait
+                ? p->limit - p->time : p->wait;
+
+            p->time += advance;
+            p->wait -= advance;
+            continue;
+        }
+
+        if (p->done || p->time >= p->limit)
+            return;
+
+        decode_command(p);
+    }
+}
+
+static void
+reset(struct vgm_player *p)
+{
+    vgm_buf_seek(&p->v, 0);
+
+    p->time = 0;
+    p->limit = 0;
+    p->wait = 0;
+    p->seeking = false;
+    p->done = false;
+    p->pending_head = 0;
+    p->pending_count = 0;
+
+    /* All channels silent. */
+    for (unsigned chip = 0; chip < 2; chip++) {
+        for (unsigned i = 0; i < 8; i++)
+            p->psg_regs[chip][i] = (i & 1) != 0 ? 0x0f : 0;
+
+        p->psg_latch[chip] = 0;
+    }
+
+    p->psg2_used = false;
+    p->ay_period = 0;
+    p->speaker_period = 0;
+    p->speaker_on = false;
+
+    memset(p->saa_regs, 0, sizeof(p->saa_regs));
+    p->saa_used = false;
+
+    memset(p->opl_regs, 0, sizeof(p->opl_regs));
+    p->opl_used = false;
+}
+
+static uint32_t
+read_le32(const uint8_t *ptr)
+{
+    return (uint32_t) ptr[0] | ((uint32_t) ptr[1] << 8) |
+        ((uint32_t) ptr[2] << 16) | ((uint32_t) ptr[3] << 24);
+}
+
+uint32_t
+vgm_data_start(const void *data, size_t size)
+{
+    if (size < 0x40)
+        return size;
+
+    /* Before version 1.50, the VGM data always starts at 0x40. */
+    const uint32_t version = read_le32((const uint8_t *) data + 0x08);
+    const uint32_t data_offset = read_le32((const uint8_t *) data + 0x34);
+    const uint32_t data_start = version >= 0x150 && data_offset != 0
+        ? data_offset + 0x34 : 0x40;
+
+    return data_start > size ? size : data_start;
+}
+
+struct vgm_player *
+vgm_player_open_memory(const void *data, size_t size)
+{
+    static const char ident[4] = { 'V', 'g', 'm', ' ' };
+
+    if (size < 0x40 || memcmp(data, ident, sizeof(ident)) != 0)
+        return NULL;
+
+    struct vgm_player *const p = calloc(1, sizeof(*p));
+    if (p == NULL)
+        return NULL;
+
+    p->data = data;
+    p->size = size;
+
+    const uint32_t data_start = vgm_data_start(data, size);
+
+    /* Header fields that overlap the VGM data do not exist in this file's
+     * header version. Leave them zero.
+     */
+    const size_t header_bytes = data_start < sizeof(p->header)
+        ? data_start : sizeof(p->header);
+
+    memcpy(&p->header, data, header_bytes);
+
+    if (p->header.version < 0x151) {
+        p->header.sn76489_flags = 0;
+        p->header.ay8910_clock = 0;
+    }
+
+    vgm_buf_init(&p->v, (uint8_t *) data + data_start, size - data_start);
+    reset(p);
+
+    return p;
+}
+
+void
+vgm_player_close(struct vgm_player *p)
+{
+    free(p);
+}
+
+const struct vgm_header *
+vgm_player_header(const struct vgm_player *p)
+{
+    return &p->header;
+}
+
+int
+vgm_player_gd3(const struct vgm_player *p, enum vgm_gd3_field field,
+               char *buf, size_t size)
+{
+    static const char ident[4] = { 'G', 'd', '3', ' ' };
+
+    if (p->header.gd3_offset == 0)
+        return -1;
+
+    /* The GD3 offset is relative to its own location in the header. */
+    const uint64_t start = (uint64_t) p->header.gd3_offset + 0x14;
+
+    if (start + 12 > p->size || memcmp(p->data + start, ident, 4) != 0)
+        return -1;
+
+    const uint8_t *s = p->data + start + 12;
+    const uint32_t length = read_le32(p->data + start + 8);
+    const uint8_t *const end = start + 12 + length > p->size
+        ? p->data + p->size : s + length;
+
+    /* Skip the fields before the requested field. Each field is a string of
+     * UTF-16LE characters terminated by a zero character.
+     */
+    for (unsigned i = 0; i < (unsigned) field; i++) {
+        while (s + 1 < end && (s[0] != 0 || s[1] != 0))
+            s += 2;
+
+        s += 2;
+        if (s > end)
+            return -1;
+    }
+
+    size_t len = 0;
+    while (s + 1 < end && (s[0] != 0 || s[1] != 0)) {
+        if (len + 1 < size)
+            buf[len] = (s[1] == 0 && s[0] < 0x80) ? (char) s[0] : '?';
+
+        len++;
+        s += 2;
+    }
+
+    if (size != 0)
+        buf[len < size ? len : size - 1] = '\0';
+
+    return (int) len;
+}
+
+uint32_t
+vgm_player_step(struct vgm_player *p, uint32_t samples)
+{
+    p->limit += samples;
+    return p->limit;
+}
+
+bool
+vgm_player_next_write(struct vgm_player *p, struct vgm_port_write *w)
+{
+    decode(p);
+
+    if (p->pending_count == 0)
+        return false;
+
+    *w = p->pending[p->pending_head];
+    p->pending_head = (p->pending_head + 1) % MAX_PENDING;
+    p->pending_count--;
+
+    return true;
+}
+
+void
+vgm_player_seek(struct vgm_player *p, uint32_t sample)
+{
+    if (sample < p->time || p->pending_count != 0)
+        reset(p);
+
+    p->seeking = true;
+    p->limit = sample;
+    decode(p);
+    p->seeking = false;
+
+    /* Restore the state of the sound hardware at the new position. */
+    const unsigned psg_chips = p->psg2_used ? 2 : 1;
+
+    for (unsigned chip = 0; chip < psg_chips; chip++) {
+        const uint16_t *const regs = p->psg_regs[chip];
+        const uint16_t port = psg_ports[chip];
+
+        for (unsigned ch = 0; ch < 3; ch++) {
+            const uint16_t tone = regs[ch * 2];
+
+            queue_write(p, port, 0x80 | (ch << 5) | (tone & 0x0f));
+            queue_write(p, port, tone >> 4);
+            queue_write(p, port, 0x90 | (ch << 5) | regs[ch * 2 + 1]);
+        }
+
+        queue_write(p, port, 0xe0 | regs[6]);
+        queue_write(p, port, 0xf0 | regs[7]);
+    }
+
+    if (p->speaker_on) {
+        queue_write(p, VGM_PORT_PIT_CTRL, 0xb6);
+        queue_write(p, VGM_PORT_PIT_CH2, p->speaker_period & 0x00ff);
+        queue_write(p, VGM_PORT_PIT_CH2, p->speaker_period >> 8);
+        queue_write(p, VGM_PORT_SPEAKER, 0x03);
+    } else {
+        queue_write(p, VGM_PORT_SPEAKER, 0x00);
+    }
+
+    /* The enable register goes last so that the chips do not make any sound
+     * until all of the other registers are restored.
+     */
+    if (p->saa_used) {
+        for (unsigned chip = 0; chip < 2; chip++) {
+            const uint16_t port = VGM_PORT_CMS + chip * 2;
+
+            for (unsigned reg = 0; reg < SAA_REGS; reg++) {
+                queue_write(p, port + 1, reg);
+                queue_write(p, port, p->saa_regs[chip][reg]);
+            }
+        }
+    }
+
+    /* The key-on registers go last so that notes start with all of their
+     * settings in place.
+     */
+    if (p->opl_used) {
+        for (unsigned reg = 0x01; reg <= 0xf5; reg++) {
+            if (reg < 0xb0 || reg > 0xb8) {
+                queue_write(p, VGM_PORT_OPL, reg);
+                queue_write(p, VGM_PORT_OPL + 1, p->opl_regs[reg]);
+            }
+        }
+
+        for (unsigned reg = 0xb0; reg <= 0xb8; reg++) {
+            queue_write(p, VGM_PORT_OPL, reg);
+            queue_write(p, VGM_PORT_OPL + 1, p->opl_regs[reg]);
+        }
+    }
+
+    /* Restore the latch so that a following data byte goes to the same
+     * register it would have originally.
+     */
+    for (unsigned chip = 0; chip < psg_chips; chip++) {
+        const unsigned reg = p->psg_latch[chip];
+
+        if (reg != 7) {
+            queue_write(p, psg_ports[chip],
+                        0x80 | (reg << 4) | (p->psg_regs[chip][reg] & 0x0f));
+        }
+    }
+}
+
+uint32_t
+vgm_player_position(const struct vgm_player *p)
+{
+    /* Once the end of the data is reached, the window cannot extend past
+     * it.
+     */
+    if (p->done && p->wait == 0 && p->time < p->limit)
+        return p->time;
+
+    return p->limit;
+}
+
+bool
+vgm_player_done(const struct vgm_player *p)
+{
+    return p->done && p->wait == 0 && p->pending_count == 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_PLAYER_H
+#define VGM_PLAYER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm.h"
+
+/**
+ * \file
+ * Incremental VGM playback library for host tools.
+ *
+ * A \c vgm_player decodes a VGM file held in memory into the same sequence
+ * of I/O port writes that the DOS player would make on a Tandy 1000. All
+ * state lives in the \c vgm_player, so any number of files can be processed
+ * at once from separate threads.
+ *
+ * Time is measured in 44.1kHz samples from the start of the file. Playback
+ * advances in two steps. \c vgm_player_step moves the end of the current
+ * time window forward, and \c vgm_player_next_write returns the port writes
+ * that occur before the end of the window, in order.
+ */
+
+/* Ports written by the player. */
+#define VGM_PORT_PSG           0xc0
+
+/**
+ * Second SN76489 (the right channel of Game Gear stereo). The DOS player
+ * uses this port when run with /psg2:1e0.
+ */
+#define VGM_PORT_PSG2          0x1e0
+#define VGM_PORT_PIT_CH2       0x42
+#define VGM_PORT_PIT_CTRL      0x43
+
+/**
+ * PC speaker gate.
+ *
+ * Port 0x61 is shared with other hardware, so writes only carry the speaker
+ * gate bits (bits 0 and 1). A real write must merge them with the current
+ * value of the port.
+ */
+#define VGM_PORT_SPEAKER       0x61
+
+/**
+ * Creative Music System / Game Blaster base port.
+ *
+ * Each SAA1099 register write is two port writes: the register number to
+ * the address port (base + 1 for the first chip, base + 3 for the second),
+ * then the value to the data port (base + 0 or base + 2).
+ */
+#define VGM_PORT_CMS           0x220
+
+/**
+ * AdLib (OPL2) address port. The data port is the next port.
+ */
+#define VGM_PORT_OPL           0x388
+
+struct vgm_port_write {
+    /** Time of the write in 44.1kHz samples. */
+    uint32_t sample;
+
+    uint16_t port;
+    uint8_t value;
+};
+
+/** Fields of the GD3 tag, in the order they are stored. */
+enum vgm_gd3_field {
+    VGM_GD3_TRACK_NAME,
+    VGM_GD3_TRACK_NAME_JP,
+    VGM_GD3_GAME_NAME,
+    VGM_GD3_GAME_NAME_JP,
+    VGM_GD3_SYSTEM_NAME,
+    VGM_GD3_SYSTEM_NAME_JP,
+    VGM_GD3_AUTHOR,
+    VGM_GD3_AUTHOR_JP,
+    VGM_GD3_DATE,
+    VGM_GD3_RIPPER,
+    VGM_GD3_NOTES,
+};
+
+struct vgm_player;
+
+/**
+ * Get the offset of the VGM command data in a file.
+ *
+ * \return
+ * The offset, or \c size if the data is too short to be a VGM file.
+ */
+uint32_t vgm_data_start(const void *data, size_t size);
+
+/**
+ * Create a player for a VGM file in memory.
+ *
+ * The data is not copied. It must remain valid and unchanged until the
+ * player is closed.
+ *
+ * \return
+ * A new player, or NULL if the data is not a VGM file or memory could not be
+ * allocated.
+ */
+struct vgm_player *vgm_player_open_memory(const void *data, size_t size);
+
+void vgm_player_close(struct vgm_player *p);
+
+/**
+ * Get the file header.
+ *
+ * Fields not present in the file's header version are zero.
+ */
+const struct vgm_header *vgm_player_header(const struct vgm_player *p);
+
+/**
+ * Get a GD3 tag field as ASCII.
+ *
+ * Characters outside of ASCII are replaced by '?'. The result is always
+ * terminated if \c size is not zero.
+ *
+ * \return
+ * The length of the complete field, or -1 if the file has no valid GD3 tag.
+ * If the result is \c size or more, the field was truncated.
+ */
+int vgm_player_gd3(const struct vgm_player *p, enum vgm_gd3_field field,
+                   char *buf, size_t size);
+
+/**
+ * Advance the end of the current time window.
+ *
+ * \return
+ * The new end of the window.
+ */
+uint32_t vgm_player_step(struct vgm_player *p, uint32_t samples);
+
+/**
+ * Get the next port write before the end of the current time window.
+ *
+ * \return
+ * False if there are no more writes in the window.
+ */
+bool vgm_player_next_write(struct vgm_player *p, struct vgm_port_write *w);
+
+/**
+ * Move playback to a specific time.
+ *
+ * The window is reset to end at \c sample. The next writes returned restore
+ * the state of the sound hardware at that time.
+ */
+void vgm_player_seek(struct vgm_player *p, uint32_t sample);
+
+/**
+ * Get the end of the current time window.
+ */
+uint32_t vgm_player_position(const struct vgm_player *p);
+
+/**
+ * Determine whether the end of the VGM data has been reached and all of its
+ * writes have been returned.
+ */
+bool vgm_player_done(const struct vgm_player *p);
+
+#endif /* ifndef VGM_PLAYER_H */
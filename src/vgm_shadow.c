@@ -0,0 +1,222 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_shadow.h"
+#include "vgm_iter.h"
+
+void
+vgm_shadow_init(struct vgm_shadow *s)
+{
+    memset(s, 0, sizeof(*s));
+
+    for (unsigned chip = 0; chip < 2; chip++) {
+        for (unsigned reg = 1; reg < 8; reg += 2)
+            s->psg[chip][reg] = 0x0f;
+    }
+}
+
+static void
+psg_write(struct vgm_shadow *s, unsigned chip, uint8_t value)
+{
+    uint16_t *const regs = s->psg[chip];
+
+    if ((value & 0x80) != 0) {
+        const unsigned reg = (value >> 4) & 7;
+
+        s->latch[chip] = reg;
+        regs[reg] = (regs[reg] & ~0x000f) | (value & 0x0f);
+        return;
+    }
+
+    const unsigned reg = s->latch[chip];
+
+    if ((reg & 1) == 0 && reg != 6)
+        regs[reg] = (regs[reg] & 0x000f) | ((uint16_t)(value & 0x3f) << 4);
+    else
+        regs[reg] = value & 0x0f;
+}
+
+/**
+ * Only channel A is played, on the PC speaker. See play_events in main.c.
+ */
+static void
+ay8910_write(struct vgm_shadow *s, uint8_t reg, uint8_t value)
+{
+    if (reg == 0) {
+        s->ay_period = (s->ay_period & 0xff00) | value;
+    } else if (reg == 1) {
+        s->ay_period = 0x0fff & ((s->ay_period & 0x00ff) |
+                                 ((uint16_t)value << 8));
+        if (s->ay_period != 0)
+            s->speaker_on = true;
+    } else if (reg == 7) {
+        if ((value & 1) != 0 && s->ay_period != 0)
+            s->speaker_on = true;
+    } else if (reg == 8) {
+        if ((value & 1) == 0)
+            s->speaker_on = false;
+    }
+}
+
+void
+vgm_shadow_saa(struct vgm_shadow *s, uint8_t reg, uint8_t value)
+{
+    if ((reg & 0x1f) < VGM_SHADOW_SAA_REGS)
+        s->saa[(reg & 0x80) != 0 ? 1 : 0][reg & 0x1f] = value;
+}
+
+void
+vgm_shadow_event(struct vgm_shadow *s, const struct vgm_event *e)
+{
+    switch (e->type) {
+    case VGM_EVENT_PSG_WRITE:
+        psg_write(s, 0, e->value);
+        break;
+
+    case VGM_EVENT_PSG2_WRITE:
+        psg_write(s, 1, e->value);
+        break;
+
+    case VGM_EVENT_AY8910_WRITE:
+        ay8910_write(s, e->reg, e->value);
+        break;
+
+    case VGM_EVENT_SAA1099_WRITE:
+        vgm_shadow_saa(s, e->reg, e->value);
+        break;
+
+    case VGM_EVENT_OPL2_WRITE:
+        s->opl[e->reg] = e->value;
+        break;
+    }
+}
+
+struct diff {
+    struct vgm_shadow *have;
+    uint8_t *out;
+    uint16_t size;
+};
+
+/**
+ * Store a command, and apply it to the state being changed.
+ */
+static void
+emit(struct diff *d, uint8_t command, uint8_t a, uint8_t b)
+{
+    d->out[d->size++] = command;
+    d->out[d->size++] = a;
+
+    switch (command) {
+    case 0x50:
+        psg_write(d->have, 0, a);
+        return;
+
+    case 0x30:
+        psg_write(d->have, 1, a);
+        return;
+
+    case 0xa0:
+        ay8910_write(d->have, a, b);
+        break;
+
+    case 0xbd:
+        vgm_shadow_saa(d->have, a, b);
+        break;
+
+    case 0x5a:
+        d->have->opl[a] = b;
+        break;
+    }
+
+    d->out[d->size++] = b;
+}
+
+static void
+psg_reg_diff(struct diff *d, const struct vgm_shadow *want, unsigned chip,
+             unsigned reg)
+{
+    const uint8_t command = chip == 0 ? 0x50 : 0x30;
+    const uint16_t w = want->psg[chip][reg];
+    const uint16_t h = d->have->psg[chip][reg];
+
+    if (w == h)
+        return;
+
+    const bool tone = (reg & 1) == 0 && reg != 6;
+    const bool high = tone && ((w ^ h) >> 4) != 0;
+
+    emit(d, command, 0x80 | (reg << 4) | (w & 0x0f), 0);
+    if (high)
+        emit(d, command, w >> 4, 0);
+}
+
+static void
+psg_diff(struct diff *d, const struct vgm_shadow *want, unsigned chip)
+{
+    const uint8_t command = chip == 0 ? 0x50 : 0x30;
+    const unsigned latch = want->latch[chip];
+
+    /* A data byte at the loop point goes to the register latched there, so
+     * that register is written last.
+     */
+    for (unsigned reg = 0; reg < 8; reg++) {
+        if (reg != latch)
+            psg_reg_diff(d, want, chip, reg);
+    }
+
+    psg_reg_diff(d, want, chip, latch);
+
+    /* If the latched register did not change, the latch is moved back by
+     * writing the value it already has. Any write to the noise control
+     * resets the noise shift register, though, so the noise is not
+     * rewritten just to restore the latch. Loops almost always start with a
+     * latch byte.
+     */
+    if (d->have->latch[chip] != latch && latch != 6) {
+        emit(d, command,
+             0x80 | (latch << 4) | (want->psg[chip][latch] & 0x0f), 0);
+    }
+}
+
+uint16_t
+vgm_shadow_diff(const struct vgm_shadow *want, struct vgm_shadow *have,
+                uint8_t *out)
+{
+    struct diff d = { have, out, 0 };
+
+    psg_diff(&d, want, 0);
+    psg_diff(&d, want, 1);
+
+    /* Writing the high byte of the period starts the speaker. */
+    if (want->ay_period != have->ay_period) {
+        emit(&d, 0xa0, 0, want->ay_period & 0xff);
+        emit(&d, 0xa0, 1, want->ay_period >> 8);
+    }
+
+    if (want->speaker_on && !have->speaker_on)
+        emit(&d, 0xa0, 7, 0x01);
+    else if (!want->speaker_on && have->speaker_on)
+        emit(&d, 0xa0, 8, 0x00);
+
+    for (unsigned chip = 0; chip < 2; chip++) {
+        for (unsigned reg = 0; reg < VGM_SHADOW_SAA_REGS; reg++) {
+            if (want->saa[chip][reg] != have->saa[chip][reg])
+                emit(&d, 0xbd, (chip << 7) | reg, want->saa[chip][reg]);
+        }
+    }
+
+    /* Key-on last, so that notes start with all of their settings. */
+    for (unsigned pass = 0; pass < 2; pass++) {
+        for (unsigned reg = 0; reg < 0x100; reg++) {
+            const bool key_on = reg >= 0xb0 && reg <= 0xb8;
+
+            if (key_on == (pass != 0) && want->opl[reg] != have->opl[reg])
+                emit(&d, 0x5a, reg, want->opl[reg]);
+        }
+    }
+
+    return d.size;
+}
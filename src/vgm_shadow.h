@@ -0,0 +1,85 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_SHADOW_H
+#define VGM_SHADOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Registers of each SAA1099 that hold state. 0x1c (sound enable and reset)
+ * is the last one.
+ */
+#define VGM_SHADOW_SAA_REGS 0x1d
+
+/* Largest number of bytes of VGM commands made by vgm_shadow_diff: the
+ * registers of two SN76489s plus a latch byte each, the PC speaker, two
+ * SAA1099s, and an OPL2.
+ */
+#define VGM_SHADOW_DIFF_MAX 1024
+
+/**
+ * \file
+ * Shadow copy of the state of the sound hardware, as written by VGM
+ * commands.
+ *
+ * Registers that have not been written hold the values the player leaves
+ * them with before playback starts: silent SN76489 voices and zero for
+ * everything else.
+ */
+struct vgm_shadow {
+    /* Registers of each SN76489, indexed by the register bits of a latch
+     * byte, and the latched register.
+     */
+    uint16_t psg[2][8];
+    uint8_t latch[2];
+
+    /* AY-8910 channel A period, and whether it is playing on the PC
+     * speaker.
+     */
+    uint16_t ay_period;
+    bool speaker_on;
+
+    uint8_t saa[2][VGM_SHADOW_SAA_REGS];
+    uint8_t opl[0x100];
+};
+
+struct vgm_event;
+
+void vgm_shadow_init(struct vgm_shadow *s);
+
+/**
+ * Update the state for a decoded command. Commands that do not write a
+ * register that is played are ignored.
+ */
+void vgm_shadow_event(struct vgm_shadow *s, const struct vgm_event *e);
+
+/**
+ * Update the state for an SAA1099 write.
+ *
+ * \param reg Register number. Bit 7 selects the second chip.
+ */
+void vgm_shadow_saa(struct vgm_shadow *s, uint8_t reg, uint8_t value);
+
+/**
+ * Make the VGM commands that change the state in \c have to the state in
+ * \c want.
+ *
+ * Only registers that differ are written. Registers that make a chip start
+ * sounding (the SAA1099 enable and the OPL2 key-on registers) are written
+ * after the rest. Each SN76489 is left with the latch in \c want, unless
+ * that is the noise register and it already has the right value, because
+ * rewriting it would reset the noise. \c have is updated as the commands
+ * are made, so its registers are equal to \c want afterward.
+ *
+ * \param out Buffer of at least \c VGM_SHADOW_DIFF_MAX bytes.
+ *
+ * \return
+ * Number of bytes stored in \c out.
+ */
+uint16_t vgm_shadow_diff(const struct vgm_shadow *want,
+                         struct vgm_shadow *have, uint8_t *out);
+
+#endif /* ifndef VGM_SHADOW_H */
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_stereo.h"
+#include "vgm_iter.h"
+
+static struct {
+    /* Shadow of the SN76489 registers, indexed by the register bits of a
+     * latch byte (bits 4 through 6), and the latched register.
+     */
+    uint8_t regs[8];
+    uint8_t latch;
+
+    /* The chips' latches were moved off of \c latch by \c set_pan. */
+    bool relatch;
+
+    /* Pan mask from 0x4f. Bits 4 through 7 enable voices 0 through 3 on the
+     * left, and bits 0 through 3 enable them on the right.
+     */
+    uint8_t pan;
+
+    /* Bits ORed into a write to each register for each chip. For the
+     * attenuation of a voice that is not enabled on a chip, this is 0x0f
+     * (silent). Otherwise it is zero.
+     */
+    uint8_t mask[2][8];
+} s;
+
+static const uint8_t chip_command[2] = { 0x50, 0x30 };
+
+static void
+build_masks(void)
+{
+    for (unsigned ch = 0; ch < 4; ch++) {
+        const unsigned vol = ch * 2 + 1;
+
+        s.mask[0][vol] = (s.pan & (0x10 << ch)) != 0 ? 0x00 : 0x0f;
+        s.mask[1][vol] = (s.pan & (0x01 << ch)) != 0 ? 0x00 : 0x0f;
+    }
+}
+
+static void
+psg_write(struct vgm_out *o, uint8_t value)
+{
+    unsigned reg;
+
+    if ((value & 0x80) != 0) {
+        reg = (value >> 4) & 7;
+        s.latch = reg;
+        s.regs[reg] = value & 0x0f;
+    } else {
+        reg = s.latch;
+        if ((reg & 1) != 0 || reg == 6)
+            s.regs[reg] = value & 0x0f;
+
+        if (s.relatch) {
+            if ((reg & 1) != 0 || reg == 6) {
+                /* A data byte sets the same bits as a latch byte. */
+                value = 0x80 | (reg << 4) | (value & 0x0f);
+            } else {
+                /* Latch the tone register with the low bits that it
+                 * already has, so the data byte sets its high bits.
+                 */
+                for (unsigned chip = 0; chip < 2; chip++) {
+                    vgm_out_byte(o, chip_command[chip]);
+                    vgm_out_byte(o, 0x80 | (reg << 4) | s.regs[reg]);
+                }
+            }
+        }
+    }
+
+    s.relatch = false;
+
+    vgm_out_byte(o, 0x50);
+    vgm_out_byte(o, value | s.mask[0][reg]);
+    vgm_out_byte(o, 0x30);
+    vgm_out_byte(o, value | s.mask[1][reg]);
+}
+
+/**
+ * Change the pan mask.
+ *
+ * The attenuation of each voice that moves is rewritten on the chip that it
+ * moved on or off of. That changes the latched register. It is not restored
+ * here, because latching the noise register with the value it already holds
+ * still resets the noise LFSR. \c psg_write restores it if a data byte
+ * follows.
+ */
+static void
+set_pan(struct vgm_out *o, uint8_t pan)
+{
+    uint8_t old_mask[2][8];
+
+    memcpy(old_mask, s.mask, sizeof(old_mask));
+    s.pan = pan;
+    build_masks();
+
+    for (unsigned chip = 0; chip < 2; chip++) {
+        for (unsigned vol = 1; vol < 8; vol += 2) {
+            if (s.mask[chip][vol] == old_mask[chip][vol])
+                continue;
+
+            vgm_out_byte(o, chip_command[chip]);
+            vgm_out_byte(o, 0x80 | (vol << 4) | s.regs[vol] |
+                         s.mask[chip][vol]);
+            s.relatch = true;
+        }
+    }
+}
+
+bool
+gg_stereo_split(struct vgm_out *o, struct vgm_buf *v,
+                const struct vgm_header *header)
+{
+    (void) header;
+
+    /* All voices silent and on both sides. */
+    memset(&s, 0, sizeof(s));
+    for (unsigned reg = 1; reg < 8; reg += 2)
+        s.regs[reg] = 0x0f;
+
+    s.pan = 0xff;
+    build_masks();
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_PSG_WRITE:
+            psg_write(o, e.value);
+            break;
+
+        case VGM_EVENT_CHIP_WRITE:
+            if (e.command == 0x4f) {
+                if (e.data[0] != s.pan)
+                    set_pan(o, e.data[0]);
+
+                break;
+            }
+
+            vgm_out_copy(o, v, start);
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
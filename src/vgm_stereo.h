@@ -0,0 +1,25 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_STEREO_H
+#define VGM_STEREO_H
+
+#include "vgm_pass.h"
+
+/**
+ * Load-time pass that plays Game Gear stereo on two SN76489s.
+ *
+ * The first chip (0x50) is the left channel, and the second chip (0x30) is
+ * the right channel. Every PSG write is sent to both chips. The attenuation
+ * of a voice that is not panned to a side is forced to silence on that
+ * side's chip, using a table that is rebuilt only when the pan mask (0x4f)
+ * changes. The 0x4f commands are removed.
+ *
+ * Files that already use a second PSG are not supported.
+ */
+bool gg_stereo_split(struct vgm_out *o, struct vgm_buf *v,
+                     const struct vgm_header *header);
+
+#endif /* ifndef VGM_STEREO_H */
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_voice.h"
+#include "vgm_iter.h"
+
+/* Logical tone voices. Voice n is tone voice n % 3 of chip n / 3. */
+#define NUM_VOICES 6
+
+#define NO_VOICE 0xff
+#define NOISE 3
+
+static struct {
+    /* Shadow of the registers of each chip, indexed by the register bits of
+     * a latch byte, and the latched register.
+     */
+    uint16_t regs[2][8];
+    uint8_t latch[2];
+
+    /* Time, in samples, of the latest note on each voice (noise is voice
+     * 3) of each chip.
+     */
+    uint32_t start[2][4];
+    uint32_t now;
+
+    /* Logical voice on each channel, and the chip whose noise is played. */
+    uint8_t owner[3];
+    uint8_t noise_chip;
+
+    struct vgm_psg_out psg;
+} s;
+
+static uint8_t
+atten(unsigned chip, unsigned ch)
+{
+    return s.regs[chip][ch * 2 + 1] & 0x0f;
+}
+
+static uint16_t
+period(unsigned chip, unsigned ch)
+{
+    return s.regs[chip][ch * 2];
+}
+
+/**
+ * Determine whether one voice should get a channel ahead of another.
+ *
+ * A voice that has a channel counts as one step louder than it is, so that
+ * two voices at about the same volume do not trade a channel back and forth.
+ */
+static bool
+wins(unsigned chip_a, unsigned ch_a, bool has_a,
+     unsigned chip_b, unsigned ch_b, bool has_b)
+{
+    const int a = atten(chip_a, ch_a) - (has_a ? 1 : 0);
+    const int b = atten(chip_b, ch_b) - (has_b ? 1 : 0);
+
+    if (a != b)
+        return a < b;
+
+    return s.start[chip_a][ch_a] > s.start[chip_b][ch_b];
+}
+
+static bool
+has_channel(unsigned voice)
+{
+    for (unsigned ch = 0; ch < 3; ch++) {
+        if (s.owner[ch] == voice)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Pick the noise to play.
+ *
+ * \return
+ * Logical voice that must be on channel 2 because it clocks the noise, or
+ * NO_VOICE.
+ */
+static uint8_t
+allocate_noise(void)
+{
+    const unsigned other = s.noise_chip ^ 1;
+
+    if (atten(other, NOISE) != 0x0f &&
+        wins(other, NOISE, false, s.noise_chip, NOISE, true))
+        s.noise_chip = other;
+
+    const unsigned chip = s.noise_chip;
+
+    return (s.regs[chip][6] & 0x03) == 3 && atten(chip, NOISE) != 0x0f
+        ? chip * 3 + 2 : NO_VOICE;
+}
+
+static void
+allocate(struct vgm_out *o)
+{
+    const uint8_t pinned = allocate_noise();
+    uint8_t chosen[3];
+    unsigned num_chosen = 0;
+
+    /* Choose the voices that get a channel, best first. */
+    const unsigned num_free = pinned == NO_VOICE ? 3 : 2;
+    bool taken[NUM_VOICES] = { false };
+
+    while (num_chosen < num_free) {
+        uint8_t best = NO_VOICE;
+
+        for (unsigned voice = 0; voice < NUM_VOICES; voice++) {
+            if (taken[voice] || voice == pinned ||
+                atten(voice / 3, voice % 3) == 0x0f)
+                continue;
+
+            if (best == NO_VOICE ||
+                wins(voice / 3, voice % 3, has_channel(voice),
+                     best / 3, best % 3, has_channel(best)))
+                best = voice;
+        }
+
+        if (best == NO_VOICE)
+            break;
+
+        taken[best] = true;
+        chosen[num_chosen++] = best;
+    }
+
+    /* Voices that keep their channels. */
+    bool placed[3] = { false };
+    uint8_t owner[3] = { NO_VOICE, NO_VOICE, NO_VOICE };
+
+    if (pinned != NO_VOICE)
+        owner[2] = pinned;
+
+    for (unsigned i = 0; i < num_chosen; i++) {
+        for (unsigned ch = 0; ch < 3; ch++) {
+            if (s.owner[ch] == chosen[i] && owner[ch] == NO_VOICE) {
+                owner[ch] = chosen[i];
+                placed[i] = true;
+            }
+        }
+    }
+
+    /* Voices that move. A channel that already has the right period saves
+     * a write.
+     */
+    for (unsigned i = 0; i < num_chosen; i++) {
+        if (placed[i])
+            continue;
+
+        const uint16_t p = period(chosen[i] / 3, chosen[i] % 3);
+        unsigned dest = 3;
+
+        for (unsigned ch = 0; ch < 3; ch++) {
+            if (owner[ch] != NO_VOICE)
+                continue;
+
+            if (dest == 3 || s.psg.tone[ch] == p)
+                dest = ch;
+        }
+
+        owner[dest] = chosen[i];
+    }
+
+    for (unsigned ch = 0; ch < 3; ch++) {
+        const uint8_t voice = owner[ch];
+        const bool moved = voice != s.owner[ch];
+
+        s.owner[ch] = voice;
+
+        if (voice == NO_VOICE) {
+            vgm_psg_atten(o, &s.psg, ch, 0x0f);
+        } else {
+            const uint16_t p = period(voice / 3, voice % 3);
+
+            /* A channel that changes voices is silenced before it is
+             * retuned. Otherwise the new pitch would be heard briefly at the
+             * old voice's volume.
+             */
+            if (moved && s.psg.tone[ch] != p)
+                vgm_psg_atten(o, &s.psg, ch, 0x0f);
+
+            vgm_psg_tone(o, &s.psg, ch, p);
+            vgm_psg_atten(o, &s.psg, ch, atten(voice / 3, voice % 3));
+        }
+    }
+
+    vgm_psg_noise(o, &s.psg, s.regs[s.noise_chip][6] & 0x07);
+    vgm_psg_atten(o, &s.psg, NOISE, atten(s.noise_chip, NOISE));
+}
+
+static void
+psg_write(struct vgm_out *o, unsigned chip, uint8_t value)
+{
+    uint16_t *const regs = s.regs[chip];
+
+    if ((value & 0x80) != 0)
+        s.latch[chip] = (value >> 4) & 7;
+
+    const unsigned reg = s.latch[chip];
+    const unsigned ch = reg >> 1;
+    const bool was_silent = atten(chip, ch) == 0x0f;
+
+    if ((value & 0x80) != 0)
+        regs[reg] = (regs[reg] & ~0x000f) | (value & 0x0f);
+    else if ((reg & 1) == 0 && reg != 6)
+        regs[reg] = (regs[reg] & 0x000f) | ((uint16_t)(value & 0x3f) << 4);
+    else
+        regs[reg] = value & 0x0f;
+
+    /* A new note is a voice being turned on, or the period of a voice that
+     * is playing being changed.
+     */
+    if (reg == 6) {
+        /* Writing the noise control restarts the noise, so it is written
+         * even if it has not changed.
+         */
+        if (chip == s.noise_chip)
+            s.psg.noise = 0xff;
+
+        s.start[chip][NOISE] = s.now;
+    } else if ((reg & 1) != 0 ? was_silent && atten(chip, ch) != 0x0f
+               : !was_silent) {
+        s.start[chip][ch] = s.now;
+    }
+
+    allocate(o);
+}
+
+bool
+voice_merge(struct vgm_out *o, struct vgm_buf *v,
+            const struct vgm_header *header)
+{
+    (void) header;
+
+    /* All voices silent. */
+    memset(&s, 0, sizeof(s));
+    for (unsigned chip = 0; chip < 2; chip++) {
+        for (unsigned reg = 1; reg < 8; reg += 2)
+            s.regs[chip][reg] = 0x0f;
+    }
+
+    for (unsigned ch = 0; ch < 3; ch++)
+        s.owner[ch] = NO_VOICE;
+
+    vgm_psg_out_init(&s.psg);
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_PSG_WRITE:
+            psg_write(o, 0, e.value);
+            break;
+
+        case VGM_EVENT_PSG2_WRITE:
+            psg_write(o, 1, e.value);
+            break;
+
+        case VGM_EVENT_WAIT:
+            s.now += e.samples;
+            vgm_out_copy(o, v, start);
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_VOICE_H
+#define VGM_VOICE_H
+
+#include "vgm_pass.h"
+
+/**
+ * Load-time pass that plays the voices of two SN76489s on one.
+ *
+ * The six tone voices of the two chips (0x50 and 0x30) share the three tone
+ * voices of the first chip. Whenever a write changes which voices are
+ * playing, the loudest voices get a channel, with the most recent note
+ * winning a tie. A voice that already has a channel keeps it unless another
+ * voice is clearly louder, and a voice that moves prefers a channel already
+ * set to its period. The louder of the two noise voices is played, and when
+ * it is clocked by its chip's tone voice 2, that voice is kept on channel 2.
+ *
+ * Only registers that change are written, and the 0x30 commands are
+ * removed.
+ */
+bool voice_merge(struct vgm_out *o, struct vgm_buf *v,
+                 const struct vgm_header *header);
+
+#endif /* ifndef VGM_VOICE_H */
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+#include "vgm_volume.h"
+#include "vgm_iter.h"
+
+static int gain_db = 0;
+
+static struct {
+    /* Latched register of each chip. */
+    uint8_t latch[2];
+
+    uint8_t remap[16];
+} s;
+
+void
+volume_set_gain(int db)
+{
+    gain_db = db;
+}
+
+int
+volume_steps(const struct vgm_header *header)
+{
+    /* The modifier is a signed number from -63 to 192 that scales the
+     * volume by 2^(m / 32), so each step is 6.02 / 32 dB. It is first in
+     * version 1.60.
+     */
+    const int m = header->version < 0x160 ? 0
+        : header->volume_modifier > 0xc0
+        ? (int) header->volume_modifier - 0x100 : header->volume_modifier;
+
+    /* Tenths of a dB. This overflows 16 bits without the cast. */
+    const int32_t tenths = (int32_t) m * 602 / 320 + (int32_t) gain_db * 10;
+
+    /* Round to the nearest 2dB step. More gain is less attenuation. */
+    if (tenths >= 0)
+        return -(int)((tenths + 10) / 20);
+    else
+        return (int)((10 - tenths) / 20);
+}
+
+static uint8_t
+remap_value(unsigned chip, uint8_t value)
+{
+    if ((value & 0x80) != 0)
+        s.latch[chip] = (value >> 4) & 7;
+
+    if ((s.latch[chip] & 1) == 0)
+        return value;
+
+    return (value & 0xf0) | s.remap[value & 0x0f];
+}
+
+bool
+volume_remap(struct vgm_out *o, struct vgm_buf *v,
+             const struct vgm_header *header)
+{
+    const int steps = volume_steps(header);
+
+    memset(&s, 0, sizeof(s));
+    for (int a = 0; a < 15; a++) {
+        const int r = a + steps;
+
+        s.remap[a] = r < 0 ? 0 : (r > 15 ? 15 : r);
+    }
+
+    s.remap[15] = 15;
+
+    vgm_buf_seek(v, 0);
+
+    while (true) {
+        const uint32_t start = vgm_buf_tell(v);
+        struct vgm_event e;
+
+        vgm_out_mark(o, v);
+
+        switch (vgm_next_event(v, &e)) {
+        case VGM_EVENT_PSG_WRITE:
+            vgm_out_byte(o, 0x50);
+            vgm_out_byte(o, remap_value(0, e.value));
+            break;
+
+        case VGM_EVENT_PSG2_WRITE:
+            vgm_out_byte(o, 0x30);
+            vgm_out_byte(o, remap_value(1, e.value));
+            break;
+
+        case VGM_EVENT_END:
+            vgm_out_copy(o, v, start);
+            return true;
+
+        case VGM_EVENT_ERROR:
+            return false;
+
+        default:
+            vgm_out_copy(o, v, start);
+            break;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2024 Ian D. Romanick
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#ifndef VGM_VOLUME_H
+#define VGM_VOLUME_H
+
+#include "vgm_pass.h"
+
+/**
+ * Set a gain, in dB, that the user wants in addition to the file's volume
+ * modifier. Negative values make playback quieter.
+ */
+void volume_set_gain(int db);
+
+/**
+ * Number of 2dB attenuation steps to add to every SN76489 volume for the
+ * header's volume modifier and the user's gain.
+ *
+ * \return
+ * Zero if the volume does not change.
+ */
+int volume_steps(const struct vgm_header *header);
+
+/**
+ * Load-time pass that changes the volume of SN76489 music.
+ *
+ * Every attenuation written to either PSG (0x50 and 0x30) is remapped by a
+ * 16-entry table built from \c volume_steps. Volumes that would be louder
+ * than the chip can play are played at full volume, and silence stays
+ * silent. All other commands are copied unchanged.
+ */
+bool volume_remap(struct vgm_out *o, struct vgm_buf *v,
+                  const struct vgm_header *header);
+
+#endif /* ifndef VGM_VOLUME_H */